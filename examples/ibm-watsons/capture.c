@@ -0,0 +1,65 @@
+#include <string.h>
+#include "capture.h"
+
+// Record header on disk: host_usec, address, characteristic, length
+#define CAPTURE_RECORD_HEAD (8 + 18 + 1 + 1)
+
+FILE* capture_create(const char* path){
+    FILE* file = fopen(path, "wb");
+
+    if (file == NULL){
+        return NULL;
+    }
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_SIZE, file);
+    return file;
+}
+
+void capture_write(FILE* file, int64_t host_usec, const char* address, uint8_t characteristic,
+                   const uint8_t* data, size_t data_length){
+    capture_record_t record;
+
+    if (data_length > SENSIBLE_FRAME_MAX){
+        data_length = SENSIBLE_FRAME_MAX;
+    }
+    memset(&record, 0, sizeof(record));
+    record.host_usec = host_usec;
+    strncpy(record.address, address, sizeof(record.address) - 1);
+    record.characteristic = characteristic;
+    record.length = (uint8_t)data_length;
+    memcpy(record.data, data, data_length);
+
+    fwrite(&record.host_usec, sizeof(record.host_usec), 1, file);
+    fwrite(record.address, sizeof(record.address), 1, file);
+    fwrite(&record.characteristic, 1, 1, file);
+    fwrite(&record.length, 1, 1, file);
+    fwrite(record.data, 1, record.length, file);
+}
+
+FILE* capture_open(const char* path){
+    char magic[CAPTURE_MAGIC_SIZE];
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL){
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0){
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+int capture_read(FILE* file, capture_record_t* record){
+    if (fread(&record->host_usec, sizeof(record->host_usec), 1, file) != 1 ||
+        fread(record->address, sizeof(record->address), 1, file) != 1 ||
+        fread(&record->characteristic, 1, 1, file) != 1 ||
+        fread(&record->length, 1, 1, file) != 1){
+        return -1;
+    }
+    record->address[sizeof(record->address) - 1] = '\0';
+    if (record->length > SENSIBLE_FRAME_MAX || record->characteristic >= CHARACTERISTICS_COUNT ||
+        fread(record->data, 1, record->length, file) != record->length){
+        return -1;
+    }
+    return 0;
+}
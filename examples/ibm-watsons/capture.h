@@ -0,0 +1,34 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "characteristics.h"
+
+#define CAPTURE_MAGIC "SBCAP1\n"
+#define CAPTURE_MAGIC_SIZE 7
+
+// Raw notification as received from a board. A capture file is the magic
+// followed by records stored field after field, with only length bytes of
+// data, integers in the byte order of the gateway.
+typedef struct {
+    int64_t host_usec;
+    char address[18];
+    uint8_t characteristic;
+    uint8_t length;
+    uint8_t data[SENSIBLE_FRAME_MAX];
+} capture_record_t;
+
+// Opens path for recording. Returns NULL on failure.
+FILE* capture_create(const char* path);
+
+void capture_write(FILE* file, int64_t host_usec, const char* address, uint8_t characteristic,
+                   const uint8_t* data, size_t data_length);
+
+// Opens path for reading and checks its magic. Returns NULL on failure.
+FILE* capture_open(const char* path);
+
+// Reads the next record. Returns 0 on success, -1 at the end of the file.
+int capture_read(FILE* file, capture_record_t* record);
+
+#endif
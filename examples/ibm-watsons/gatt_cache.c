@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "gatt_cache.h"
+
+#define GATT_CACHE_HEADER "# SensiBLE GATT handles: MAC UUID=HANDLE...\n"
+
+static int characteristic_by_uuid(const char* uuid, size_t length){
+    int c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (strlen(characteristics[c].uuid) == length && strncasecmp(characteristics[c].uuid, uuid, length) == 0){
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Parses "MAC UUID=HANDLE ..." into entry. Returns 0 when the line names a board.
+static int parse_line(char* line, gatt_cache_entry_t* entry){
+    char* token;
+    char* save;
+
+    memset(entry, 0, sizeof(*entry));
+    token = strtok_r(line, " \t\r\n", &save);
+    if (token == NULL || token[0] == '#' || strlen(token) >= sizeof(entry->address)){
+        return -1;
+    }
+    snprintf(entry->address, sizeof(entry->address), "%s", token);
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL){
+        char* equal = strchr(token, '=');
+        int c;
+
+        if (equal == NULL){
+            continue;
+        }
+        c = characteristic_by_uuid(token, (size_t)(equal - token));
+        if (c >= 0){
+            entry->value_handles[c] = (uint16_t)strtoul(equal + 1, NULL, 0);
+        }
+    }
+    return 0;
+}
+
+int gatt_cache_load(gatt_cache_t* cache, const char* path){
+    gatt_cache_entry_t entry;
+    char line[1024];
+    FILE* file;
+
+    memset(cache, 0, sizeof(*cache));
+    file = fopen(path, "r");
+    if (file == NULL){
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL){
+        if (parse_line(line, &entry) == 0 && gatt_cache_store(cache, entry.address, entry.value_handles) != 0){
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+const gatt_cache_entry_t* gatt_cache_find(const gatt_cache_t* cache, const char* address){
+    size_t i;
+
+    for (i = 0; i < cache->count; i++){
+        if (strcasecmp(cache->entries[i].address, address) == 0){
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int gatt_cache_store(gatt_cache_t* cache, const char* address, const uint16_t value_handles[CHARACTERISTICS_COUNT]){
+    gatt_cache_entry_t* entry = (gatt_cache_entry_t*)gatt_cache_find(cache, address);
+
+    if (entry == NULL){
+        if (cache->count == cache->capacity){
+            size_t capacity = cache->capacity ? cache->capacity * 2 : 16;
+            gatt_cache_entry_t* entries = realloc(cache->entries, capacity * sizeof(*entries));
+            if (entries == NULL){
+                return -1;
+            }
+            cache->entries = entries;
+            cache->capacity = capacity;
+        }
+        entry = &cache->entries[cache->count++];
+        snprintf(entry->address, sizeof(entry->address), "%s", address);
+    }
+    memcpy(entry->value_handles, value_handles, sizeof(entry->value_handles));
+    return 0;
+}
+
+int gatt_cache_save(const gatt_cache_t* cache, const char* path){
+    char tmp[4096];
+    FILE* file;
+    size_t i;
+    int c;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)){
+        return -1;
+    }
+    file = fopen(tmp, "w");
+    if (file == NULL){
+        return -1;
+    }
+    fputs(GATT_CACHE_HEADER, file);
+    for (i = 0; i < cache->count; i++){
+        fputs(cache->entries[i].address, file);
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            if (cache->entries[i].value_handles[c] != 0){
+                fprintf(file, " %s=0x%04x", characteristics[c].uuid, cache->entries[i].value_handles[c]);
+            }
+        }
+        fputc('\n', file);
+    }
+    if (fclose(file) != 0){
+        remove(tmp);
+        return -1;
+    }
+    return rename(tmp, path);
+}
+
+void gatt_cache_destroy(gatt_cache_t* cache){
+    free(cache->entries);
+    memset(cache, 0, sizeof(*cache));
+}
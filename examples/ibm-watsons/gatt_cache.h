@@ -0,0 +1,40 @@
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+#include <stdint.h>
+#include "characteristics.h"
+
+// Length of a textual BLE MAC address with its terminator
+#define GATT_CACHE_ADDRESS_SIZE 18
+
+// Characteristic value handles discovered on one board, 0 for the
+// characteristics it does not offer
+typedef struct {
+    char address[GATT_CACHE_ADDRESS_SIZE];
+    uint16_t value_handles[CHARACTERISTICS_COUNT];
+} gatt_cache_entry_t;
+
+// Handles of every board seen so far, kept across runs in a text file with
+// one line per board: its MAC address followed by UUID=HANDLE pairs
+typedef struct {
+    gatt_cache_entry_t* entries;
+    size_t count;
+    size_t capacity;
+} gatt_cache_t;
+
+// Reads path into cache. A missing file gives an empty cache, unknown
+// characteristics and malformed lines are skipped. Returns 0 on success.
+int gatt_cache_load(gatt_cache_t* cache, const char* path);
+
+// Returns the entry of address, NULL when it was never discovered
+const gatt_cache_entry_t* gatt_cache_find(const gatt_cache_t* cache, const char* address);
+
+// Adds or replaces the entry of address. Returns 0 on success.
+int gatt_cache_store(gatt_cache_t* cache, const char* address, const uint16_t value_handles[CHARACTERISTICS_COUNT]);
+
+// Writes the cache to a temporary file renamed over path. Returns 0 on success.
+int gatt_cache_save(const gatt_cache_t* cache, const char* path);
+
+void gatt_cache_destroy(gatt_cache_t* cache);
+
+#endif
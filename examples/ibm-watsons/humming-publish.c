@@ -1,457 +1,531 @@
 #include <assert.h>
 #include <glib.h>
+#include <glib-unix.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 #include "gattlib.h"
 #include "deviceclient.h"
+#include "capture.h"
+#include "characteristics.h"
+#include "device_clock.h"
+#include "gatt_cache.h"
+#include "journal.h"
+#include "link_state.h"
+#include "local_sink.h"
+#include "logger.h"
+#include "metrics.h"
+#include "monotonic.h"
+#include "payload.h"
+#include "publish_filter.h"
+#include "publisher.h"
+#include "sample_store.h"
+#include "sensible.h"
+#include "sensible_gattlib.h"
+#include "sink.h"
+#include "worker.h"
 
-// Uncomment this to have debug output on notifications
-#define NOTIFICATION_DEBUG
+// Log level of every characteristic, overridden with -l. Decoded
+// notifications are logged at debug level, rate limited, from the logger
+// thread; NO_NOTIFICATION_DEBUG leaves them out by default.
+#if !defined(NO_NOTIFICATION_DEBUG)
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_WARNING
+#endif
 
-// Period of sending data from sensors
+// Period of sending data from sensors: every notification is folded into
+// a summary of its characteristic published once per period. Overridden
+// with -a, 0 publishes every notification as is.
 #define PERIOD_MSEC 1000
 
-// UUID of Characteristics, used in SensiBLE                                                                                                                                              
-#define LED_STATE       "20000000-0001-11e1-ac36-0002a5d5c51b"
-#define LIGHT_SENSOR    "01000000-0001-11e1-ac36-0002a5d5c51b"
-#define BATTERY_STATUS  "00020000-0001-11e1-ac36-0002a5d5c51b"
-#define COMPAS          "00000040-0001-11e1-ac36-0002a5d5c51b"
-#define CARRY_POSITION  "00000008-0001-11e1-ac36-0002a5d5c51b"
-#define ACTIVITY_REC    "00000010-0001-11e1-ac36-0002a5d5c51b"
-#define GESTURE_RECOGN  "00000002-0001-11e1-ac36-0002a5d5c51b"
-#define ORIENT_ESTIM    "00000100-0001-11e1-ac36-0002a5d5c51b"
-#define AUDIO_LVL       "04000000-0001-11e1-ac36-0002a5d5c51b"
-#define ACC_GYRO_MAG    "00e00000-0001-11e1-ac36-0002a5d5c51b"
-#define ACCEL_EV        "00000400-0001-11e1-ac36-0002a5d5c51b"
-
-// Nuber of characteristics
-#define CHARACTERISTICS_COUNT 11
+// Window for merging notifications of different characteristics into one
+// event. 0 sends one event per notification with all of its fields.
+// Keep it below PERIOD_MSEC so a characteristic appears once per event.
+// Overridden with -w.
+#define COALESCE_WINDOW_MSEC 0
+
+// Encoding of published events, overridden with -f
+#define PAYLOAD_FORMAT PAYLOAD_JSON
+
+// Samples kept by the store-and-forward journal enabled with -j
+#define JOURNAL_CAPACITY 65536
+
+// Journaled samples republished per second after an outage
+#define JOURNAL_REPLAY_PER_SEC 200
+
+// Sample buffers, a notification or a window summary each, queued per
+// board between the BLE callbacks and each output sink
+#define SINK_QUEUE_CAPACITY_PER_DEVICE 256
+
+// What the full queue of a sink does: QUEUE_DROP_OLDEST keeps the newest
+// data, QUEUE_BACKPRESSURE keeps the queued data and drops the new buffer
+#define SINK_QUEUE_POLICY QUEUE_DROP_OLDEST
+
+// Most boards served by one gateway process
+#define MAX_DEVICES 64
+
+// Length of a textual BLE MAC address with its terminator
+#define BLE_ADDRESS_SIZE 18
 
 // Timeout for scanning
 #define BLE_SCAN_TIMEOUT 4
 
-static const char* uuids[CHARACTERISTICS_COUNT] = {
-    LED_STATE,
-    LIGHT_SENSOR,
-    BATTERY_STATUS,
-    COMPAS,
-    CARRY_POSITION,
-    ACTIVITY_REC,
-    GESTURE_RECOGN,
-    ORIENT_ESTIM,
-    AUDIO_LVL,
-    ACC_GYRO_MAG,
-    ACCEL_EV,
+// Threads connecting and subscribing the boards at startup. More would
+// only queue on connect_mutex.
+#define CONNECT_THREADS 1
+
+// Longest line of a configuration file given with -c
+#define CONFIG_LINE_SIZE 512
+
+// Worker threads the boards are sharded over, 0 serves them from the main
+// loop. Overridden with -t.
+#define WORKERS 0
+
+// State of one connected board, passed to the notification callbacks as user_data
+typedef struct {
+    uint8_t index;
+    char address[BLE_ADDRESS_SIZE];
+    gatt_connection_t* connection;
+    // Characteristic value handles from the GATT cache or the discovery,
+    // 0 for the characteristics the board does not offer
+    uint16_t value_handles[CHARACTERISTICS_COUNT];
+    bool handles_cached;
+    bool handles_discovered;
+    uint8_t subscribed;
+    // Supervision of the BLE link: lost links are reconnected from
+    // connect_thread after a backoff, the other boards keep streaming
+    link_t link;
+    metric_link_t* link_metrics;
+    pthread_t connect_thread;
+    // Set by the disconnection callback, possibly during a reconnection
+    atomic_bool lost;
+    // Decoding, windows and board clock, as for any libsensible client
+    sensible_session_t session;
+    // Counters of this board, indexed by characteristic
+    metric_channel_t* metrics;
+    // Thread decoding, aggregating and publishing the notifications of the
+    // board, with the session and counters above; NULL when the main loop
+    // does. The link is supervised from the main loop.
+    worker_t* worker;
+} device_t;
+
+static device_t devices[MAX_DEVICES];
+static uint8_t devices_count = 0;
+
+// Aggregation window of each characteristic, 0 for none
+static uint32_t window_msec[CHARACTERISTICS_COUNT];
+
+// Boards are served by workers[device index % workers_count]
+static worker_t workers[MAX_WORKERS];
+static uint8_t workers_count = WORKERS;
+
+// Board name prefix selecting devices during the scan, NULL when unused
+static const char* device_name_filter = NULL;
+
+static publisher_config_t publisher_config = {
+    .format = PAYLOAD_FORMAT,
+    .window_msec = COALESCE_WINDOW_MSEC,
+    .journal = NULL,
+    .replay_per_sec = JOURNAL_REPLAY_PER_SEC,
 };
 
+static const char* journal_path = NULL;
+
+static const char* metrics_path = NULL;
+
+// Characteristic handles of the boards are kept there when -g is given
+static const char* gatt_cache_path = NULL;
+
+// Every decoded notification is stored there when -s is given, in at most
+// store_mbytes of segments
+static const char* store_path = NULL;
+static uint32_t store_mbytes = STORE_DEFAULT_MBYTES;
+
+// Where decoded samples go, see -o
+typedef enum {
+    OUTPUT_MQTT,
+    OUTPUT_STDOUT,
+    OUTPUT_FILE,
+    OUTPUT_SOCKET,
+} output_kind_t;
+
+typedef struct {
+    output_kind_t kind;
+    // As given to -o, names the sink in the metrics
+    const char* spec;
+    const char* path;
+    sink_t sink;
+    line_sink_t lines;
+    socket_sink_t socket;
+} output_t;
+
+// Outputs in the order of -o, the broker alone when none is given
+static output_t outputs[SINK_MAX];
+static uint8_t outputs_count = 0;
+static output_t* mqtt_output = NULL;
+
 static iotfclient client;
 
-static const char* acc_ev_flag_desc[] = {
-    "ACC_NOT_USED\n",
-    "ACC_6D_OR_TOP\n",
-    "ACC_6D_OR_LEFT\n",
-    "ACC_6D_OR_BOTTOM\n",
-    "ACC_6D_OR_RIGHT\n",
-    "ACC_6D_OR_UP\n",
-    "ACC_6D_OR_DOWN\n"
-    "ACC_ERROR\n",
-    "ACC_TILT\n",
-    "ACC_FREE_FALL\n",
-    "ACC_SINGLE_TAP\n",
-	"ACC_ERROR\n",
-    "ACC_DOUBLE_TAP\n",
-	"ACC_ERROR\n",
-	"ACC_ERROR\n",
-	"ACC_ERROR\n",
-    "ACC_WAKE_UP\n",
-};
+// Fans samples out to the sinks of the outputs
+static sink_hub_t hub;
 
-const uint8_t acc_ev_flag_desc_err_index = 7;
+static publisher_t publisher;
 
-static const char* gesture_flag_desc[] = {
-    "MGR_NOGESTURE\n",
-    "MGR_PICKUP\n",
-    "MGR_GLANCE\n",
-    "MGR_WAKEUP\n",
-    "MGR_ERROR\n",
-};
+static journal_t journal;
 
-const uint8_t gesture_flag_desc_err_index = 4;
-
-static const char* activity_flag_desc[] = {
-    "MAR_NOACTIVITY\n",
-    "MAR_STATIONARY\n",
-    "MAR_WALKING\n",
-    "MAR_FASTWALKING\n",
-    "MAR_JOGGING\n",
-    "MAR_BIKING\n",
-    "MAR_DRIVING\n",
-    "MAR_ERROR\n",
-};
+static metrics_t metrics;
 
-const uint8_t activity_flag_desc_err_index = 7;
-
-static const char* carry_position_flag_desc[] = {
-    "MCP_UNKNOWN\n",
-    "MCP_ONDESK\n",
-    "MCP_INHAND\n",
-    "MCP_NEARHEAD\n",
-    "MCP_SHIRTPOCKET\n",
-    "MCP_TROUSERPOCKET\n",
-    "MCP_ARMSWING\n",
-    "MCP_JACKETPOCKET\n",
-};
+static logger_t logger;
 
-const uint8_t carry_position_flag_desc_err_index = 0;
+static sample_store_t store;
 
-static const char* battery_status_flag_desc[] = {
-    "Status of Battery is discharging.\n",
-    "Status of Battery is charging.\n",
-    "Error status of Battery\n",
-    "Status of Battery is unknown.\n",
-};
+// Per field publish policies, see -p
+static publish_filter_t publish_filter;
+
+static gatt_cache_t gatt_cache;
+
+static pthread_t connect_threads[CONNECT_THREADS];
+static int connect_threads_count = 0;
+static atomic_uint connect_next;
 
-const uint8_t battery_status_flag_desc_err_index = 2;
+// gattlib does not document its calls as safe from several threads at
+// once, so the connecting threads take turns in connect_device()
+static pthread_mutex_t connect_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void iot_publish_variable(const char* name, int32_t value){
-    char pdata[64];
-    snprintf(pdata, 64, "{\"d\" : {\"%s\" : %d }}", name, value);
-    if (publishEvent(&client, "status", "json", pdata, QOS0) != 0){
-        printf("Error while publishing the event stat %s\n", name);
+// Every notification is recorded here when -r is given
+static FILE* capture_file = NULL;
+
+// Hands the samples of a session over to every output sink, as one shared
+// buffer. Discrete events go ahead of the telemetry queued.
+static void publish_samples(const sample_t* samples, int count, void* user_data){
+    device_t* device = user_data;
+    bool queued = sink_hub_publish(&hub, samples, (uint32_t)count, sample_is_event(&samples[0])) == 0;
+    int i;
+
+    for (i = 0; i < count; i++){
+        metric_channel_t* channel = &device->metrics[samples[i].characteristic];
+        metric_add(queued ? &channel->queued : &channel->refused, 1);
     }
 }
 
-void get_led_notification_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t led_timestamp_prev = 0;
-    uint16_t led_timestamp_current = (data[1] << 8) | (data[0] & 0xff);
-    uint8_t led_state = (data[2] << 8);
-    
-    if (led_timestamp_current >= led_timestamp_prev && (led_timestamp_current - led_timestamp_prev) < PERIOD_MSEC){
-        return;
+// Queue of the full-rate store the thread serving device pushes to
+static inline uint8_t store_producer(const device_t* device){
+    return device->worker != NULL ? device->worker->index : 0;
+}
+
+// Every notification the session decoded, before a window takes it: timed,
+// logged and kept in the full-rate store
+static void on_decoded(const sample_t* samples, int count, void* user_data){
+    device_t* device = user_data;
+    metric_channel_t* channel = &device->metrics[samples[0].characteristic];
+    int i;
+
+    for (i = 0; i < count; i++){
+        metric_observe(&channel->notify_to_decode, samples[i].decoded_usec - samples[i].received_usec);
     }
-    led_timestamp_prev = led_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Led State Notification Handler: \n");
-    printf("Timestamp is:= %05dmS\n", led_timestamp_current);
-    if (led_state == 0x00){
-        printf("Led state is OFF\n");
+    if (window_msec[samples[0].characteristic] > 0 && !sample_is_event(&samples[0])){
+        metric_add(&channel->folded, (uint64_t)count);
     }
-    else{
-        printf("Led state is ON\n");
+    if (logger_enabled(&logger, samples[0].characteristic, LOG_LEVEL_DEBUG)){
+        for (i = 0; i < count; i++){
+            logger_sample(&logger, &samples[i]);
+        }
+    }
+    if (store_path != NULL){
+        for (i = 0; i < count; i++){
+            sample_store_push(&store, store_producer(device), &samples[i]);
+        }
     }
-    printf("============================\n");
-#endif
-    iot_publish_variable("led", 0x0000FFFF & led_state);
 }
 
-void get_light_notification_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data) {
-    static uint16_t light_timestamp_prev = 0;
-    uint16_t light_timestamp_current = (data[1] << 8) | (data[0] & 0xff);
-    uint16_t light_sens_val = (data[3] << 8) | (data[2] & 0xff);
-    
-    if (light_timestamp_current >= light_timestamp_prev && (light_timestamp_current - light_timestamp_prev) < PERIOD_MSEC){
-        return;
+static void on_short_frame(uint8_t characteristic, const uint8_t* data, size_t data_length, void* user_data){
+    device_t* device = user_data;
+
+    metric_add(&device->metrics[characteristic].short_frames, 1);
+    if (logger_enabled(&logger, characteristic, LOG_LEVEL_WARNING)){
+        logger_short_frame(&logger, device->index, characteristic, data, data_length);
     }
-    light_timestamp_prev = light_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Light Notification Handler: \n");
-    printf("Timestamp is:= %05dmS\n", light_timestamp_current);
-    printf("Light Sensor Value is: = %5dLux\n", light_sens_val);
-    printf("============================\n");
-#endif
-    iot_publish_variable("light", 0x0000FFFF & light_sens_val);
-}
-
-void get_battery_notification_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t battery_timestamp_prev = 0;
-    uint16_t battery_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint16_t battery_soc = ((data[3] << 8) | (data[2] & 0xff));
-    uint16_t battery_voltage = ((data[5] << 8) | (data[4] & 0xff));
-    uint16_t battery_current = ((data[7] << 8) | (data[6] & 0xff));
-    uint8_t battery_status = data[8];
-    
-    if (battery_timestamp_current >= battery_timestamp_prev && (battery_timestamp_current - battery_timestamp_prev) < PERIOD_MSEC){
-        return;
+}
+
+// Subscribes the session of a board to every characteristic, with the
+// windows of -a
+static void open_session(device_t* device){
+    uint8_t c;
+
+    sensible_session_init(&device->session, device->index);
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        sensible_session_subscribe(&device->session, c, publish_samples, device, window_msec[c]);
     }
-    battery_timestamp_prev = battery_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Battery State Notification Handler: \n");
-    printf("Timestamp is:= %05dmS\n", battery_timestamp_current);
-    printf("Battery soc is:= %05d%%\n", battery_soc);
-    printf("Battery voltage is:= %05dmV\n", battery_voltage);
-    printf("Battery current is:= %05dmA\n", battery_current);
-    uint8_t index = battery_status - 1;
-    if (battery_status == 0x00 || battery_status > 0x04){
-        index = battery_status_flag_desc_err_index;
-    }
-    printf("%s", battery_status_flag_desc[index]);
-    printf("============================\n");
-#endif
-    iot_publish_variable("batt_soc", 0x0000FFFF & battery_soc);
-    iot_publish_variable("batt_volt", 0x0000FFFF & battery_voltage);
-    iot_publish_variable("batt_curr", 0x0000FFFF & battery_current);
-    iot_publish_variable("batt_stat", 0x0000FFFF & battery_status);
-}
-
-void get_compas_notification_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t compass_timestamp_prev = 0;
-    uint16_t compass_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint16_t compass_angle = ((data[3] << 8) | (data[2] & 0xff));
-    
-    if (compass_timestamp_current >= compass_timestamp_prev && (compass_timestamp_current - compass_timestamp_prev) < PERIOD_MSEC){
+    sensible_session_on_decoded(&device->session, on_decoded, device);
+    sensible_session_on_short_frame(&device->session, on_short_frame, device);
+}
+
+// Feeds a notification to the session of its board, which queues it, or
+// the summary of the window it closes when aggregated
+static void handle_notification(device_t* device, uint8_t characteristic, const uint8_t* data, size_t data_length,
+                                int64_t received_usec){
+    metric_channel_t* channel = &device->metrics[characteristic];
+    device_clock_t* clock = &device->session.clock;
+    uint16_t timestamp;
+
+    metric_add(&channel->notifications, 1);
+    if (sensible_session_notify(&device->session, characteristic, data, data_length, received_usec) < 0){
         return;
     }
-    compass_timestamp_prev = compass_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Compas Notification Handler: \n");
-    printf("Timestamp is:= %05dmS\n", compass_timestamp_current);
-    printf("Angle between the board and north direction is:= %3d*\n", (compass_angle/100));
-    printf("============================\n");
-#endif
-    iot_publish_variable("compass", 0x0000FFFF & compass_angle);
+    // Every frame starts with the board timestamp
+    timestamp = (uint16_t)(data[0] | (data[1] << 8));
+    metric_observe(&channel->sensor_to_notify,
+                   received_usec - device_clock_host_usec(clock, device_clock_board_msec(clock, timestamp)));
 }
 
-void get_carry_position_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t carry_timestamp_prev = 0;
-    uint16_t carry_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint8_t carry_position_flag = data[2];
-    
-    if (carry_timestamp_current >= carry_timestamp_prev && (carry_timestamp_current - carry_timestamp_prev) < PERIOD_MSEC){
-        return;
+// Publishes the windows of the boards of worker, NULL for the main loop,
+// that stopped notifying, all open windows when force is set
+static void close_windows(worker_t* worker, bool force){
+    uint8_t i;
+
+    for (i = 0; i < devices_count; i++){
+        if (devices[i].worker == worker){
+            sensible_session_flush(&devices[i].session, force);
+        }
     }
-    carry_timestamp_prev = carry_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Carry Position Handler: \n");
-    printf("Timestamp is:= %05dmS\n", carry_timestamp_current);
-    uint8_t index = carry_position_flag;
-    if(carry_position_flag > 0x06){
-        index = carry_position_flag_desc_err_index;
-    }
-    printf("%s", carry_position_flag_desc[index]);
-#endif
-    iot_publish_variable("carry", 0x0000FFFF & carry_position_flag);
 }
 
-void get_activity_recognition_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t activity_timestamp_prev = 0;
-    uint16_t activity_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint8_t activity_flag = data[2];
-    
-    if (activity_timestamp_current >= activity_timestamp_prev && (activity_timestamp_current - activity_timestamp_prev) < PERIOD_MSEC){
-        return;
+static gboolean close_quiet_windows(gpointer user_data){
+    close_windows(user_data, false);
+    return G_SOURCE_CONTINUE;
+}
+
+// Parses -a: MSEC for every characteristic, or FIELD=MSEC for the
+// characteristic carrying FIELD. Discrete events are never aggregated, but
+// the step counter sharing their characteristic is. Returns 0 on success.
+static int parse_window(const char* arg){
+    const char* equal = strchr(arg, '=');
+    char name[32];
+    uint32_t msec;
+    int c;
+
+    if (equal == NULL){
+        msec = (uint32_t)strtoul(arg, NULL, 10);
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            window_msec[c] = characteristics[c].event == EVENT_ALWAYS ? 0 : msec;
+        }
+        return 0;
     }
-    activity_timestamp_prev = activity_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Activity Recognition Handler: \n");
-    printf("Timestamp is:= %05dmS\n", activity_timestamp_current);
-    uint8_t index = activity_flag;
-    if(activity_flag > 0x06){
-        index = activity_flag_desc_err_index;
-    }
-    printf("%s", activity_flag_desc[index]);
-    printf("============================\n");
-#endif
-    iot_publish_variable("activity", 0x0000FFFF & activity_flag);
+    if ((size_t)(equal - arg) >= sizeof(name)){
+        return -1;
+    }
+    memcpy(name, arg, (size_t)(equal - arg));
+    name[equal - arg] = '\0';
+    c = characteristic_by_field(name);
+    if (c < 0 || characteristics[c].event == EVENT_ALWAYS){
+        return -1;
+    }
+    window_msec[c] = (uint32_t)strtoul(equal + 1, NULL, 10);
+    return 0;
 }
 
-void get_gesture_recognition_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t gesture_timestamp_prev = 0;
-    uint16_t gesture_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint8_t gesture_flag = data[2];
-    
-    if (gesture_timestamp_current >= gesture_timestamp_prev && (gesture_timestamp_current - gesture_timestamp_prev) < PERIOD_MSEC){
-        return;
+// Parses -l: LEVEL for every characteristic, or FIELD=LEVEL for the
+// characteristic carrying FIELD. Returns 0 on success.
+static int parse_log_level(const char* arg){
+    const char* equal = strchr(arg, '=');
+    char name[32];
+    log_level_t level;
+    int c;
+
+    if (equal == NULL){
+        if (log_level_parse(arg, &level) != 0){
+            return -1;
+        }
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            logger.levels[c] = level;
+        }
+        return 0;
     }
-    gesture_timestamp_prev = gesture_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Gesture Recognition Handler: \n");
-    printf("Timestamp is:= %05dmS\n", gesture_timestamp_current);
-    uint8_t index = gesture_flag;
-    if(gesture_flag > 0x03){
-        index = gesture_flag_desc_err_index;
-    }
-    printf("%s", gesture_flag_desc[index]);
-    printf("============================\n");
-#endif
-    iot_publish_variable("gesture", 0x0000FFFF & gesture_flag);
-}
-
-void get_orientation_estimation_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t orient_timestamp_prev = 0;
-    uint16_t orient_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint16_t quat0_X = ((data[3] << 8) | (data[2] & 0xff));
-    uint16_t quat0_Y = ((data[5] << 8) | (data[4] & 0xff));
-    uint16_t quat0_Z = ((data[7] << 8) | (data[6] & 0xff));
-    uint16_t quat1_X = ((data[9] << 8) | (data[8] & 0xff));
-    uint16_t quat1_Y = ((data[11] << 8) | (data[10] & 0xff));
-    uint16_t quat1_Z = ((data[13] << 8) | (data[12] & 0xff));
-    uint16_t quat2_X = ((data[15] << 8) | (data[14] & 0xff));
-    uint16_t quat2_Y = ((data[17] << 8) | (data[16] & 0xff));
-    uint16_t quat2_Z = ((data[19] << 8) | (data[18] & 0xff));
-    
-    if (orient_timestamp_current >= orient_timestamp_prev && (orient_timestamp_current - orient_timestamp_prev) < PERIOD_MSEC){
-        return;
+    if ((size_t)(equal - arg) >= sizeof(name)){
+        return -1;
     }
-    orient_timestamp_prev = orient_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Orientation Estimation Handler: \n");
-    printf("Timestamp is:= %05dmS\n", orient_timestamp_current);
-    printf("quat0_X is:= %05d\n", (quat0_X/1000));
-    printf("quat0_Y is:= %05d\n", (quat0_Y/1000));
-    printf("quat0_Z is:= %05d\n", (quat0_Z/1000));
-    printf("quat1_X is:= %05d\n", (quat1_X/1000));
-    printf("quat1_Y is:= %05d\n", (quat1_Y/1000));
-    printf("quat1_Z is:= %05d\n", (quat1_Z/1000));
-    printf("quat2_X is:= %05d\n", (quat2_X/1000));
-    printf("quat2_Y is:= %05d\n", (quat2_Y/1000));
-    printf("quat2_Z is:= %05d\n", (quat2_Z/1000));
-
-    printf("============================\n");
-#endif
-    iot_publish_variable("quat0_X", 0x0000FFFF & quat0_X);
-    iot_publish_variable("quat0_Y", 0x0000FFFF & quat0_Y);
-    iot_publish_variable("quat0_Z", 0x0000FFFF & quat0_Z);
-    iot_publish_variable("quat1_X", 0x0000FFFF & quat1_X);
-    iot_publish_variable("quat1_Y", 0x0000FFFF & quat1_Y);
-    iot_publish_variable("quat1_Z", 0x0000FFFF & quat1_Z);
-    iot_publish_variable("quat2_X", 0x0000FFFF & quat2_X);
-    iot_publish_variable("quat2_Y", 0x0000FFFF & quat2_Y);
-    iot_publish_variable("quat2_Z", 0x0000FFFF & quat2_Z);
-}
-
-void get_audio_level_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t audio_timestamp_prev = 0;
-    uint16_t audio_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint8_t audio_level = data[2];
-    
-    if (audio_timestamp_current >= audio_timestamp_prev && (audio_timestamp_current - audio_timestamp_prev) < PERIOD_MSEC){
-        return;
+    memcpy(name, arg, (size_t)(equal - arg));
+    name[equal - arg] = '\0';
+    c = characteristic_by_field(name);
+    if (c < 0 || log_level_parse(equal + 1, &level) != 0){
+        return -1;
     }
-    audio_timestamp_prev = audio_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Audio Level Handler: \n");
-    printf("Timestamp is:= %05dmS\n", audio_timestamp_current);
-    printf("Audio Level is:= %03d\n", audio_level);
-    printf("============================\n");
-#endif
-    iot_publish_variable("audio", 0x0000FFFF & audio_level);
-}
-
-void get_acc_gyro_mag_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t acc_timestamp_prev = 0;
-    uint16_t acc_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    int16_t acc_x = ((data[3] << 8) | (data[2] & 0xff));
-    int16_t acc_y = ((data[5] << 8) | (data[4] & 0xff));
-    int16_t acc_z = ((data[7] << 8) | (data[6] & 0xff));
-    int16_t gyro_x = ((data[9] << 8) | (data[8] & 0xff));
-    int16_t gyro_y = ((data[11] << 8) | (data[10] & 0xff));
-    int16_t gyro_z = ((data[13] << 8) | (data[12] & 0xff));
-    int16_t mag_x = ((data[15] << 8) | (data[14] & 0xff));
-    int16_t mag_y = ((data[17] << 8) | (data[16] & 0xff));
-    int16_t mag_z = ((data[19] << 8) | (data[18] & 0xff));
-    
-    if (acc_timestamp_current >= acc_timestamp_prev && (acc_timestamp_current - acc_timestamp_prev) < PERIOD_MSEC){
-        return;
+    logger.levels[c] = level;
+    return 0;
+}
+
+// -q WINDOW: QoS1 publishes in flight at once, 0 for QoS0
+static int parse_inflight_window(const char* arg){
+    char* end;
+    unsigned long window = strtoul(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || window > MQTT_PIPELINE_MAX_WINDOW){
+        return -1;
     }
-    acc_timestamp_prev = acc_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Timestamp is:= %05dmS\n", acc_timestamp_current);
-    printf("ACCx is:= %05dmg\n", acc_x);
-    printf("ACCy is:= %05dmg\n", acc_y);
-    printf("ACCz is:= %05dmg\n", acc_z);
-    printf("GYROx is:= %05dmdps/100\n", gyro_x);
-    printf("GYROy is:= %05dmdps/100\n", gyro_y);
-    printf("GYROz is:= %05dmdps/100\n", gyro_z);
-    printf("MAGx is:= %05dmGa\n", mag_x);
-    printf("MAGy is:= %05dmGa\n", mag_y);
-    printf("MAGz is:= %05dmGa\n", mag_z);
-    printf("============================\n");
-#endif
-    iot_publish_variable("acc_x", acc_x);
-    iot_publish_variable("acc_y", acc_y);
-    iot_publish_variable("acc_z", acc_z);
-    iot_publish_variable("gyro_x", gyro_x);
-    iot_publish_variable("gyro_y", gyro_y);
-    iot_publish_variable("gyro_z", gyro_z);
-    iot_publish_variable("mag_x", mag_x);
-    iot_publish_variable("mag_y", mag_y);
-    iot_publish_variable("mag_z", mag_z);
-}
-
-void get_acc_events_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
-    static uint16_t acc_ev_timestamp_prev = 0;
-    uint16_t acc_ev_timestamp_current = ((data[1] << 8) | (data[0] & 0xff));
-    uint8_t acc_ev_flag_high = data[2];
-    uint16_t acc_steps_count = 0;
-    uint8_t acc_ev_flag_low = 0;
-    if (acc_ev_flag_high == 0)
-        acc_steps_count = ((data[4] << 8) | (data[3] & 0xff));
-    else
-        acc_ev_flag_low = data[3];
-    
-    if (acc_ev_timestamp_current >= acc_ev_timestamp_prev && (acc_ev_timestamp_current - acc_ev_timestamp_prev) < PERIOD_MSEC){
-        return;
+    publisher_config.inflight_window = (uint16_t)window;
+    return 0;
+}
+
+// -o SINK: mqtt, stdout, file:PATH or socket:PATH, each at most once
+static int parse_output(const char* arg){
+    output_t* output = &outputs[outputs_count];
+    uint8_t i;
+
+    if (outputs_count == SINK_MAX){
+        return -1;
+    }
+    memset(output, 0, sizeof(*output));
+    output->spec = arg;
+    if (strcmp(arg, "mqtt") == 0){
+        output->kind = OUTPUT_MQTT;
+    }else if (strcmp(arg, "stdout") == 0){
+        output->kind = OUTPUT_STDOUT;
+    }else if (strncmp(arg, "file:", 5) == 0 && arg[5] != '\0'){
+        output->kind = OUTPUT_FILE;
+        output->path = arg + 5;
+    }else if (strncmp(arg, "socket:", 7) == 0 && arg[7] != '\0'){
+        output->kind = OUTPUT_SOCKET;
+        output->path = arg + 7;
+    }else{
+        return -1;
+    }
+    for (i = 0; i < outputs_count; i++){
+        if (strcmp(outputs[i].spec, arg) == 0 || (output->kind != OUTPUT_FILE && output->kind != OUTPUT_SOCKET &&
+                                                  outputs[i].kind == output->kind)){
+            return -1;
+        }
+    }
+    if (output->kind == OUTPUT_MQTT){
+        mqtt_output = output;
+    }
+    outputs_count++;
+    return 0;
+}
+
+// Sets up the sink of every output and the hub feeding them. The MQTT
+// sink is drained by the publisher, started once the broker is connected.
+// Returns 0 on success.
+static int open_outputs(const char* const* device_ids){
+    sink_t* sinks[SINK_MAX];
+    uint8_t i;
+
+    for (i = 0; i < outputs_count; i++){
+        output_t* output = &outputs[i];
+        metric_sink_t* counters;
+
+        if (sink_init(&output->sink, output->spec, SINK_QUEUE_CAPACITY_PER_DEVICE * devices_count,
+                      SINK_QUEUE_POLICY) != 0){
+            fprintf(stderr, "ERROR: Failed to allocate the queue of the %s output.\n", output->spec);
+            return -1;
+        }
+        counters = metrics_add_sink(&metrics, output->spec);
+        if (counters != NULL){
+            output->sink.metrics = counters;
+        }
+        sinks[i] = &output->sink;
     }
-    acc_ev_timestamp_prev = acc_ev_timestamp_current;
-    
-#if defined(NOTIFICATION_DEBUG)
-    printf("============================\n");
-    printf("Timestamp is:= %05dmS\n", acc_ev_timestamp_current);
-    if (acc_ev_flag_high != 0){
-        uint8_t index = acc_ev_flag_low;
-        if (index > 0x08 && index < 0x10){ 
-            index = acc_ev_flag_desc_err_index;
-        }
-        else if (index >= 0x10){
-            if (index != 0x10 && index != 0x20 && index != 0x40 && index != 0x80){
-                index = acc_ev_flag_desc_err_index;
-            }else{
-                index = (index >> 4) + 0x08;
+    if (sink_hub_init(&hub, sinks, outputs_count) != 0){
+        fprintf(stderr, "ERROR: Failed to allocate the sample buffers.\n");
+        return -1;
+    }
+    for (i = 0; i < outputs_count; i++){
+        output_t* output = &outputs[i];
+        int rc = 0;
+
+        if (output->kind == OUTPUT_STDOUT || output->kind == OUTPUT_FILE){
+            rc = line_sink_open(&output->lines, output->path, device_ids);
+            if (rc == 0 && sink_start(&output->sink, &line_sink_ops, &output->lines) != 0){
+                line_sink_ops.close(&output->sink);
+                rc = -1;
             }
+        }else if (output->kind == OUTPUT_SOCKET){
+            rc = socket_sink_open(&output->socket, output->path, device_ids);
+            if (rc == 0 && sink_start(&output->sink, &socket_sink_ops, &output->socket) != 0){
+                socket_sink_ops.close(&output->sink);
+                rc = -1;
+            }
+        }
+        if (rc != 0){
+            fprintf(stderr, "ERROR: Failed to open the %s output.\n", output->spec);
+            return -1;
         }
-        printf("%s", acc_ev_flag_desc[index]);
     }
-    printf("============================\n");
-#endif
-    iot_publish_variable("acc_ev_fl_1", 0x0000FFFF & acc_ev_flag_high);
-    iot_publish_variable("acc_ev_fl_2", 0x0000FFFF & acc_ev_flag_low);
-    iot_publish_variable("acc_steps", 0x0000FFFF & acc_steps_count);
-}
-
-static void (*notification_handlers[CHARACTERISTICS_COUNT])(const uuid_t*, const uint8_t*, size_t, void*) = {
-    get_led_notification_handler,
-    get_light_notification_handler,
-    get_battery_notification_handler,
-    get_compas_notification_handler,
-    get_carry_position_handler,
-    get_activity_recognition_handler,
-    get_gesture_recognition_handler,
-    get_orientation_estimation_handler,
-    get_audio_level_handler,
-    get_acc_gyro_mag_handler,
-    get_acc_events_handler,
-};
+    return 0;
+}
+
+// Stops the local sinks, writing what they still hold
+static void stop_outputs(void){
+    uint8_t i;
+
+    for (i = 0; i < outputs_count; i++){
+        output_t* output = &outputs[i];
+
+        if (!output->sink.started){
+            continue;
+        }
+        sink_stop(&output->sink);
+        printf("Output %s: %llu samples written, %llu dropped by its full queue\n", output->spec,
+               (unsigned long long)atomic_load(&output->sink.metrics->written),
+               (unsigned long long)atomic_load(&output->sink.metrics->dropped));
+    }
+}
+
+// Single notification callback for the whole board: every characteristic
+// is subscribed on the same connection, so route by UUID to its decoder,
+// or to the worker serving the board
+static void notification_dispatcher(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
+    device_t* device = user_data;
+    int characteristic = sensible_gattlib_characteristic(uuid);
+    int64_t received_usec;
+
+    if (characteristic < 0){
+        return;
+    }
+    received_usec = monotonic_usec();
+    if (capture_file != NULL){
+        capture_write(capture_file, received_usec, device->address, (uint8_t)characteristic, data, data_length);
+    }
+    if (device->worker != NULL){
+        worker_push(device->worker, device->index, (uint8_t)characteristic, data, data_length, received_usec);
+    }else{
+        handle_notification(device, (uint8_t)characteristic, data, data_length, received_usec);
+    }
+}
+
+static gboolean quit_on_signal(gpointer user_data){
+    g_main_loop_quit((GMainLoop*)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+// Adds a board to devices[], ignoring duplicates. Returns NULL when full.
+static device_t* add_device(const char* address){
+    device_t* device;
+    uint8_t i;
+
+    for (i = 0; i < devices_count; i++){
+        if (strcasecmp(devices[i].address, address) == 0){
+            return &devices[i];
+        }
+    }
+    if (devices_count == MAX_DEVICES){
+        fprintf(stderr, "Too many devices, %s is ignored.\n", address);
+        return NULL;
+    }
+    device = &devices[devices_count];
+    memset(device, 0, sizeof(*device));
+    device->index = devices_count;
+    snprintf(device->address, sizeof(device->address), "%s", address);
+    link_init(&device->link, device->address, (uint32_t)monotonic_usec() ^ (uint32_t)(devices_count + 1) * 2654435761u);
+    devices_count++;
+    return device;
+}
 
 static void ble_discovered_device(const char* addr, const char* name){
     if (name){
@@ -459,97 +533,851 @@ static void ble_discovered_device(const char* addr, const char* name){
     }else{
         printf("Discovered %s\n", addr);
     }
+    if (device_name_filter != NULL && name != NULL &&
+        strncmp(name, device_name_filter, strlen(device_name_filter)) == 0){
+        add_device(addr);
+    }
+}
+
+static void set_device_link(device_t* device, link_state_t state){
+    if (link_enter(&device->link, state, monotonic_msec())){
+        metric_link_enter(device->link_metrics, state);
+    }
+}
+
+static gboolean device_lost(gpointer user_data);
+
+// gattlib callback, the link is torn down from the main loop
+static void on_device_disconnected(void* user_data){
+    device_t* device = user_data;
+
+    atomic_store(&device->lost, true);
+    g_idle_add(device_lost, device);
+}
+
+// Enables the notifications of the characteristics the cache lists for
+// the board, leaving out those it does not offer, without discovering all
+// of them first. gattlib_notification_start() finds the client
+// configuration descriptors wherever they are, and the D-Bus backend only
+// routes the notifications it started. Returns the number of subscribed
+// characteristics, 0 after stopping them again when one failed.
+static uint8_t subscribe_cached(device_t* device){
+    uint8_t subscribed = 0;
+    uint8_t i;
+
+    for (i = 0; i < CHARACTERISTICS_COUNT; i++){
+        if (device->value_handles[i] == 0){
+            continue;
+        }
+        if (gattlib_notification_start(device->connection, sensible_gattlib_uuid(i))){
+            while (i-- > 0){
+                if (device->value_handles[i] != 0){
+                    gattlib_notification_stop(device->connection, sensible_gattlib_uuid(i));
+                }
+            }
+            return 0;
+        }
+        subscribed++;
+    }
+    return subscribed;
+}
+
+// Looks up the value handles of the characteristics with a service
+// discovery. Returns 0 on success.
+static int discover_handles(device_t* device){
+    gattlib_characteristic_t* list;
+    int count;
+    int j;
+
+    if (gattlib_discover_char(device->connection, &list, &count)){
+        return -1;
+    }
+    memset(device->value_handles, 0, sizeof(device->value_handles));
+    for (j = 0; j < count; j++){
+        int characteristic = sensible_gattlib_characteristic(&list[j].uuid);
+
+        if (characteristic >= 0){
+            device->value_handles[characteristic] = list[j].value_handle;
+        }
+    }
+    free(list);
+    device->handles_discovered = true;
+    return 0;
+}
+
+// connect_device() without connect_mutex
+static uint8_t connect_subscribe(device_t* device){
+    uint8_t subscribed = 0;
+    uint8_t i;
+
+    device->connection = gattlib_connect(NULL, device->address, BDADDR_LE_PUBLIC, BT_SEC_LOW, 0, 0);
+    if (device->connection == NULL){
+        fprintf(stderr, "Fail to connect to the bluetooth device %s.\n", device->address);
+        return 0;
+    }
+
+    gattlib_register_notification(device->connection, notification_dispatcher, device);
+    gattlib_register_on_disconnect(device->connection, on_device_disconnected, device);
+
+    if (device->handles_cached){
+        subscribed = subscribe_cached(device);
+        if (subscribed > 0){
+            return subscribed;
+        }
+        fprintf(stderr, "Cached handles of %s are stale, discovering.\n", device->address);
+    }
+    if (gatt_cache_path != NULL && discover_handles(device) != 0){
+        fprintf(stderr, "Fail to discover the characteristics of %s.\n", device->address);
+    }
+
+    for (i = 0; i < CHARACTERISTICS_COUNT; i++){
+        if (device->handles_discovered && device->value_handles[i] == 0){
+            continue;
+        }
+        if (gattlib_notification_start(device->connection, sensible_gattlib_uuid(i))){
+            fprintf(stderr, "Fail to start notification for characteristic number %hhu of %s.\n", i, device->address);
+            device->value_handles[i] = 0;
+            continue;
+        }
+        subscribed++;
+    }
+
+    if (subscribed == 0){
+        gattlib_disconnect(device->connection);
+        device->connection = NULL;
+    }
+    return subscribed;
+}
+
+// Connects to a board and subscribes every characteristic on that single
+// link, with the cached handles when they are known. Returns the number of
+// subscribed characteristics.
+static uint8_t connect_device(device_t* device){
+    uint8_t subscribed;
+
+    pthread_mutex_lock(&connect_mutex);
+    subscribed = connect_subscribe(device);
+    pthread_mutex_unlock(&connect_mutex);
+    return subscribed;
+}
+
+// Remembers the handles a connection discovered for the next ones
+static void update_gatt_cache(device_t* device){
+    if (gatt_cache_path == NULL || !device->handles_discovered){
+        return;
+    }
+    device->handles_discovered = false;
+    device->handles_cached = true;
+    if (gatt_cache_store(&gatt_cache, device->address, device->value_handles) != 0 ||
+        gatt_cache_save(&gatt_cache, gatt_cache_path) != 0){
+        fprintf(stderr, "WARNING: Cannot write the GATT cache %s.\n", gatt_cache_path);
+    }
+}
+
+static gboolean reconnect_device(gpointer user_data);
+
+static void schedule_reconnect(device_t* device){
+    uint32_t delay = link_backoff_msec(&device->link);
+
+    set_device_link(device, LINK_BACKOFF);
+    printf("Reconnecting %s in %u ms\n", device->address, delay);
+    g_timeout_add(delay, reconnect_device, device);
+}
+
+// Publishes what the windows of a lost board hold and starts it afresh:
+// a board coming back may have been reset
+static void close_device_windows(device_t* device){
+    sensible_session_flush(&device->session, 1);
+    sensible_session_reset(&device->session);
+}
+
+// Worker side of notification_dispatcher() and device_lost()
+static void handle_record(worker_t* worker, const worker_record_t* record){
+    device_t* device = &devices[record->device];
+
+    if (record->characteristic == WORKER_RECORD_LOST){
+        close_device_windows(device);
+    }else{
+        handle_notification(device, record->characteristic, record->data, record->length, record->received_usec);
+    }
+}
+
+static gboolean device_lost(gpointer user_data){
+    device_t* device = user_data;
+
+    if (device->link.state != LINK_UP){
+        return G_SOURCE_REMOVE;
+    }
+    set_device_link(device, LINK_DOWN);
+    // Behind the notifications the worker still holds
+    if (device->worker != NULL){
+        worker_push_lost(device->worker, device->index);
+    }else{
+        close_device_windows(device);
+    }
+    gattlib_disconnect(device->connection);
+    device->connection = NULL;
+    schedule_reconnect(device);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean reconnect_done(gpointer user_data){
+    device_t* device = user_data;
+
+    pthread_join(device->connect_thread, NULL);
+    if (device->subscribed > 0 && !atomic_load(&device->lost)){
+        set_device_link(device, LINK_UP);
+        update_gatt_cache(device);
+        return G_SOURCE_REMOVE;
+    }
+    if (device->connection != NULL){
+        gattlib_disconnect(device->connection);
+        device->connection = NULL;
+    }
+    schedule_reconnect(device);
+    return G_SOURCE_REMOVE;
+}
+
+static void* reconnect_worker(void* arg){
+    device_t* device = arg;
+
+    device->subscribed = connect_device(device);
+    g_idle_add(reconnect_done, device);
+    return NULL;
+}
+
+// Connects in a thread of its own so that the main loop keeps serving the
+// other boards meanwhile
+static gboolean reconnect_device(gpointer user_data){
+    device_t* device = user_data;
+
+    set_device_link(device, LINK_CONNECTING);
+    atomic_store(&device->lost, false);
+    if (pthread_create(&device->connect_thread, NULL, reconnect_worker, device) != 0){
+        schedule_reconnect(device);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void* connect_worker(void* arg){
+    unsigned int i;
+
+    while ((i = atomic_fetch_add(&connect_next, 1)) < devices_count){
+        devices[i].subscribed = connect_device(&devices[i]);
+    }
+    return NULL;
+}
+
+// Starts connecting every board from up to CONNECT_THREADS threads, so the
+// connection setups overlap the broker connection
+static void connect_devices_start(void){
+    const gatt_cache_entry_t* entry;
+    uint8_t i;
+
+    for (i = 0; i < devices_count; i++){
+        entry = gatt_cache_path != NULL ? gatt_cache_find(&gatt_cache, devices[i].address) : NULL;
+        if (entry != NULL){
+            memcpy(devices[i].value_handles, entry->value_handles, sizeof(devices[i].value_handles));
+            devices[i].handles_cached = true;
+        }
+        set_device_link(&devices[i], LINK_CONNECTING);
+    }
+    atomic_store(&connect_next, 0);
+    for (connect_threads_count = 0; connect_threads_count < CONNECT_THREADS && connect_threads_count < devices_count;
+         connect_threads_count++){
+        if (pthread_create(&connect_threads[connect_threads_count], NULL, connect_worker, NULL) != 0){
+            break;
+        }
+    }
+    if (connect_threads_count == 0){
+        connect_worker(NULL);
+    }
+}
+
+// Waits for the connections started by connect_devices_start() and stores
+// the handles discovered meanwhile. The boards that failed are retried by
+// the supervisor. Returns the number of streaming boards.
+static uint8_t connect_devices_wait(void){
+    uint8_t connected = 0;
+    bool updated = false;
+    uint8_t i;
+
+    while (connect_threads_count > 0){
+        pthread_join(connect_threads[--connect_threads_count], NULL);
+    }
+    for (i = 0; i < devices_count; i++){
+        if (devices[i].subscribed == 0 || atomic_load(&devices[i].lost)){
+            if (devices[i].connection != NULL){
+                gattlib_disconnect(devices[i].connection);
+                devices[i].connection = NULL;
+            }
+            schedule_reconnect(&devices[i]);
+            continue;
+        }
+        set_device_link(&devices[i], LINK_UP);
+        printf("Streaming %s\n", devices[i].address);
+        connected++;
+        if (gatt_cache_path != NULL && devices[i].handles_discovered){
+            devices[i].handles_discovered = false;
+            devices[i].handles_cached = true;
+            updated |= gatt_cache_store(&gatt_cache, devices[i].address, devices[i].value_handles) == 0;
+        }
+    }
+    if (updated && gatt_cache_save(&gatt_cache, gatt_cache_path) != 0){
+        fprintf(stderr, "WARNING: Cannot write the GATT cache %s.\n", gatt_cache_path);
+    }
+    return connected;
+}
+
+static void disconnect_devices(void){
+    uint64_t short_frames;
+    uint64_t refused;
+    uint8_t i;
+    uint8_t c;
+
+    for (i = 0; i < devices_count; i++){
+        if (devices[i].link.state == LINK_CONNECTING){
+            pthread_join(devices[i].connect_thread, NULL);
+        }
+        if (devices[i].connection != NULL){
+            gattlib_disconnect(devices[i].connection);
+            devices[i].connection = NULL;
+        }
+        short_frames = 0;
+        refused = 0;
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            short_frames += devices[i].metrics[c].short_frames;
+            refused += devices[i].metrics[c].refused;
+        }
+        if (short_frames > 0){
+            printf("%s: %llu notifications rejected as too short\n", devices[i].address,
+                   (unsigned long long)short_frames);
+        }
+        if (refused > 0){
+            printf("%s: %llu samples refused as no sample buffer was free\n", devices[i].address,
+                   (unsigned long long)refused);
+        }
+        if (devices[i].session.clock.synced){
+            printf("%s: board clock drifts %+.1f ppm after %u estimates, %u rollovers, %u steps\n",
+                   devices[i].address, devices[i].session.clock.drift_ppm, devices[i].session.clock.estimates,
+                   devices[i].session.clock.rollovers, devices[i].session.clock.steps);
+        }
+    }
+}
+
+// Sets up the workers given by -t and shares the boards out among them.
+// Returns 0 on success.
+static int open_workers(void){
+    uint8_t i;
+
+    if (workers_count > devices_count){
+        workers_count = devices_count;
+    }
+    for (i = 0; i < workers_count; i++){
+        metric_worker_t* counters;
+
+        if (worker_init(&workers[i], i, handle_record) != 0){
+            workers_count = i;
+            return -1;
+        }
+        counters = metrics_add_worker(&metrics);
+        if (counters != NULL){
+            workers[i].metrics = counters;
+        }
+    }
+    for (i = 0; i < devices_count; i++){
+        devices[i].worker = workers_count > 0 ? &workers[i % workers_count] : NULL;
+    }
+    return 0;
+}
+
+// Starts the worker threads, each closing the quiet windows of its boards,
+// or has the main loop close them all. Returns 0 on success.
+static int start_workers(void){
+    uint8_t i;
+
+    if (workers_count == 0){
+        g_timeout_add(PERIOD_MSEC, close_quiet_windows, NULL);
+        return 0;
+    }
+    for (i = 0; i < workers_count; i++){
+        worker_timeout_add(&workers[i], PERIOD_MSEC, close_quiet_windows, &workers[i]);
+        if (worker_start(&workers[i]) != 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Joins the worker threads, handles what their inboxes still hold from
+// this thread and publishes every open window
+static void stop_workers(void){
+    uint8_t i;
+
+    for (i = 0; i < workers_count; i++){
+        worker_stop(&workers[i]);
+        worker_drain(&workers[i], UINT32_MAX);
+        close_windows(&workers[i], true);
+        printf("Worker %hhu: %llu notifications handled, %llu dropped by its full inbox\n", i,
+               (unsigned long long)atomic_load(&workers[i].metrics->handled),
+               (unsigned long long)atomic_load(&workers[i].metrics->dropped));
+    }
+    close_windows(NULL, true);
+}
+
+// Prints the notifications handled since start_usec, by every thread
+static void print_throughput(int64_t start_usec){
+    double seconds = (double)(monotonic_usec() - start_usec) / 1e6;
+    uint64_t notifications = 0;
+    uint8_t i;
+    uint8_t c;
+
+    for (i = 0; i < devices_count; i++){
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            notifications += atomic_load(&devices[i].metrics[c].notifications);
+        }
+    }
+    printf("Handled %llu notifications in %.1fs, %.0f per second\n", (unsigned long long)notifications, seconds,
+           seconds > 0 ? (double)notifications / seconds : 0.0);
+}
+
+static void usage(const char* program){
+    printf("Usage: %s [-c CONFIG] [-n NAME_PREFIX] [-a [FIELD=]MSEC] [-f FORMAT] [-w MSEC] [-j JOURNAL]\n"
+           "       [-r CAPTURE] [-m METRICS] [-g GATT_CACHE] [-l [FIELD=]LEVEL]\n"
+           "       [-p FIELD=POLICY] [-q WINDOW] [-s STORE] [-S MBYTES] [-o SINK] [-t THREADS] [MAC ...]\n",
+           program);
+    printf("  MAC             address of a board to stream, may be repeated\n");
+    printf("  -c CONFIG       read options from the CONFIG file, one \"key value\" per line\n");
+    printf("  -n NAME_PREFIX  also stream every scanned board whose name starts with NAME_PREFIX\n");
+    printf("  -a [FIELD=]MSEC publish min/max/mean/RMS summaries of MSEC windows (default %d) instead of\n"
+           "                  every notification, 0 for every notification; FIELD=MSEC sets the window of\n"
+           "                  the characteristic carrying FIELD only, may be repeated; accelerometer events\n"
+           "                  and gestures are always published at once, as alert events, step counts are\n"
+           "                  windowed\n", PERIOD_MSEC);
+    printf("  -f FORMAT       event encoding: json (default), binary or binary-zlib\n");
+    printf("  -w MSEC         collect samples for MSEC before publishing them as one event\n");
+    printf("  -j JOURNAL      keep samples in the JOURNAL file while the broker is unreachable\n");
+    printf("  -r CAPTURE      record every raw notification to the CAPTURE file\n");
+    printf("  -m METRICS      write counters and latencies to the METRICS file, in the Prometheus text format\n");
+    printf("  -g GATT_CACHE   keep the characteristic handles of the boards in the GATT_CACHE file to skip\n"
+           "                  the service discovery on later connections\n");
+    printf("  -l [FIELD=]LEVEL log level: off, error, warning (short frames), info or debug (notifications,\n"
+           "                  %d per second of a characteristic), default %s; FIELD=LEVEL sets the level of\n"
+           "                  the characteristic carrying FIELD only, may be repeated\n",
+           LOGGER_RATE_PER_SEC, LOG_LEVEL_DEFAULT == LOG_LEVEL_DEBUG ? "debug" : "warning");
+    printf("  -p FIELD=POLICY publish FIELD, or all fields, only when POLICY lets it through: always,\n"
+           "                  change, abs:THRESHOLD or rel:PERCENT away from the last published value,\n"
+           "                  followed by /MSEC to publish it anyway that long after (default %d),\n"
+           "                  may be repeated; led, batt_stat, carry and activity default to change,\n"
+           "                  compass to abs:100\n", PUBLISH_HEARTBEAT_MSEC);
+    printf("  -q WINDOW       publish at QoS1 with up to WINDOW events awaiting their acknowledgement,\n"
+           "                  at most %d, for example %d; 0 publishes at QoS0 (default)\n",
+           MQTT_PIPELINE_MAX_WINDOW, MQTT_PIPELINE_WINDOW);
+    printf("  -s STORE        keep every decoded notification in the STORE directory, see sensible-query\n");
+    printf("  -S MBYTES       disk space of the store, oldest segments deleted beyond it (default %d)\n",
+           STORE_DEFAULT_MBYTES);
+    printf("  -o SINK         send the samples to SINK: mqtt (default), stdout, file:PATH appending JSON\n"
+           "                  lines or socket:PATH streaming them to local clients; may be repeated, each\n"
+           "                  sink with a queue of its own\n");
+    printf("  -t THREADS      decode, aggregate and queue the notifications from THREADS worker threads, at\n"
+           "                  most %d, each serving a share of the boards with a main loop of its own; 0 serves\n"
+           "                  them from the main loop (default %d)\n", MAX_WORKERS, WORKERS);
+    printf("Without boards the scanned devices are listed and one MAC is read from stdin.\n");
+}
+
+// Keys of a configuration file and the options they stand for; "device"
+// adds a board like a MAC argument
+static const struct {
+    const char* key;
+    int opt;
+} config_keys[] = {
+    {"device", 'd'},
+    {"name", 'n'},
+    {"aggregate", 'a'},
+    {"format", 'f'},
+    {"coalesce", 'w'},
+    {"journal", 'j'},
+    {"capture", 'r'},
+    {"metrics", 'm'},
+    {"gatt-cache", 'g'},
+    {"log", 'l'},
+    {"policy", 'p'},
+    {"inflight", 'q'},
+    {"store", 's'},
+    {"store-size", 'S'},
+    {"output", 'o'},
+    {"threads", 't'},
+};
+
+static int load_config(const char* path);
+
+// Applies one option of the command line or of a configuration file.
+// Returns 0 on success.
+static int apply_option(int opt, const char* arg){
+    switch (opt){
+    case 'c':
+        return load_config(arg);
+    case 'd':
+        return add_device(arg) != NULL ? 0 : -1;
+    case 'n':
+        device_name_filter = arg;
+        return 0;
+    case 'a':
+        if (parse_window(arg) != 0){
+            fprintf(stderr, "Unknown field in -a %s.\n", arg);
+            return -1;
+        }
+        return 0;
+    case 'f':
+        if (payload_format_parse(arg, &publisher_config.format) != 0){
+            fprintf(stderr, "Unsupported event format %s.\n", arg);
+            return -1;
+        }
+        return 0;
+    case 'w':
+        publisher_config.window_msec = (uint32_t)strtoul(arg, NULL, 10);
+        return 0;
+    case 'j':
+        journal_path = arg;
+        return 0;
+    case 'm':
+        metrics_path = arg;
+        return 0;
+    case 'g':
+        gatt_cache_path = arg;
+        return 0;
+    case 'p':
+        if (publish_filter_parse(&publish_filter, arg) != 0){
+            fprintf(stderr, "Unknown field or policy in -p %s.\n", arg);
+            return -1;
+        }
+        return 0;
+    case 'q':
+        if (parse_inflight_window(arg) != 0){
+            fprintf(stderr, "The in-flight window of -q %s is not a number up to %d.\n", arg,
+                    MQTT_PIPELINE_MAX_WINDOW);
+            return -1;
+        }
+        return 0;
+    case 's':
+        store_path = arg;
+        return 0;
+    case 'S':
+        store_mbytes = (uint32_t)strtoul(arg, NULL, 10);
+        return 0;
+    case 'o':
+        if (parse_output(arg) != 0){
+            fprintf(stderr, "Unknown or repeated sink -o %s.\n", arg);
+            return -1;
+        }
+        return 0;
+    case 'l':
+        if (parse_log_level(arg) != 0){
+            fprintf(stderr, "Unknown field or level in -l %s.\n", arg);
+            return -1;
+        }
+        return 0;
+    case 't':
+        if (strtoul(arg, NULL, 10) > MAX_WORKERS){
+            fprintf(stderr, "At most %d worker threads, not -t %s.\n", MAX_WORKERS, arg);
+            return -1;
+        }
+        workers_count = (uint8_t)strtoul(arg, NULL, 10);
+        return 0;
+    case 'r':
+        if (capture_file != NULL){
+            fclose(capture_file);
+        }
+        capture_file = capture_create(arg);
+        if (capture_file == NULL){
+            perror(arg);
+            return -1;
+        }
+        return 0;
+    default:
+        return -1;
+    }
 }
 
-int main(void){
+// Reads "key value" lines, blank lines and # comments are skipped. The
+// values are kept for the whole run. Returns 0 on success.
+static int load_config(const char* path){
+    char line[CONFIG_LINE_SIZE];
+    unsigned int number = 0;
+    FILE* file = fopen(path, "r");
+    int rc = 0;
+
+    if (file == NULL){
+        perror(path);
+        return -1;
+    }
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL){
+        char* save;
+        char* key = strtok_r(line, " \t\r\n", &save);
+        char* value = strtok_r(NULL, " \t\r\n", &save);
+        size_t k;
+
+        number++;
+        if (key == NULL || key[0] == '#'){
+            continue;
+        }
+        for (k = 0; k < sizeof(config_keys) / sizeof(config_keys[0]); k++){
+            if (strcmp(key, config_keys[k].key) == 0){
+                break;
+            }
+        }
+        if (k == sizeof(config_keys) / sizeof(config_keys[0]) || value == NULL){
+            fprintf(stderr, "%s:%u: expected \"key value\" with a known key.\n", path, number);
+            rc = -1;
+        }else{
+            value = strdup(value);
+            rc = value != NULL ? apply_option(config_keys[k].opt, value) : -1;
+        }
+    }
+    fclose(file);
+    return rc;
+}
+
+// Releases everything set up after the broker client, in reverse order
+static void shutdown_pipeline(bool publisher_started){
+    uint8_t i;
+
+    if (publisher_started){
+        publisher_stop(&publisher);
+    }
+    stop_outputs();
+    logger_stop(&logger);
+    sample_store_stop(&store);
+    metrics_export_stop(&metrics);
+    journal_close(&journal);
+    for (i = 0; i < outputs_count; i++){
+        sink_destroy(&outputs[i].sink);
+    }
+    sink_hub_destroy(&hub);
+    for (i = 0; i < workers_count; i++){
+        worker_destroy(&workers[i]);
+    }
+    metrics_destroy(&metrics);
+    gatt_cache_destroy(&gatt_cache);
+    publish_filter_destroy(&publish_filter);
+    if (capture_file != NULL){
+        fclose(capture_file);
+    }
+}
+
+int main(int argc, char* argv[]){
 
     const char* adapter_name;
     void* adapter;
-    gatt_connection_t* connections[CHARACTERISTICS_COUNT] = {NULL};
     int ret;
     adapter_name = NULL;
-    char bluetooth_address[30];
+    char bluetooth_address[BLE_ADDRESS_SIZE];
+    const char* device_ids[MAX_DEVICES];
     uint8_t i;
-    uuid_t characteristic_rx_uuid;
+    uint8_t connected = 0;
+    int64_t start_msec = monotonic_msec();
+    int64_t start_usec;
+    int opt;
     int rc = -1;
 
-    rc = initialize(&client, "quickstart", "internetofthings.ibmcloud.com", "HummingBoard_SensiEdge",
-                    "HB_SE_1", "token", "hb-se-1-t", "iot-embeddedc/IoTFoundation.pem", 
-                    0, NULL, NULL, NULL, 0);
+    for (i = 0; i < CHARACTERISTICS_COUNT; i++){
+        window_msec[i] = characteristics[i].event == EVENT_ALWAYS ? 0 : PERIOD_MSEC;
+        logger.levels[i] = LOG_LEVEL_DEFAULT;
+    }
+    publish_filter_defaults(&publish_filter);
 
-    if(rc != SUCCESS){
-        printf("Initialize returned rc = %d.\n Quitting..\n", rc);
-        return 0;
+    while ((opt = getopt(argc, argv, "c:n:a:f:w:j:r:m:g:l:p:q:s:S:o:t:h")) != -1){
+        if (opt == 'h' || opt == '?' || apply_option(opt, optarg) != 0){
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    for (; optind < argc; optind++){
+        add_device(argv[optind]);
+    }
+    if (outputs_count == 0){
+        parse_output("mqtt");
     }
 
-    rc = connectiotf(&client);
+    if (sensible_init() != 0){
+        fprintf(stderr, "ERROR: Inconsistent characteristic frame layouts.\n");
+        return 1;
+    }
+    if (sensible_gattlib_init() != 0){
+        fprintf(stderr, "ERROR: Failed to parse the characteristic UUIDs.\n");
+        return 1;
+    }
 
-    if(rc != SUCCESS){
-        printf("Connection returned rc = %d.\n Quitting..\n", rc);
-        return 0;
+    if (gatt_cache_path != NULL && gatt_cache_load(&gatt_cache, gatt_cache_path) != 0){
+        fprintf(stderr, "ERROR: Failed to read the GATT cache %s.\n", gatt_cache_path);
+        return 1;
+    }
+
+    if (mqtt_output != NULL){
+        rc = initialize(&client, "quickstart", "internetofthings.ibmcloud.com", "HummingBoard_SensiEdge",
+                        "HB_SE_1", "token", "hb-se-1-t", "iot-embeddedc/IoTFoundation.pem", 
+                        0, NULL, NULL, NULL, 0);
+
+        if(rc != SUCCESS){
+            printf("Initialize returned rc = %d.\n Quitting..\n", rc);
+            return 0;
+        }
     }
 
-    printf("Connection Successful. Press Ctrl+C to quit\n");
-    
     ret = gattlib_adapter_open(adapter_name, &adapter);
     if (ret){
         fprintf(stderr, "ERROR: Failed to open adapter.\n");
         return 1;
     }
 
-    ret = gattlib_adapter_scan_enable(adapter, ble_discovered_device, BLE_SCAN_TIMEOUT);
-    if (ret){
-        fprintf(stderr, "ERROR: Failed to scan.\n");
-        return 1;
+    if (devices_count == 0 || device_name_filter != NULL){
+        ret = gattlib_adapter_scan_enable(adapter, ble_discovered_device, BLE_SCAN_TIMEOUT);
+        if (ret){
+            fprintf(stderr, "ERROR: Failed to scan.\n");
+            return 1;
+        }
+
+        gattlib_adapter_scan_disable(adapter);
     }
 
-    gattlib_adapter_scan_disable(adapter);
+    if (devices_count == 0 && device_name_filter == NULL){
+        puts("Scan completed. Now please type your BLE MAC-adress:");
+        if (scanf("%17s", bluetooth_address) == 1){
+            add_device(bluetooth_address);
+        }
+    }
 
-    puts("Scan completed. Now please type your BLE MAC-adress:");
-    scanf("%s", bluetooth_address);
+    if (devices_count == 0){
+        fprintf(stderr, "No device selected. Quitting..\n");
+        return 1;
+    }
 
-    for (i = 0; i < CHARACTERISTICS_COUNT; i++){
+    for (i = 0; i < devices_count; i++){
+        device_ids[i] = devices[i].address;
+    }
 
-        connections[i] = gattlib_connect(NULL, bluetooth_address, BDADDR_LE_PUBLIC, BT_SEC_LOW, 0, 0);
-        if (connections[i] == NULL){
-            fprintf(stderr, "Fail to connect to the bluetooth device for characteric number %hhu.\n", i);
-            continue;
+    if (metrics_init(&metrics, device_ids, devices_count) != 0){
+        fprintf(stderr, "ERROR: Failed to allocate the metrics.\n");
+        return 1;
+    }
+    for (i = 0; i < devices_count; i++){
+        devices[i].metrics = metrics_channel(&metrics, i, 0);
+        devices[i].link_metrics = metrics_link(&metrics, i);
+        open_session(&devices[i]);
+    }
+    publisher_config.metrics = &metrics;
+
+    if (publish_filter_active(&publish_filter)){
+        if (publish_filter_init(&publish_filter, devices_count) != 0){
+            fprintf(stderr, "ERROR: Failed to allocate the publish policies.\n");
+            metrics_destroy(&metrics);
+            return 1;
         }
+        publisher_config.filter = &publish_filter;
+    }
 
-        if (gattlib_string_to_uuid(uuids[i], strlen(uuids[i]) + 1, &characteristic_rx_uuid) < 0) {
-            printf("Error func gattlib_string_to_uuid for characteristic number %hhu\n", i);
-            continue;
+    if (open_workers() != 0){
+        fprintf(stderr, "ERROR: Failed to allocate the worker threads.\n");
+        shutdown_pipeline(false);
+        return 1;
+    }
+
+    if (open_outputs(device_ids) != 0){
+        shutdown_pipeline(false);
+        return 1;
+    }
+
+    if (journal_path != NULL && mqtt_output == NULL){
+        fprintf(stderr, "WARNING: The journal %s only serves the mqtt output, ignored.\n", journal_path);
+    }else if (journal_path != NULL){
+        if (journal_open(&journal, journal_path, JOURNAL_CAPACITY) != 0){
+            fprintf(stderr, "ERROR: Failed to open the journal %s.\n", journal_path);
+            shutdown_pipeline(false);
+            return 1;
         }
+        publisher_config.journal = &journal;
+        if (journal_pending(&journal) > 0){
+            printf("Journal holds %llu samples to replay\n", (unsigned long long)journal_pending(&journal));
+        }
+    }
+
+    if (logger_start(&logger, device_ids, devices_count) != 0){
+        fprintf(stderr, "WARNING: Failed to start the logger, notifications are not logged.\n");
+    }
 
-        gattlib_register_notification(connections[i], notification_handlers[i], NULL);
+    if (store_path != NULL && sample_store_start(&store, store_path, store_mbytes, device_ids, devices_count,
+                                                workers_count > 0 ? workers_count : 1) != 0){
+        fprintf(stderr, "ERROR: Failed to open the store %s.\n", store_path);
+        shutdown_pipeline(false);
+        return 1;
+    }
 
-        ret = gattlib_notification_start(connections[i], &characteristic_rx_uuid);
-        if (ret){
-            fprintf(stderr, "Fail to start notification\n.");
-            continue;
+    // Notifications are only dispatched once the main loop runs, so the
+    // boards can be set up while the broker connection is established
+    connect_devices_start();
+
+    if (mqtt_output != NULL){
+        rc = connectiotf(&client);
+
+        if(rc != SUCCESS){
+            printf("Connection returned rc = %d.\n Quitting..\n", rc);
+            connect_devices_wait();
+            disconnect_devices();
+            shutdown_pipeline(false);
+            return 0;
         }
-        ret = gattlib_notification_start(connections[i], &characteristic_rx_uuid);
-        if (ret){
-            fprintf(stderr, "Fail to start notification\n.");
-            continue;
+
+        printf("Connection Successful. Press Ctrl+C to quit\n");
+
+        if (publisher_start(&publisher, &mqtt_output->sink, &client, &publisher_config, device_ids,
+                            devices_count) != 0){
+            fprintf(stderr, "ERROR: Failed to start the publisher thread.\n");
+            connect_devices_wait();
+            disconnect_devices();
+            shutdown_pipeline(false);
+            disconnect(&client);
+            return 1;
         }
     }
 
+    if (metrics_path != NULL && metrics_export_start(&metrics, metrics_path) != 0){
+        fprintf(stderr, "WARNING: Cannot write the metrics file %s.\n", metrics_path);
+    }
+
+    connected = connect_devices_wait();
+
+    // The boards that failed are in backoff, the supervisor keeps
+    // retrying them from the main loop
+    if (connected == 0){
+        fprintf(stderr, "WARNING: No board streaming yet, retrying in the background.\n");
+    }
+    printf("%hhu of %hhu boards streaming after %lld ms\n", connected, devices_count,
+           (long long)(monotonic_msec() - start_msec));
+
     GMainLoop *loop = g_main_loop_new(NULL, 0);
-    g_main_loop_run(loop);
+    g_unix_signal_add(SIGINT, quit_on_signal, loop);
+    g_unix_signal_add(SIGTERM, quit_on_signal, loop);
+    start_usec = monotonic_usec();
+    ret = start_workers();
+    if (ret == 0){
+        g_main_loop_run(loop);
+    }else{
+        fprintf(stderr, "ERROR: Failed to start the worker threads.\n");
+    }
 
     g_main_loop_unref(loop);
 
-    for (i = 0; i < CHARACTERISTICS_COUNT; i++){
-        if (connections[i] != NULL){
-            gattlib_disconnect(connections[i]);
-        }
-    }
+    stop_workers();
+    print_throughput(start_usec);
+    disconnect_devices();
+
+    shutdown_pipeline(mqtt_output != NULL);
 
     printf("Quitting!!\n");
 
-    disconnect(&client);
+    if (mqtt_output != NULL){
+        disconnect(&client);
+    }
 
-    return 0;
+    return ret != 0;
 }
-
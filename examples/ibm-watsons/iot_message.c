@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include "iot_message.h"
+
+#define IOT_MESSAGE_HEAD "{\"d\":{"
+#define IOT_MESSAGE_TAIL "}}"
+#define IOT_MESSAGE_TIME "},\"time\":"
+#define IOT_MESSAGE_TAG "\"dev\":\""
+
+// Longest device ID kept in the "dev" field
+#define IOT_TAG_MAX_CHARS 64
+
+// Longest field value: sign and 10 digits
+#define IOT_VALUE_MAX_CHARS 11
+
+// Room kept for the time: the closing brace, key and 20 digits
+#define IOT_TIME_MAX_CHARS (sizeof(IOT_MESSAGE_TIME) - 1 + 20)
+
+// Writes value in decimal at dst, returns the number of characters written
+static size_t format_int32(char* dst, int32_t value){
+    char tmp[IOT_VALUE_MAX_CHARS];
+    size_t n = 0;
+    size_t i = 0;
+    uint32_t v = (value < 0) ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+    do{
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    }while (v != 0);
+
+    if (value < 0){
+        dst[i++] = '-';
+    }
+    while (n > 0){
+        dst[i++] = tmp[--n];
+    }
+    return i;
+}
+
+static void iot_message_reset(iot_message_t* msg){
+    msg->length = msg->head_length;
+    msg->fields = 0;
+    msg->time_msec = 0;
+}
+
+void iot_message_init(iot_message_t* msg, iotfclient* client, mqtt_pipeline_t* pipeline, const char* tag){
+    size_t length = sizeof(IOT_MESSAGE_HEAD) - 1;
+
+    msg->client = client;
+    msg->pipeline = pipeline;
+    msg->tag = tag;
+
+    memcpy(msg->buffer, IOT_MESSAGE_HEAD, length);
+    if (tag != NULL){
+        // The head is written once, every event of this builder starts with it
+        size_t tag_length = strnlen(tag, IOT_TAG_MAX_CHARS);
+        memcpy(msg->buffer + length, IOT_MESSAGE_TAG, sizeof(IOT_MESSAGE_TAG) - 1);
+        length += sizeof(IOT_MESSAGE_TAG) - 1;
+        memcpy(msg->buffer + length, tag, tag_length);
+        length += tag_length;
+        msg->buffer[length++] = '"';
+    }
+    msg->head_length = length;
+    iot_message_reset(msg);
+}
+
+int iot_message_add(iot_message_t* msg, const char* name, int32_t value){
+    size_t name_length = strlen(name);
+    // ,"name":value plus the closing braces and terminator
+    size_t needed = 1 + name_length + 3 + IOT_VALUE_MAX_CHARS + IOT_TIME_MAX_CHARS + sizeof(IOT_MESSAGE_TAIL);
+
+    if (msg->length + needed > IOT_MESSAGE_SIZE){
+        return -1;
+    }
+    if (msg->length > sizeof(IOT_MESSAGE_HEAD) - 1){
+        msg->buffer[msg->length++] = ',';
+    }
+    msg->buffer[msg->length++] = '"';
+    memcpy(msg->buffer + msg->length, name, name_length);
+    msg->length += name_length;
+    msg->buffer[msg->length++] = '"';
+    msg->buffer[msg->length++] = ':';
+    msg->length += format_int32(msg->buffer + msg->length, value);
+    msg->fields++;
+    return 0;
+}
+
+void iot_message_time(iot_message_t* msg, int64_t time_usec){
+    int64_t time_msec = time_usec / 1000;
+
+    if (time_msec > 0 && (msg->time_msec == 0 || time_msec < msg->time_msec)){
+        msg->time_msec = time_msec;
+    }
+}
+
+int iot_message_publish(iot_message_t* msg, const char* event_type){
+    size_t length = msg->length;
+    int rc = 0;
+
+    if (msg->fields == 0){
+        return 0;
+    }
+    if (msg->time_msec > 0){
+        memcpy(msg->buffer + length, IOT_MESSAGE_TIME, sizeof(IOT_MESSAGE_TIME) - 1);
+        length += sizeof(IOT_MESSAGE_TIME) - 1;
+        length += (size_t)snprintf(msg->buffer + length, IOT_MESSAGE_SIZE - length, "%lld",
+                                   (long long)msg->time_msec);
+        msg->buffer[length++] = '}';
+        msg->buffer[length] = '\0';
+    }else{
+        memcpy(msg->buffer + length, IOT_MESSAGE_TAIL, sizeof(IOT_MESSAGE_TAIL));
+        length += sizeof(IOT_MESSAGE_TAIL) - 1;
+    }
+    if (msg->pipeline != NULL){
+        rc = iot_publish_raw(msg->client, msg->pipeline, event_type, "json", (const uint8_t*)msg->buffer,
+                             length, QOS1);
+    }else{
+        rc = publishEvent(msg->client, (char*)event_type, "json", (unsigned char*)msg->buffer, QOS0);
+    }
+    if (rc != 0){
+        printf("Error while publishing the event with %hhu fields\n", msg->fields);
+        rc = -1;
+    }
+    iot_message_reset(msg);
+    return rc;
+}
+
+int iot_publish_raw(iotfclient* client, mqtt_pipeline_t* pipeline, const char* event_type, const char* format,
+                    const uint8_t* data, size_t length, enum QoS qos){
+    char topic[IOT_TOPIC_SIZE];
+    MQTTMessage pub;
+
+    // publishEvent() takes the payload length from strlen(), which binary
+    // payloads cannot go through
+    snprintf(topic, sizeof(topic), "iot-2/evt/%s/fmt/%s", event_type, format);
+    if (pipeline != NULL){
+        return mqtt_pipeline_publish(pipeline, topic, data, length);
+    }
+    memset(&pub, 0, sizeof(pub));
+    pub.qos = qos;
+    pub.retained = 0;
+    pub.payload = (void*)data;
+    pub.payloadlen = length;
+    return MQTTPublish(&client->c, topic, &pub);
+}
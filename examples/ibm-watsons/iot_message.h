@@ -0,0 +1,53 @@
+#ifndef IOT_MESSAGE_H
+#define IOT_MESSAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "deviceclient.h"
+#include "mqtt_pipeline.h"
+
+// Size of an event topic
+#define IOT_TOPIC_SIZE 128
+
+// Size of a field name, statistic suffix included
+#define IOT_FIELD_NAME_SIZE 32
+
+// Size of one coalesced {"d":{...}} document
+#define IOT_MESSAGE_SIZE 512
+
+// Builder that gathers the fields of one or more samples into a single
+// event, so a frame costs one publishEvent() instead of one per field
+typedef struct {
+    iotfclient* client;
+    // QoS1 pipeline the events go through, NULL for blocking QoS0 publishes
+    mqtt_pipeline_t* pipeline;
+    // Device ID written as "dev" in every event, NULL for none
+    const char* tag;
+    char buffer[IOT_MESSAGE_SIZE];
+    size_t length;
+    size_t head_length;
+    uint8_t fields;
+    // Unix time in ms of the earliest sample of the document, 0 for none
+    int64_t time_msec;
+} iot_message_t;
+
+void iot_message_init(iot_message_t* msg, iotfclient* client, mqtt_pipeline_t* pipeline, const char* tag);
+
+// Appends one "name":value pair. Returns -1 when the document has no room
+// left for it, the caller then publishes and adds again.
+int iot_message_add(iot_message_t* msg, const char* name, int32_t value);
+
+// Stamps the pending document with the Unix time of one of its samples:
+// {"d":{...},"time":MSEC} carries the earliest one. 0 is ignored.
+void iot_message_time(iot_message_t* msg, int64_t time_usec);
+
+// Publishes the pending document, if any, as an event_type event and
+// starts a new one. Returns 0 on success.
+int iot_message_publish(iot_message_t* msg, const char* event_type);
+
+// Publishes an event of any format and length, through pipeline at QoS1
+// or, when pipeline is NULL, at qos with a blocking publish
+int iot_publish_raw(iotfclient* client, mqtt_pipeline_t* pipeline, const char* event_type, const char* format,
+                    const uint8_t* data, size_t length, enum QoS qos);
+
+#endif
@@ -0,0 +1,183 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "journal.h"
+
+static uint32_t crc_table[256];
+
+static void crc_init(void){
+    uint32_t i;
+    uint32_t j;
+
+    if (crc_table[1] != 0){
+        return;
+    }
+    for (i = 0; i < 256; i++){
+        uint32_t c = i;
+        for (j = 0; j < 8; j++){
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t record_crc(const journal_record_t* record){
+    journal_record_t copy = *record;
+    const uint8_t* p = (const uint8_t*)&copy;
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i;
+
+    copy.crc = 0;
+    for (i = 0; i < sizeof(copy); i++){
+        crc = crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static int record_valid(const journal_record_t* record, uint64_t seq){
+    return record->seq == seq && record->crc == record_crc(record);
+}
+
+static journal_record_t* slot(journal_t* journal, uint64_t seq){
+    return &journal->records[seq % journal->capacity];
+}
+
+static void journal_reset(journal_t* journal){
+    memset(journal->map, 0, journal->map_size);
+    journal->header->magic = JOURNAL_MAGIC;
+    journal->header->version = JOURNAL_VERSION;
+    journal->header->record_size = sizeof(journal_record_t);
+    journal->header->capacity = journal->capacity;
+    // Sequence 0 marks a never written slot
+    journal->header->write_seq = 1;
+    journal->header->read_seq = 1;
+    msync(journal->map, journal->map_size, MS_SYNC);
+}
+
+// Picks up records written after the last header update, then makes sure
+// the window still fits the ring
+static void journal_recover(journal_t* journal){
+    journal_header_t* header = journal->header;
+    uint32_t scanned = 0;
+
+    while (scanned < journal->capacity && record_valid(slot(journal, header->write_seq), header->write_seq)){
+        header->write_seq++;
+        scanned++;
+    }
+    if (header->read_seq > header->write_seq){
+        header->read_seq = header->write_seq;
+    }
+    if (header->write_seq - header->read_seq > journal->capacity){
+        header->read_seq = header->write_seq - journal->capacity;
+    }
+}
+
+int journal_open(journal_t* journal, const char* path, uint32_t capacity){
+    struct stat st;
+    int existing;
+
+    crc_init();
+    memset(journal, 0, sizeof(*journal));
+    journal->capacity = capacity;
+    journal->map_size = JOURNAL_HEADER_SIZE + (size_t)capacity * sizeof(journal_record_t);
+
+    journal->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (journal->fd < 0){
+        perror(path);
+        return -1;
+    }
+    existing = (fstat(journal->fd, &st) == 0 && (size_t)st.st_size == journal->map_size);
+    if (!existing && ftruncate(journal->fd, (off_t)journal->map_size) != 0){
+        perror(path);
+        close(journal->fd);
+        return -1;
+    }
+
+    journal->map = mmap(NULL, journal->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    if (journal->map == MAP_FAILED){
+        perror(path);
+        close(journal->fd);
+        return -1;
+    }
+    journal->header = (journal_header_t*)journal->map;
+    journal->records = (journal_record_t*)(journal->map + JOURNAL_HEADER_SIZE);
+
+    if (existing && journal->header->magic == JOURNAL_MAGIC && journal->header->version == JOURNAL_VERSION &&
+        journal->header->record_size == sizeof(journal_record_t) && journal->header->capacity == capacity){
+        journal_recover(journal);
+    }else{
+        journal_reset(journal);
+    }
+    return 0;
+}
+
+void journal_close(journal_t* journal){
+    if (journal->map == NULL){
+        return;
+    }
+    msync(journal->map, journal->map_size, MS_SYNC);
+    munmap(journal->map, journal->map_size);
+    close(journal->fd);
+    journal->map = NULL;
+}
+
+static void journal_sync(journal_t* journal){
+    if (++journal->unsynced >= JOURNAL_SYNC_EVERY){
+        msync(journal->map, journal->map_size, MS_ASYNC);
+        journal->unsynced = 0;
+    }
+}
+
+void journal_append(journal_t* journal, const char* device_id, const sample_t* sample){
+    journal_header_t* header = journal->header;
+    journal_record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.seq = header->write_seq;
+    strncpy(record.device_id, device_id, sizeof(record.device_id) - 1);
+    record.sample = *sample;
+    record.crc = record_crc(&record);
+
+    if (header->write_seq - header->read_seq >= journal->capacity){
+        header->read_seq++;
+        journal->overwritten++;
+    }
+    // The record is complete before the header points past it
+    *slot(journal, record.seq) = record;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    header->write_seq++;
+    journal->appended++;
+    journal_sync(journal);
+}
+
+uint32_t journal_peek(journal_t* journal, journal_record_t* out, uint32_t max){
+    journal_header_t* header = journal->header;
+    uint64_t seq = header->read_seq;
+    uint32_t count = 0;
+
+    while (count < max && seq < header->write_seq){
+        const journal_record_t* record = slot(journal, seq);
+        if (!record_valid(record, seq)){
+            if (count > 0){
+                break;
+            }
+            // Nothing valid precedes it, drop it right away
+            header->read_seq = ++seq;
+            journal->corrupt++;
+            continue;
+        }
+        out[count++] = *record;
+        seq++;
+    }
+    return count;
+}
+
+void journal_consume(journal_t* journal, uint32_t count){
+    uint64_t pending = journal_pending(journal);
+
+    journal->header->read_seq += (count < pending) ? count : pending;
+    journal_sync(journal);
+}
@@ -0,0 +1,76 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "sample_queue.h"
+
+#define JOURNAL_MAGIC 0x4C4E524A
+#define JOURNAL_VERSION 1
+
+// The header owns the first page, records follow
+#define JOURNAL_HEADER_SIZE 4096
+
+// Longest device ID kept with a record, a MAC address
+#define JOURNAL_DEVICE_ID_SIZE 18
+
+// Appends between two asynchronous flushes of the mapping to disk
+#define JOURNAL_SYNC_EVERY 256
+
+// One journaled sample. Record seq lives in slot seq % capacity; crc covers
+// the whole record with crc itself zeroed, so torn writes are detected.
+typedef struct {
+    uint64_t seq;
+    uint32_t crc;
+    char device_id[JOURNAL_DEVICE_ID_SIZE];
+    uint16_t reserved;
+    sample_t sample;
+} journal_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    // Sequence of the next record to write and of the oldest one kept
+    uint64_t write_seq;
+    uint64_t read_seq;
+} journal_header_t;
+
+// Fixed-size ring of samples in a memory-mapped file, holding what could
+// not be published until the broker is reachable again. Not thread safe,
+// owned by the publisher thread.
+typedef struct {
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    journal_header_t* header;
+    journal_record_t* records;
+    uint32_t capacity;
+    uint32_t unsynced;
+    uint64_t appended;
+    // Records lost to a full ring or found corrupt on replay
+    uint64_t overwritten;
+    uint64_t corrupt;
+} journal_t;
+
+// Opens or creates the journal at path. Records left by a previous run are
+// kept when the file has the same geometry. Returns 0 on success.
+int journal_open(journal_t* journal, const char* path, uint32_t capacity);
+
+void journal_close(journal_t* journal);
+
+// Stores a sample, overwriting the oldest one when the ring is full
+void journal_append(journal_t* journal, const char* device_id, const sample_t* sample);
+
+// Copies up to max of the oldest records to out without consuming them.
+// Corrupt records met before any valid one are dropped and counted.
+uint32_t journal_peek(journal_t* journal, journal_record_t* out, uint32_t max);
+
+// Drops the count oldest records once they are published
+void journal_consume(journal_t* journal, uint32_t count);
+
+static inline uint64_t journal_pending(const journal_t* journal){
+    return journal->header->write_seq - journal->header->read_seq;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include "latency.h"
+
+uint64_t latency_percentile(const latency_histogram_t* histogram, double percentile){
+    uint64_t rank = (uint64_t)(histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+    uint8_t i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++){
+        seen += histogram->buckets[i];
+        if (seen > rank){
+            return (uint64_t)1 << i;
+        }
+    }
+    return histogram->max_usec;
+}
+
+void latency_print(const char* label, const latency_histogram_t* histogram){
+    if (histogram->count == 0){
+        printf("%s: no samples\n", label);
+        return;
+    }
+    printf("%s: %llu samples, mean %lluus, p50 <%lluus, p99 <%lluus, max %lluus\n", label,
+           (unsigned long long)histogram->count,
+           (unsigned long long)(histogram->total_usec / histogram->count),
+           (unsigned long long)latency_percentile(histogram, 50),
+           (unsigned long long)latency_percentile(histogram, 99),
+           (unsigned long long)histogram->max_usec);
+}
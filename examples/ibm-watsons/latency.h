@@ -0,0 +1,42 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Bucket i counts latencies below 2^i microseconds
+#define LATENCY_BUCKETS 32
+
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_usec;
+    uint64_t max_usec;
+} latency_histogram_t;
+
+static inline uint8_t latency_bucket(uint64_t usec){
+    uint8_t bucket = 0;
+
+    while (bucket < LATENCY_BUCKETS - 1 && (usec >> bucket) != 0){
+        bucket++;
+    }
+    return bucket;
+}
+
+static inline void latency_record(latency_histogram_t* histogram, int64_t usec){
+    uint64_t value = usec > 0 ? (uint64_t)usec : 0;
+
+    histogram->buckets[latency_bucket(value)]++;
+    histogram->count++;
+    histogram->total_usec += value;
+    if (value > histogram->max_usec){
+        histogram->max_usec = value;
+    }
+}
+
+// Upper bound, in microseconds, of the bucket holding the given percentile
+uint64_t latency_percentile(const latency_histogram_t* histogram, double percentile);
+
+// One line summary: count, mean, p50, p99 and max
+void latency_print(const char* label, const latency_histogram_t* histogram);
+
+#endif
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include "link_state.h"
+#include "monotonic.h"
+
+static const char* const state_names[LINK_STATES] = {"down", "connecting", "up", "backoff"};
+
+void link_init(link_t* link, const char* name, uint32_t seed){
+    link->name = name;
+    link->state = LINK_DOWN;
+    link->since_msec = monotonic_msec();
+    link->failures = 0;
+    link->seed = seed ? seed : 1;
+}
+
+bool link_enter(link_t* link, link_state_t state, int64_t now_msec){
+    if (link->state == state){
+        return false;
+    }
+    printf("Link %s: %s -> %s after %lld ms\n", link->name, state_names[link->state], state_names[state],
+           (long long)(now_msec - link->since_msec));
+    link->state = state;
+    link->since_msec = now_msec;
+    if (state == LINK_UP){
+        link->failures = 0;
+    }
+    return true;
+}
+
+uint32_t link_backoff_msec(link_t* link){
+    uint32_t ceiling = LINK_BACKOFF_MAX_MSEC;
+    uint32_t x = link->seed;
+
+    if (link->failures < 16 && ((uint32_t)LINK_BACKOFF_BASE_MSEC << link->failures) < ceiling){
+        ceiling = (uint32_t)LINK_BACKOFF_BASE_MSEC << link->failures;
+    }
+    link->failures++;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    link->seed = x;
+    return ceiling / 2 + x % (ceiling / 2 + 1);
+}
+
+const char* link_state_name(link_state_t state){
+    return state < LINK_STATES ? state_names[state] : "";
+}
@@ -0,0 +1,46 @@
+#ifndef LINK_STATE_H
+#define LINK_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// First reconnection delay, doubled after every failed attempt
+#define LINK_BACKOFF_BASE_MSEC 500
+
+// Ceiling of the reconnection delay
+#define LINK_BACKOFF_MAX_MSEC 60000
+
+typedef enum {
+    LINK_DOWN,
+    LINK_CONNECTING,
+    LINK_UP,
+    // Waiting for the next reconnection attempt
+    LINK_BACKOFF,
+    LINK_STATES
+} link_state_t;
+
+// Connection to a board or to the broker, owned by a single thread
+typedef struct {
+    const char* name;
+    link_state_t state;
+    int64_t since_msec;
+    // Failed attempts since the link was last up
+    uint32_t failures;
+    uint32_t seed;
+} link_t;
+
+// seed decorrelates the jitter of links failing at the same time
+void link_init(link_t* link, const char* name, uint32_t seed);
+
+// Moves link to state and logs the transition. Reaching LINK_UP resets
+// the backoff. Returns false when link already was in state.
+bool link_enter(link_t* link, link_state_t state, int64_t now_msec);
+
+// Delay before the next attempt, a random value between half and all of
+// LINK_BACKOFF_BASE_MSEC doubled per failure, so that links lost together
+// do not come back in a storm. Counts one more failure.
+uint32_t link_backoff_msec(link_t* link);
+
+const char* link_state_name(link_state_t state);
+
+#endif
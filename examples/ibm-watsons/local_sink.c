@@ -0,0 +1,168 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "characteristics.h"
+#include "local_sink.h"
+#include "monotonic.h"
+
+// JSON lines of one buffer, written to the clients in one send()
+#define SOCKET_SINK_CHUNK_SIZE (SAMPLE_BUFFER_SAMPLES * SAMPLE_JSON_SIZE)
+
+static void line_sink_write(sink_t* sink, const sample_buffer_t* buffer){
+    line_sink_t* lines = sink->state;
+    char line[SAMPLE_JSON_SIZE];
+    uint32_t i;
+
+    for (i = 0; i < buffer->count; i++){
+        const sample_t* sample = &buffer->samples[i];
+        int length = format_sample_json(lines->device_ids[sample->device], sample, line, sizeof(line));
+
+        line[length] = '\n';
+        fwrite(line, 1, (size_t)length + 1, lines->file);
+    }
+}
+
+static void line_sink_idle(sink_t* sink){
+    line_sink_t* lines = sink->state;
+
+    fflush(lines->file);
+}
+
+static void line_sink_close(sink_t* sink){
+    line_sink_t* lines = sink->state;
+
+    if (lines->owned){
+        fclose(lines->file);
+    }
+    lines->file = NULL;
+}
+
+const sink_ops_t line_sink_ops = {
+    .write = line_sink_write,
+    .idle = line_sink_idle,
+    .close = line_sink_close,
+};
+
+int line_sink_open(line_sink_t* sink, const char* path, const char* const* device_ids){
+    sink->device_ids = device_ids;
+    sink->owned = path != NULL;
+    sink->file = path != NULL ? fopen(path, "a") : stdout;
+    if (sink->file == NULL){
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void socket_sink_drop(socket_sink_t* sockets, uint8_t client){
+    close(sockets->clients[client]);
+    sockets->clients[client] = sockets->clients[--sockets->clients_count];
+}
+
+// Takes the clients that connected since the last call
+static void socket_sink_accept(socket_sink_t* sockets){
+    int fd;
+
+    sockets->accept_msec = monotonic_msec() + SOCKET_SINK_ACCEPT_MSEC;
+    while ((fd = accept(sockets->listener, NULL, NULL)) >= 0){
+        if (sockets->clients_count == SOCKET_SINK_MAX_CLIENTS){
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        shutdown(fd, SHUT_RD);
+        sockets->clients[sockets->clients_count++] = fd;
+        sockets->accepted++;
+    }
+}
+
+static void socket_sink_write(sink_t* sink, const sample_buffer_t* buffer){
+    socket_sink_t* sockets = sink->state;
+    char chunk[SOCKET_SINK_CHUNK_SIZE];
+    size_t length = 0;
+    uint32_t i;
+    uint8_t c;
+
+    if (monotonic_msec() >= sockets->accept_msec){
+        socket_sink_accept(sockets);
+    }
+    if (sockets->clients_count == 0){
+        return;
+    }
+    // Formatted once for every client
+    for (i = 0; i < buffer->count; i++){
+        const sample_t* sample = &buffer->samples[i];
+
+        length += (size_t)format_sample_json(sockets->device_ids[sample->device], sample, chunk + length,
+                                             SAMPLE_JSON_SIZE - 1);
+        chunk[length++] = '\n';
+    }
+    for (c = 0; c < sockets->clients_count;){
+        ssize_t sent = send(sockets->clients[c], chunk, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        // A partial line would garble the stream, so a lagging client goes
+        if (sent != (ssize_t)length){
+            if (sent >= 0 || errno == EAGAIN || errno == EWOULDBLOCK){
+                sockets->lagging++;
+            }
+            socket_sink_drop(sockets, c);
+            continue;
+        }
+        c++;
+    }
+}
+
+static void socket_sink_idle(sink_t* sink){
+    socket_sink_accept(sink->state);
+}
+
+static void socket_sink_close(sink_t* sink){
+    socket_sink_t* sockets = sink->state;
+
+    while (sockets->clients_count > 0){
+        socket_sink_drop(sockets, 0);
+    }
+    close(sockets->listener);
+    unlink(sockets->path);
+    printf("Socket %s served %llu clients, %llu disconnected for lagging\n", sockets->path,
+           (unsigned long long)sockets->accepted, (unsigned long long)sockets->lagging);
+}
+
+const sink_ops_t socket_sink_ops = {
+    .write = socket_sink_write,
+    .idle = socket_sink_idle,
+    .close = socket_sink_close,
+};
+
+int socket_sink_open(socket_sink_t* sink, const char* path, const char* const* device_ids){
+    struct sockaddr_un address;
+
+    memset(sink, 0, sizeof(*sink));
+    sink->path = path;
+    sink->device_ids = device_ids;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)){
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    sink->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sink->listener < 0){
+        perror(path);
+        return -1;
+    }
+    unlink(path);
+    if (bind(sink->listener, (const struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(sink->listener, SOCKET_SINK_MAX_CLIENTS) != 0){
+        perror(path);
+        close(sink->listener);
+        return -1;
+    }
+    return 0;
+}
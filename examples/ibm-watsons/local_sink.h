@@ -0,0 +1,48 @@
+#ifndef LOCAL_SINK_H
+#define LOCAL_SINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sink.h"
+
+// Most local clients of a socket sink at once
+#define SOCKET_SINK_MAX_CLIENTS 16
+
+// Pause between two checks for new clients of a busy socket sink
+#define SOCKET_SINK_ACCEPT_MSEC 100
+
+// Sink writing every sample as a JSON line, see format_sample_json(), to
+// stdout or appended to a file
+typedef struct {
+    FILE* file;
+    bool owned;
+    const char* const* device_ids;
+} line_sink_t;
+
+extern const sink_ops_t line_sink_ops;
+
+// path NULL writes to stdout. device_ids[i] names device i and must
+// outlive sink. Returns 0 on success.
+int line_sink_open(line_sink_t* sink, const char* path, const char* const* device_ids);
+
+// Sink streaming the same JSON lines to the local clients of a
+// UNIX-domain stream socket. A client whose socket buffer is full is
+// disconnected rather than waited for.
+typedef struct {
+    const char* path;
+    int listener;
+    int clients[SOCKET_SINK_MAX_CLIENTS];
+    uint8_t clients_count;
+    int64_t accept_msec;
+    const char* const* device_ids;
+    uint64_t accepted;
+    uint64_t lagging;
+} socket_sink_t;
+
+extern const sink_ops_t socket_sink_ops;
+
+// Listens on path, replacing a stale socket file. Returns 0 on success.
+int socket_sink_open(socket_sink_t* sink, const char* path, const char* const* device_ids);
+
+#endif
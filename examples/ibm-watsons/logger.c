@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+#include "monotonic.h"
+
+static const char* const level_names[LOG_LEVELS] = {"off", "error", "warning", "info", "debug"};
+
+int log_level_parse(const char* name, log_level_t* level){
+    int l;
+
+    for (l = 0; l < LOG_LEVELS; l++){
+        if (strcmp(name, level_names[l]) == 0){
+            *level = (log_level_t)l;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Takes a token of the bucket of a board's characteristic, counting the
+// record as suppressed when there is none left
+static bool logger_admit(logger_t* logger, uint8_t device, uint8_t characteristic, int64_t now_usec){
+    log_limiter_t* limiter;
+    int64_t now = now_usec / 1000;
+    int64_t refill;
+
+    if (device >= logger->devices_count){
+        return false;
+    }
+    limiter = &logger->limiters[device * CHARACTERISTICS_COUNT + characteristic];
+    refill = (now - limiter->refill_msec) * LOGGER_RATE_PER_SEC / 1000;
+    if (refill > 0){
+        limiter->tokens = limiter->tokens + refill >= LOGGER_RATE_PER_SEC ? LOGGER_RATE_PER_SEC :
+                          limiter->tokens + (uint32_t)refill;
+        limiter->refill_msec = now;
+    }
+    if (limiter->tokens == 0){
+        atomic_store_explicit(&limiter->suppressed,
+                              atomic_load_explicit(&limiter->suppressed, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return false;
+    }
+    limiter->tokens--;
+    return true;
+}
+
+// Claims the next slot, NULL when the ring is full
+static log_slot_t* logger_claim(logger_t* logger, uint32_t* position){
+    uint32_t tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+
+    for (;;){
+        log_slot_t* slot = &logger->slots[tail & (LOGGER_CAPACITY - 1)];
+        int32_t lap = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - tail);
+
+        if (lap == 0){
+            if (atomic_compare_exchange_weak_explicit(&logger->tail, &tail, tail + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                *position = tail;
+                return slot;
+            }
+        }else if (lap < 0){
+            atomic_fetch_add_explicit(&logger->dropped, 1, memory_order_relaxed);
+            return NULL;
+        }else{
+            tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static void logger_publish(log_slot_t* slot, uint32_t position){
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+}
+
+void logger_sample(logger_t* logger, const sample_t* sample){
+    int64_t now = monotonic_usec();
+    uint32_t position;
+    log_slot_t* slot;
+
+    if (logger->slots == NULL || !logger_admit(logger, sample->device, sample->characteristic, now)){
+        return;
+    }
+    slot = logger_claim(logger, &position);
+    if (slot == NULL){
+        return;
+    }
+    slot->record.usec = now;
+    slot->record.kind = LOG_RECORD_SAMPLE;
+    slot->record.level = LOG_LEVEL_DEBUG;
+    slot->record.sample = *sample;
+    logger_publish(slot, position);
+}
+
+void logger_short_frame(logger_t* logger, uint8_t device, uint8_t characteristic, const uint8_t* data,
+                        size_t data_length){
+    int64_t now = monotonic_usec();
+    uint32_t position;
+    log_slot_t* slot;
+
+    if (logger->slots == NULL || !logger_admit(logger, device, characteristic, now)){
+        return;
+    }
+    slot = logger_claim(logger, &position);
+    if (slot == NULL){
+        return;
+    }
+    if (data_length > SENSIBLE_FRAME_MAX){
+        data_length = SENSIBLE_FRAME_MAX;
+    }
+    slot->record.usec = now;
+    slot->record.kind = LOG_RECORD_SHORT_FRAME;
+    slot->record.level = LOG_LEVEL_WARNING;
+    slot->record.frame.device = device;
+    slot->record.frame.characteristic = characteristic;
+    slot->record.frame.length = (uint8_t)data_length;
+    memcpy(slot->record.frame.data, data, data_length);
+    logger_publish(slot, position);
+}
+
+// One line of key=value pairs per record
+static void logger_format(const logger_t* logger, const log_record_t* record, FILE* file){
+    char line[512];
+    int length;
+    uint8_t device = record->kind == LOG_RECORD_SAMPLE ? record->sample.device : record->frame.device;
+    uint8_t characteristic = record->kind == LOG_RECORD_SAMPLE ? record->sample.characteristic :
+                             record->frame.characteristic;
+    uint8_t i;
+
+    length = snprintf(line, sizeof(line), "t=%lld.%06lld level=%s dev=%s char=\"%s\"",
+                      (long long)(record->usec / 1000000), (long long)(record->usec % 1000000),
+                      level_names[record->level], logger->device_ids[device], characteristics[characteristic].title);
+    if (record->kind == LOG_RECORD_SAMPLE){
+        length += format_sample(&record->sample, line + length, sizeof(line) - (size_t)length);
+    }else{
+        length += snprintf(line + length, sizeof(line) - (size_t)length, " msg=\"short frame\" length=%u data=",
+                           record->frame.length);
+        for (i = 0; i < record->frame.length && (size_t)length + 3 < sizeof(line); i++){
+            length += snprintf(line + length, sizeof(line) - (size_t)length, "%02x", record->frame.data[i]);
+        }
+    }
+    if ((size_t)length >= sizeof(line) - 1){
+        length = (int)sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    fwrite(line, 1, (size_t)length, file);
+}
+
+// Formats every published record. Returns how many there were.
+static uint32_t logger_drain(logger_t* logger){
+    uint32_t count = 0;
+
+    for (;;){
+        log_slot_t* slot = &logger->slots[logger->head & (LOGGER_CAPACITY - 1)];
+
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != logger->head + 1){
+            break;
+        }
+        logger_format(logger, &slot->record, stdout);
+        atomic_store_explicit(&slot->sequence, logger->head + LOGGER_CAPACITY, memory_order_release);
+        logger->head++;
+        count++;
+    }
+    if (count > 0){
+        fflush(stdout);
+    }
+    return count;
+}
+
+static void logger_report(logger_t* logger, uint64_t* reported_suppressed, uint64_t* reported_dropped){
+    uint64_t suppressed = 0;
+    uint64_t dropped = atomic_load_explicit(&logger->dropped, memory_order_relaxed);
+    uint32_t i;
+
+    for (i = 0; i < (uint32_t)logger->devices_count * CHARACTERISTICS_COUNT; i++){
+        suppressed += atomic_load_explicit(&logger->limiters[i].suppressed, memory_order_relaxed);
+    }
+    if (suppressed != *reported_suppressed || dropped != *reported_dropped){
+        printf("level=warning msg=\"log records lost\" suppressed=%llu dropped=%llu\n",
+               (unsigned long long)(suppressed - *reported_suppressed),
+               (unsigned long long)(dropped - *reported_dropped));
+        fflush(stdout);
+        *reported_suppressed = suppressed;
+        *reported_dropped = dropped;
+    }
+}
+
+static void* logger_run(void* arg){
+    logger_t* logger = arg;
+    struct timespec idle = {0, LOGGER_IDLE_MSEC * 1000000L};
+    int64_t report_msec = monotonic_msec() + LOGGER_REPORT_MSEC;
+    uint64_t suppressed = 0;
+    uint64_t dropped = 0;
+
+    while (atomic_load(&logger->running)){
+        if (logger_drain(logger) == 0){
+            nanosleep(&idle, NULL);
+        }
+        if (monotonic_msec() >= report_msec){
+            logger_report(logger, &suppressed, &dropped);
+            report_msec = monotonic_msec() + LOGGER_REPORT_MSEC;
+        }
+    }
+    logger_drain(logger);
+    logger_report(logger, &suppressed, &dropped);
+    return NULL;
+}
+
+int logger_start(logger_t* logger, const char* const* device_ids, uint8_t devices_count){
+    uint32_t i;
+
+    logger->device_ids = device_ids;
+    logger->devices_count = devices_count;
+    logger->limiters = calloc((size_t)devices_count * CHARACTERISTICS_COUNT, sizeof(log_limiter_t));
+    logger->slots = calloc(LOGGER_CAPACITY, sizeof(log_slot_t));
+    if (logger->limiters == NULL || logger->slots == NULL){
+        free(logger->limiters);
+        free(logger->slots);
+        logger->limiters = NULL;
+        logger->slots = NULL;
+        return -1;
+    }
+    for (i = 0; i < LOGGER_CAPACITY; i++){
+        atomic_init(&logger->slots[i].sequence, i);
+    }
+    for (i = 0; i < (uint32_t)devices_count * CHARACTERISTICS_COUNT; i++){
+        logger->limiters[i].tokens = LOGGER_RATE_PER_SEC;
+    }
+    atomic_init(&logger->tail, 0);
+    logger->head = 0;
+    atomic_init(&logger->dropped, 0);
+    atomic_init(&logger->running, 1);
+    if (pthread_create(&logger->thread, NULL, logger_run, logger) != 0){
+        free(logger->limiters);
+        free(logger->slots);
+        logger->limiters = NULL;
+        logger->slots = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void logger_stop(logger_t* logger){
+    if (logger->slots == NULL){
+        return;
+    }
+    atomic_store(&logger->running, 0);
+    pthread_join(logger->thread, NULL);
+    free(logger->limiters);
+    free(logger->slots);
+    logger->limiters = NULL;
+    logger->slots = NULL;
+}
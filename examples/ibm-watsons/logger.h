@@ -0,0 +1,109 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "characteristics.h"
+#include "sample_queue.h"
+
+// Records buffered between the logging threads and the writer, a power of two
+#define LOGGER_CAPACITY 4096
+
+// Records of one characteristic of one board let through per second, also
+// the burst allowance
+#define LOGGER_RATE_PER_SEC 10
+
+// Pause of the writer once the buffer is empty, bounds shutdown latency
+#define LOGGER_IDLE_MSEC 50
+
+// Pause between two reports of suppressed and dropped records
+#define LOGGER_REPORT_MSEC 10000
+
+typedef enum {
+    LOG_LEVEL_OFF,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVELS
+} log_level_t;
+
+typedef enum {
+    // Decoded notification, at LOG_LEVEL_DEBUG
+    LOG_RECORD_SAMPLE,
+    // Notification shorter than its frame layout, at LOG_LEVEL_WARNING
+    LOG_RECORD_SHORT_FRAME,
+} log_record_kind_t;
+
+// Binary record: the logging thread only copies it, the writer formats it
+typedef struct {
+    int64_t usec;
+    uint8_t kind;
+    uint8_t level;
+    union {
+        sample_t sample;
+        struct {
+            uint8_t device;
+            uint8_t characteristic;
+            uint8_t length;
+            uint8_t data[SENSIBLE_FRAME_MAX];
+        } frame;
+    };
+} log_record_t;
+
+// Slot of the ring, sequence tells which lap may write or read it
+typedef struct {
+    _Atomic uint32_t sequence;
+    log_record_t record;
+} log_slot_t;
+
+// Token bucket of one characteristic of one board, only touched by the
+// thread serving that board
+typedef struct {
+    uint32_t tokens;
+    int64_t refill_msec;
+    _Atomic uint64_t suppressed;
+} log_limiter_t;
+
+// Bounded multi-producer/single-consumer ring of log records: any thread
+// logs with one compare-and-swap and a copy, never blocking nor formatting,
+// and a writer thread formats the records to stdout
+typedef struct {
+    // Lowest level logged, per characteristic
+    log_level_t levels[CHARACTERISTICS_COUNT];
+    const char* const* device_ids;
+    uint8_t devices_count;
+    // limiters[device * CHARACTERISTICS_COUNT + characteristic]
+    log_limiter_t* limiters;
+    log_slot_t* slots;
+    _Atomic uint32_t tail;
+    uint32_t head;
+    _Atomic uint64_t dropped;
+    pthread_t thread;
+    atomic_int running;
+} logger_t;
+
+// Whether records of level are logged for characteristic, to test before
+// building them
+static inline bool logger_enabled(const logger_t* logger, uint8_t characteristic, log_level_t level){
+    return level <= logger->levels[characteristic];
+}
+
+// Parses "off", "error", "warning", "info" or "debug". Returns 0 on success.
+int log_level_parse(const char* name, log_level_t* level);
+
+// Starts the writer thread. levels must be set beforehand, device_ids[i]
+// names device i and must outlive logger. Returns 0 on success.
+int logger_start(logger_t* logger, const char* const* device_ids, uint8_t devices_count);
+
+// Writes what is still buffered and joins the writer thread
+void logger_stop(logger_t* logger);
+
+void logger_sample(logger_t* logger, const sample_t* sample);
+
+void logger_short_frame(logger_t* logger, uint8_t device, uint8_t characteristic, const uint8_t* data,
+                        size_t data_length);
+
+#endif
@@ -0,0 +1,323 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+
+// Slice of the export pause, bounds how long metrics_export_stop() waits
+#define METRICS_SLEEP_MSEC 100
+
+typedef struct {
+    const char* name;
+    const char* help;
+    size_t offset;
+} counter_desc_t;
+
+static const counter_desc_t counters[] = {
+    { "sensible_notifications_total", "Notifications received",
+      offsetof(metric_channel_t, notifications) },
+    { "sensible_short_frames_total", "Notifications rejected as shorter than their frame layout",
+      offsetof(metric_channel_t, short_frames) },
+    { "sensible_folded_total", "Notifications folded into window summaries",
+      offsetof(metric_channel_t, folded) },
+    { "sensible_queued_samples_total", "Samples handed to the output sinks",
+      offsetof(metric_channel_t, queued) },
+    { "sensible_refused_samples_total", "Samples dropped for every sink as no sample buffer was free",
+      offsetof(metric_channel_t, refused) },
+    { "sensible_published_samples_total", "Samples published",
+      offsetof(metric_channel_t, published) },
+    { "sensible_filtered_samples_total", "Samples left out whole as unchanged by their publish policies",
+      offsetof(metric_channel_t, filtered) },
+    { "sensible_failed_samples_total", "Samples whose publish failed, journaled or dropped",
+      offsetof(metric_channel_t, failed) },
+};
+
+int metrics_init(metrics_t* metrics, const char* const* device_ids, uint8_t devices_count){
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->device_ids = device_ids;
+    metrics->devices_count = devices_count;
+    metrics->channels = calloc((size_t)devices_count * CHARACTERISTICS_COUNT, sizeof(metric_channel_t));
+    metrics->links = calloc((size_t)devices_count + 1, sizeof(metric_link_t));
+    if (metrics->channels == NULL || metrics->links == NULL){
+        metrics_destroy(metrics);
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_destroy(metrics_t* metrics){
+    free(metrics->channels);
+    free(metrics->links);
+    metrics->channels = NULL;
+    metrics->links = NULL;
+}
+
+metric_sink_t* metrics_add_sink(metrics_t* metrics, const char* name){
+    metric_sink_t* sink;
+
+    if (metrics->sinks_count == METRICS_MAX_SINKS){
+        return NULL;
+    }
+    sink = &metrics->sinks[metrics->sinks_count++];
+    sink->name = name;
+    return sink;
+}
+
+metric_worker_t* metrics_add_worker(metrics_t* metrics){
+    if (metrics->workers_count == METRICS_MAX_WORKERS){
+        return NULL;
+    }
+    return &metrics->workers[metrics->workers_count++];
+}
+
+static uint64_t metric_read(const metric_counter_t* counter){
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Adds the current values of histogram to sum
+static void metric_snapshot(const metric_histogram_t* histogram, latency_histogram_t* sum){
+    uint8_t i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++){
+        sum->buckets[i] += metric_read(&histogram->buckets[i]);
+    }
+    sum->count += metric_read(&histogram->count);
+    sum->total_usec += metric_read(&histogram->total_usec);
+}
+
+static void write_histogram(FILE* file, const char* name, const char* labels, const latency_histogram_t* histogram){
+    uint64_t cumulative = 0;
+    uint8_t i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++){
+        cumulative += histogram->buckets[i];
+        fprintf(file, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, *labels ? "," : "",
+                (double)((uint64_t)1 << i) / 1e6, (unsigned long long)cumulative);
+    }
+    fprintf(file, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, *labels ? "," : "",
+            (unsigned long long)histogram->count);
+    fprintf(file, "%s_sum%s%s%s %g\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+            histogram->total_usec / 1e6);
+    fprintf(file, "%s_count%s%s%s %llu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+            (unsigned long long)histogram->count);
+}
+
+// Latency histograms are summed over the boards, per characteristic
+static void write_channel_histogram(FILE* file, const metrics_t* metrics, const char* name, const char* help,
+                                    size_t offset){
+    char labels[64];
+    uint8_t c;
+    uint8_t d;
+
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        latency_histogram_t sum;
+
+        memset(&sum, 0, sizeof(sum));
+        for (d = 0; d < metrics->devices_count; d++){
+            metric_snapshot((const metric_histogram_t*)
+                            ((const char*)&metrics->channels[d * CHARACTERISTICS_COUNT + c] + offset), &sum);
+        }
+        snprintf(labels, sizeof(labels), "characteristic=\"%s\"", characteristics[c].title);
+        write_histogram(file, name, labels, &sum);
+    }
+}
+
+static const char* link_label(const metrics_t* metrics, uint8_t link){
+    return link < metrics->devices_count ? metrics->device_ids[link] : "broker";
+}
+
+static void write_links(FILE* file, const metrics_t* metrics){
+    uint8_t link;
+    int state;
+
+    fprintf(file, "# HELP sensible_link_state State of a board or broker link: 0 down, 1 connecting, 2 up, 3 backoff\n"
+                  "# TYPE sensible_link_state gauge\n");
+    for (link = 0; link <= metrics->devices_count; link++){
+        fprintf(file, "sensible_link_state{link=\"%s\"} %llu\n", link_label(metrics, link),
+                (unsigned long long)metric_read(&metrics->links[link].state));
+    }
+    fprintf(file, "# HELP sensible_link_transitions_total Times a board or broker link entered a state\n"
+                  "# TYPE sensible_link_transitions_total counter\n");
+    for (link = 0; link <= metrics->devices_count; link++){
+        for (state = 0; state < LINK_STATES; state++){
+            fprintf(file, "sensible_link_transitions_total{link=\"%s\",state=\"%s\"} %llu\n",
+                    link_label(metrics, link), link_state_name((link_state_t)state),
+                    (unsigned long long)metric_read(&metrics->links[link].transitions[state]));
+        }
+    }
+}
+
+static void write_acks(FILE* file, const metrics_t* metrics){
+    latency_histogram_t ack_latency;
+
+    fprintf(file, "# HELP sensible_inflight_publishes QoS1 publishes awaiting their PUBACK\n"
+                  "# TYPE sensible_inflight_publishes gauge\n");
+    fprintf(file, "sensible_inflight_publishes %llu\n", (unsigned long long)metric_read(&metrics->inflight));
+    fprintf(file, "# HELP sensible_acked_publishes_total QoS1 publishes acknowledged by the broker\n"
+                  "# TYPE sensible_acked_publishes_total counter\n");
+    fprintf(file, "sensible_acked_publishes_total %llu\n", (unsigned long long)metric_read(&metrics->acked));
+    fprintf(file, "# HELP sensible_retransmitted_publishes_total QoS1 publishes written again after a reconnect\n"
+                  "# TYPE sensible_retransmitted_publishes_total counter\n");
+    fprintf(file, "sensible_retransmitted_publishes_total %llu\n",
+            (unsigned long long)metric_read(&metrics->retransmitted));
+    fprintf(file, "# HELP sensible_ack_latency_seconds From the write of a QoS1 publish to its PUBACK\n"
+                  "# TYPE sensible_ack_latency_seconds histogram\n");
+    memset(&ack_latency, 0, sizeof(ack_latency));
+    metric_snapshot(&metrics->ack_latency, &ack_latency);
+    write_histogram(file, "sensible_ack_latency_seconds", "", &ack_latency);
+}
+
+static void write_alerts(FILE* file, const metrics_t* metrics){
+    latency_histogram_t alert_latency;
+
+    fprintf(file, "# HELP sensible_alert_latency_seconds From the arrival of a discrete event to the end of its publish\n"
+                  "# TYPE sensible_alert_latency_seconds histogram\n");
+    memset(&alert_latency, 0, sizeof(alert_latency));
+    metric_snapshot(&metrics->alert_latency, &alert_latency);
+    write_histogram(file, "sensible_alert_latency_seconds", "", &alert_latency);
+    fprintf(file, "# HELP sensible_alerts_late_total Discrete events published later than the latency target\n"
+                  "# TYPE sensible_alerts_late_total counter\n");
+    fprintf(file, "sensible_alerts_late_total %llu\n", (unsigned long long)metric_read(&metrics->alerts_late));
+}
+
+static void write_sinks(FILE* file, const metrics_t* metrics){
+    uint8_t i;
+
+    fprintf(file, "# HELP sensible_sink_samples_total Samples consumed by an output sink\n"
+                  "# TYPE sensible_sink_samples_total counter\n");
+    for (i = 0; i < metrics->sinks_count; i++){
+        fprintf(file, "sensible_sink_samples_total{sink=\"%s\"} %llu\n", metrics->sinks[i].name,
+                (unsigned long long)metric_read(&metrics->sinks[i].written));
+    }
+    fprintf(file, "# HELP sensible_sink_dropped_total Samples dropped by the full queue of an output sink\n"
+                  "# TYPE sensible_sink_dropped_total counter\n");
+    for (i = 0; i < metrics->sinks_count; i++){
+        fprintf(file, "sensible_sink_dropped_total{sink=\"%s\"} %llu\n", metrics->sinks[i].name,
+                (unsigned long long)metric_read(&metrics->sinks[i].dropped));
+    }
+}
+
+static void write_workers(FILE* file, const metrics_t* metrics){
+    uint8_t i;
+
+    if (metrics->workers_count == 0){
+        return;
+    }
+    fprintf(file, "# HELP sensible_worker_notifications_total Notifications handled by a worker thread\n"
+                  "# TYPE sensible_worker_notifications_total counter\n");
+    for (i = 0; i < metrics->workers_count; i++){
+        fprintf(file, "sensible_worker_notifications_total{worker=\"%u\"} %llu\n", i,
+                (unsigned long long)metric_read(&metrics->workers[i].handled));
+    }
+    fprintf(file, "# HELP sensible_worker_dropped_total Notifications dropped by the full inbox of a worker thread\n"
+                  "# TYPE sensible_worker_dropped_total counter\n");
+    for (i = 0; i < metrics->workers_count; i++){
+        fprintf(file, "sensible_worker_dropped_total{worker=\"%u\"} %llu\n", i,
+                (unsigned long long)metric_read(&metrics->workers[i].dropped));
+    }
+}
+
+static void write_metrics(FILE* file, const metrics_t* metrics){
+    latency_histogram_t publish_duration;
+    size_t k;
+    uint8_t c;
+    uint8_t d;
+
+    for (k = 0; k < sizeof(counters) / sizeof(counters[0]); k++){
+        fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", counters[k].name, counters[k].help, counters[k].name);
+        for (d = 0; d < metrics->devices_count; d++){
+            for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+                const metric_counter_t* counter = (const metric_counter_t*)
+                    ((const char*)&metrics->channels[d * CHARACTERISTICS_COUNT + c] + counters[k].offset);
+                fprintf(file, "%s{device=\"%s\",characteristic=\"%s\"} %llu\n", counters[k].name,
+                        metrics->device_ids[d], characteristics[c].title, (unsigned long long)metric_read(counter));
+            }
+        }
+    }
+    write_channel_histogram(file, metrics, "sensible_notify_to_decode_seconds",
+                            "From notification arrival to its decoding",
+                            offsetof(metric_channel_t, notify_to_decode));
+    write_channel_histogram(file, metrics, "sensible_decode_to_publish_seconds",
+                            "From decoding, or window summary, to the end of its publish",
+                            offsetof(metric_channel_t, decode_to_publish));
+    write_channel_histogram(file, metrics, "sensible_sensor_to_notify_seconds",
+                            "From the board time of a sample to its notification, beyond the fastest one",
+                            offsetof(metric_channel_t, sensor_to_notify));
+    write_channel_histogram(file, metrics, "sensible_sensor_to_publish_seconds",
+                            "From the board time of a sample to the end of its publish",
+                            offsetof(metric_channel_t, sensor_to_publish));
+
+    fprintf(file, "# HELP sensible_publishes_total Batches of a board published, one or more events each\n"
+                  "# TYPE sensible_publishes_total counter\n");
+    fprintf(file, "sensible_publishes_total %llu\n", (unsigned long long)metric_read(&metrics->publishes));
+    fprintf(file, "# HELP sensible_publish_failures_total Batches whose publish failed\n"
+                  "# TYPE sensible_publish_failures_total counter\n");
+    fprintf(file, "sensible_publish_failures_total %llu\n",
+            (unsigned long long)metric_read(&metrics->publish_failures));
+    fprintf(file, "# HELP sensible_publish_duration_seconds Time spent publishing one batch\n"
+                  "# TYPE sensible_publish_duration_seconds histogram\n");
+    memset(&publish_duration, 0, sizeof(publish_duration));
+    metric_snapshot(&metrics->publish_duration, &publish_duration);
+    write_histogram(file, "sensible_publish_duration_seconds", "", &publish_duration);
+    write_acks(file, metrics);
+    write_alerts(file, metrics);
+    write_sinks(file, metrics);
+    write_workers(file, metrics);
+    write_links(file, metrics);
+}
+
+static int metrics_write(const metrics_t* metrics){
+    char tmp[4096];
+    FILE* file;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", metrics->path) >= (int)sizeof(tmp)){
+        return -1;
+    }
+    file = fopen(tmp, "w");
+    if (file == NULL){
+        return -1;
+    }
+    write_metrics(file, metrics);
+    if (fclose(file) != 0){
+        remove(tmp);
+        return -1;
+    }
+    return rename(tmp, metrics->path);
+}
+
+static void* metrics_run(void* arg){
+    metrics_t* metrics = arg;
+    struct timespec slice = { 0, METRICS_SLEEP_MSEC * 1000000L };
+    uint32_t slept = 0;
+
+    while (atomic_load(&metrics->running)){
+        nanosleep(&slice, NULL);
+        slept += METRICS_SLEEP_MSEC;
+        if (slept >= METRICS_EXPORT_MSEC){
+            metrics_write(metrics);
+            slept = 0;
+        }
+    }
+    return NULL;
+}
+
+int metrics_export_start(metrics_t* metrics, const char* path){
+    metrics->path = path;
+    atomic_init(&metrics->running, 1);
+    if (metrics_write(metrics) != 0 || pthread_create(&metrics->thread, NULL, metrics_run, metrics) != 0){
+        metrics->path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_export_stop(metrics_t* metrics){
+    if (metrics->path == NULL){
+        return;
+    }
+    atomic_store(&metrics->running, 0);
+    pthread_join(metrics->thread, NULL);
+    metrics_write(metrics);
+}
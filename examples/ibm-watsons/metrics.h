@@ -0,0 +1,177 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "characteristics.h"
+#include "latency.h"
+#include "link_state.h"
+
+// Pause between two writes of the metrics file
+#define METRICS_EXPORT_MSEC 5000
+
+// Most output sinks whose counters are exported
+#define METRICS_MAX_SINKS 8
+
+// Most worker threads whose counters are exported
+#define METRICS_MAX_WORKERS 16
+
+// Every counter has a single writer thread, so it is bumped with a
+// relaxed load and store: no locked instruction on the hot path, and the
+// exporter thread still never reads a torn value
+typedef _Atomic uint64_t metric_counter_t;
+
+static inline void metric_add(metric_counter_t* counter, uint64_t n){
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// For the few counters any worker thread may bump, such as the drops of
+// a shared queue: a locked add, off the common path
+static inline void metric_add_shared(metric_counter_t* counter, uint64_t n){
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline void metric_set(metric_counter_t* counter, uint64_t value){
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+// Latencies in the buckets of latency_histogram_t
+typedef struct {
+    metric_counter_t buckets[LATENCY_BUCKETS];
+    metric_counter_t count;
+    metric_counter_t total_usec;
+} metric_histogram_t;
+
+static inline void metric_observe(metric_histogram_t* histogram, int64_t usec){
+    uint64_t value = usec > 0 ? (uint64_t)usec : 0;
+    uint8_t bucket = value ? (uint8_t)(64 - __builtin_clzll(value)) : 0;
+
+    metric_add(&histogram->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1], 1);
+    metric_add(&histogram->count, 1);
+    metric_add(&histogram->total_usec, value);
+}
+
+// One characteristic of one board. The thread serving the board writes
+// the arrival side, the publisher thread the rest.
+typedef struct {
+    metric_counter_t notifications;
+    metric_counter_t short_frames;
+    // Notifications folded into window summaries rather than sent as is
+    metric_counter_t folded;
+    // Samples handed to the output sinks, and dropped for all of them as
+    // no sample buffer was free
+    metric_counter_t queued;
+    metric_counter_t refused;
+    metric_counter_t published;
+    // Samples whose every field was left out by its publish policy
+    metric_counter_t filtered;
+    // Samples whose publish failed, journaled or dropped
+    metric_counter_t failed;
+    metric_histogram_t notify_to_decode;
+    metric_histogram_t decode_to_publish;
+    // From the board time of a raw sample to the arrival of its
+    // notification, beyond the fastest one, and to the end of its publish
+    metric_histogram_t sensor_to_notify;
+    metric_histogram_t sensor_to_publish;
+} metric_channel_t;
+
+// A board link, written by the BLE thread, or the broker link, written by
+// the publisher thread: its current link_state_t and how often it entered
+// each state
+typedef struct {
+    metric_counter_t state;
+    metric_counter_t transitions[LINK_STATES];
+} metric_link_t;
+
+static inline void metric_link_enter(metric_link_t* link, link_state_t state){
+    metric_set(&link->state, state);
+    metric_add(&link->transitions[state], 1);
+}
+
+// An output sink: samples it consumed, written by the sink, and samples
+// its full queue dropped, written by the threads serving the boards with
+// metric_add_shared()
+typedef struct {
+    const char* name;
+    metric_counter_t written;
+    metric_counter_t dropped;
+} metric_sink_t;
+
+// A worker thread serving a shard of the boards: notifications it
+// handled, written by the worker, and those its full inbox dropped,
+// written by the BLE callbacks with metric_add_shared()
+typedef struct {
+    metric_counter_t handled;
+    metric_counter_t dropped;
+} metric_worker_t;
+
+typedef struct {
+    const char* const* device_ids;
+    uint8_t devices_count;
+    // channels[device * CHARACTERISTICS_COUNT + characteristic]
+    metric_channel_t* channels;
+    // links[device], then the broker link
+    metric_link_t* links;
+    // Publisher thread: publishes of a board's batch, failed ones and how
+    // long each took
+    metric_counter_t publishes;
+    metric_counter_t publish_failures;
+    metric_histogram_t publish_duration;
+    // Publisher thread with QoS1: publishes awaiting their PUBACK,
+    // acknowledged and written again after a reconnect, and how long
+    // each PUBACK took
+    metric_counter_t inflight;
+    metric_counter_t acked;
+    metric_counter_t retransmitted;
+    metric_histogram_t ack_latency;
+    // Publisher thread: samples of discrete events published as alerts,
+    // from notification arrival to the end of their publish, and those
+    // that missed the alert latency target
+    metric_histogram_t alert_latency;
+    metric_counter_t alerts_late;
+    metric_sink_t sinks[METRICS_MAX_SINKS];
+    uint8_t sinks_count;
+    metric_worker_t workers[METRICS_MAX_WORKERS];
+    uint8_t workers_count;
+    // Exporter thread writing the Prometheus text file
+    const char* path;
+    pthread_t thread;
+    atomic_int running;
+} metrics_t;
+
+// device_ids[i] labels the metrics of device i and must outlive metrics.
+// Returns 0 on success.
+int metrics_init(metrics_t* metrics, const char* const* device_ids, uint8_t devices_count);
+
+void metrics_destroy(metrics_t* metrics);
+
+static inline metric_channel_t* metrics_channel(metrics_t* metrics, uint8_t device, uint8_t characteristic){
+    return &metrics->channels[device * CHARACTERISTICS_COUNT + characteristic];
+}
+
+static inline metric_link_t* metrics_link(metrics_t* metrics, uint8_t device){
+    return &metrics->links[device];
+}
+
+static inline metric_link_t* metrics_broker_link(metrics_t* metrics){
+    return &metrics->links[metrics->devices_count];
+}
+
+// Counters of the sink named name, which must outlive metrics. Returns
+// NULL when METRICS_MAX_SINKS are taken.
+metric_sink_t* metrics_add_sink(metrics_t* metrics, const char* name);
+
+// Counters of the next worker, labelled by its index. Returns NULL when
+// METRICS_MAX_WORKERS are taken.
+metric_worker_t* metrics_add_worker(metrics_t* metrics);
+
+// Rewrites path in the Prometheus text format every METRICS_EXPORT_MSEC,
+// from its own thread, through a temporary file renamed over it so
+// scrapers never read half a file. Returns 0 on success.
+int metrics_export_start(metrics_t* metrics, const char* path);
+
+// Writes the file a last time and joins the exporter thread
+void metrics_export_stop(metrics_t* metrics);
+
+#endif
@@ -0,0 +1,280 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include "monotonic.h"
+#include "mqtt_pipeline.h"
+
+// Fixed header flag of a PUBLISH written again
+#define MQTT_DUP_FLAG 0x08
+
+// Largest packet read back: PUBACK and PINGRESP are 2 to 4 bytes, anything
+// bigger is read in chunks and ignored
+#define MQTT_PIPELINE_READ_SIZE 64
+
+// Pause between two PUBACK checks while the window is full
+#define MQTT_PIPELINE_WAIT_MSEC 10
+
+int mqtt_pipeline_init(mqtt_pipeline_t* pipeline, iotfclient* client, uint16_t window, metrics_t* metrics){
+    memset(pipeline, 0, sizeof(*pipeline));
+    if (window == 0 || window > MQTT_PIPELINE_MAX_WINDOW){
+        return -1;
+    }
+    pipeline->client = client;
+    pipeline->window = window;
+    pipeline->next_id = 1;
+    pipeline->metrics = metrics;
+    pipeline->slots = calloc(window, sizeof(mqtt_inflight_t));
+    pipeline->resend_order = calloc(window, sizeof(mqtt_inflight_t*));
+    if (pipeline->slots == NULL || pipeline->resend_order == NULL){
+        mqtt_pipeline_destroy(pipeline);
+        return -1;
+    }
+    return 0;
+}
+
+void mqtt_pipeline_destroy(mqtt_pipeline_t* pipeline){
+    free(pipeline->slots);
+    free(pipeline->resend_order);
+    pipeline->slots = NULL;
+    pipeline->resend_order = NULL;
+}
+
+static int pipeline_write(mqtt_pipeline_t* pipeline, uint8_t* buffer, int length){
+    Network* network = pipeline->client->c.ipstack;
+    int written = 0;
+
+    while (written < length){
+        int rc = network->mqttwrite(network, buffer + written, length - written, MQTT_PIPELINE_READ_MSEC);
+        if (rc <= 0){
+            return -1;
+        }
+        written += rc;
+    }
+    return 0;
+}
+
+// Reads one packet, its first MQTT_PIPELINE_READ_SIZE bytes into buffer.
+// Returns its type, 0 when none started within timeout_msec and -1 when
+// the connection is closed, failed or broke off in the middle of one.
+static int pipeline_read(mqtt_pipeline_t* pipeline, uint8_t* buffer, int* length, int timeout_msec){
+    Network* network = pipeline->client->c.ipstack;
+    uint8_t discard[MQTT_PIPELINE_READ_SIZE];
+    uint32_t remaining = 0;
+    uint32_t multiplier = 1;
+    int header = 1;
+    struct pollfd ready = { network->my_socket, POLLIN, 0 };
+    uint8_t byte;
+    int rc;
+
+    // mqttread() waits a little even with a 0 timeout, the socket tells
+    // whether a packet started without blocking the publisher
+    rc = poll(&ready, 1, timeout_msec);
+    if (rc == 0 || (rc < 0 && errno == EINTR)){
+        return 0;
+    }
+    // A hung up peer may still have left packets to read, an error may not
+    if (rc < 0 || (ready.revents & (POLLERR | POLLNVAL)) || !(ready.revents & POLLIN) ||
+        network->mqttread(network, buffer, 1, MQTT_PIPELINE_READ_MSEC) != 1){
+        return -1;
+    }
+    do{
+        if (header == 5 || network->mqttread(network, &byte, 1, MQTT_PIPELINE_READ_MSEC) != 1){
+            return -1;
+        }
+        buffer[header++] = byte;
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+    }while (byte & 0x80);
+
+    *length = header;
+    while (remaining > 0){
+        uint8_t* dst = *length < MQTT_PIPELINE_READ_SIZE ? buffer + *length : discard;
+        int room = (int)(dst == discard ? sizeof(discard) : MQTT_PIPELINE_READ_SIZE - (size_t)*length);
+        int chunk = remaining < (uint32_t)room ? (int)remaining : room;
+
+        if (network->mqttread(network, dst, chunk, MQTT_PIPELINE_READ_MSEC) != chunk){
+            return -1;
+        }
+        if (dst != discard){
+            *length += chunk;
+        }
+        remaining -= (uint32_t)chunk;
+    }
+    return buffer[0] >> 4;
+}
+
+// Slots are indexed by packet ID modulo the window, so a PUBACK finds its
+// publish without a search
+static mqtt_inflight_t* pipeline_slot(mqtt_pipeline_t* pipeline, uint16_t packet_id){
+    return &pipeline->slots[packet_id % pipeline->window];
+}
+
+static void pipeline_ack(mqtt_pipeline_t* pipeline, uint16_t packet_id){
+    mqtt_inflight_t* slot = pipeline_slot(pipeline, packet_id);
+    int64_t usec;
+
+    if (slot->packet_id != packet_id){
+        // Acknowledges a publish sent twice, already acknowledged
+        return;
+    }
+    usec = monotonic_usec() - slot->sent_usec;
+    slot->packet_id = 0;
+    pipeline->count--;
+    pipeline->acked++;
+    latency_record(&pipeline->ack_latency, usec);
+    if (pipeline->metrics != NULL){
+        metric_add(&pipeline->metrics->acked, 1);
+        metric_observe(&pipeline->metrics->ack_latency, usec);
+        metric_set(&pipeline->metrics->inflight, pipeline->count);
+    }
+}
+
+int mqtt_pipeline_poll(mqtt_pipeline_t* pipeline, int timeout_msec){
+    uint8_t buffer[MQTT_PIPELINE_READ_SIZE];
+    uint64_t acked = pipeline->acked;
+    int length;
+    int type;
+
+    while ((type = pipeline_read(pipeline, buffer, &length, timeout_msec)) > 0){
+        unsigned char packet_type;
+        unsigned char dup;
+        unsigned short packet_id;
+
+        if (type == PUBACK && MQTTDeserialize_ack(&packet_type, &dup, &packet_id, buffer, length) == 1){
+            pipeline_ack(pipeline, packet_id);
+        }else if (type == PINGRESP){
+            pipeline->ping_usec = 0;
+        }
+        // Only the first packet is waited for
+        timeout_msec = 0;
+    }
+    return type < 0 ? -1 : (int)(pipeline->acked - acked);
+}
+
+// Takes the next packet ID whose slot is free. The window must not be full.
+static mqtt_inflight_t* pipeline_claim(mqtt_pipeline_t* pipeline){
+    mqtt_inflight_t* slot;
+
+    for (;;){
+        uint16_t packet_id = pipeline->next_id;
+
+        pipeline->next_id = packet_id == UINT16_MAX ? 1 : packet_id + 1;
+        slot = pipeline_slot(pipeline, packet_id);
+        if (slot->packet_id == 0){
+            slot->packet_id = packet_id;
+            return slot;
+        }
+    }
+}
+
+int mqtt_pipeline_publish(mqtt_pipeline_t* pipeline, const char* topic, const uint8_t* data, size_t length){
+    int64_t deadline = monotonic_msec() + MQTT_PIPELINE_ACK_TIMEOUT_MSEC;
+    MQTTString topic_name = MQTTString_initializer;
+    mqtt_inflight_t* slot;
+
+    while (pipeline->count == pipeline->window){
+        if (mqtt_pipeline_poll(pipeline, MQTT_PIPELINE_WAIT_MSEC) < 0 ||
+            (pipeline->count == pipeline->window && monotonic_msec() >= deadline)){
+            return -1;
+        }
+    }
+
+    slot = pipeline_claim(pipeline);
+    topic_name.cstring = (char*)topic;
+    slot->length = MQTTSerialize_publish(slot->packet, sizeof(slot->packet), 0, QOS1, 0, slot->packet_id,
+                                         topic_name, (unsigned char*)data, (int)length);
+    if (slot->length <= 0){
+        slot->packet_id = 0;
+        return -1;
+    }
+    slot->sequence = pipeline->sequence++;
+    slot->sent_usec = monotonic_usec();
+    if (pipeline_write(pipeline, slot->packet, slot->length) != 0){
+        // The caller journals what failed, resending it as well would
+        // publish it twice
+        slot->packet_id = 0;
+        return -1;
+    }
+    pipeline->count++;
+    pipeline->sent++;
+    if (pipeline->metrics != NULL){
+        metric_set(&pipeline->metrics->inflight, pipeline->count);
+    }
+    return 0;
+}
+
+int mqtt_pipeline_keepalive(mqtt_pipeline_t* pipeline){
+    uint8_t buffer[2];
+    int length;
+
+    if (pipeline->ping_usec != 0){
+        return monotonic_usec() - pipeline->ping_usec > MQTT_PIPELINE_ACK_TIMEOUT_MSEC * 1000LL ? -1 : 0;
+    }
+    length = MQTTSerialize_pingreq(buffer, sizeof(buffer));
+    if (length <= 0 || pipeline_write(pipeline, buffer, length) != 0){
+        return -1;
+    }
+    pipeline->ping_usec = monotonic_usec();
+    return 0;
+}
+
+static int compare_sequence(const void* a, const void* b){
+    uint64_t first = (*(mqtt_inflight_t* const*)a)->sequence;
+    uint64_t second = (*(mqtt_inflight_t* const*)b)->sequence;
+
+    return (first > second) - (first < second);
+}
+
+int mqtt_pipeline_resend(mqtt_pipeline_t* pipeline){
+    uint16_t count = 0;
+    uint16_t i;
+
+    // A PINGREQ of the previous connection will never be answered
+    pipeline->ping_usec = 0;
+    // Slots follow the packet IDs, which wrap around the window
+    for (i = 0; i < pipeline->window; i++){
+        if (pipeline->slots[i].packet_id != 0){
+            pipeline->resend_order[count++] = &pipeline->slots[i];
+        }
+    }
+    qsort(pipeline->resend_order, count, sizeof(mqtt_inflight_t*), compare_sequence);
+    for (i = 0; i < count; i++){
+        mqtt_inflight_t* slot = pipeline->resend_order[i];
+
+        slot->packet[0] |= MQTT_DUP_FLAG;
+        slot->sent_usec = monotonic_usec();
+        if (pipeline_write(pipeline, slot->packet, slot->length) != 0){
+            return -1;
+        }
+        pipeline->retransmitted++;
+        if (pipeline->metrics != NULL){
+            metric_add(&pipeline->metrics->retransmitted, 1);
+        }
+    }
+    return 0;
+}
+
+int mqtt_pipeline_in_flight(const mqtt_pipeline_t* pipeline, uint64_t first, uint64_t end){
+    uint16_t i;
+
+    for (i = 0; i < pipeline->window; i++){
+        const mqtt_inflight_t* slot = &pipeline->slots[i];
+
+        if (slot->packet_id != 0 && slot->sequence >= first && slot->sequence < end){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint16_t mqtt_pipeline_drain(mqtt_pipeline_t* pipeline, uint32_t timeout_msec){
+    int64_t deadline = monotonic_msec() + timeout_msec;
+
+    while (pipeline->count > 0 && monotonic_msec() < deadline){
+        if (mqtt_pipeline_poll(pipeline, MQTT_PIPELINE_WAIT_MSEC) < 0){
+            break;
+        }
+    }
+    return pipeline->count;
+}
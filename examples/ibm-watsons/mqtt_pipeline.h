@@ -0,0 +1,95 @@
+#ifndef MQTT_PIPELINE_H
+#define MQTT_PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "deviceclient.h"
+#include "latency.h"
+#include "metrics.h"
+#include "payload.h"
+
+// Default and largest number of QoS1 publishes awaiting their PUBACK
+#define MQTT_PIPELINE_WINDOW 32
+#define MQTT_PIPELINE_MAX_WINDOW 1024
+
+// Largest PUBLISH packet: fixed header, topic and packet ID, payload
+#define MQTT_PIPELINE_PACKET_SIZE (PAYLOAD_BUFFER_SIZE + 256)
+
+// How long a full window waits for a PUBACK, and a PINGREQ for its
+// PINGRESP, before the connection is taken for dead
+#define MQTT_PIPELINE_ACK_TIMEOUT_MSEC 5000
+
+// Socket timeout for the rest of a packet once its first byte is in
+#define MQTT_PIPELINE_READ_MSEC 1000
+
+// A QoS1 publish written to the broker and not acknowledged yet
+typedef struct {
+    // 0 while the slot is free
+    uint16_t packet_id;
+    // Order in which the publishes were first written
+    uint64_t sequence;
+    int64_t sent_usec;
+    int length;
+    uint8_t packet[MQTT_PIPELINE_PACKET_SIZE];
+} mqtt_inflight_t;
+
+// QoS1 publishing that does not wait for each PUBACK: up to window
+// publishes are in flight at once, so throughput is bound by bandwidth
+// rather than by the round trip to the broker. Packets are serialized
+// and written here, and PUBACKs read back from the same socket, so once
+// QoS1 is on the pipeline owns the connection and yield() must not be
+// called on it. Single threaded, owned by the publisher thread.
+typedef struct {
+    iotfclient* client;
+    uint16_t window;
+    uint16_t count;
+    uint16_t next_id;
+    mqtt_inflight_t* slots;
+    // Sequence of the next publish, and room to sort the slots by it
+    uint64_t sequence;
+    mqtt_inflight_t** resend_order;
+    // Keepalive: when the last PINGREQ went out, 0 once answered
+    int64_t ping_usec;
+    // Acknowledgement counters and latencies, NULL for none
+    metrics_t* metrics;
+    uint64_t sent;
+    uint64_t acked;
+    uint64_t retransmitted;
+    // From the write of a publish to its PUBACK
+    latency_histogram_t ack_latency;
+} mqtt_pipeline_t;
+
+// Returns 0 on success
+int mqtt_pipeline_init(mqtt_pipeline_t* pipeline, iotfclient* client, uint16_t window, metrics_t* metrics);
+
+void mqtt_pipeline_destroy(mqtt_pipeline_t* pipeline);
+
+// Writes a QoS1 publish of data to topic, first waiting for PUBACKs while
+// the window is full. Returns 0 once written, -1 when the connection is
+// lost. A publish written stays in flight until its PUBACK and goes out
+// again on reconnect, one that failed is left to the caller.
+int mqtt_pipeline_publish(mqtt_pipeline_t* pipeline, const char* topic, const uint8_t* data, size_t length);
+
+// Takes the PUBACKs already received, waiting up to timeout_msec for the
+// first one. Returns the number of publishes acknowledged, -1 when the
+// connection is lost.
+int mqtt_pipeline_poll(mqtt_pipeline_t* pipeline, int timeout_msec);
+
+// Sends a PINGREQ, unless one is unanswered. Returns -1 when the last one
+// is unanswered for MQTT_PIPELINE_ACK_TIMEOUT_MSEC or the write fails.
+int mqtt_pipeline_keepalive(mqtt_pipeline_t* pipeline);
+
+// Writes every publish still in flight again, with the DUP flag and in the
+// order they were first written, after the connection is reopened.
+// Returns 0 on success.
+int mqtt_pipeline_resend(mqtt_pipeline_t* pipeline);
+
+// Whether a publish written with a sequence from first to end - 1 still
+// awaits its PUBACK. pipeline->sequence is that of the next publish.
+int mqtt_pipeline_in_flight(const mqtt_pipeline_t* pipeline, uint64_t first, uint64_t end);
+
+// Waits up to timeout_msec for the publishes in flight to be acknowledged.
+// Returns how many are left.
+uint16_t mqtt_pipeline_drain(mqtt_pipeline_t* pipeline, uint32_t timeout_msec);
+
+#endif
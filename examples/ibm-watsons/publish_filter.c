@@ -0,0 +1,150 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "publish_filter.h"
+
+_Static_assert(SAMPLE_MAX_FIELDS <= 16, "sample_t.omitted overflow");
+
+// Defaults: labelled states only matter when they change, the compass
+// when it turns by more than a degree (hundredths of a degree on the wire)
+static const char* const default_policies[] = {
+    "led=change",
+    "batt_stat=change",
+    "carry=change",
+    "activity=change",
+    "compass=abs:100",
+};
+
+void publish_filter_defaults(publish_filter_t* filter){
+    size_t i;
+
+    memset(filter->policies, 0, sizeof(filter->policies));
+    for (i = 0; i < sizeof(default_policies) / sizeof(default_policies[0]); i++){
+        publish_filter_parse(filter, default_policies[i]);
+    }
+}
+
+static int parse_policy(const char* text, field_policy_t* policy){
+    char* end;
+
+    policy->threshold = 0;
+    policy->heartbeat_msec = PUBLISH_HEARTBEAT_MSEC;
+    if (strncmp(text, "always", 6) == 0){
+        policy->mode = FILTER_ALWAYS;
+        end = (char*)text + 6;
+    }else if (strncmp(text, "change", 6) == 0){
+        policy->mode = FILTER_ON_CHANGE;
+        end = (char*)text + 6;
+    }else if (strncmp(text, "abs:", 4) == 0 || strncmp(text, "rel:", 4) == 0){
+        policy->mode = text[0] == 'a' ? FILTER_DEADBAND_ABS : FILTER_DEADBAND_REL;
+        policy->threshold = strtod(text + 4, &end);
+        if (end == text + 4 || policy->threshold < 0){
+            return -1;
+        }
+    }else{
+        return -1;
+    }
+    if (*end == '/'){
+        policy->heartbeat_msec = (uint32_t)strtoul(end + 1, &end, 10);
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+int publish_filter_parse(publish_filter_t* filter, const char* arg){
+    const char* equal = strchr(arg, '=');
+    field_policy_t policy;
+    size_t length;
+    int found = 0;
+    int c;
+    int f;
+
+    if (equal == NULL || parse_policy(equal + 1, &policy) != 0){
+        return -1;
+    }
+    length = (size_t)(equal - arg);
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        for (f = 0; f < characteristics[c].field_count; f++){
+            const char* name = characteristics[c].fields[f].name;
+
+            if ((length == 3 && strncmp(arg, "all", 3) == 0) ||
+                (strlen(name) == length && strncmp(name, arg, length) == 0)){
+                filter->policies[c][f] = policy;
+                found = 1;
+            }
+        }
+    }
+    return found ? 0 : -1;
+}
+
+bool publish_filter_active(const publish_filter_t* filter){
+    int c;
+    int f;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        for (f = 0; f < SAMPLE_MAX_FIELDS; f++){
+            if (filter->policies[c][f].mode != FILTER_ALWAYS){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int publish_filter_init(publish_filter_t* filter, uint8_t devices_count){
+    filter->devices_count = devices_count;
+    filter->states = calloc((size_t)devices_count * CHARACTERISTICS_COUNT * SAMPLE_STATISTICS_COUNT * SAMPLE_MAX_FIELDS,
+                            sizeof(field_state_t));
+    return filter->states == NULL ? -1 : 0;
+}
+
+void publish_filter_destroy(publish_filter_t* filter){
+    free(filter->states);
+    filter->states = NULL;
+}
+
+static bool policy_holds_back(const field_policy_t* policy, const field_state_t* state, int32_t value,
+                              int64_t now_msec){
+    double difference;
+
+    if (state->published_msec == 0 || now_msec - state->published_msec >= policy->heartbeat_msec){
+        return false;
+    }
+    difference = fabs((double)value - state->value);
+    switch (policy->mode){
+    case FILTER_ON_CHANGE:
+        return difference == 0;
+    case FILTER_DEADBAND_ABS:
+        return difference <= policy->threshold;
+    case FILTER_DEADBAND_REL:
+        return difference * 100 <= policy->threshold * fabs((double)state->value);
+    default:
+        return false;
+    }
+}
+
+bool publish_filter_apply(publish_filter_t* filter, sample_t* sample, int64_t now_msec){
+    const field_policy_t* policies = filter->policies[sample->characteristic];
+    field_state_t* states;
+    bool any = false;
+    uint8_t f;
+
+    sample->omitted = 0;
+    if (sample->device >= filter->devices_count){
+        return true;
+    }
+    states = &filter->states[((sample->device * CHARACTERISTICS_COUNT + sample->characteristic) *
+                              SAMPLE_STATISTICS_COUNT + sample->statistic) * SAMPLE_MAX_FIELDS];
+    for (f = 0; f < sample->count; f++){
+        if (!sample_field_present(sample, f)){
+            continue;
+        }
+        if (policies[f].mode != FILTER_ALWAYS && policy_holds_back(&policies[f], &states[f], sample->values[f], now_msec)){
+            sample->omitted |= (uint16_t)(1u << f);
+            continue;
+        }
+        states[f].value = sample->values[f];
+        states[f].published_msec = now_msec;
+        any = true;
+    }
+    return any;
+}
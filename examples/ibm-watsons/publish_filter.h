@@ -0,0 +1,67 @@
+#ifndef PUBLISH_FILTER_H
+#define PUBLISH_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "characteristics.h"
+
+// Longest time a filtered field goes unpublished, unless its policy sets one
+#define PUBLISH_HEARTBEAT_MSEC 60000
+
+typedef enum {
+    // Every value is published
+    FILTER_ALWAYS,
+    // Only values differing from the last published one
+    FILTER_ON_CHANGE,
+    // Only values more than threshold away from the last published one
+    FILTER_DEADBAND_ABS,
+    // Only values more than threshold percent away from the last published one
+    FILTER_DEADBAND_REL,
+} filter_mode_t;
+
+typedef struct {
+    filter_mode_t mode;
+    double threshold;
+    // A value is published anyway once this long after the last one
+    uint32_t heartbeat_msec;
+} field_policy_t;
+
+// Last value published of one field, published_msec is 0 before the first
+typedef struct {
+    int32_t value;
+    int64_t published_msec;
+} field_state_t;
+
+// Per field publish policies, applied by the publisher thread to the
+// samples of every board before they are serialized
+typedef struct {
+    field_policy_t policies[CHARACTERISTICS_COUNT][SAMPLE_MAX_FIELDS];
+    uint8_t devices_count;
+    // states[((device * CHARACTERISTICS_COUNT + characteristic) * SAMPLE_STATISTICS_COUNT + statistic)
+    //        * SAMPLE_MAX_FIELDS + field]
+    field_state_t* states;
+} publish_filter_t;
+
+// Leaves the rarely changing states and the compass to on-change and
+// deadband policies, every other field to FILTER_ALWAYS
+void publish_filter_defaults(publish_filter_t* filter);
+
+// Parses FIELD=POLICY[/HEARTBEAT_MSEC], POLICY being always, change,
+// abs:THRESHOLD or rel:PERCENT. FIELD "all" sets every field. Returns 0 on
+// success.
+int publish_filter_parse(publish_filter_t* filter, const char* arg);
+
+// Whether any field is filtered at all
+bool publish_filter_active(const publish_filter_t* filter);
+
+// Returns 0 on success
+int publish_filter_init(publish_filter_t* filter, uint8_t devices_count);
+
+void publish_filter_destroy(publish_filter_t* filter);
+
+// Sets in sample->omitted the fields its policy holds back, and records
+// the others as published at now_msec. Returns false when every field of
+// the sample is held back.
+bool publish_filter_apply(publish_filter_t* filter, sample_t* sample, int64_t now_msec);
+
+#endif
@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <string.h>
+#include "characteristics.h"
+#include "monotonic.h"
+#include "publisher.h"
+
+// Name of a field in JSON events. Summaries suffix the statistic to
+// measurements and carry states and counters once, in their mean sample.
+// Returns NULL for a field the sample does not carry or its publish
+// policy left out.
+static const char* json_field_name(const sample_t* sample, uint8_t f, char* buffer, size_t size){
+    const field_desc_t* field = &characteristics[sample->characteristic].fields[f];
+
+    if (sample->omitted & (1u << f)){
+        return NULL;
+    }
+    if (sample->statistic == SAMPLE_RAW){
+        return field->name;
+    }
+    if (field->aggregate != AGGREGATE_STATS){
+        return sample->statistic == SAMPLE_MEAN ? field->name : NULL;
+    }
+    snprintf(buffer, size, "%s_%s", field->name, statistic_name(sample->statistic));
+    return buffer;
+}
+
+// Renders samples as JSON documents, starting a new document whenever a
+// characteristic, or statistic of a summary, repeats or the current
+// document is full. On failure *published tells how many samples went out
+// in the documents written before, a sample split across the failed
+// document and the previous one counting as not published.
+static int publish_json(iot_message_t* message, const sample_t* samples, uint32_t count, const char* event_type,
+                        uint32_t* published){
+    uint64_t in_document = 0;
+    char buffer[IOT_FIELD_NAME_SIZE];
+    uint32_t i;
+    uint8_t f;
+
+    *published = 0;
+    for (i = 0; i < count; i++){
+        uint64_t bit = 1ull << (samples[i].characteristic * SAMPLE_STATISTICS_COUNT + samples[i].statistic);
+
+        if (in_document & bit){
+            if (iot_message_publish(message, event_type) != 0){
+                return -1;
+            }
+            *published = i;
+            in_document = 0;
+        }
+        for (f = 0; f < samples[i].count; f++){
+            const char* name = json_field_name(&samples[i], f, buffer, sizeof(buffer));
+
+            if (name == NULL){
+                continue;
+            }
+            if (iot_message_add(message, name, samples[i].values[f]) != 0){
+                if (iot_message_publish(message, event_type) != 0){
+                    return -1;
+                }
+                *published = i;
+                in_document = 0;
+                iot_message_add(message, name, samples[i].values[f]);
+            }
+            iot_message_time(message, samples[i].time_usec);
+        }
+        in_document |= bit;
+    }
+    if (iot_message_publish(message, event_type) != 0){
+        return -1;
+    }
+    *published = count;
+    return 0;
+}
+
+static int publish_binary(publisher_t* publisher, const char* device_id, const sample_t* samples,
+                          uint32_t count, const char* event_type){
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    int length = payload_encode(device_id, samples, count, publisher->config.format == PAYLOAD_BINARY_ZLIB,
+                                out, sizeof(out));
+
+    if (length < 0){
+        return -1;
+    }
+    if (iot_publish_raw(publisher->client, publisher->pipeline, event_type, PAYLOAD_BINARY_FORMAT,
+                        out, (size_t)length, QOS0) != 0){
+        printf("Error while publishing the batch of %u samples\n", count);
+        return -1;
+    }
+    publisher->published_bytes += (uint64_t)length;
+    return 0;
+}
+
+// Publishes samples under event_type. Returns 0 on success, -1 with the
+// number of the first samples that still went out in *published.
+static int publish_samples(publisher_t* publisher, const char* device_id, iot_message_t* message,
+                           const sample_t* samples, uint32_t count, const char* event_type, uint32_t* published){
+    if (publisher->config.format == PAYLOAD_JSON){
+        return publish_json(message, samples, count, event_type, published);
+    }
+    *published = 0;
+    if (publish_binary(publisher, device_id, samples, count, event_type) != 0){
+        return -1;
+    }
+    *published = count;
+    return 0;
+}
+
+static void publisher_set_link(publisher_t* publisher, link_state_t state, int64_t now){
+    if (link_enter(&publisher->link, state, now) && publisher->config.metrics != NULL){
+        metric_link_enter(metrics_broker_link(publisher->config.metrics), state);
+    }
+}
+
+// Waits a jittered, exponentially growing delay before the next attempt
+static void publisher_backoff(publisher_t* publisher, int64_t now){
+    uint32_t delay = link_backoff_msec(&publisher->link);
+
+    publisher_set_link(publisher, LINK_BACKOFF, now);
+    publisher->reconnect_msec = now + delay;
+}
+
+static void publisher_link_down(publisher_t* publisher){
+    int64_t now = monotonic_msec();
+
+    printf("Lost the connection to the broker, %s\n",
+           publisher->config.journal ? "journaling samples" : "dropping samples");
+    publisher_set_link(publisher, LINK_DOWN, now);
+    disconnect(publisher->client);
+    publisher_backoff(publisher, now);
+}
+
+// Sends an MQTT keepalive. With QoS1 the pipeline reads the socket, so
+// yield() would swallow its PUBACKs.
+static int publisher_keepalive(publisher_t* publisher){
+    if (!isConnected(publisher->client)){
+        return -1;
+    }
+    if (publisher->pipeline != NULL){
+        return mqtt_pipeline_keepalive(publisher->pipeline);
+    }
+    return yield(publisher->client, 1) == SUCCESS ? 0 : -1;
+}
+
+// Keeps the MQTT session alive while the link is up, noticing a dead
+// connection even when there is nothing to publish, and reconnects once
+// the backoff delay is over
+static void publisher_check_link(publisher_t* publisher){
+    int64_t now = monotonic_msec();
+
+    if (publisher->link.state == LINK_UP){
+        if (publisher->pipeline != NULL && mqtt_pipeline_poll(publisher->pipeline, 0) < 0){
+            publisher_link_down(publisher);
+            return;
+        }
+        if (now < publisher->keepalive_msec){
+            return;
+        }
+        publisher->keepalive_msec = now + PUBLISHER_KEEPALIVE_MSEC;
+        if (publisher_keepalive(publisher) != 0){
+            publisher_link_down(publisher);
+        }
+        return;
+    }
+    if (now < publisher->reconnect_msec){
+        return;
+    }
+    publisher_set_link(publisher, LINK_CONNECTING, now);
+    if (connectiotf(publisher->client) == SUCCESS){
+        now = monotonic_msec();
+        printf("Reconnected to the broker\n");
+        publisher_set_link(publisher, LINK_UP, now);
+        publisher->keepalive_msec = now + PUBLISHER_KEEPALIVE_MSEC;
+        publisher->replay_refill_msec = now;
+        // Publishes left unacknowledged by the lost connection go first
+        if (publisher->pipeline != NULL && mqtt_pipeline_resend(publisher->pipeline) != 0){
+            publisher_link_down(publisher);
+        }
+    }else{
+        publisher_backoff(publisher, monotonic_msec());
+    }
+}
+
+// Updates the metrics of samples of one device, published or not. The
+// time from the board to the publish is only taken for raw samples, a
+// summary would add its window.
+static void publisher_count(publisher_t* publisher, const sample_t* samples, uint32_t count, uint8_t device,
+                            int published, int64_t now){
+    metrics_t* metrics = publisher->config.metrics;
+    int64_t realtime = published ? now + realtime_offset_usec() : 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++){
+        const sample_t* sample = &samples[i];
+
+        if (published && sample->statistic == SAMPLE_RAW && sample->time_usec != 0){
+            latency_record(&publisher->sensor_latency, realtime - sample->time_usec);
+            if (metrics != NULL){
+                metric_observe(&metrics_channel(metrics, device, sample->characteristic)->sensor_to_publish,
+                               realtime - sample->time_usec);
+            }
+        }
+    }
+    if (metrics == NULL){
+        return;
+    }
+    for (i = 0; i < count; i++){
+        metric_channel_t* channel = metrics_channel(metrics, device, samples[i].characteristic);
+        if (published){
+            metric_add(&channel->published, 1);
+            metric_observe(&channel->decode_to_publish, now - samples[i].decoded_usec);
+        }else{
+            metric_add(&channel->failed, 1);
+        }
+    }
+}
+
+// Publishes a batch of one device under event_type, recording the
+// latency of its samples in latency. Returns 0 once published, -1 when
+// the batch was journaled or dropped instead.
+static int publisher_publish_batch(publisher_t* publisher, uint8_t device, payload_batch_t* batch,
+                                   const char* event_type, latency_histogram_t* latency){
+    metrics_t* metrics = publisher->config.metrics;
+    uint32_t published = 0;
+    int64_t start;
+    int64_t now;
+    uint32_t i;
+    int rc;
+
+    if (batch->count == 0){
+        return 0;
+    }
+    if (publisher->link.state == LINK_UP){
+        start = monotonic_usec();
+        rc = publish_samples(publisher, publisher->device_ids[device], &publisher->messages[device],
+                             batch->samples, batch->count, event_type, &published);
+        now = monotonic_usec();
+        if (metrics != NULL){
+            metric_observe(&metrics->publish_duration, now - start);
+            metric_add(rc == 0 ? &metrics->publishes : &metrics->publish_failures, 1);
+        }
+        for (i = 0; i < published; i++){
+            latency_record(latency, now - batch->samples[i].received_usec);
+        }
+        publisher_count(publisher, batch->samples, published, device, 1, now);
+        publisher->published += published;
+        if (rc == 0){
+            batch->count = 0;
+            return 0;
+        }
+    }
+    publisher_count(publisher, batch->samples + published, batch->count - published, device, 0, 0);
+
+    if (publisher->link.state == LINK_UP){
+        publisher_link_down(publisher);
+    }
+    // Only what did not go out is journaled. At QoS1 the rest is in flight
+    // and goes out again on reconnect, journaling it too would publish it
+    // twice.
+    if (publisher->config.journal != NULL){
+        for (i = published; i < batch->count; i++){
+            journal_append(publisher->config.journal, publisher->device_ids[device], &batch->samples[i]);
+        }
+        publisher->journaled += batch->count - published;
+    }else{
+        publisher->failed += batch->count - published;
+    }
+    batch->count = 0;
+    return -1;
+}
+
+static void publisher_flush_batch(publisher_t* publisher, uint8_t device){
+    publisher_publish_batch(publisher, device, &publisher->batches[device], "status", &publisher->latency);
+}
+
+// Publishes a discrete event at once as an "alert" event, ahead of the
+// pending batches: no publish policy applies and no window delays it
+static void publisher_alert(publisher_t* publisher, const sample_buffer_t* buffer){
+    payload_batch_t* alert = &publisher->alert;
+    metrics_t* metrics = publisher->config.metrics;
+    uint8_t device = buffer->samples[0].device;
+    int64_t now;
+    uint32_t i;
+
+    if (device >= publisher->devices_count){
+        return;
+    }
+    memcpy(alert->samples, buffer->samples, buffer->count * sizeof(sample_t));
+    alert->count = buffer->count;
+    if (publisher_publish_batch(publisher, device, alert, "alert", &publisher->alert_latency) != 0){
+        return;
+    }
+    now = monotonic_usec();
+    for (i = 0; i < buffer->count; i++){
+        int64_t latency = now - buffer->samples[i].received_usec;
+
+        if (metrics != NULL){
+            metric_observe(&metrics->alert_latency, latency);
+        }
+        if (latency > PUBLISHER_ALERT_TARGET_USEC){
+            publisher->alerts_late++;
+            if (metrics != NULL){
+                metric_add(&metrics->alerts_late, 1);
+            }
+        }
+    }
+}
+
+// Drops the journal records before journal sequence until, replayed.
+// Those the journal overwrote meanwhile are gone already.
+static void publisher_replay_done(publisher_t* publisher, uint64_t until){
+    journal_t* journal = publisher->config.journal;
+    uint64_t read_seq = journal->header->read_seq;
+
+    if (until > read_seq){
+        journal_consume(journal, (uint32_t)(until - read_seq));
+        publisher->replayed += until - read_seq;
+    }
+}
+
+// Takes the journal records before journal sequence until for replayed:
+// right away at QoS0, once the publishes written since replay_first are
+// acknowledged at QoS1, so an outage never loses them
+static void publisher_replay_sent(publisher_t* publisher, uint64_t until){
+    if (publisher->pipeline == NULL){
+        publisher_replay_done(publisher, until);
+        return;
+    }
+    publisher->replay_waiting = 1;
+    publisher->replay_until = until;
+    publisher->replay_end = publisher->pipeline->sequence;
+}
+
+// Republishes journaled samples under the "replay" event type, at most
+// replay_per_sec of them per second so live traffic keeps flowing. At
+// QoS1 nothing more is replayed until the last samples replayed are
+// acknowledged.
+static void publisher_replay(publisher_t* publisher){
+    journal_t* journal = publisher->config.journal;
+    journal_record_t records[PAYLOAD_MAX_SAMPLES];
+    sample_t samples[PAYLOAD_MAX_SAMPLES];
+    int64_t now = monotonic_msec();
+    uint32_t published;
+    uint64_t refill;
+    uint32_t count;
+    uint32_t first;
+    uint32_t i;
+
+    if (journal == NULL || publisher->link.state != LINK_UP || journal_pending(journal) == 0){
+        return;
+    }
+    if (publisher->replay_waiting){
+        if (mqtt_pipeline_in_flight(publisher->pipeline, publisher->replay_first, publisher->replay_end)){
+            return;
+        }
+        publisher->replay_waiting = 0;
+        publisher_replay_done(publisher, publisher->replay_until);
+    }
+
+    refill = (uint64_t)(now - publisher->replay_refill_msec) * publisher->config.replay_per_sec / 1000;
+    if (refill > 0){
+        publisher->replay_tokens += (uint32_t)refill;
+        if (publisher->replay_tokens > publisher->config.replay_per_sec){
+            publisher->replay_tokens = publisher->config.replay_per_sec;
+        }
+        publisher->replay_refill_msec = now;
+    }
+
+    count = journal_peek(journal, records, publisher->replay_tokens < PAYLOAD_MAX_SAMPLES ?
+                                           publisher->replay_tokens : PAYLOAD_MAX_SAMPLES);
+    if (count == 0){
+        return;
+    }
+    if (publisher->pipeline != NULL){
+        publisher->replay_first = publisher->pipeline->sequence;
+    }
+    for (first = 0; first < count; first = i){
+        uint32_t n = 0;
+
+        for (i = first; i < count && strcmp(records[i].device_id, records[first].device_id) == 0; i++){
+            samples[n++] = records[i].sample;
+        }
+        iot_message_init(&publisher->replay_message, publisher->client, publisher->pipeline,
+                         records[first].device_id);
+        if (publish_samples(publisher, records[first].device_id, &publisher->replay_message,
+                            samples, n, "replay", &published) != 0){
+            // What did not go out stays in the journal for the next replay
+            publisher->replay_tokens -= first + published;
+            publisher_replay_sent(publisher, records[first].seq + published);
+            publisher_link_down(publisher);
+            return;
+        }
+    }
+    publisher->replay_tokens -= count;
+    publisher_replay_sent(publisher, records[count - 1].seq + 1);
+}
+
+// Batches a sample, unless its publish policy leaves out all of its fields
+static void publisher_add(publisher_t* publisher, const sample_t* sample){
+    payload_batch_t* batch = &publisher->batches[sample->device];
+    sample_t* slot = &batch->samples[batch->count];
+    int64_t now = monotonic_msec();
+
+    *slot = *sample;
+    if (publisher->config.filter == NULL || publish_filter_apply(publisher->config.filter, slot, now)){
+        if (batch->count == 0){
+            batch->opened_msec = now;
+        }
+        batch->count++;
+    }else if (publisher->config.metrics != NULL){
+        metric_add(&metrics_channel(publisher->config.metrics, sample->device, sample->characteristic)->filtered, 1);
+    }
+    // Without a coalescing window a summary still goes out as one event
+    if (batch->count == PAYLOAD_MAX_SAMPLES ||
+        (publisher->config.window_msec == 0 && (sample->statistic == SAMPLE_RAW || sample->statistic == SAMPLE_RMS))){
+        publisher_flush_batch(publisher, sample->device);
+    }
+}
+
+// Takes one buffer at a time, so a discrete event pushed while a batch is
+// being published overtakes the telemetry still queued
+static uint32_t publisher_drain(publisher_t* publisher){
+    sample_buffer_t* buffer;
+    uint32_t total = 0;
+    uint32_t i;
+
+    while (sink_pop(publisher->sink, &buffer, 1) > 0){
+        if (buffer->urgent){
+            publisher_alert(publisher, buffer);
+        }else{
+            for (i = 0; i < buffer->count; i++){
+                if (buffer->samples[i].device < publisher->devices_count){
+                    publisher_add(publisher, &buffer->samples[i]);
+                }
+            }
+        }
+        sink_done(publisher->sink, buffer);
+        total++;
+    }
+    return total;
+}
+
+// Publishes the windows that are over, or every pending batch when force is set
+static void publisher_flush(publisher_t* publisher, int force){
+    int64_t now = monotonic_msec();
+    uint8_t i;
+
+    for (i = 0; i < publisher->devices_count; i++){
+        if (force || now - publisher->batches[i].opened_msec >= publisher->config.window_msec){
+            publisher_flush_batch(publisher, i);
+        }
+    }
+}
+
+static void* publisher_run(void* arg){
+    publisher_t* publisher = arg;
+    uint32_t idle_msec = PUBLISHER_IDLE_MSEC;
+
+    if (publisher->config.window_msec > 0 && publisher->config.window_msec < idle_msec){
+        idle_msec = publisher->config.window_msec;
+    }
+
+    while (atomic_load(&publisher->running)){
+        uint32_t wait_msec = idle_msec;
+
+        publisher_check_link(publisher);
+        if (publisher->link.state == LINK_UP && publisher->config.journal != NULL &&
+            journal_pending(publisher->config.journal) > 0 && wait_msec > PUBLISHER_REPLAY_TICK_MSEC){
+            wait_msec = PUBLISHER_REPLAY_TICK_MSEC;
+        }
+        if (publisher_drain(publisher) == 0){
+            sink_wait(publisher->sink, wait_msec);
+        }
+        if (publisher->config.window_msec > 0){
+            publisher_flush(publisher, 0);
+        }
+        publisher_replay(publisher);
+    }
+
+    publisher_drain(publisher);
+    publisher_flush(publisher, 1);
+    if (publisher->pipeline != NULL && publisher->link.state == LINK_UP){
+        mqtt_pipeline_drain(publisher->pipeline, PUBLISHER_DRAIN_MSEC);
+        // Replayed samples still unacknowledged are replayed by the next run
+        if (publisher->replay_waiting &&
+            !mqtt_pipeline_in_flight(publisher->pipeline, publisher->replay_first, publisher->replay_end)){
+            publisher_replay_done(publisher, publisher->replay_until);
+        }
+    }
+    return NULL;
+}
+
+int publisher_start(publisher_t* publisher, sink_t* sink, iotfclient* client,
+                    const publisher_config_t* config, const char* const* device_ids, uint8_t devices_count){
+    uint8_t i;
+
+    if (devices_count > PUBLISHER_MAX_DEVICES){
+        return -1;
+    }
+    publisher->sink = sink;
+    publisher->client = client;
+    publisher->config = *config;
+    publisher->pipeline = NULL;
+    if (config->inflight_window > 0){
+        if (mqtt_pipeline_init(&publisher->qos1, client, config->inflight_window, config->metrics) != 0){
+            return -1;
+        }
+        publisher->pipeline = &publisher->qos1;
+    }
+    link_init(&publisher->link, "broker", (uint32_t)monotonic_usec());
+    publisher_set_link(publisher, LINK_UP, monotonic_msec());
+    publisher->reconnect_msec = 0;
+    publisher->keepalive_msec = monotonic_msec() + PUBLISHER_KEEPALIVE_MSEC;
+    publisher->replay_tokens = 0;
+    publisher->replay_waiting = 0;
+    publisher->replay_refill_msec = monotonic_msec();
+    publisher->published = 0;
+    publisher->failed = 0;
+    publisher->published_bytes = 0;
+    publisher->journaled = 0;
+    publisher->replayed = 0;
+    memset(&publisher->latency, 0, sizeof(publisher->latency));
+    memset(&publisher->alert_latency, 0, sizeof(publisher->alert_latency));
+    memset(&publisher->sensor_latency, 0, sizeof(publisher->sensor_latency));
+    publisher->alerts_late = 0;
+    publisher->alert.count = 0;
+    publisher->devices_count = devices_count;
+    for (i = 0; i < devices_count; i++){
+        publisher->device_ids[i] = device_ids[i];
+        publisher->batches[i].count = 0;
+        iot_message_init(&publisher->messages[i], client, publisher->pipeline, device_ids[i]);
+    }
+    atomic_init(&publisher->running, 1);
+
+    if (pthread_create(&publisher->thread, NULL, publisher_run, publisher) != 0){
+        if (publisher->pipeline != NULL){
+            mqtt_pipeline_destroy(publisher->pipeline);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+void publisher_stop(publisher_t* publisher){
+    atomic_store(&publisher->running, 0);
+    sink_wake(publisher->sink);
+    pthread_join(publisher->thread, NULL);
+
+    printf("Published %llu samples, %llu failed, %llu dropped by the full queue of %llu queued samples\n",
+           (unsigned long long)publisher->published, (unsigned long long)publisher->failed,
+           (unsigned long long)atomic_load(&publisher->sink->metrics->dropped),
+           (unsigned long long)(atomic_load(&publisher->sink->metrics->written) +
+                                atomic_load(&publisher->sink->metrics->dropped)));
+    latency_print("Notification to publish latency", &publisher->latency);
+    latency_print("Board to publish latency", &publisher->sensor_latency);
+    if (publisher->alert_latency.count > 0){
+        latency_print("Event to alert latency", &publisher->alert_latency);
+        printf("%llu alerts missed the %d ms target\n", (unsigned long long)publisher->alerts_late,
+               PUBLISHER_ALERT_TARGET_USEC / 1000);
+    }
+    if (publisher->config.format != PAYLOAD_JSON){
+        printf("Binary events carried %llu bytes\n", (unsigned long long)publisher->published_bytes);
+    }
+    if (publisher->config.journal != NULL){
+        printf("Journaled %llu samples, replayed %llu, %llu still pending, %llu overwritten, %llu corrupt\n",
+               (unsigned long long)publisher->journaled, (unsigned long long)publisher->replayed,
+               (unsigned long long)journal_pending(publisher->config.journal),
+               (unsigned long long)publisher->config.journal->overwritten,
+               (unsigned long long)publisher->config.journal->corrupt);
+    }
+    if (publisher->pipeline != NULL){
+        printf("QoS1: %llu publishes acknowledged, %llu written again, %u unacknowledged\n",
+               (unsigned long long)publisher->pipeline->acked, (unsigned long long)publisher->pipeline->retransmitted,
+               publisher->pipeline->count);
+        latency_print("Publish to PUBACK latency", &publisher->pipeline->ack_latency);
+        mqtt_pipeline_destroy(publisher->pipeline);
+    }
+}
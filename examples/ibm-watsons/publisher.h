@@ -0,0 +1,114 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "iot_message.h"
+#include "journal.h"
+#include "latency.h"
+#include "link_state.h"
+#include "metrics.h"
+#include "mqtt_pipeline.h"
+#include "payload.h"
+#include "publish_filter.h"
+#include "sink.h"
+
+// Longest sleep of an idle publisher, bounds shutdown latency
+#define PUBLISHER_IDLE_MSEC 100
+
+// Most devices a publisher builds events for
+#define PUBLISHER_MAX_DEVICES 64
+
+// Period of the MQTT keepalive and of the broker connection check while
+// the link is up. Reconnection delays follow link_backoff_msec().
+#define PUBLISHER_KEEPALIVE_MSEC 1000
+
+// Sleep between two replay steps while the journal holds samples
+#define PUBLISHER_REPLAY_TICK_MSEC 20
+
+// How long a stopping publisher waits for its QoS1 publishes in flight
+#define PUBLISHER_DRAIN_MSEC 2000
+
+// Latency target of discrete events, from notification arrival to the end
+// of their publish. Alerts later than that are counted as late.
+#define PUBLISHER_ALERT_TARGET_USEC 50000
+
+typedef struct {
+    payload_format_t format;
+    // How long samples of a board are collected into one event, 0 for none
+    uint32_t window_msec;
+    // Store-and-forward journal, NULL to drop samples while the broker is
+    // unreachable
+    journal_t* journal;
+    // Journaled samples republished per second once the broker is back
+    uint32_t replay_per_sec;
+    // Publish counters and latencies, NULL for none
+    metrics_t* metrics;
+    // Per field publish policies, NULL to publish every field
+    publish_filter_t* filter;
+    // QoS1 publishes in flight at once, 0 for blocking QoS0 publishes
+    uint16_t inflight_window;
+} publisher_config_t;
+
+// Samples of one device waiting to be published as one event
+typedef struct {
+    sample_t samples[PAYLOAD_MAX_SAMPLES];
+    uint32_t count;
+    int64_t opened_msec;
+} payload_batch_t;
+
+// MQTT sink: a thread draining its queue into IoT events, so a slow broker
+// never blocks BLE event dispatch nor the other sinks
+typedef struct {
+    sink_t* sink;
+    iotfclient* client;
+    publisher_config_t config;
+    // One batch and event builder per device, so events never mix boards
+    payload_batch_t batches[PUBLISHER_MAX_DEVICES];
+    // Discrete event being published at once, ahead of the batches
+    payload_batch_t alert;
+    iot_message_t messages[PUBLISHER_MAX_DEVICES];
+    iot_message_t replay_message;
+    const char* device_ids[PUBLISHER_MAX_DEVICES];
+    uint8_t devices_count;
+    pthread_t thread;
+    atomic_int running;
+    // QoS1 pipeline, NULL at QoS0
+    mqtt_pipeline_t* pipeline;
+    mqtt_pipeline_t qos1;
+    // Broker connection, reconnected with a jittered exponential backoff
+    link_t link;
+    int64_t reconnect_msec;
+    int64_t keepalive_msec;
+    uint32_t replay_tokens;
+    int64_t replay_refill_msec;
+    // At QoS1, replayed journal records before journal sequence
+    // replay_until are only consumed once the pipeline publishes of
+    // sequences replay_first to replay_end - 1 all got their PUBACK
+    uint8_t replay_waiting;
+    uint64_t replay_until;
+    uint64_t replay_first;
+    uint64_t replay_end;
+    uint64_t published;
+    uint64_t failed;
+    uint64_t published_bytes;
+    uint64_t journaled;
+    uint64_t replayed;
+    // From notification arrival to the end of the publish of live samples
+    latency_histogram_t latency;
+    // From the board time of live raw samples to the end of their publish
+    latency_histogram_t sensor_latency;
+    // The same for discrete events, and how many missed their target
+    latency_histogram_t alert_latency;
+    uint64_t alerts_late;
+} publisher_t;
+
+// device_ids[i] tags the events of the samples whose device is i
+int publisher_start(publisher_t* publisher, sink_t* sink, iotfclient* client,
+                    const publisher_config_t* config, const char* const* device_ids, uint8_t devices_count);
+
+// Publishes what is still queued and joins the thread
+void publisher_stop(publisher_t* publisher);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include "sample_buffer.h"
+
+int buffer_ring_init(buffer_ring_t* ring, uint32_t capacity){
+    uint32_t size = 1;
+    uint32_t i;
+
+    while (size < capacity){
+        size <<= 1;
+    }
+    ring->slots = calloc(size, sizeof(buffer_slot_t));
+    if (ring->slots == NULL){
+        return -1;
+    }
+    ring->mask = size - 1;
+    for (i = 0; i < size; i++){
+        atomic_init(&ring->slots[i].sequence, i);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    return 0;
+}
+
+void buffer_ring_destroy(buffer_ring_t* ring){
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+bool buffer_ring_push(buffer_ring_t* ring, sample_buffer_t* buffer){
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    buffer_slot_t* slot;
+
+    for (;;){
+        int32_t lap;
+
+        slot = &ring->slots[tail & ring->mask];
+        lap = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - tail);
+        if (lap == 0){
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &tail, tail + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }else if (lap < 0){
+            return false;
+        }else{
+            tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    slot->buffer = buffer;
+    atomic_store_explicit(&slot->sequence, tail + 1, memory_order_release);
+    return true;
+}
+
+sample_buffer_t* buffer_ring_pop(buffer_ring_t* ring){
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    sample_buffer_t* buffer;
+    buffer_slot_t* slot;
+
+    for (;;){
+        int32_t lap;
+
+        slot = &ring->slots[head & ring->mask];
+        lap = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - (head + 1));
+        if (lap == 0){
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &head, head + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }else if (lap < 0){
+            return NULL;
+        }else{
+            head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+    buffer = slot->buffer;
+    atomic_store_explicit(&slot->sequence, head + ring->mask + 1, memory_order_release);
+    return buffer;
+}
+
+int sample_pool_init(sample_pool_t* pool, uint32_t count){
+    uint32_t i;
+
+    pool->buffers = calloc(count, sizeof(sample_buffer_t));
+    if (pool->buffers == NULL){
+        return -1;
+    }
+    if (buffer_ring_init(&pool->free, count) != 0){
+        free(pool->buffers);
+        pool->buffers = NULL;
+        return -1;
+    }
+    for (i = 0; i < count; i++){
+        pool->buffers[i].pool = pool;
+        buffer_ring_push(&pool->free, &pool->buffers[i]);
+    }
+    atomic_init(&pool->exhausted, 0);
+    return 0;
+}
+
+void sample_pool_destroy(sample_pool_t* pool){
+    buffer_ring_destroy(&pool->free);
+    free(pool->buffers);
+    pool->buffers = NULL;
+}
+
+sample_buffer_t* sample_pool_take(sample_pool_t* pool, uint32_t refs){
+    sample_buffer_t* buffer = buffer_ring_pop(&pool->free);
+
+    if (buffer == NULL){
+        atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+        return NULL;
+    }
+    atomic_store_explicit(&buffer->refs, refs, memory_order_relaxed);
+    return buffer;
+}
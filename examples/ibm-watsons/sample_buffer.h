@@ -0,0 +1,74 @@
+#ifndef SAMPLE_BUFFER_H
+#define SAMPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "aggregate.h"
+#include "sample_queue.h"
+
+// Samples of one buffer: a notification, or the summaries of a window
+#define SAMPLE_BUFFER_SAMPLES AGGREGATE_SUMMARY_SAMPLES
+
+// Size of a cache line, keeps producer and consumer indexes apart
+#define BUFFER_RING_CACHE_LINE 64
+
+typedef struct sample_pool sample_pool_t;
+
+// Samples written once by the producer, then only read by every sink it
+// was handed to. The last sink to release it returns it to its pool.
+typedef struct {
+    _Atomic uint32_t refs;
+    uint32_t count;
+    // Samples of a discrete event, taken by the sinks ahead of telemetry
+    bool urgent;
+    sample_pool_t* pool;
+    sample_t samples[SAMPLE_BUFFER_SAMPLES];
+} sample_buffer_t;
+
+// Slot of a ring, sequence tells which lap may write or read it
+typedef struct {
+    _Atomic uint32_t sequence;
+    sample_buffer_t* buffer;
+} buffer_slot_t;
+
+// Bounded multi-producer/multi-consumer ring of buffer pointers, one
+// compare-and-swap per push or pop and no lock
+typedef struct {
+    buffer_slot_t* slots;
+    uint32_t mask;
+    _Alignas(BUFFER_RING_CACHE_LINE) _Atomic uint32_t tail;
+    _Alignas(BUFFER_RING_CACHE_LINE) _Atomic uint32_t head;
+} buffer_ring_t;
+
+// capacity is rounded up to a power of two. Returns 0 on success.
+int buffer_ring_init(buffer_ring_t* ring, uint32_t capacity);
+void buffer_ring_destroy(buffer_ring_t* ring);
+
+// Returns false when the ring is full
+bool buffer_ring_push(buffer_ring_t* ring, sample_buffer_t* buffer);
+
+// Returns NULL when the ring is empty
+sample_buffer_t* buffer_ring_pop(buffer_ring_t* ring);
+
+// Fixed set of buffers, allocated once
+struct sample_pool {
+    sample_buffer_t* buffers;
+    buffer_ring_t free;
+    // Takes that found every buffer in use
+    _Atomic uint64_t exhausted;
+};
+
+int sample_pool_init(sample_pool_t* pool, uint32_t count);
+void sample_pool_destroy(sample_pool_t* pool);
+
+// A free buffer with refs set to refs, NULL when all are in use
+sample_buffer_t* sample_pool_take(sample_pool_t* pool, uint32_t refs);
+
+static inline void sample_buffer_release(sample_buffer_t* buffer){
+    if (atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1){
+        buffer_ring_push(&buffer->pool->free, buffer);
+    }
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "sample_queue.h"
+
+int sample_queue_init(sample_queue_t* queue, uint32_t capacity, queue_policy_t policy){
+    uint32_t size = 1;
+
+    while (size < capacity){
+        size <<= 1;
+    }
+    queue->slots = calloc(size, sizeof(sample_t));
+    if (queue->slots == NULL){
+        return -1;
+    }
+    if (sem_init(&queue->wakeup, 0, 0) != 0){
+        free(queue->slots);
+        queue->slots = NULL;
+        return -1;
+    }
+    queue->mask = size - 1;
+    queue->policy = policy;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->pushed, 0);
+    atomic_init(&queue->overruns, 0);
+    atomic_init(&queue->consumer_waiting, 0);
+    return 0;
+}
+
+void sample_queue_destroy(sample_queue_t* queue){
+    sem_destroy(&queue->wakeup);
+    free(queue->slots);
+    queue->slots = NULL;
+}
+
+void sample_queue_wake(sample_queue_t* queue){
+    if (atomic_exchange(&queue->consumer_waiting, 0)){
+        sem_post(&queue->wakeup);
+    }
+}
+
+int sample_queue_push(sample_queue_t* queue, const sample_t* sample){
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head - tail > queue->mask){
+        if (queue->policy == QUEUE_BACKPRESSURE){
+            atomic_fetch_add_explicit(&queue->overruns, 1, memory_order_relaxed);
+            return -1;
+        }
+        // Reclaim the oldest slot. If the consumer moved the tail first the
+        // slot is free anyway and nothing was lost.
+        if (atomic_compare_exchange_strong_explicit(&queue->tail, &tail, tail + 1,
+                                                    memory_order_acq_rel, memory_order_acquire)){
+            atomic_fetch_add_explicit(&queue->overruns, 1, memory_order_relaxed);
+        }
+    }
+
+    queue->slots[head & queue->mask] = *sample;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&queue->pushed, 1, memory_order_relaxed);
+
+    // Pairs with the fence in sample_queue_wait() so a sleeping consumer
+    // either sees the new head or gets posted
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->consumer_waiting, memory_order_relaxed)){
+        sample_queue_wake(queue);
+    }
+    return 0;
+}
+
+uint32_t sample_queue_pop(sample_queue_t* queue, sample_t* out, uint32_t max){
+    for (;;){
+        uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        uint32_t count = head - tail;
+        uint32_t i;
+
+        if (count > max){
+            count = max;
+        }
+        if (count == 0){
+            return 0;
+        }
+        for (i = 0; i < count; i++){
+            out[i] = queue->slots[(tail + i) & queue->mask];
+        }
+        // Under QUEUE_DROP_OLDEST the producer may have reclaimed and
+        // rewritten the slots just copied; the copy is then discarded
+        if (atomic_compare_exchange_strong_explicit(&queue->tail, &tail, tail + count,
+                                                    memory_order_release, memory_order_relaxed)){
+            return count;
+        }
+    }
+}
+
+void sample_queue_wait(sample_queue_t* queue, uint32_t timeout_msec){
+    struct timespec deadline;
+
+    atomic_store_explicit(&queue->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->head, memory_order_relaxed) !=
+        atomic_load_explicit(&queue->tail, memory_order_relaxed)){
+        atomic_store(&queue->consumer_waiting, 0);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_msec / 1000;
+    deadline.tv_nsec += (long)(timeout_msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&queue->wakeup, &deadline) != 0 && errno == EINTR){
+    }
+    atomic_store(&queue->consumer_waiting, 0);
+}
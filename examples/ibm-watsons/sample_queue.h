@@ -0,0 +1,51 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <semaphore.h>
+#include "sample.h"
+
+// Size of a cache line, keeps producer and consumer indexes apart
+#define SAMPLE_QUEUE_CACHE_LINE 64
+
+typedef enum {
+    // A full queue discards its oldest sample to take the new one
+    QUEUE_DROP_OLDEST,
+    // A full queue refuses the new sample, the producer keeps it
+    QUEUE_BACKPRESSURE,
+} queue_policy_t;
+
+// Bounded single-producer/single-consumer ring of samples. The BLE
+// callbacks push, the publisher thread pops; neither side takes a lock.
+typedef struct {
+    sample_t* slots;
+    uint32_t mask;
+    queue_policy_t policy;
+    _Alignas(SAMPLE_QUEUE_CACHE_LINE) _Atomic uint32_t head;
+    _Alignas(SAMPLE_QUEUE_CACHE_LINE) _Atomic uint32_t tail;
+    _Alignas(SAMPLE_QUEUE_CACHE_LINE) _Atomic uint64_t pushed;
+    _Atomic uint64_t overruns;
+    _Atomic int consumer_waiting;
+    sem_t wakeup;
+} sample_queue_t;
+
+// capacity is rounded up to a power of two. Returns 0 on success.
+int sample_queue_init(sample_queue_t* queue, uint32_t capacity, queue_policy_t policy);
+void sample_queue_destroy(sample_queue_t* queue);
+
+// Producer side. Returns 0 when the sample was queued, -1 when it was
+// refused under QUEUE_BACKPRESSURE.
+int sample_queue_push(sample_queue_t* queue, const sample_t* sample);
+
+// Consumer side. Copies up to max samples in FIFO order into out and
+// returns how many were taken.
+uint32_t sample_queue_pop(sample_queue_t* queue, sample_t* out, uint32_t max);
+
+// Consumer side. Sleeps until a sample is pushed, the timeout expires or
+// sample_queue_wake() is called.
+void sample_queue_wait(sample_queue_t* queue, uint32_t timeout_msec);
+
+void sample_queue_wake(sample_queue_t* queue);
+
+#endif
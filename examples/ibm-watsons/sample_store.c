@@ -0,0 +1,353 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "monotonic.h"
+#include "sample_store.h"
+
+// Segments are named after their sequence: 0000000000000042.seg
+#define STORE_SEGMENT_SUFFIX ".seg"
+#define STORE_PATH_SIZE 4096
+
+// Most samples taken from the queue per append round
+#define STORE_BATCH 64
+
+void store_segment_path(char* path, size_t size, const char* dir, uint64_t sequence){
+    snprintf(path, size, "%s/%016llu" STORE_SEGMENT_SUFFIX, dir, (unsigned long long)sequence);
+}
+
+static int compare_sequences(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int store_list_segments(const char* dir, uint64_t** sequences){
+    DIR* directory = opendir(dir);
+    struct dirent* entry;
+    uint64_t* list = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    if (directory == NULL){
+        return -1;
+    }
+    while ((entry = readdir(directory)) != NULL){
+        unsigned long long sequence;
+        char suffix[8];
+
+        if (sscanf(entry->d_name, "%16llu%7s", &sequence, suffix) != 2 ||
+            strcmp(suffix, STORE_SEGMENT_SUFFIX) != 0){
+            continue;
+        }
+        if (count == capacity){
+            uint64_t* grown = realloc(list, (capacity ? capacity * 2 : 16) * sizeof(uint64_t));
+            if (grown == NULL){
+                break;
+            }
+            list = grown;
+            capacity = capacity ? capacity * 2 : 16;
+        }
+        list[count++] = sequence;
+    }
+    closedir(directory);
+    if (count > 0){
+        qsort(list, (size_t)count, sizeof(uint64_t), compare_sequences);
+    }
+    *sequences = list;
+    return count;
+}
+
+int store_segment_map(store_segment_t* segment, const char* path){
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    memset(segment, 0, sizeof(*segment));
+    if (fd < 0){
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < STORE_HEADER_SIZE){
+        close(fd);
+        return -1;
+    }
+    segment->size = (size_t)st.st_size;
+    segment->map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment->map == MAP_FAILED){
+        segment->map = NULL;
+        return -1;
+    }
+    segment->header = (const store_segment_header_t*)segment->map;
+    if (segment->header->magic != STORE_MAGIC || segment->header->version != STORE_VERSION ||
+        segment->header->block_size != STORE_BLOCK_SIZE ||
+        STORE_HEADER_SIZE + (size_t)segment->header->blocks * STORE_BLOCK_SIZE > segment->size){
+        store_segment_unmap(segment);
+        return -1;
+    }
+    // Scans read through the mapping front to back
+    madvise(segment->map, segment->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+void store_segment_unmap(store_segment_t* segment){
+    if (segment->map != NULL){
+        munmap(segment->map, segment->size);
+    }
+    segment->map = NULL;
+}
+
+static void store_close_segment(sample_store_t* store){
+    if (store->map == NULL){
+        return;
+    }
+    msync(store->map, STORE_SEGMENT_SIZE, MS_ASYNC);
+    munmap(store->map, STORE_SEGMENT_SIZE);
+    store->map = NULL;
+    store->header = NULL;
+    memset(store->open, 0, (size_t)store->devices_count * CHARACTERISTICS_COUNT * sizeof(store->open[0]));
+}
+
+// Starts the next segment, deleting the oldest ones beyond max_segments.
+// The file is sparse: disk blocks are taken as rows are written.
+static int store_open_segment(sample_store_t* store){
+    char path[STORE_PATH_SIZE];
+    struct timespec now;
+    uint8_t* map;
+    int fd;
+
+    store_close_segment(store);
+    while (store->sequence + 1 - store->oldest > store->max_segments){
+        store_segment_path(path, sizeof(path), store->dir, store->oldest++);
+        if (unlink(path) == 0){
+            store->deleted++;
+        }
+    }
+
+    store_segment_path(path, sizeof(path), store->dir, store->sequence);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        perror(path);
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)STORE_SEGMENT_SIZE) != 0){
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED){
+        perror(path);
+        return -1;
+    }
+    store->map = map;
+    store->header = (store_segment_header_t*)map;
+    clock_gettime(CLOCK_REALTIME, &now);
+    store->header->version = STORE_VERSION;
+    store->header->block_size = STORE_BLOCK_SIZE;
+    store->header->blocks = STORE_SEGMENT_BLOCKS;
+    store->header->sequence = store->sequence;
+    store->header->created_usec = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    atomic_store_explicit(&store->header->used, 0, memory_order_relaxed);
+    // Readers only trust a segment whose magic is in place
+    atomic_thread_fence(memory_order_release);
+    store->header->magic = STORE_MAGIC;
+    store->sequence++;
+    return 0;
+}
+
+// Block the next row of a board's characteristic goes to, a new one once
+// the open block is full. Returns NULL when no segment can be opened.
+static store_block_header_t* store_block(sample_store_t* store, uint8_t device, uint8_t characteristic){
+    store_block_header_t** open = &store->open[device * CHARACTERISTICS_COUNT + characteristic];
+    store_block_header_t* block = *open;
+    uint32_t index;
+    uint8_t f;
+
+    if (block != NULL && atomic_load_explicit(&block->rows, memory_order_relaxed) < block->capacity){
+        return block;
+    }
+    if (store->header == NULL || atomic_load_explicit(&store->header->used, memory_order_relaxed) ==
+                                 store->header->blocks){
+        if (store_open_segment(store) != 0){
+            return NULL;
+        }
+    }
+    index = atomic_load_explicit(&store->header->used, memory_order_relaxed);
+    block = (store_block_header_t*)(store->map + STORE_HEADER_SIZE + (size_t)index * STORE_BLOCK_SIZE);
+    strncpy(block->device_id, store->device_ids[device], STORE_DEVICE_ID_SIZE - 1);
+    block->characteristic = characteristic;
+    block->field_count = characteristics[characteristic].field_count;
+    block->capacity = store_block_capacity(block->field_count);
+    block->min_usec = INT64_MAX;
+    block->max_usec = INT64_MIN;
+    for (f = 0; f < block->field_count; f++){
+        block->min[f] = INT32_MAX;
+        block->max[f] = INT32_MIN;
+    }
+    atomic_store_explicit(&block->rows, 0, memory_order_relaxed);
+    atomic_store_explicit(&store->header->used, index + 1, memory_order_release);
+    *open = block;
+    return block;
+}
+
+static void store_append(sample_store_t* store, const sample_t* sample){
+    store_block_header_t* block = store_block(store, sample->device, sample->characteristic);
+    // Board time, or arrival time when the board clock is not known yet
+    int64_t usec = sample->time_usec != 0 ? sample->time_usec : sample->received_usec + store->realtime_offset_usec;
+    uint32_t row;
+    uint8_t f;
+
+    if (block == NULL){
+        return;
+    }
+    row = atomic_load_explicit(&block->rows, memory_order_relaxed);
+    store_block_times(block)[row] = usec;
+    store_block_timestamps(block)[row] = sample->timestamp;
+    if (usec < block->min_usec){
+        block->min_usec = usec;
+    }
+    if (usec > block->max_usec){
+        block->max_usec = usec;
+    }
+    for (f = 0; f < block->field_count; f++){
+        int32_t value = f < sample->count ? sample->values[f] : 0;
+
+        store_block_column(block, f)[row] = value;
+        if (value < block->min[f]){
+            block->min[f] = value;
+        }
+        if (value > block->max[f]){
+            block->max[f] = value;
+        }
+    }
+    atomic_store_explicit(&block->rows, row + 1, memory_order_release);
+    store->stored++;
+}
+
+static void store_free(sample_store_t* store){
+    free(store->open);
+    store->open = NULL;
+}
+
+static void* store_run(void* arg){
+    sample_store_t* store = arg;
+    sample_t batch[STORE_BATCH];
+    uint32_t taken;
+    uint32_t count;
+    uint32_t i;
+    uint8_t p;
+
+    for (;;){
+        int running = atomic_load(&store->running);
+
+        do{
+            taken = 0;
+            for (p = 0; p < store->producers; p++){
+                count = sample_queue_pop(&store->queues[p], batch, STORE_BATCH);
+                for (i = 0; i < count; i++){
+                    if (batch[i].device < store->devices_count && batch[i].statistic == SAMPLE_RAW){
+                        store_append(store, &batch[i]);
+                    }
+                }
+                taken += count;
+            }
+        }while (taken > 0);
+        if (!running){
+            return NULL;
+        }
+        // Only the first producer wakes the thread up, the others are
+        // looked at every STORE_IDLE_MSEC at least, far from filling up
+        sample_queue_wait(&store->queues[0], STORE_IDLE_MSEC);
+    }
+}
+
+static void store_destroy_queues(sample_store_t* store){
+    uint8_t p;
+
+    for (p = 0; p < store->producers; p++){
+        sample_queue_destroy(&store->queues[p]);
+    }
+}
+
+int sample_store_start(sample_store_t* store, const char* dir, uint32_t max_mbytes, const char* const* device_ids,
+                       uint8_t devices_count, uint8_t producers){
+    uint64_t* sequences = NULL;
+    int count;
+
+    memset(store, 0, sizeof(*store));
+    store->dir = dir;
+    store->device_ids = device_ids;
+    store->devices_count = devices_count;
+    store->max_segments = (uint32_t)(((uint64_t)max_mbytes << 20) / STORE_SEGMENT_SIZE);
+    if (store->max_segments < STORE_MIN_SEGMENTS){
+        store->max_segments = STORE_MIN_SEGMENTS;
+    }
+
+    if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0){
+        perror(dir);
+        return -1;
+    }
+    count = store_list_segments(dir, &sequences);
+    if (count < 0){
+        perror(dir);
+        return -1;
+    }
+    if (count > 0){
+        store->oldest = sequences[0];
+        store->sequence = sequences[count - 1] + 1;
+    }
+    free(sequences);
+
+    store->realtime_offset_usec = realtime_offset_usec();
+    store->open = calloc((size_t)devices_count * CHARACTERISTICS_COUNT, sizeof(store->open[0]));
+    if (store->open == NULL){
+        return -1;
+    }
+    if (producers == 0 || producers > STORE_MAX_PRODUCERS){
+        store_free(store);
+        return -1;
+    }
+    for (store->producers = 0; store->producers < producers; store->producers++){
+        if (sample_queue_init(&store->queues[store->producers], STORE_QUEUE_CAPACITY, QUEUE_BACKPRESSURE) != 0){
+            store_destroy_queues(store);
+            store_free(store);
+            return -1;
+        }
+    }
+    atomic_init(&store->running, 1);
+    if (store_open_segment(store) != 0 || pthread_create(&store->thread, NULL, store_run, store) != 0){
+        store_close_segment(store);
+        store_destroy_queues(store);
+        store_free(store);
+        return -1;
+    }
+    return 0;
+}
+
+void sample_store_stop(sample_store_t* store){
+    uint64_t refused = 0;
+    uint8_t p;
+
+    if (store->open == NULL){
+        return;
+    }
+    atomic_store(&store->running, 0);
+    sample_queue_wake(&store->queues[0]);
+    pthread_join(store->thread, NULL);
+    store_close_segment(store);
+
+    for (p = 0; p < store->producers; p++){
+        refused += atomic_load(&store->queues[p].overruns);
+    }
+    printf("Stored %llu samples in %s, %llu refused, %llu old segments deleted\n",
+           (unsigned long long)store->stored, store->dir, (unsigned long long)refused,
+           (unsigned long long)store->deleted);
+    store_destroy_queues(store);
+    store_free(store);
+}
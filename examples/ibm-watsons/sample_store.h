@@ -0,0 +1,160 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "characteristics.h"
+#include "sample_queue.h"
+
+#define STORE_MAGIC 0x54534E53
+#define STORE_VERSION 1
+
+// The segment header owns the first page, blocks follow
+#define STORE_HEADER_SIZE 4096
+
+// Blocks of one board and characteristic: a header with the row count and
+// the min/max of every column, then the columns themselves
+#define STORE_BLOCK_SIZE 65536
+#define STORE_BLOCK_HEADER_SIZE 256
+
+// Blocks per segment file, 64 MiB segments
+#define STORE_SEGMENT_BLOCKS 1024
+#define STORE_SEGMENT_SIZE (STORE_HEADER_SIZE + (size_t)STORE_SEGMENT_BLOCKS * STORE_BLOCK_SIZE)
+
+// Disk space of a store unless -S says otherwise, and the least it takes
+#define STORE_DEFAULT_MBYTES 1024
+#define STORE_MIN_SEGMENTS 2
+
+// Samples waiting for the store thread per producer, beyond which new
+// ones are refused
+#define STORE_QUEUE_CAPACITY 16384
+
+// Most threads pushing samples, each through a queue of its own
+#define STORE_MAX_PRODUCERS 16
+
+// Longest sleep of an idle store thread, bounds shutdown latency
+#define STORE_IDLE_MSEC 100
+
+// Longest device ID kept with a block, a MAC address
+#define STORE_DEVICE_ID_SIZE 18
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t blocks;
+    // Blocks handed out so far, readers ignore the others
+    _Atomic uint32_t used;
+    uint32_t reserved;
+    uint64_t sequence;
+    // CLOCK_REALTIME microseconds the segment was created at
+    int64_t created_usec;
+} store_segment_header_t;
+
+// Block index: readers skip a block whose time or value ranges cannot
+// match. Rows are committed by the release store of rows, after their
+// columns and the ranges covering them.
+typedef struct {
+    char device_id[STORE_DEVICE_ID_SIZE];
+    uint8_t characteristic;
+    uint8_t field_count;
+    uint32_t capacity;
+    _Atomic uint32_t rows;
+    uint32_t reserved;
+    // CLOCK_REALTIME microseconds of the first and last row
+    int64_t min_usec;
+    int64_t max_usec;
+    int32_t min[SAMPLE_MAX_FIELDS];
+    int32_t max[SAMPLE_MAX_FIELDS];
+} store_block_header_t;
+
+_Static_assert(sizeof(store_block_header_t) <= STORE_BLOCK_HEADER_SIZE, "store block header too large");
+
+// Columns of a block: Unix times the board took the samples, one column
+// per field, board timestamps last so every column stays aligned
+static inline uint32_t store_block_capacity(uint8_t field_count){
+    return (STORE_BLOCK_SIZE - STORE_BLOCK_HEADER_SIZE) / (sizeof(int64_t) + field_count * sizeof(int32_t) +
+                                                         sizeof(uint16_t));
+}
+
+static inline int64_t* store_block_times(const store_block_header_t* block){
+    return (int64_t*)((uint8_t*)block + STORE_BLOCK_HEADER_SIZE);
+}
+
+static inline int32_t* store_block_column(const store_block_header_t* block, uint8_t field){
+    return (int32_t*)(store_block_times(block) + block->capacity) + (size_t)field * block->capacity;
+}
+
+static inline uint16_t* store_block_timestamps(const store_block_header_t* block){
+    return (uint16_t*)store_block_column(block, block->field_count);
+}
+
+// Append-only store of every decoded notification, at full rate, in
+// memory-mapped segment files of a directory. The oldest segment is
+// deleted once the store would outgrow its size. The threads serving the
+// boards push samples, each through a single-producer queue of its own,
+// and a store thread appends them.
+typedef struct {
+    const char* dir;
+    uint32_t max_segments;
+    const char* const* device_ids;
+    uint8_t devices_count;
+    // CLOCK_REALTIME minus CLOCK_MONOTONIC, dates the samples
+    int64_t realtime_offset_usec;
+    // Segment being written and the oldest one kept
+    uint8_t* map;
+    store_segment_header_t* header;
+    uint64_t sequence;
+    uint64_t oldest;
+    // open[device * CHARACTERISTICS_COUNT + characteristic], NULL for none
+    store_block_header_t** open;
+    sample_queue_t queues[STORE_MAX_PRODUCERS];
+    uint8_t producers;
+    pthread_t thread;
+    atomic_int running;
+    uint64_t stored;
+    uint64_t deleted;
+} sample_store_t;
+
+// Opens a new segment in dir, after the ones a previous run left, and
+// starts the store thread taking the samples of producers threads, at
+// most STORE_MAX_PRODUCERS. device_ids[i] names device i and must outlive
+// store. Returns 0 on success.
+int sample_store_start(sample_store_t* store, const char* dir, uint32_t max_mbytes, const char* const* device_ids,
+                       uint8_t devices_count, uint8_t producers);
+
+// Stores what is still queued and joins the store thread
+void sample_store_stop(sample_store_t* store);
+
+// Producer side, never blocks: a sample is refused and counted when the
+// store thread lags STORE_QUEUE_CAPACITY samples behind producer, the
+// index of the calling thread below producers
+static inline void sample_store_push(sample_store_t* store, uint8_t producer, const sample_t* sample){
+    sample_queue_push(&store->queues[producer], sample);
+}
+
+// Read-only mapping of a segment, for queries
+typedef struct {
+    uint8_t* map;
+    size_t size;
+    const store_segment_header_t* header;
+} store_segment_t;
+
+// Returns 0 on success, -1 when path is not a segment of this version
+int store_segment_map(store_segment_t* segment, const char* path);
+
+void store_segment_unmap(store_segment_t* segment);
+
+static inline const store_block_header_t* store_segment_block(const store_segment_t* segment, uint32_t index){
+    return (const store_block_header_t*)(segment->map + STORE_HEADER_SIZE + (size_t)index * STORE_BLOCK_SIZE);
+}
+
+// Sequences of the segments in dir, oldest first, into a malloc()ed array
+// the caller frees. Returns how many, -1 when dir cannot be read.
+int store_list_segments(const char* dir, uint64_t** sequences);
+
+void store_segment_path(char* path, size_t size, const char* dir, uint64_t sequence);
+
+#endif
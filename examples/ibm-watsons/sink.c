@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "sink.h"
+
+int sink_init(sink_t* sink, const char* name, uint32_t capacity, queue_policy_t policy){
+    memset(sink, 0, sizeof(*sink));
+    if (buffer_ring_init(&sink->queue, capacity) != 0){
+        return -1;
+    }
+    if (buffer_ring_init(&sink->urgent, SINK_URGENT_CAPACITY) != 0){
+        buffer_ring_destroy(&sink->queue);
+        return -1;
+    }
+    if (sem_init(&sink->wakeup, 0, 0) != 0){
+        buffer_ring_destroy(&sink->urgent);
+        buffer_ring_destroy(&sink->queue);
+        return -1;
+    }
+    sink->name = name;
+    sink->policy = policy;
+    sink->metrics = &sink->counters;
+    atomic_init(&sink->consumer_waiting, 0);
+    atomic_init(&sink->running, 0);
+    return 0;
+}
+
+void sink_destroy(sink_t* sink){
+    sample_buffer_t* buffer;
+
+    if (sink->queue.slots == NULL){
+        return;
+    }
+    while ((buffer = buffer_ring_pop(&sink->urgent)) != NULL){
+        sample_buffer_release(buffer);
+    }
+    while ((buffer = buffer_ring_pop(&sink->queue)) != NULL){
+        sample_buffer_release(buffer);
+    }
+    sem_destroy(&sink->wakeup);
+    buffer_ring_destroy(&sink->urgent);
+    buffer_ring_destroy(&sink->queue);
+}
+
+void sink_wake(sink_t* sink){
+    if (atomic_exchange(&sink->consumer_waiting, 0)){
+        sem_post(&sink->wakeup);
+    }
+}
+
+// Queues buffer behind the others per the queue policy
+static bool sink_enqueue(sink_t* sink, sample_buffer_t* buffer){
+    sample_buffer_t* oldest;
+
+    while (!buffer_ring_push(&sink->queue, buffer)){
+        if (sink->policy == QUEUE_BACKPRESSURE){
+            metric_add_shared(&sink->metrics->dropped, buffer->count);
+            sample_buffer_release(buffer);
+            return false;
+        }
+        // Reclaim the oldest buffer. If the sink took it first there is
+        // room anyway and nothing was lost.
+        oldest = buffer_ring_pop(&sink->queue);
+        if (oldest != NULL){
+            metric_add_shared(&sink->metrics->dropped, oldest->count);
+            sample_buffer_release(oldest);
+        }
+    }
+    return true;
+}
+
+bool sink_push(sink_t* sink, sample_buffer_t* buffer){
+    if (!(buffer->urgent && buffer_ring_push(&sink->urgent, buffer)) && !sink_enqueue(sink, buffer)){
+        return false;
+    }
+
+    // Pairs with the fence in sink_wait() so a sleeping sink either sees
+    // the new buffer or gets posted
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sink->consumer_waiting, memory_order_relaxed)){
+        sink_wake(sink);
+    }
+    return true;
+}
+
+uint32_t sink_pop(sink_t* sink, sample_buffer_t** out, uint32_t max){
+    uint32_t count = 0;
+
+    // The hub sized its pool for SINK_BATCH buffers in hand per sink
+    if (max > SINK_BATCH){
+        max = SINK_BATCH;
+    }
+    while (count < max && (out[count] = buffer_ring_pop(&sink->urgent)) != NULL){
+        count++;
+    }
+    while (count < max && (out[count] = buffer_ring_pop(&sink->queue)) != NULL){
+        count++;
+    }
+    return count;
+}
+
+// Whether the consumer would find a buffer in ring
+static bool buffer_ring_ready(buffer_ring_t* ring){
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    buffer_slot_t* next = &ring->slots[head & ring->mask];
+
+    return atomic_load_explicit(&next->sequence, memory_order_relaxed) == head + 1;
+}
+
+void sink_wait(sink_t* sink, uint32_t timeout_msec){
+    struct timespec deadline;
+
+    atomic_store_explicit(&sink->consumer_waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (buffer_ring_ready(&sink->urgent) || buffer_ring_ready(&sink->queue)){
+        atomic_store(&sink->consumer_waiting, 0);
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_msec / 1000;
+    deadline.tv_nsec += (long)(timeout_msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&sink->wakeup, &deadline) != 0 && errno == EINTR){
+    }
+    atomic_store(&sink->consumer_waiting, 0);
+}
+
+static uint32_t sink_drain(sink_t* sink){
+    sample_buffer_t* batch[SINK_BATCH];
+    uint32_t total = 0;
+    uint32_t count;
+    uint32_t i;
+
+    while ((count = sink_pop(sink, batch, SINK_BATCH)) > 0){
+        for (i = 0; i < count; i++){
+            sink->ops->write(sink, batch[i]);
+            sink_done(sink, batch[i]);
+        }
+        total += count;
+    }
+    return total;
+}
+
+static void* sink_run(void* arg){
+    sink_t* sink = arg;
+
+    while (atomic_load(&sink->running)){
+        if (sink_drain(sink) == 0){
+            if (sink->ops->idle != NULL){
+                sink->ops->idle(sink);
+            }
+            sink_wait(sink, SINK_IDLE_MSEC);
+        }
+    }
+    sink_drain(sink);
+    if (sink->ops->idle != NULL){
+        sink->ops->idle(sink);
+    }
+    if (sink->ops->close != NULL){
+        sink->ops->close(sink);
+    }
+    return NULL;
+}
+
+int sink_start(sink_t* sink, const sink_ops_t* ops, void* state){
+    sink->ops = ops;
+    sink->state = state;
+    atomic_store(&sink->running, 1);
+    if (pthread_create(&sink->thread, NULL, sink_run, sink) != 0){
+        return -1;
+    }
+    sink->started = true;
+    return 0;
+}
+
+void sink_stop(sink_t* sink){
+    if (!sink->started){
+        return;
+    }
+    atomic_store(&sink->running, 0);
+    sink_wake(sink);
+    pthread_join(sink->thread, NULL);
+    sink->started = false;
+}
+
+int sink_hub_init(sink_hub_t* hub, sink_t* const* sinks, uint8_t count){
+    uint32_t buffers = 0;
+    uint8_t i;
+
+    if (count > SINK_MAX){
+        return -1;
+    }
+    hub->count = count;
+    for (i = 0; i < count; i++){
+        hub->sinks[i] = sinks[i];
+        buffers += sinks[i]->queue.mask + 1 + sinks[i]->urgent.mask + 1 + SINK_BATCH;
+    }
+    return sample_pool_init(&hub->pool, buffers > 0 ? buffers : 1);
+}
+
+void sink_hub_destroy(sink_hub_t* hub){
+    sample_pool_destroy(&hub->pool);
+}
+
+int sink_hub_publish(sink_hub_t* hub, const sample_t* samples, uint32_t count, bool urgent){
+    sample_buffer_t* buffer;
+    uint8_t i;
+
+    if (count == 0 || hub->count == 0){
+        return 0;
+    }
+    buffer = sample_pool_take(&hub->pool, hub->count);
+    if (buffer == NULL){
+        return -1;
+    }
+    buffer->count = count;
+    buffer->urgent = urgent;
+    memcpy(buffer->samples, samples, count * sizeof(sample_t));
+    for (i = 0; i < hub->count; i++){
+        sink_push(hub->sinks[i], buffer);
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+#include "sample_buffer.h"
+#include "sample_queue.h"
+
+// Most sinks fed by one hub
+#define SINK_MAX METRICS_MAX_SINKS
+
+// Most buffers taken from a sink queue per wakeup
+#define SINK_BATCH 32
+
+// Longest sleep of an idle sink thread, bounds shutdown latency
+#define SINK_IDLE_MSEC 100
+
+// Buffers of discrete events a sink keeps ahead of its queue, the
+// overflow waits in the queue behind telemetry
+#define SINK_URGENT_CAPACITY 64
+
+typedef struct sink sink_t;
+
+// Behaviour of a sink driven by a sink thread, see sink_start()
+typedef struct {
+    // Consumes the samples of one buffer, which stays valid until it returns
+    void (*write)(sink_t* sink, const sample_buffer_t* buffer);
+    // Called once the queue ran dry, e.g. to flush, NULL for none
+    void (*idle)(sink_t* sink);
+    // Called on the sink thread when it stops, NULL for none
+    void (*close)(sink_t* sink);
+} sink_ops_t;
+
+// Consumer of the decoded samples with a queue of its own, so a slow sink
+// only ever loses its own samples. The producer pushes, the sink pops;
+// the MQTT publisher pops from its own thread, the other sinks are driven
+// by a sink thread calling their ops.
+struct sink {
+    const char* name;
+    buffer_ring_t queue;
+    // Urgent buffers, always taken before the queue
+    buffer_ring_t urgent;
+    queue_policy_t policy;
+    _Atomic int consumer_waiting;
+    sem_t wakeup;
+    // Counters of this sink, exported when they belong to the metrics
+    metric_sink_t* metrics;
+    metric_sink_t counters;
+    const sink_ops_t* ops;
+    void* state;
+    pthread_t thread;
+    bool started;
+    atomic_int running;
+};
+
+// capacity, in buffers, is rounded up to a power of two. A full queue
+// follows policy: QUEUE_DROP_OLDEST keeps the newest buffers,
+// QUEUE_BACKPRESSURE the queued ones. Returns 0 on success.
+int sink_init(sink_t* sink, const char* name, uint32_t capacity, queue_policy_t policy);
+
+// Releases the buffers still queued, once the sink stopped
+void sink_destroy(sink_t* sink);
+
+// Starts a sink thread feeding the queued buffers to ops. Returns 0 on
+// success.
+int sink_start(sink_t* sink, const sink_ops_t* ops, void* state);
+
+// Writes what is still queued, closes the sink and joins its thread
+void sink_stop(sink_t* sink);
+
+// Producer side, never blocks. Takes one reference of buffer, released
+// at once when the queue refuses it. Returns false when it was refused.
+// An urgent buffer goes ahead of the queue while there is room.
+bool sink_push(sink_t* sink, sample_buffer_t* buffer);
+
+// Consumer side. Takes up to max buffers, the urgent ones first then the
+// others in FIFO order, each to be handed back with sink_done().
+uint32_t sink_pop(sink_t* sink, sample_buffer_t** out, uint32_t max);
+
+// Consumer side. Counts the samples of a consumed buffer and releases it.
+static inline void sink_done(sink_t* sink, sample_buffer_t* buffer){
+    metric_add(&sink->metrics->written, buffer->count);
+    sample_buffer_release(buffer);
+}
+
+// Consumer side. Sleeps until a buffer is pushed, the timeout expires or
+// sink_wake() is called.
+void sink_wait(sink_t* sink, uint32_t timeout_msec);
+
+void sink_wake(sink_t* sink);
+
+// Fans the decoded samples out to every sink: each batch is copied once
+// into a pooled buffer that all the sinks read
+typedef struct {
+    sink_t* sinks[SINK_MAX];
+    uint8_t count;
+    sample_pool_t pool;
+} sink_hub_t;
+
+// Sinks must be initialized. The pool holds as many buffers as they can
+// keep queued or in hand together, so taking one never fails while every
+// sink honours SINK_BATCH. Returns 0 on success.
+int sink_hub_init(sink_hub_t* hub, sink_t* const* sinks, uint8_t count);
+
+// Once every sink was destroyed
+void sink_hub_destroy(sink_hub_t* hub);
+
+// Producer side, never blocks: count samples, at most
+// SAMPLE_BUFFER_SAMPLES, for every sink, ahead of telemetry when urgent
+// is set. Returns -1 when no buffer was free and the samples were dropped
+// for all sinks.
+int sink_hub_publish(sink_hub_t* hub, const sample_t* samples, uint32_t count, bool urgent);
+
+#endif
@@ -0,0 +1,227 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "worker.h"
+
+// GSource of the inbox, ready whenever a record is queued
+typedef struct {
+    GSource source;
+    worker_t* worker;
+} inbox_source_t;
+
+// Whether the worker would find a record in its inbox
+static bool inbox_ready(worker_t* worker){
+    worker_slot_t* next = &worker->slots[worker->head & worker->mask];
+
+    return atomic_load_explicit(&next->sequence, memory_order_acquire) == worker->head + 1;
+}
+
+static gboolean inbox_prepare(GSource* source, gint* timeout){
+    worker_t* worker = ((inbox_source_t*)source)->worker;
+
+    *timeout = -1;
+    if (inbox_ready(worker)){
+        return TRUE;
+    }
+    // Pairs with the fence in inbox_publish() so a worker about to poll
+    // either sees the new record or gets woken up
+    atomic_store_explicit(&worker->sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (inbox_ready(worker)){
+        atomic_store(&worker->sleeping, 0);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean inbox_check(GSource* source){
+    worker_t* worker = ((inbox_source_t*)source)->worker;
+
+    atomic_store(&worker->sleeping, 0);
+    return inbox_ready(worker);
+}
+
+static gboolean inbox_dispatch(GSource* source, GSourceFunc callback, gpointer user_data){
+    (void)callback;
+    (void)user_data;
+    worker_drain(((inbox_source_t*)source)->worker, WORKER_DISPATCH_MAX);
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs inbox_funcs = {
+    .prepare = inbox_prepare,
+    .check = inbox_check,
+    .dispatch = inbox_dispatch,
+};
+
+int worker_init(worker_t* worker, uint8_t index, worker_handler_t handler){
+    uint32_t i;
+
+    memset(worker, 0, sizeof(*worker));
+    worker->slots = calloc(WORKER_INBOX_CAPACITY, sizeof(worker_slot_t));
+    if (worker->slots == NULL){
+        return -1;
+    }
+    worker->mask = WORKER_INBOX_CAPACITY - 1;
+    for (i = 0; i < WORKER_INBOX_CAPACITY; i++){
+        atomic_init(&worker->slots[i].sequence, i);
+    }
+    atomic_init(&worker->tail, 0);
+    atomic_init(&worker->sleeping, 0);
+    worker->index = index;
+    worker->handler = handler;
+    worker->metrics = &worker->counters;
+    worker->context = g_main_context_new();
+    worker->loop = g_main_loop_new(worker->context, FALSE);
+    worker->inbox = g_source_new(&inbox_funcs, sizeof(inbox_source_t));
+    ((inbox_source_t*)worker->inbox)->worker = worker;
+    g_source_attach(worker->inbox, worker->context);
+    return 0;
+}
+
+void worker_destroy(worker_t* worker){
+    if (worker->slots == NULL){
+        return;
+    }
+    g_source_destroy(worker->inbox);
+    g_source_unref(worker->inbox);
+    g_main_loop_unref(worker->loop);
+    g_main_context_unref(worker->context);
+    free(worker->slots);
+    worker->slots = NULL;
+}
+
+static void* worker_run(void* arg){
+    worker_t* worker = arg;
+
+    // Sources the handlers add without a context land on this worker
+    g_main_context_push_thread_default(worker->context);
+    g_main_loop_run(worker->loop);
+    g_main_context_pop_thread_default(worker->context);
+    return NULL;
+}
+
+int worker_start(worker_t* worker){
+    if (pthread_create(&worker->thread, NULL, worker_run, worker) != 0){
+        return -1;
+    }
+    worker->started = true;
+    return 0;
+}
+
+static gboolean worker_quit(gpointer user_data){
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+void worker_stop(worker_t* worker){
+    GSource* source;
+
+    if (!worker->started){
+        return;
+    }
+    // Quits from within the loop: a g_main_loop_quit() reaching the
+    // thread before g_main_loop_run() would be lost
+    source = g_idle_source_new();
+    g_source_set_callback(source, worker_quit, worker->loop, NULL);
+    g_source_attach(source, worker->context);
+    g_source_unref(source);
+    pthread_join(worker->thread, NULL);
+    worker->started = false;
+}
+
+guint worker_timeout_add(worker_t* worker, guint msec, GSourceFunc func, gpointer data){
+    GSource* source = g_timeout_source_new(msec);
+    guint id;
+
+    g_source_set_callback(source, func, data, NULL);
+    id = g_source_attach(source, worker->context);
+    g_source_unref(source);
+    return id;
+}
+
+// Claims the slot of the next record. Returns NULL when the inbox is full.
+static worker_slot_t* inbox_reserve(worker_t* worker, uint32_t* position){
+    uint32_t tail = atomic_load_explicit(&worker->tail, memory_order_relaxed);
+    worker_slot_t* slot;
+
+    for (;;){
+        int32_t lap;
+
+        slot = &worker->slots[tail & worker->mask];
+        lap = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - tail);
+        if (lap == 0){
+            if (atomic_compare_exchange_weak_explicit(&worker->tail, &tail, tail + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                *position = tail;
+                return slot;
+            }
+        }else if (lap < 0){
+            return NULL;
+        }else{
+            tail = atomic_load_explicit(&worker->tail, memory_order_relaxed);
+        }
+    }
+}
+
+// Hands the filled slot over and wakes the worker up if it sleeps
+static void inbox_publish(worker_t* worker, worker_slot_t* slot, uint32_t position){
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&worker->sleeping, memory_order_relaxed) && atomic_exchange(&worker->sleeping, 0)){
+        g_main_context_wakeup(worker->context);
+    }
+}
+
+bool worker_push(worker_t* worker, uint8_t device, uint8_t characteristic, const uint8_t* data, size_t length,
+                 int64_t received_usec){
+    uint32_t position;
+    worker_slot_t* slot = inbox_reserve(worker, &position);
+
+    if (slot == NULL){
+        metric_add_shared(&worker->metrics->dropped, 1);
+        return false;
+    }
+    if (length > SENSIBLE_FRAME_MAX){
+        length = SENSIBLE_FRAME_MAX;
+    }
+    slot->record.received_usec = received_usec;
+    slot->record.device = device;
+    slot->record.characteristic = characteristic;
+    slot->record.length = (uint8_t)length;
+    memcpy(slot->record.data, data, length);
+    inbox_publish(worker, slot, position);
+    return true;
+}
+
+void worker_push_lost(worker_t* worker, uint8_t device){
+    uint32_t position;
+    worker_slot_t* slot;
+
+    while ((slot = inbox_reserve(worker, &position)) == NULL){
+        sched_yield();
+    }
+    slot->record.received_usec = 0;
+    slot->record.device = device;
+    slot->record.characteristic = WORKER_RECORD_LOST;
+    slot->record.length = 0;
+    inbox_publish(worker, slot, position);
+}
+
+uint32_t worker_drain(worker_t* worker, uint32_t max){
+    uint32_t count = 0;
+
+    while (count < max && inbox_ready(worker)){
+        worker_slot_t* slot = &worker->slots[worker->head & worker->mask];
+
+        worker->handler(worker, &slot->record);
+        atomic_store_explicit(&slot->sequence, worker->head + worker->mask + 1, memory_order_release);
+        worker->head++;
+        count++;
+    }
+    if (count > 0){
+        metric_add(&worker->metrics->handled, count);
+    }
+    return count;
+}
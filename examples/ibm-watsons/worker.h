@@ -0,0 +1,109 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "characteristics.h"
+#include "metrics.h"
+
+// Most worker threads, see -t
+#define MAX_WORKERS METRICS_MAX_WORKERS
+
+// Records queued per worker between the BLE callbacks and its thread
+#define WORKER_INBOX_CAPACITY 4096
+
+// Most records handled per dispatch, so the timers of a worker still run
+// under a flood of notifications
+#define WORKER_DISPATCH_MAX 256
+
+// Size of a cache line, keeps producer and consumer indexes apart
+#define WORKER_CACHE_LINE 64
+
+// Characteristic of a record telling that its board was lost, rather than
+// a notification
+#define WORKER_RECORD_LOST 0xFF
+
+// Raw notification handed from a BLE callback to the worker serving its
+// board, copied as received
+typedef struct {
+    int64_t received_usec;
+    uint8_t device;
+    uint8_t characteristic;
+    uint8_t length;
+    uint8_t data[SENSIBLE_FRAME_MAX];
+} worker_record_t;
+
+// Slot of the inbox, sequence tells which lap may write or read it
+typedef struct {
+    _Atomic uint32_t sequence;
+    worker_record_t record;
+} worker_slot_t;
+
+typedef struct worker worker_t;
+
+// Called on the worker thread for every record, in the order they were
+// pushed by each producer
+typedef void (*worker_handler_t)(worker_t* worker, const worker_record_t* record);
+
+// Thread serving a shard of the boards from a GMainContext of its own.
+// The BLE callbacks push raw notifications into its inbox, a bounded
+// multi-producer/single-consumer ring, and the thread does the decoding,
+// aggregation and handoff to the sinks of its boards, whose state no other
+// thread touches. A worker sleeping in its main loop is only woken up when
+// a record arrives.
+struct worker {
+    uint8_t index;
+    GMainContext* context;
+    GMainLoop* loop;
+    GSource* inbox;
+    worker_handler_t handler;
+    worker_slot_t* slots;
+    uint32_t mask;
+    _Alignas(WORKER_CACHE_LINE) _Atomic uint32_t tail;
+    _Atomic int sleeping;
+    _Alignas(WORKER_CACHE_LINE) uint32_t head;
+    // Counters of this worker, exported when they belong to the metrics
+    metric_worker_t* metrics;
+    metric_worker_t counters;
+    pthread_t thread;
+    bool started;
+};
+
+// Sets up the context and inbox of worker number index. Returns 0 on
+// success.
+int worker_init(worker_t* worker, uint8_t index, worker_handler_t handler);
+
+// Once the worker stopped
+void worker_destroy(worker_t* worker);
+
+// Starts the thread running the main loop of the worker. Returns 0 on
+// success.
+int worker_start(worker_t* worker);
+
+// Quits the main loop of the worker and joins its thread, leaving the
+// records still queued for worker_drain()
+void worker_stop(worker_t* worker);
+
+// Producer side, any thread, never blocks: queues length bytes of data,
+// at most SENSIBLE_FRAME_MAX, received from characteristic of device.
+// Returns false when the inbox was full and the notification dropped.
+bool worker_push(worker_t* worker, uint8_t device, uint8_t characteristic, const uint8_t* data, size_t length,
+                 int64_t received_usec);
+
+// Producer side, queues a WORKER_RECORD_LOST record of device, waiting
+// for room rather than dropping it
+void worker_push_lost(worker_t* worker, uint8_t device);
+
+// Calls func(data) on the worker thread every msec, as
+// g_timeout_add() does on the main loop
+guint worker_timeout_add(worker_t* worker, guint msec, GSourceFunc func, gpointer data);
+
+// Consumer side: hands up to max queued records to the handler, from
+// the worker thread or once it stopped. Returns how many were handled.
+uint32_t worker_drain(worker_t* worker, uint32_t max);
+
+#endif
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <string.h>
+#include "aggregate.h"
+#include "monotonic.h"
+
+static void aggregate_reset(aggregate_channel_t* channel){
+    channel->opened_msec = monotonic_msec();
+    channel->count = 0;
+    memset(channel->present, 0, sizeof(channel->present));
+    memset(channel->sum, 0, sizeof(channel->sum));
+    memset(channel->sum_squares, 0, sizeof(channel->sum_squares));
+}
+
+static void aggregate_fold_value(aggregate_channel_t* channel, uint8_t f, int32_t value){
+    if (channel->present[f] == 0){
+        channel->min[f] = value;
+        channel->max[f] = value;
+        channel->first[f] = value;
+    }
+    if (value < channel->min[f]){
+        channel->min[f] = value;
+    }
+    if (value > channel->max[f]){
+        channel->max[f] = value;
+    }
+    channel->last[f] = value;
+    channel->sum[f] += value;
+    channel->sum_squares[f] += (uint64_t)((int64_t)value * value);
+    channel->present[f]++;
+}
+
+int aggregate_crosses(const aggregate_channel_t* channel, uint32_t window_msec, int64_t board_msec){
+    return channel->started && board_msec - channel->window_start >= (window_msec ? window_msec : 1);
+}
+
+int aggregate_advance(aggregate_channel_t* channel, uint32_t window_msec, uint8_t device, uint8_t characteristic,
+                      uint16_t timestamp, int64_t board_msec, sample_t* summary){
+    int64_t elapsed;
+    int written;
+
+    if (window_msec == 0){
+        window_msec = 1;
+    }
+    if (!channel->started){
+        channel->started = 1;
+        channel->device = device;
+        channel->characteristic = characteristic;
+        channel->clock = board_msec;
+        channel->window_start = board_msec;
+        channel->last_timestamp = timestamp;
+        aggregate_reset(channel);
+        return 0;
+    }
+    // Notifications may arrive slightly out of order, only a later sample
+    // moves the windows
+    if (board_msec > channel->clock){
+        channel->clock = board_msec;
+        channel->last_timestamp = timestamp;
+    }
+
+    elapsed = channel->clock - channel->window_start;
+    if (elapsed < window_msec){
+        return 0;
+    }
+    written = aggregate_close(channel, summary);
+    // Windows stay on the grid of the first one, skipping empty windows
+    channel->window_start += elapsed / window_msec * window_msec;
+    aggregate_reset(channel);
+    return written;
+}
+
+int aggregate_add(aggregate_channel_t* channel, uint32_t window_msec, const sample_t* sample, int64_t board_msec,
+                  sample_t* summary){
+    int written = aggregate_advance(channel, window_msec, sample->device, sample->characteristic,
+                                    sample->timestamp, board_msec, summary);
+    uint8_t f;
+
+    for (f = 0; f < sample->count; f++){
+        if (sample_field_present(sample, f)){
+            aggregate_fold_value(channel, f, sample->values[f]);
+        }
+    }
+    channel->count++;
+    channel->last_received_usec = sample->received_usec;
+    return written;
+}
+
+void aggregate_fold_columns(aggregate_channel_t* channel, const sample_columns_t* columns, int64_t received_usec){
+    const characteristic_desc_t* desc = &characteristics[columns->characteristic];
+    uint32_t n = columns->count;
+    uint32_t i;
+    uint8_t f;
+
+    if (n == 0){
+        return;
+    }
+    for (f = 0; f < desc->field_count; f++){
+        const field_desc_t* field = &desc->fields[f];
+        const int32_t* column = columns->columns[f];
+        int32_t min;
+        int32_t max;
+        int64_t sum = 0;
+        uint64_t sum_squares = 0;
+
+        if (field->presence != FIELD_ALWAYS){
+            const int32_t* condition = columns->columns[field->presence_field];
+            for (i = 0; i < n; i++){
+                if ((condition[i] == 0) == (field->presence == FIELD_WHEN_ZERO)){
+                    aggregate_fold_value(channel, f, column[i]);
+                }
+            }
+            continue;
+        }
+        // Branch free over the column so the compiler can vectorize it
+        min = column[0];
+        max = column[0];
+        for (i = 0; i < n; i++){
+            min = column[i] < min ? column[i] : min;
+            max = column[i] > max ? column[i] : max;
+            sum += column[i];
+            sum_squares += (uint64_t)((int64_t)column[i] * column[i]);
+        }
+        if (channel->present[f] == 0){
+            channel->min[f] = min;
+            channel->max[f] = max;
+            channel->first[f] = column[0];
+        }
+        channel->min[f] = min < channel->min[f] ? min : channel->min[f];
+        channel->max[f] = max > channel->max[f] ? max : channel->max[f];
+        channel->last[f] = column[n - 1];
+        channel->sum[f] += sum;
+        channel->sum_squares[f] += sum_squares;
+        channel->present[f] += n;
+    }
+    channel->count += n;
+    channel->last_received_usec = received_usec;
+}
+
+static int32_t aggregate_value(aggregate_channel_t* channel, const field_desc_t* field, uint8_t f, uint8_t statistic){
+    uint32_t n = channel->present[f];
+    double rms;
+
+    if (n == 0){
+        return 0;
+    }
+    if (field->aggregate == AGGREGATE_LAST){
+        return channel->last[f];
+    }
+    if (field->aggregate == AGGREGATE_DELTA){
+        int32_t base = channel->counter_known[f] ? channel->counter_base[f] : channel->first[f];
+        return (uint16_t)(channel->last[f] - base);
+    }
+    switch (statistic){
+    case SAMPLE_MIN:
+        return channel->min[f];
+    case SAMPLE_MAX:
+        return channel->max[f];
+    case SAMPLE_MEAN:
+        return (int32_t)lround((double)channel->sum[f] / n);
+    default:
+        rms = sqrt((double)channel->sum_squares[f] / n);
+        // The RMS of a signed 16-bit field can reach 32768
+        if (field->type == FIELD_S16 && rms > INT16_MAX){
+            return INT16_MAX;
+        }
+        return (int32_t)lround(rms);
+    }
+}
+
+int aggregate_close(aggregate_channel_t* channel, sample_t* summary){
+    const characteristic_desc_t* desc = &characteristics[channel->characteristic];
+    int64_t offset = channel->clock - channel->window_start;
+    int64_t now = monotonic_usec();
+    uint8_t s;
+    uint8_t f;
+
+    if (channel->count == 0){
+        return 0;
+    }
+    for (s = 0; s < AGGREGATE_SUMMARY_SAMPLES; s++){
+        sample_t* out = &summary[s];
+
+        out->received_usec = channel->last_received_usec;
+        out->decoded_usec = now;
+        // Board timestamp of the window start
+        out->timestamp = (uint16_t)(channel->last_timestamp - offset);
+        out->device = channel->device;
+        out->characteristic = channel->characteristic;
+        out->count = desc->field_count;
+        out->statistic = SAMPLE_MIN + s;
+        out->omitted = 0;
+        out->time_usec = 0;
+        for (f = 0; f < desc->field_count; f++){
+            out->values[f] = aggregate_value(channel, &desc->fields[f], f, out->statistic);
+        }
+    }
+    for (f = 0; f < desc->field_count; f++){
+        if (desc->fields[f].aggregate == AGGREGATE_DELTA && channel->present[f] > 0){
+            channel->counter_base[f] = channel->last[f];
+            channel->counter_known[f] = 1;
+        }
+    }
+    aggregate_reset(channel);
+    return AGGREGATE_SUMMARY_SAMPLES;
+}
+
+int aggregate_expire(aggregate_channel_t* channel, uint32_t window_msec, sample_t* summary){
+    int64_t elapsed = channel->clock - channel->window_start;
+    int written = aggregate_close(channel, summary);
+
+    if (window_msec == 0){
+        window_msec = 1;
+    }
+    // The open window may already lie ahead of the clock after an earlier
+    // expiry, it is then the one just closed
+    if (written > 0){
+        channel->window_start += (elapsed >= 0 ? elapsed / window_msec + 1 : 1) * window_msec;
+    }
+    return written;
+}
@@ -0,0 +1,83 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include "characteristics.h"
+#include "frame_batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A window is summarized by one sample per statistic, SAMPLE_MIN to SAMPLE_RMS
+#define AGGREGATE_SUMMARY_SAMPLES (SAMPLE_STATISTICS_COUNT - 1)
+
+// Window of one characteristic of one board. Windows follow the board
+// time device_clock_update() resolves each timestamp to, so rollovers and
+// silences longer than a wrap of the 16 bits close windows as they should.
+typedef struct {
+    uint8_t started;
+    uint8_t device;
+    uint8_t characteristic;
+    // Timestamp and board time of the latest sample, and start of the open
+    // window
+    uint16_t last_timestamp;
+    int64_t clock;
+    int64_t window_start;
+    // Host time the open window received its first sample
+    int64_t opened_msec;
+    int64_t last_received_usec;
+    uint32_t count;
+    uint32_t present[SAMPLE_MAX_FIELDS];
+    int32_t min[SAMPLE_MAX_FIELDS];
+    int32_t max[SAMPLE_MAX_FIELDS];
+    int32_t first[SAMPLE_MAX_FIELDS];
+    int32_t last[SAMPLE_MAX_FIELDS];
+    int64_t sum[SAMPLE_MAX_FIELDS];
+    uint64_t sum_squares[SAMPLE_MAX_FIELDS];
+    // AGGREGATE_DELTA fields: value at the end of the previous window
+    uint8_t counter_known[SAMPLE_MAX_FIELDS];
+    int32_t counter_base[SAMPLE_MAX_FIELDS];
+} aggregate_channel_t;
+
+// Folds a raw sample at board time board_msec into its window. When the
+// sample lies past the open window, that window is closed first and its
+// summary written to summary. A sample older than the latest one does not
+// move the windows. Returns the number of summary samples written, 0 or
+// AGGREGATE_SUMMARY_SAMPLES.
+int aggregate_add(aggregate_channel_t* channel, uint32_t window_msec, const sample_t* sample, int64_t board_msec,
+                  sample_t* summary);
+
+// aggregate_add() in two steps, for frames decoded in batches after their
+// arrival: aggregate_advance() moves the board time to each frame as it
+// arrives, closing the open window like aggregate_add(), and
+// aggregate_fold_columns() later folds the decoded frames into the window.
+// Frames of a window must be folded before the frame that ends it, which
+// aggregate_crosses() tells, advances the board time.
+int aggregate_advance(aggregate_channel_t* channel, uint32_t window_msec, uint8_t device, uint8_t characteristic,
+                      uint16_t timestamp, int64_t board_msec, sample_t* summary);
+
+int aggregate_crosses(const aggregate_channel_t* channel, uint32_t window_msec, int64_t board_msec);
+
+void aggregate_fold_columns(aggregate_channel_t* channel, const sample_columns_t* columns, int64_t received_usec);
+
+// Closes the open window when it holds samples. Same return as aggregate_add().
+int aggregate_close(aggregate_channel_t* channel, sample_t* summary);
+
+// Whether the open window should be closed by host time, its board having
+// gone quiet: it has been open for twice the window length
+static inline int aggregate_expired(const aggregate_channel_t* channel, uint32_t window_msec, int64_t now_msec){
+    return channel->started && now_msec - channel->opened_msec >= 2 * (int64_t)window_msec;
+}
+
+// Closes the open window by host time, once aggregate_expired(), and moves
+// the next window past it on the board clock, so that a late sample of the
+// closed window goes to the next one rather than summarizing it twice.
+// Same return as aggregate_add().
+int aggregate_expire(aggregate_channel_t* channel, uint32_t window_msec, sample_t* summary);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <string.h>
+#include "characteristics.h"
+
+#define LABELS(table, err, how) { table, sizeof(table) / sizeof(table[0]), err, how }
+
+static const char* const led_state_desc[] = {
+    "Led state is OFF",
+    "Led state is ON",
+};
+
+static const char* const acc_ev_flag_desc[] = {
+    "ACC_NOT_USED",
+    "ACC_6D_OR_TOP",
+    "ACC_6D_OR_LEFT",
+    "ACC_6D_OR_BOTTOM",
+    "ACC_6D_OR_RIGHT",
+    "ACC_6D_OR_UP",
+    "ACC_6D_OR_DOWN",
+    "ACC_ERROR",
+    "ACC_TILT",
+    "ACC_FREE_FALL",
+    "ACC_SINGLE_TAP",
+    "ACC_ERROR",
+    "ACC_DOUBLE_TAP",
+    "ACC_ERROR",
+    "ACC_ERROR",
+    "ACC_ERROR",
+    "ACC_WAKE_UP",
+};
+
+static const char* const gesture_flag_desc[] = {
+    "MGR_NOGESTURE",
+    "MGR_PICKUP",
+    "MGR_GLANCE",
+    "MGR_WAKEUP",
+    "MGR_ERROR",
+};
+
+static const char* const activity_flag_desc[] = {
+    "MAR_NOACTIVITY",
+    "MAR_STATIONARY",
+    "MAR_WALKING",
+    "MAR_FASTWALKING",
+    "MAR_JOGGING",
+    "MAR_BIKING",
+    "MAR_DRIVING",
+    "MAR_ERROR",
+};
+
+static const char* const carry_position_flag_desc[] = {
+    "MCP_UNKNOWN",
+    "MCP_ONDESK",
+    "MCP_INHAND",
+    "MCP_NEARHEAD",
+    "MCP_SHIRTPOCKET",
+    "MCP_TROUSERPOCKET",
+    "MCP_ARMSWING",
+    "MCP_JACKETPOCKET",
+};
+
+static const char* const battery_status_flag_desc[] = {
+    "Status of Battery is discharging.",
+    "Status of Battery is charging.",
+    "Error status of Battery",
+    "Status of Battery is unknown.",
+};
+
+static const field_labels_t led_state_labels = LABELS(led_state_desc, 0, LABEL_BY_NONZERO);
+static const field_labels_t acc_ev_labels = LABELS(acc_ev_flag_desc, 7, LABEL_BY_EVENT_BIT);
+static const field_labels_t gesture_labels = LABELS(gesture_flag_desc, 4, LABEL_BY_VALUE);
+static const field_labels_t activity_labels = LABELS(activity_flag_desc, 7, LABEL_BY_VALUE);
+static const field_labels_t carry_position_labels = LABELS(carry_position_flag_desc, 0, LABEL_BY_VALUE);
+static const field_labels_t battery_status_labels = LABELS(battery_status_flag_desc, 2, LABEL_BY_VALUE_MINUS_ONE);
+
+const characteristic_desc_t characteristics[CHARACTERISTICS_COUNT] = {
+    [CHAR_LED_STATE] = { LED_STATE, "Led State", 1, {
+        { "led", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", &led_state_labels, AGGREGATE_LAST },
+    }},
+    [CHAR_LIGHT_SENSOR] = { LIGHT_SENSOR, "Light", 1, {
+        { "light", 2, FIELD_U16, FIELD_ALWAYS, 0, 1, "Lux", NULL },
+    }},
+    [CHAR_BATTERY_STATUS] = { BATTERY_STATUS, "Battery State", 4, {
+        { "batt_soc", 2, FIELD_U16, FIELD_ALWAYS, 0, 1, "%", NULL },
+        { "batt_volt", 4, FIELD_U16, FIELD_ALWAYS, 0, 1, "mV", NULL },
+        { "batt_curr", 6, FIELD_U16, FIELD_ALWAYS, 0, 1, "mA", NULL },
+        { "batt_stat", 8, FIELD_U8, FIELD_ALWAYS, 0, 1, "", &battery_status_labels, AGGREGATE_LAST },
+    }},
+    [CHAR_COMPAS] = { COMPAS, "Compas", 1, {
+        { "compass", 2, FIELD_U16, FIELD_ALWAYS, 0, 100, "*", NULL },
+    }},
+    [CHAR_CARRY_POSITION] = { CARRY_POSITION, "Carry Position", 1, {
+        { "carry", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", &carry_position_labels, AGGREGATE_LAST },
+    }},
+    [CHAR_ACTIVITY_REC] = { ACTIVITY_REC, "Activity Recognition", 1, {
+        { "activity", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", &activity_labels, AGGREGATE_LAST },
+    }},
+    [CHAR_GESTURE_RECOGN] = { GESTURE_RECOGN, "Gesture Recognition", 1, {
+        { "gesture", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", &gesture_labels, AGGREGATE_LAST },
+    }, EVENT_ALWAYS },
+    [CHAR_ORIENT_ESTIM] = { ORIENT_ESTIM, "Orientation Estimation", 9, {
+        { "quat0_X", 2, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat0_Y", 4, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat0_Z", 6, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat1_X", 8, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat1_Y", 10, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat1_Z", 12, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat2_X", 14, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat2_Y", 16, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+        { "quat2_Z", 18, FIELD_U16, FIELD_ALWAYS, 0, 1000, "", NULL },
+    }},
+    [CHAR_AUDIO_LVL] = { AUDIO_LVL, "Audio Level", 1, {
+        { "audio", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", NULL },
+    }},
+    [CHAR_ACC_GYRO_MAG] = { ACC_GYRO_MAG, "Accelerometer Gyroscope Magnetometer", 9, {
+        { "acc_x", 2, FIELD_S16, FIELD_ALWAYS, 0, 1, "mg", NULL },
+        { "acc_y", 4, FIELD_S16, FIELD_ALWAYS, 0, 1, "mg", NULL },
+        { "acc_z", 6, FIELD_S16, FIELD_ALWAYS, 0, 1, "mg", NULL },
+        { "gyro_x", 8, FIELD_S16, FIELD_ALWAYS, 0, 1, "mdps/100", NULL },
+        { "gyro_y", 10, FIELD_S16, FIELD_ALWAYS, 0, 1, "mdps/100", NULL },
+        { "gyro_z", 12, FIELD_S16, FIELD_ALWAYS, 0, 1, "mdps/100", NULL },
+        { "mag_x", 14, FIELD_S16, FIELD_ALWAYS, 0, 1, "mGa", NULL },
+        { "mag_y", 16, FIELD_S16, FIELD_ALWAYS, 0, 1, "mGa", NULL },
+        { "mag_z", 18, FIELD_S16, FIELD_ALWAYS, 0, 1, "mGa", NULL },
+    }},
+    // The byte after the event flags holds a second flag byte, or the low
+    // half of the step counter when no event is flagged
+    [CHAR_ACCEL_EV] = { ACCEL_EV, "Accelerometer Events", 3, {
+        { "acc_ev_fl_1", 2, FIELD_U8, FIELD_ALWAYS, 0, 1, "", NULL, AGGREGATE_LAST },
+        { "acc_ev_fl_2", 3, FIELD_U8, FIELD_WHEN_NONZERO, 0, 1, "", &acc_ev_labels, AGGREGATE_LAST },
+        { "acc_steps", 3, FIELD_U16, FIELD_WHEN_ZERO, 0, 1, "", NULL, AGGREGATE_DELTA },
+    }, EVENT_WHEN_FLAGGED },
+};
+
+// One field compiled for decode_frame(): value = lo | (hi << 8 & hi_mask),
+// sign extended through sign, zeroed unless the presence test passes
+typedef struct {
+    uint8_t lo;
+    uint8_t hi;
+    uint16_t hi_mask;
+    int32_t sign;
+    uint8_t conditional;
+    uint8_t presence_field;
+    uint8_t when_zero;
+} decode_op_t;
+
+typedef struct {
+    // Frames shorter than this are rejected
+    uint8_t min_length;
+    // Frames at least this long are decoded in place, shorter ones are
+    // zero padded first so absent conditional fields read as 0
+    uint8_t full_length;
+    uint8_t count;
+    decode_op_t ops[SAMPLE_MAX_FIELDS];
+} decoder_t;
+
+static decoder_t decoders[CHARACTERISTICS_COUNT];
+
+static uint8_t field_size(field_type_t type){
+    return type == FIELD_U8 ? 1 : 2;
+}
+
+int decoder_init(void){
+    uint8_t c;
+    uint8_t f;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        const characteristic_desc_t* desc = &characteristics[c];
+        decoder_t* decoder = &decoders[c];
+
+        if (desc->field_count > SAMPLE_MAX_FIELDS){
+            return -1;
+        }
+        decoder->min_length = SENSIBLE_TIMESTAMP_SIZE;
+        decoder->full_length = SENSIBLE_TIMESTAMP_SIZE;
+        decoder->count = desc->field_count;
+
+        for (f = 0; f < desc->field_count; f++){
+            const field_desc_t* field = &desc->fields[f];
+            decode_op_t* op = &decoder->ops[f];
+            uint8_t end = field->offset + field_size(field->type);
+
+            if (end > SENSIBLE_FRAME_MAX){
+                return -1;
+            }
+            if (field->presence != FIELD_ALWAYS && field->presence_field >= f){
+                return -1;
+            }
+            op->lo = field->offset;
+            op->hi = (field->type == FIELD_U8) ? field->offset : field->offset + 1;
+            op->hi_mask = (field->type == FIELD_U8) ? 0 : 0xFF00;
+            op->sign = (field->type == FIELD_S16) ? 0x8000 : 0;
+            op->conditional = (field->presence != FIELD_ALWAYS);
+            op->presence_field = field->presence_field;
+            op->when_zero = (field->presence == FIELD_WHEN_ZERO);
+
+            if (!op->conditional && end > decoder->min_length){
+                decoder->min_length = end;
+            }
+            if (end > decoder->full_length){
+                decoder->full_length = end;
+            }
+        }
+    }
+    return 0;
+}
+
+uint8_t decoder_min_length(uint8_t characteristic){
+    return decoders[characteristic].min_length;
+}
+
+int decode_frame(uint8_t characteristic, const uint8_t* data, size_t data_length, sample_t* sample){
+    const decoder_t* decoder = &decoders[characteristic];
+    uint8_t padded[SENSIBLE_FRAME_MAX];
+    const uint8_t* frame = data;
+    uint8_t i;
+
+    if (data_length < decoder->min_length){
+        return -1;
+    }
+    if (data_length < decoder->full_length){
+        memcpy(padded, data, data_length);
+        memset(padded + data_length, 0, sizeof(padded) - data_length);
+        frame = padded;
+    }
+
+    sample->timestamp = (uint16_t)(frame[0] | (frame[1] << 8));
+    sample->characteristic = characteristic;
+    sample->statistic = SAMPLE_RAW;
+    sample->omitted = 0;
+    sample->time_usec = 0;
+    sample->count = decoder->count;
+
+    for (i = 0; i < decoder->count; i++){
+        const decode_op_t* op = &decoder->ops[i];
+        int32_t value = frame[op->lo] | ((frame[op->hi] << 8) & op->hi_mask);
+        int32_t present = !op->conditional |
+                          ((sample->values[op->presence_field] == 0) == op->when_zero);
+
+        value = (value ^ op->sign) - op->sign;
+        sample->values[i] = value & -present;
+    }
+    return 0;
+}
+
+int sample_field_present(const sample_t* sample, uint8_t field){
+    const field_desc_t* desc = &characteristics[sample->characteristic].fields[field];
+
+    return desc->presence == FIELD_ALWAYS ||
+           (sample->values[desc->presence_field] == 0) == (desc->presence == FIELD_WHEN_ZERO);
+}
+
+int sample_is_event(const sample_t* sample){
+    event_kind_t event = characteristics[sample->characteristic].event;
+
+    return sample->statistic == SAMPLE_RAW &&
+           (event == EVENT_ALWAYS || (event == EVENT_WHEN_FLAGGED && sample->values[0] != 0));
+}
+
+int characteristic_by_field(const char* name){
+    uint8_t c;
+    uint8_t f;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        for (f = 0; f < characteristics[c].field_count; f++){
+            if (strcmp(characteristics[c].fields[f].name, name) == 0){
+                return c;
+            }
+        }
+    }
+    return -1;
+}
+
+const char* statistic_name(uint8_t statistic){
+    static const char* const names[SAMPLE_STATISTICS_COUNT] = { "", "min", "max", "mean", "rms" };
+
+    return statistic < SAMPLE_STATISTICS_COUNT ? names[statistic] : "";
+}
+
+static const char* field_label(const field_labels_t* labels, int32_t value){
+    uint32_t index = (uint32_t)value;
+
+    switch (labels->map){
+    case LABEL_BY_VALUE_MINUS_ONE:
+        index = (value == 0) ? labels->error_index : (uint32_t)value - 1;
+        break;
+    case LABEL_BY_NONZERO:
+        index = (value != 0);
+        break;
+    case LABEL_BY_EVENT_BIT:
+        if (index > 0x08 && index < 0x10){
+            index = labels->error_index;
+        }else if (index >= 0x10){
+            if (index != 0x10 && index != 0x20 && index != 0x40 && index != 0x80){
+                index = labels->error_index;
+            }else{
+                index = (index >> 4) + 0x08;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    if (index >= labels->count){
+        index = labels->error_index;
+    }
+    return labels->text[index];
+}
+
+int format_sample(const sample_t* sample, char* buffer, size_t size){
+    const characteristic_desc_t* desc = &characteristics[sample->characteristic];
+    size_t length;
+    uint8_t i;
+
+    length = (size_t)snprintf(buffer, size, " ts=%05u", sample->timestamp);
+    if (sample->statistic != SAMPLE_RAW && length < size){
+        length += (size_t)snprintf(buffer + length, size - length, " stat=%s", statistic_name(sample->statistic));
+    }
+    for (i = 0; i < sample->count && length < size; i++){
+        const field_desc_t* field = &desc->fields[i];
+
+        if (!sample_field_present(sample, i)){
+            continue;
+        }
+        if (field->labels != NULL){
+            length += (size_t)snprintf(buffer + length, size - length, " %s=\"%s\"", field->name,
+                                       field_label(field->labels, sample->values[i]));
+        }else{
+            length += (size_t)snprintf(buffer + length, size - length, " %s=%d%s", field->name,
+                                       sample->values[i] / field->scale, field->unit);
+        }
+    }
+    return (int)(length < size ? length : size - 1);
+}
+
+int format_sample_json(const char* device_id, const sample_t* sample, char* buffer, size_t size){
+    const characteristic_desc_t* desc = &characteristics[sample->characteristic];
+    const char* separator = "";
+    size_t length;
+    uint8_t i;
+
+    length = (size_t)snprintf(buffer, size, "{\"dev\":\"%s\",\"ts\":%u,", device_id, sample->timestamp);
+    if (sample->time_usec != 0 && length < size){
+        length += (size_t)snprintf(buffer + length, size - length, "\"time\":%lld,",
+                                   (long long)(sample->time_usec / 1000));
+    }
+    if (sample->statistic != SAMPLE_RAW && length < size){
+        length += (size_t)snprintf(buffer + length, size - length, "\"stat\":\"%s\",",
+                                   statistic_name(sample->statistic));
+    }
+    if (length < size){
+        length += (size_t)snprintf(buffer + length, size - length, "\"d\":{");
+    }
+    for (i = 0; i < sample->count && i < desc->field_count && length < size; i++){
+        if (sample->omitted & (1u << i)){
+            continue;
+        }
+        length += (size_t)snprintf(buffer + length, size - length, "%s\"%s\":%d", separator,
+                                   desc->fields[i].name, sample->values[i]);
+        separator = ",";
+    }
+    if (length < size){
+        length += (size_t)snprintf(buffer + length, size - length, "}}");
+    }
+    return (int)(length < size ? length : size - 1);
+}
@@ -0,0 +1,160 @@
+#ifndef CHARACTERISTICS_H
+#define CHARACTERISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// UUID of Characteristics, used in SensiBLE
+#define LED_STATE       "20000000-0001-11e1-ac36-0002a5d5c51b"
+#define LIGHT_SENSOR    "01000000-0001-11e1-ac36-0002a5d5c51b"
+#define BATTERY_STATUS  "00020000-0001-11e1-ac36-0002a5d5c51b"
+#define COMPAS          "00000040-0001-11e1-ac36-0002a5d5c51b"
+#define CARRY_POSITION  "00000008-0001-11e1-ac36-0002a5d5c51b"
+#define ACTIVITY_REC    "00000010-0001-11e1-ac36-0002a5d5c51b"
+#define GESTURE_RECOGN  "00000002-0001-11e1-ac36-0002a5d5c51b"
+#define ORIENT_ESTIM    "00000100-0001-11e1-ac36-0002a5d5c51b"
+#define AUDIO_LVL       "04000000-0001-11e1-ac36-0002a5d5c51b"
+#define ACC_GYRO_MAG    "00e00000-0001-11e1-ac36-0002a5d5c51b"
+#define ACCEL_EV        "00000400-0001-11e1-ac36-0002a5d5c51b"
+
+// Index of each characteristic in characteristics[]
+enum {
+    CHAR_LED_STATE,
+    CHAR_LIGHT_SENSOR,
+    CHAR_BATTERY_STATUS,
+    CHAR_COMPAS,
+    CHAR_CARRY_POSITION,
+    CHAR_ACTIVITY_REC,
+    CHAR_GESTURE_RECOGN,
+    CHAR_ORIENT_ESTIM,
+    CHAR_AUDIO_LVL,
+    CHAR_ACC_GYRO_MAG,
+    CHAR_ACCEL_EV,
+    // Nuber of characteristics
+    CHARACTERISTICS_COUNT
+};
+
+// Longest notification payload of a SensiBLE characteristic
+#define SENSIBLE_FRAME_MAX 20
+
+// Every frame starts with a little-endian 16-bit millisecond timestamp
+#define SENSIBLE_TIMESTAMP_SIZE 2
+
+typedef enum {
+    FIELD_U8,
+    FIELD_U16,
+    FIELD_S16,
+} field_type_t;
+
+// Fields that only exist for some values of an earlier field of the frame
+typedef enum {
+    FIELD_ALWAYS,
+    FIELD_WHEN_ZERO,
+    FIELD_WHEN_NONZERO,
+} field_presence_t;
+
+// How a field is summarized over an aggregation window
+typedef enum {
+    AGGREGATE_STATS,       // min, max, mean and RMS
+    AGGREGATE_LAST,        // states and flags: the last value seen
+    AGGREGATE_DELTA,       // counters: the increase over the window, modulo 2^16
+} field_aggregate_t;
+
+// Which frames of a characteristic are discrete events, such as a free fall
+// or a gesture, rather than periodic telemetry. Events are never
+// aggregated and go ahead of telemetry.
+typedef enum {
+    EVENT_NEVER,
+    EVENT_ALWAYS,
+    EVENT_WHEN_FLAGGED,    // when the first field, a flag byte, is nonzero
+} event_kind_t;
+
+// How a raw value selects its description in the debug output
+typedef enum {
+    LABEL_BY_VALUE,        // value indexes the table
+    LABEL_BY_VALUE_MINUS_ONE,
+    LABEL_BY_NONZERO,      // 0 selects the first entry, anything else the second
+    LABEL_BY_EVENT_BIT,    // 6D orientation below 0x09, single bit events from 0x10
+} label_map_t;
+
+typedef struct {
+    const char* const* text;
+    uint8_t count;
+    uint8_t error_index;
+    label_map_t map;
+} field_labels_t;
+
+typedef struct {
+    // Name of the field in published events
+    const char* name;
+    uint8_t offset;
+    field_type_t type;
+    field_presence_t presence;
+    // Index, in the same frame, of the field presence depends on
+    uint8_t presence_field;
+    // Divisor and unit of the human readable value, debug output only
+    uint16_t scale;
+    const char* unit;
+    const field_labels_t* labels;
+    field_aggregate_t aggregate;
+} field_desc_t;
+
+typedef struct {
+    const char* uuid;
+    const char* title;
+    uint8_t field_count;
+    field_desc_t fields[SAMPLE_MAX_FIELDS];
+    event_kind_t event;
+} characteristic_desc_t;
+
+// Frame layouts of every characteristic, indexed by CHAR_*
+extern const characteristic_desc_t characteristics[CHARACTERISTICS_COUNT];
+
+// Compiles characteristics[] into the decoder tables. Returns 0 on
+// success, -1 when a layout is inconsistent.
+int decoder_init(void);
+
+// Shortest frame accepted for a characteristic
+uint8_t decoder_min_length(uint8_t characteristic);
+
+// Decodes one notification into sample, leaving device untouched.
+// Returns -1 without reading data when the frame is too short.
+int decode_frame(uint8_t characteristic, const uint8_t* data, size_t data_length, sample_t* sample);
+
+// Whether field of a decoded sample exists, per its presence condition
+int sample_field_present(const sample_t* sample, uint8_t field);
+
+// Whether a sample is a discrete event: a raw sample of a characteristic
+// whose frames all are, or whose event flag it carries
+int sample_is_event(const sample_t* sample);
+
+// Characteristic having a field of that name, -1 when none has
+int characteristic_by_field(const char* name);
+
+// Suffix naming a statistic in events, "" for SAMPLE_RAW
+const char* statistic_name(uint8_t statistic);
+
+// Appends the fields of a decoded sample to buffer as " name=value" pairs
+// in human readable units. Returns the length written, truncated to size.
+int format_sample(const sample_t* sample, char* buffer, size_t size);
+
+// Longest line format_sample_json() writes
+#define SAMPLE_JSON_SIZE 512
+
+// Writes a sample as a one-line JSON document with its raw values:
+// {"dev":"MAC","ts":1234,"time":1760000000123,"stat":"mean","d":{...}},
+// with the Unix time in ms once known, "stat" only for summaries and
+// without the fields set in sample->omitted. Returns the length written,
+// truncated to size.
+int format_sample_json(const char* device_id, const sample_t* sample, char* buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "device_clock.h"
+#include "monotonic.h"
+
+void device_clock_reset(device_clock_t* clock){
+    memset(clock, 0, sizeof(*clock));
+}
+
+// Takes the frame at board_msec, received at received_usec, as the new
+// origin of the model and of the current epoch
+static void device_clock_anchor(device_clock_t* clock, int64_t board_msec, int64_t received_usec){
+    clock->anchor_msec = board_msec;
+    clock->anchor_usec = received_usec;
+    clock->epoch_start_msec = board_msec;
+    clock->epoch_min_msec = board_msec;
+    clock->epoch_min_usec = received_usec;
+}
+
+// Estimates the drift from the earliest arrival of this epoch and the
+// start of the baseline once it is long enough, and moves the model onto
+// the earliest arrival
+static void device_clock_close_epoch(device_clock_t* clock){
+    int64_t span = clock->epoch_min_msec - clock->baseline_msec;
+
+    if (clock->has_baseline && span >= DEVICE_CLOCK_DRIFT_SPAN_MSEC){
+        double ppm = (double)(span * 1000 - (clock->epoch_min_usec - clock->baseline_usec)) * 1000.0 / (double)span;
+
+        if (ppm <= DEVICE_CLOCK_MAX_DRIFT_PPM && ppm >= -DEVICE_CLOCK_MAX_DRIFT_PPM){
+            clock->drift_ppm += clock->estimates == 0 ? ppm - clock->drift_ppm :
+                                (ppm - clock->drift_ppm) / DEVICE_CLOCK_DRIFT_SMOOTHING;
+            clock->estimates++;
+        }
+    }
+    if (!clock->has_baseline || span >= DEVICE_CLOCK_DRIFT_SPAN_MSEC){
+        clock->has_baseline = 1;
+        clock->baseline_msec = clock->epoch_min_msec;
+        clock->baseline_usec = clock->epoch_min_usec;
+    }
+    clock->anchor_msec = clock->epoch_min_msec;
+    clock->anchor_usec = clock->epoch_min_usec;
+}
+
+int64_t device_clock_update(device_clock_t* clock, uint16_t timestamp, int64_t received_usec){
+    int64_t predicted;
+    int64_t board;
+    int64_t late;
+
+    clock->frames++;
+    if (received_usec >= clock->realtime_refresh_usec){
+        clock->realtime_offset_usec = realtime_offset_usec();
+        clock->realtime_refresh_usec = received_usec + DEVICE_CLOCK_REALTIME_REFRESH_USEC;
+    }
+    if (!clock->synced){
+        clock->synced = 1;
+        clock->last_timestamp = timestamp;
+        clock->board_msec = 0;
+        clock->last_received_usec = received_usec;
+        device_clock_anchor(clock, 0, received_usec);
+        return 0;
+    }
+
+    // The board time closest to what the host clock predicts, a wrap of
+    // the 16 bits being 65.5 s away on either side
+    predicted = clock->board_msec + (int64_t)((double)(received_usec - clock->last_received_usec) *
+                                              (1.0 + clock->drift_ppm / 1e6) / 1000.0);
+    board = predicted + (int16_t)(uint16_t)(timestamp - (uint16_t)(clock->last_timestamp +
+                                                                   (predicted - clock->board_msec)));
+    // Notifications of several characteristics may arrive slightly out of
+    // order, only a later frame moves the clock
+    if (board > clock->board_msec){
+        clock->rollovers += (uint32_t)((clock->last_timestamp + (board - clock->board_msec)) >> 16);
+        clock->board_msec = board;
+        clock->last_timestamp = timestamp;
+        clock->last_received_usec = received_usec;
+    }
+
+    late = received_usec - device_clock_host_usec(clock, board);
+    if (late > DEVICE_CLOCK_STEP_MSEC * 1000 || late < -DEVICE_CLOCK_STEP_MSEC * 1000){
+        clock->steps++;
+        clock->has_baseline = 0;
+        clock->board_msec = board;
+        clock->last_timestamp = timestamp;
+        clock->last_received_usec = received_usec;
+        device_clock_anchor(clock, board, received_usec);
+        return board;
+    }
+    // Earlier than the model allows: the lower envelope moved down
+    if (late < 0){
+        clock->anchor_msec = board;
+        clock->anchor_usec = received_usec;
+    }
+    if (received_usec - device_clock_host_usec(clock, board) <=
+        clock->epoch_min_usec - device_clock_host_usec(clock, clock->epoch_min_msec)){
+        clock->epoch_min_msec = board;
+        clock->epoch_min_usec = received_usec;
+    }
+    if (board - clock->epoch_start_msec >= DEVICE_CLOCK_EPOCH_MSEC){
+        device_clock_close_epoch(clock);
+        clock->epoch_start_msec = board;
+        clock->epoch_min_msec = board;
+        clock->epoch_min_usec = received_usec;
+    }
+    return board;
+}
@@ -0,0 +1,108 @@
+#ifndef DEVICE_CLOCK_H
+#define DEVICE_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Board time over which the earliest arrival is taken, the model moving
+// onto it at the end of each epoch
+#define DEVICE_CLOCK_EPOCH_MSEC 10000
+
+// Least board time between the two earliest arrivals a drift estimate is
+// taken from: a millisecond tick only tells drift over a long baseline
+#define DEVICE_CLOCK_DRIFT_SPAN_MSEC 60000
+
+// Largest drift estimate believed, crystals stay well within it
+#define DEVICE_CLOCK_MAX_DRIFT_PPM 20000
+
+// Distance from the model beyond which an arrival is taken for a step of
+// the board clock, a board reset for instance, and the model starts over
+#define DEVICE_CLOCK_STEP_MSEC 2000
+
+// Weight of a new drift estimate, 1/DEVICE_CLOCK_DRIFT_SMOOTHING
+#define DEVICE_CLOCK_DRIFT_SMOOTHING 4
+
+// How often the offset from host time to Unix time is read again, so a
+// wall clock set meanwhile shows in the sample times
+#define DEVICE_CLOCK_REALTIME_REFRESH_USEC 1000000
+
+// Board clock of one board. Frames only carry the low 16 bits of the
+// board millisecond tick, which wraps every 65.5 s and has no relation to
+// host time. The clock extends it to 64 bits, resolving each timestamp
+// to the board time closest to what the host clock predicts, so silences
+// longer than a wrap are no longer ambiguous.
+//
+// It then maps board time to CLOCK_MONOTONIC. A notification can only
+// arrive late, so the earliest arrivals relative to board time trace the
+// offset between the clocks: the model follows that lower envelope, and
+// its slope over DEVICE_CLOCK_DRIFT_SPAN_MSEC gives the drift.
+typedef struct {
+    uint8_t synced;
+    uint16_t last_timestamp;
+    // Latest board time seen, in ms since the first frame
+    int64_t board_msec;
+    int64_t last_received_usec;
+    // Host time of board time anchor_msec, the drift scaling the rest
+    int64_t anchor_msec;
+    int64_t anchor_usec;
+    // How much faster the board clock runs than the host clock
+    double drift_ppm;
+    // Earliest arrival of the current epoch, and the start of the drift
+    // baseline
+    int64_t epoch_start_msec;
+    int64_t epoch_min_msec;
+    int64_t epoch_min_usec;
+    uint8_t has_baseline;
+    int64_t baseline_msec;
+    int64_t baseline_usec;
+    // realtime_offset_usec() of the host, read at most once per refresh
+    int64_t realtime_offset_usec;
+    int64_t realtime_refresh_usec;
+    uint64_t frames;
+    uint32_t rollovers;
+    // Drift estimates folded in, and steps of the board clock
+    uint32_t estimates;
+    uint32_t steps;
+} device_clock_t;
+
+// A clock that has seen no frame yet, or forgets everything it saw, for a
+// board that may have been reset
+void device_clock_reset(device_clock_t* clock);
+
+// Folds in the timestamp of a frame received at received_usec, a
+// CLOCK_MONOTONIC time. Returns its board time.
+int64_t device_clock_update(device_clock_t* clock, uint16_t timestamp, int64_t received_usec);
+
+// Board time of a timestamp within 32 s of the latest frame, e.g. the
+// start of a window
+static inline int64_t device_clock_board_msec(const device_clock_t* clock, uint16_t timestamp){
+    return clock->board_msec + (int16_t)(uint16_t)(timestamp - clock->last_timestamp);
+}
+
+// CLOCK_MONOTONIC time of a board time. Notifications take a transmission
+// delay the clocks cannot tell apart from the offset, so this is the
+// arrival of the fastest possible notification, slightly after the board
+// took its sample.
+static inline int64_t device_clock_host_usec(const device_clock_t* clock, int64_t board_msec){
+    int64_t elapsed = board_msec - clock->anchor_msec;
+
+    return clock->anchor_usec + elapsed * 1000 - (int64_t)((double)elapsed * clock->drift_ppm / 1000.0);
+}
+
+// Unix time of a timestamp within 32 s of the latest frame, 0 before the
+// first frame
+static inline int64_t device_clock_time_usec(const device_clock_t* clock, uint16_t timestamp){
+    if (!clock->synced){
+        return 0;
+    }
+    return device_clock_host_usec(clock, device_clock_board_msec(clock, timestamp)) + clock->realtime_offset_usec;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
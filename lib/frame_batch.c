@@ -0,0 +1,210 @@
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "frame_batch.h"
+
+// Fields of a vectorized layout, the first one and the eight that fill
+// the last 16 bytes of the frame
+#define PACKED_FIELDS 9
+#define PACKED_TAIL_OFFSET (SENSIBLE_FRAME_MAX - 16)
+
+static uint8_t vectorized[CHARACTERISTICS_COUNT];
+static uint8_t vectorized_signed[CHARACTERISTICS_COUNT];
+
+void frame_batch_init(void){
+    uint8_t c;
+    uint8_t f;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        const characteristic_desc_t* desc = &characteristics[c];
+        int packed = (desc->field_count == PACKED_FIELDS);
+
+        for (f = 0; packed && f < desc->field_count; f++){
+            const field_desc_t* field = &desc->fields[f];
+            packed = field->presence == FIELD_ALWAYS && field->type != FIELD_U8 &&
+                     field->type == desc->fields[0].type && field->offset == SENSIBLE_TIMESTAMP_SIZE + 2 * f;
+        }
+        vectorized[c] = (uint8_t)packed;
+        vectorized_signed[c] = packed && desc->fields[0].type == FIELD_S16;
+    }
+}
+
+int frame_batch_vectorized(uint8_t characteristic){
+    return vectorized[characteristic];
+}
+
+const char* frame_batch_isa(void){
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static void decode_one(const frame_batch_t* batch, uint32_t i, sample_columns_t* columns){
+    sample_t sample;
+    uint8_t f;
+
+    decode_frame(batch->characteristic, batch->frames[i], SENSIBLE_FRAME_MAX, &sample);
+    columns->timestamps[i] = sample.timestamp;
+    for (f = 0; f < sample.count; f++){
+        columns->columns[f][i] = sample.values[f];
+    }
+}
+
+void frame_batch_decode_scalar(const frame_batch_t* batch, sample_columns_t* columns){
+    uint32_t i;
+
+    columns->characteristic = batch->characteristic;
+    columns->count = batch->count;
+    for (i = 0; i < batch->count; i++){
+        decode_one(batch, i, columns);
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// Timestamp and first field, which sit before the 16-byte tail
+static void decode_head(const frame_batch_t* batch, uint32_t i, int is_signed, sample_columns_t* columns){
+    const uint8_t* frame = batch->frames[i];
+    uint16_t first = (uint16_t)(frame[2] | (frame[3] << 8));
+
+    columns->timestamps[i] = (uint16_t)(frame[0] | (frame[1] << 8));
+    columns->columns[0][i] = is_signed ? (int16_t)first : first;
+}
+#endif
+
+#if defined(__SSE2__)
+// Transposes the tails of 8 frames, rows[k] receiving field k + 1 of each
+static void transpose_tails(const frame_batch_t* batch, uint32_t i, __m128i rows[8]){
+    __m128i v[8];
+    __m128i a[8];
+    __m128i b[8];
+    uint8_t k;
+
+    for (k = 0; k < 8; k++){
+        v[k] = _mm_loadu_si128((const __m128i*)(batch->frames[i + k] + PACKED_TAIL_OFFSET));
+    }
+    for (k = 0; k < 4; k++){
+        a[2 * k] = _mm_unpacklo_epi16(v[2 * k], v[2 * k + 1]);
+        a[2 * k + 1] = _mm_unpackhi_epi16(v[2 * k], v[2 * k + 1]);
+    }
+    for (k = 0; k < 2; k++){
+        b[4 * k] = _mm_unpacklo_epi32(a[4 * k], a[4 * k + 2]);
+        b[4 * k + 1] = _mm_unpackhi_epi32(a[4 * k], a[4 * k + 2]);
+        b[4 * k + 2] = _mm_unpacklo_epi32(a[4 * k + 1], a[4 * k + 3]);
+        b[4 * k + 3] = _mm_unpackhi_epi32(a[4 * k + 1], a[4 * k + 3]);
+    }
+    for (k = 0; k < 4; k++){
+        rows[2 * k] = _mm_unpacklo_epi64(b[k], b[k + 4]);
+        rows[2 * k + 1] = _mm_unpackhi_epi64(b[k], b[k + 4]);
+    }
+}
+#endif
+
+#if defined(__AVX2__)
+static void decode_block(const frame_batch_t* batch, uint32_t i, int is_signed, sample_columns_t* columns){
+    __m128i rows[8];
+    uint8_t k;
+
+    transpose_tails(batch, i, rows);
+    for (k = 0; k < 8; k++){
+        __m256i wide = is_signed ? _mm256_cvtepi16_epi32(rows[k]) : _mm256_cvtepu16_epi32(rows[k]);
+        _mm256_storeu_si256((__m256i*)&columns->columns[k + 1][i], wide);
+    }
+}
+#elif defined(__SSE2__)
+static void decode_block(const frame_batch_t* batch, uint32_t i, int is_signed, sample_columns_t* columns){
+    __m128i zero = _mm_setzero_si128();
+    __m128i rows[8];
+    uint8_t k;
+
+    transpose_tails(batch, i, rows);
+    for (k = 0; k < 8; k++){
+        __m128i lo;
+        __m128i hi;
+
+        if (is_signed){
+            lo = _mm_srai_epi32(_mm_unpacklo_epi16(rows[k], rows[k]), 16);
+            hi = _mm_srai_epi32(_mm_unpackhi_epi16(rows[k], rows[k]), 16);
+        }else{
+            lo = _mm_unpacklo_epi16(rows[k], zero);
+            hi = _mm_unpackhi_epi16(rows[k], zero);
+        }
+        _mm_storeu_si128((__m128i*)&columns->columns[k + 1][i], lo);
+        _mm_storeu_si128((__m128i*)&columns->columns[k + 1][i + 4], hi);
+    }
+}
+#elif defined(__ARM_NEON)
+static void decode_block(const frame_batch_t* batch, uint32_t i, int is_signed, sample_columns_t* columns){
+    uint16x8_t v[8];
+    uint16x8_t rows[8];
+    uint16x8x2_t t[4];
+    uint32x4x2_t even[2];
+    uint32x4x2_t odd[2];
+    uint8_t k;
+
+    for (k = 0; k < 8; k++){
+        v[k] = vld1q_u16((const uint16_t*)(batch->frames[i + k] + PACKED_TAIL_OFFSET));
+    }
+    for (k = 0; k < 4; k++){
+        t[k] = vtrnq_u16(v[2 * k], v[2 * k + 1]);
+    }
+    for (k = 0; k < 2; k++){
+        even[k] = vtrnq_u32(vreinterpretq_u32_u16(t[2 * k].val[0]), vreinterpretq_u32_u16(t[2 * k + 1].val[0]));
+        odd[k] = vtrnq_u32(vreinterpretq_u32_u16(t[2 * k].val[1]), vreinterpretq_u32_u16(t[2 * k + 1].val[1]));
+    }
+    for (k = 0; k < 2; k++){
+        rows[2 * k] = vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(even[0].val[k]), vget_low_u32(even[1].val[k])));
+        rows[2 * k + 4] = vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(even[0].val[k]), vget_high_u32(even[1].val[k])));
+        rows[2 * k + 1] = vreinterpretq_u16_u32(vcombine_u32(vget_low_u32(odd[0].val[k]), vget_low_u32(odd[1].val[k])));
+        rows[2 * k + 5] = vreinterpretq_u16_u32(vcombine_u32(vget_high_u32(odd[0].val[k]), vget_high_u32(odd[1].val[k])));
+    }
+    for (k = 0; k < 8; k++){
+        int32_t* out = &columns->columns[k + 1][i];
+        if (is_signed){
+            int16x8_t row = vreinterpretq_s16_u16(rows[k]);
+            vst1q_s32(out, vmovl_s16(vget_low_s16(row)));
+            vst1q_s32(out + 4, vmovl_s16(vget_high_s16(row)));
+        }else{
+            vst1q_s32(out, vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(rows[k]))));
+            vst1q_s32(out + 4, vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(rows[k]))));
+        }
+    }
+}
+#endif
+
+void frame_batch_decode(const frame_batch_t* batch, sample_columns_t* columns){
+    uint8_t c = batch->characteristic;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    int is_signed = vectorized_signed[c];
+#endif
+    uint32_t i = 0;
+
+    if (!vectorized[c]){
+        frame_batch_decode_scalar(batch, columns);
+        return;
+    }
+    columns->characteristic = c;
+    columns->count = batch->count;
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    for (; i + 8 <= batch->count; i += 8){
+        uint32_t j;
+        for (j = i; j < i + 8; j++){
+            decode_head(batch, j, is_signed, columns);
+        }
+        decode_block(batch, i, is_signed, columns);
+    }
+#endif
+    for (; i < batch->count; i++){
+        decode_one(batch, i, columns);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef FRAME_BATCH_H
+#define FRAME_BATCH_H
+
+#include <stdint.h>
+#include "characteristics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most frames held by a batch
+#define FRAME_BATCH_MAX 16
+
+// Raw frames of one characteristic waiting to be decoded together, each
+// zero padded to SENSIBLE_FRAME_MAX bytes
+typedef struct {
+    uint8_t characteristic;
+    uint32_t count;
+    // Host time each frame arrived at
+    int64_t received_usec[FRAME_BATCH_MAX];
+    uint8_t frames[FRAME_BATCH_MAX][SENSIBLE_FRAME_MAX];
+} frame_batch_t;
+
+// Decoded batch as structure of arrays: columns[f][i] is field f of frame i
+typedef struct {
+    uint8_t characteristic;
+    uint32_t count;
+    uint16_t timestamps[FRAME_BATCH_MAX];
+    int32_t columns[SAMPLE_MAX_FIELDS][FRAME_BATCH_MAX];
+} sample_columns_t;
+
+// Finds the layouts frame_batch_decode() vectorizes: nine always present
+// 16-bit fields of one signedness filling the frame after the timestamp,
+// as ACC_GYRO_MAG and ORIENT_ESTIM. Call after decoder_init().
+void frame_batch_init(void);
+
+int frame_batch_vectorized(uint8_t characteristic);
+
+// Instruction set frame_batch_decode() was built for: "avx2", "sse2",
+// "neon" or "scalar"
+const char* frame_batch_isa(void);
+
+// Decodes every frame of batch, vectorized when the layout allows it
+void frame_batch_decode(const frame_batch_t* batch, sample_columns_t* columns);
+
+// Same result one frame at a time through decode_frame()
+void frame_batch_decode_scalar(const frame_batch_t* batch, sample_columns_t* columns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
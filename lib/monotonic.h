@@ -0,0 +1,37 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline int64_t monotonic_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline int64_t monotonic_msec(void){
+    return monotonic_usec() / 1000;
+}
+
+static inline int64_t realtime_usec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Adds to a CLOCK_MONOTONIC time to get Unix time, until the wall clock
+// is set
+static inline int64_t realtime_offset_usec(void){
+    return realtime_usec() - monotonic_usec();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
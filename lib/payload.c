@@ -0,0 +1,358 @@
+#include <string.h>
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#include "characteristics.h"
+#include "payload.h"
+
+// Longest device ID stored in a batch
+#define PAYLOAD_DEVICE_ID_MAX 255
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t length;
+    int overflow;
+} writer_t;
+
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    int overflow;
+} reader_t;
+
+static void put_u8(writer_t* w, uint8_t v){
+    if (w->length + 1 > w->size){
+        w->overflow = 1;
+        return;
+    }
+    w->data[w->length++] = v;
+}
+
+static void put_u16(writer_t* w, uint16_t v){
+    if (w->length + 2 > w->size){
+        w->overflow = 1;
+        return;
+    }
+    w->data[w->length++] = (uint8_t)v;
+    w->data[w->length++] = (uint8_t)(v >> 8);
+}
+
+static void put_u64(writer_t* w, uint64_t v){
+    put_u16(w, (uint16_t)v);
+    put_u16(w, (uint16_t)(v >> 16));
+    put_u16(w, (uint16_t)(v >> 32));
+    put_u16(w, (uint16_t)(v >> 48));
+}
+
+static void put_varint(writer_t* w, uint32_t v){
+    while (v >= 0x80){
+        put_u8(w, (uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put_u8(w, (uint8_t)v);
+}
+
+static uint8_t get_u8(reader_t* r){
+    if (r->offset + 1 > r->length){
+        r->overflow = 1;
+        return 0;
+    }
+    return r->data[r->offset++];
+}
+
+static uint16_t get_u16(reader_t* r){
+    uint16_t v;
+
+    if (r->offset + 2 > r->length){
+        r->overflow = 1;
+        return 0;
+    }
+    v = (uint16_t)(r->data[r->offset] | (r->data[r->offset + 1] << 8));
+    r->offset += 2;
+    return v;
+}
+
+static uint64_t get_u64(reader_t* r){
+    uint64_t v = get_u16(r);
+
+    v |= (uint64_t)get_u16(r) << 16;
+    v |= (uint64_t)get_u16(r) << 32;
+    v |= (uint64_t)get_u16(r) << 48;
+    return v;
+}
+
+static uint32_t get_varint(reader_t* r){
+    uint32_t v = 0;
+    uint8_t shift = 0;
+    uint8_t b;
+
+    do{
+        b = get_u8(r);
+        v |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+    }while ((b & 0x80) && shift < 32 && !r->overflow);
+    return v;
+}
+
+// Characteristic and statistic share the group byte
+_Static_assert(CHARACTERISTICS_COUNT <= 16 && SAMPLE_STATISTICS_COUNT <= 16, "group byte overflow");
+// And the field count the PAYLOAD_GROUP_OMITTED flag
+_Static_assert(SAMPLE_MAX_FIELDS < PAYLOAD_GROUP_OMITTED, "field count byte overflow");
+
+static int encode_body(const char* device_id, const sample_t* samples, uint32_t count, writer_t* w){
+    uint16_t per_group[SAMPLE_STATISTICS_COUNT][CHARACTERISTICS_COUNT] = {{0}};
+    size_t id_length = strlen(device_id);
+    int64_t base_msec = 0;
+    uint8_t groups = 0;
+    uint32_t i;
+    uint8_t s;
+    uint8_t c;
+    uint8_t f;
+
+    if (id_length > PAYLOAD_DEVICE_ID_MAX){
+        id_length = PAYLOAD_DEVICE_ID_MAX;
+    }
+    for (i = 0; i < count; i++){
+        c = samples[i].characteristic;
+        s = samples[i].statistic;
+        if (c >= CHARACTERISTICS_COUNT || s >= SAMPLE_STATISTICS_COUNT){
+            return -1;
+        }
+        if (per_group[s][c]++ == 0){
+            groups++;
+        }
+    }
+    for (i = 0; i < count && samples[i].time_usec > 0; i++){
+        if (i == 0 || samples[i].time_usec / 1000 < base_msec){
+            base_msec = samples[i].time_usec / 1000;
+        }
+    }
+    if (i < count){
+        base_msec = 0;
+    }
+
+    put_u8(w, (uint8_t)id_length);
+    if (w->length + id_length > w->size){
+        return -1;
+    }
+    memcpy(w->data + w->length, device_id, id_length);
+    w->length += id_length;
+    put_u64(w, (uint64_t)base_msec);
+    put_u8(w, groups);
+
+    for (s = 0; s < SAMPLE_STATISTICS_COUNT; s++){
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            uint8_t field_count = characteristics[c].field_count;
+            uint16_t fields_mask = (uint16_t)((1u << field_count) - 1);
+            uint16_t omitted = 0;
+            uint16_t prev = 0;
+            int first = 1;
+
+            if (per_group[s][c] == 0){
+                continue;
+            }
+            for (i = 0; i < count; i++){
+                if (samples[i].characteristic == c && samples[i].statistic == s){
+                    omitted |= samples[i].omitted & fields_mask;
+                }
+            }
+            put_u8(w, (uint8_t)(c | s << 4));
+            put_u8(w, omitted ? field_count | PAYLOAD_GROUP_OMITTED : field_count);
+            put_u16(w, per_group[s][c]);
+            for (i = 0; i < count; i++){
+                if (samples[i].characteristic != c || samples[i].statistic != s){
+                    continue;
+                }
+                if (first){
+                    if (base_msec > 0){
+                        put_varint(w, (uint32_t)(samples[i].time_usec / 1000 - base_msec));
+                    }
+                    put_u16(w, samples[i].timestamp);
+                    first = 0;
+                }else{
+                    put_varint(w, (uint16_t)(samples[i].timestamp - prev));
+                }
+                prev = samples[i].timestamp;
+            }
+            for (i = 0; omitted && i < count; i++){
+                if (samples[i].characteristic == c && samples[i].statistic == s){
+                    put_varint(w, samples[i].omitted & fields_mask);
+                }
+            }
+            for (f = 0; f < field_count; f++){
+                for (i = 0; i < count; i++){
+                    if (samples[i].characteristic == c && samples[i].statistic == s &&
+                        !(samples[i].omitted & (1u << f))){
+                        put_u16(w, (uint16_t)samples[i].values[f]);
+                    }
+                }
+            }
+        }
+    }
+    return w->overflow ? -1 : 0;
+}
+
+int payload_encode(const char* device_id, const sample_t* samples, uint32_t count, int compress,
+                   uint8_t* out, size_t out_size){
+    writer_t w;
+
+    if (out_size < PAYLOAD_HEADER_SIZE){
+        return -1;
+    }
+    out[0] = PAYLOAD_MAGIC_0;
+    out[1] = PAYLOAD_MAGIC_1;
+    out[2] = PAYLOAD_VERSION;
+    out[3] = compress ? PAYLOAD_FLAG_ZLIB : 0;
+
+    if (!compress){
+        w.data = out + PAYLOAD_HEADER_SIZE;
+        w.size = out_size - PAYLOAD_HEADER_SIZE;
+        w.length = 0;
+        w.overflow = 0;
+        if (encode_body(device_id, samples, count, &w) != 0){
+            return -1;
+        }
+        return (int)(PAYLOAD_HEADER_SIZE + w.length);
+    }
+
+#if defined(HAVE_ZLIB)
+    {
+        uint8_t body[PAYLOAD_BUFFER_SIZE];
+        uLongf deflated = out_size - PAYLOAD_HEADER_SIZE;
+
+        w.data = body;
+        w.size = sizeof(body);
+        w.length = 0;
+        w.overflow = 0;
+        if (encode_body(device_id, samples, count, &w) != 0){
+            return -1;
+        }
+        if (compress2(out + PAYLOAD_HEADER_SIZE, &deflated, body, w.length, Z_BEST_SPEED) != Z_OK){
+            return -1;
+        }
+        return (int)(PAYLOAD_HEADER_SIZE + deflated);
+    }
+#else
+    return -1;
+#endif
+}
+
+static int decode_body(reader_t* r, payload_sample_cb_t sample_cb, void* user_data){
+    char device_id[PAYLOAD_DEVICE_ID_MAX + 1];
+    sample_t samples[PAYLOAD_MAX_SAMPLES];
+    uint8_t id_length = get_u8(r);
+    int64_t base_msec;
+    uint8_t groups;
+    int total = 0;
+
+    if (r->overflow || r->offset + id_length > r->length){
+        return -1;
+    }
+    memcpy(device_id, r->data + r->offset, id_length);
+    device_id[id_length] = '\0';
+    r->offset += id_length;
+    base_msec = (int64_t)get_u64(r);
+    groups = get_u8(r);
+
+    while (groups-- > 0 && !r->overflow){
+        uint8_t group = get_u8(r);
+        uint8_t c = group & 0x0F;
+        uint8_t statistic = group >> 4;
+        uint8_t field_count = get_u8(r);
+        uint8_t has_omitted = field_count & PAYLOAD_GROUP_OMITTED;
+        uint16_t count = get_u16(r);
+        int64_t time_msec = 0;
+        uint16_t i;
+        uint8_t f;
+
+        field_count &= (uint8_t)~PAYLOAD_GROUP_OMITTED;
+        if (c >= CHARACTERISTICS_COUNT || statistic >= SAMPLE_STATISTICS_COUNT || field_count > SAMPLE_MAX_FIELDS || count > PAYLOAD_MAX_SAMPLES){
+            return -1;
+        }
+        if (base_msec > 0){
+            time_msec = base_msec + get_varint(r);
+        }
+        for (i = 0; i < count; i++){
+            samples[i].characteristic = c;
+            samples[i].statistic = statistic;
+            samples[i].omitted = 0;
+            samples[i].device = 0;
+            samples[i].received_usec = 0;
+            samples[i].decoded_usec = 0;
+            samples[i].count = field_count;
+            samples[i].timestamp = (i == 0) ? get_u16(r) : (uint16_t)(samples[i - 1].timestamp + get_varint(r));
+            if (i > 0){
+                time_msec += (int16_t)(uint16_t)(samples[i].timestamp - samples[i - 1].timestamp);
+            }
+            samples[i].time_usec = base_msec > 0 ? time_msec * 1000 : 0;
+        }
+        for (i = 0; has_omitted && i < count; i++){
+            samples[i].omitted = (uint16_t)(get_varint(r) & ((1u << field_count) - 1));
+        }
+        for (f = 0; f < field_count; f++){
+            field_type_t type = (f < characteristics[c].field_count) ? characteristics[c].fields[f].type : FIELD_U16;
+            for (i = 0; i < count; i++){
+                uint16_t raw = (samples[i].omitted & (1u << f)) ? 0 : get_u16(r);
+                samples[i].values[f] = (type == FIELD_S16) ? (int16_t)raw : raw;
+            }
+        }
+        if (r->overflow){
+            return -1;
+        }
+        for (i = 0; i < count; i++){
+            sample_cb(device_id, &samples[i], user_data);
+        }
+        total += count;
+    }
+    return r->overflow ? -1 : total;
+}
+
+int payload_decode(const uint8_t* data, size_t length, payload_sample_cb_t sample_cb, void* user_data){
+    reader_t r;
+
+    if (length < PAYLOAD_HEADER_SIZE || data[0] != PAYLOAD_MAGIC_0 || data[1] != PAYLOAD_MAGIC_1 ||
+        data[2] != PAYLOAD_VERSION){
+        return -1;
+    }
+    r.overflow = 0;
+    r.offset = 0;
+
+    if (!(data[3] & PAYLOAD_FLAG_ZLIB)){
+        r.data = data + PAYLOAD_HEADER_SIZE;
+        r.length = length - PAYLOAD_HEADER_SIZE;
+        return decode_body(&r, sample_cb, user_data);
+    }
+
+#if defined(HAVE_ZLIB)
+    {
+        uint8_t body[PAYLOAD_BUFFER_SIZE];
+        uLongf inflated = sizeof(body);
+
+        if (uncompress(body, &inflated, data + PAYLOAD_HEADER_SIZE, length - PAYLOAD_HEADER_SIZE) != Z_OK){
+            return -1;
+        }
+        r.data = body;
+        r.length = inflated;
+        return decode_body(&r, sample_cb, user_data);
+    }
+#else
+    return -1;
+#endif
+}
+
+int payload_format_parse(const char* name, payload_format_t* format){
+    if (strcmp(name, "json") == 0){
+        *format = PAYLOAD_JSON;
+    }else if (strcmp(name, "binary") == 0){
+        *format = PAYLOAD_BINARY;
+#if defined(HAVE_ZLIB)
+    }else if (strcmp(name, "binary-zlib") == 0){
+        *format = PAYLOAD_BINARY_ZLIB;
+#endif
+    }else{
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Encoding of published events
+typedef enum {
+    // {"d":{...}} documents, one per frame or coalescing window
+    PAYLOAD_JSON,
+    // Packed batches, see below
+    PAYLOAD_BINARY,
+    // Packed batches deflated with zlib, needs HAVE_ZLIB
+    PAYLOAD_BINARY_ZLIB,
+} payload_format_t;
+
+// MQTT format of packed batches
+#define PAYLOAD_BINARY_FORMAT "sbin"
+
+#define PAYLOAD_MAGIC_0 'S'
+#define PAYLOAD_MAGIC_1 'B'
+#define PAYLOAD_VERSION 1
+#define PAYLOAD_FLAG_ZLIB 0x01
+#define PAYLOAD_GROUP_OMITTED 0x80
+#define PAYLOAD_HEADER_SIZE 4
+
+// Most samples in one packed batch
+#define PAYLOAD_MAX_SAMPLES 64
+
+// Enough for a full batch of the widest characteristic
+#define PAYLOAD_BUFFER_SIZE 4096
+
+// Packed batch, all integers little-endian:
+//   'S' 'B' version flags
+//   body, deflated when flags has PAYLOAD_FLAG_ZLIB:
+//     u8 device ID length, device ID
+//     u64 Unix time in ms of the earliest sample, 0 when a sample has none
+//     u8 group count
+//     per characteristic and statistic present in the batch:
+//       u8 characteristic | statistic << 4, u8 field count, ORed with
+//       PAYLOAD_GROUP_OMITTED when a publish policy left fields out,
+//       u16 sample count
+//       unless the time is 0, LEB128 varint of the time of the first
+//       sample past the earliest, in ms
+//       u16 first timestamp, then one LEB128 varint per further sample
+//       holding the timestamp step modulo 2^16; the time of a further
+//       sample follows its steps, taken as signed 16-bit steps
+//       with PAYLOAD_GROUP_OMITTED, one LEB128 varint per sample with
+//       bit f set when field f is left out
+//       16-bit values, field after field (all acc_x, then all acc_y...),
+//       but for the fields left out
+
+// Encodes count samples of one device into out. Returns the encoded size,
+// or -1 when out is too small or compression is unavailable.
+int payload_encode(const char* device_id, const sample_t* samples, uint32_t count, int compress,
+                   uint8_t* out, size_t out_size);
+
+typedef void (*payload_sample_cb_t)(const char* device_id, const sample_t* sample, void* user_data);
+
+// Calls sample_cb for every sample of a packed batch, grouped by
+// characteristic, at the millisecond resolution of time_usec. The fields
+// left out are set in sample->omitted, with a value of 0. Returns the
+// number of samples, -1 on a malformed batch.
+int payload_decode(const uint8_t* data, size_t length, payload_sample_cb_t sample_cb, void* user_data);
+
+// Parses "json", "binary" or "binary-zlib". Returns 0 on success.
+int payload_format_parse(const char* name, payload_format_t* format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
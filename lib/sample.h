@@ -0,0 +1,49 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most fields carried by one characteristic frame
+#define SAMPLE_MAX_FIELDS 9
+
+// What a sample holds: one notification, or one statistic of a window of
+// notifications folded by the aggregator
+typedef enum {
+    SAMPLE_RAW,
+    SAMPLE_MIN,
+    SAMPLE_MAX,
+    SAMPLE_MEAN,
+    SAMPLE_RMS,
+    SAMPLE_STATISTICS_COUNT
+} sample_statistic_t;
+
+// Decoded notification or window statistic, ready to be published. values[]
+// follow the field order of the characteristic frame layout.
+typedef struct {
+    // Host CLOCK_MONOTONIC time the notification arrived at
+    int64_t received_usec;
+    // Host time the sample was decoded, or its window summarized
+    int64_t decoded_usec;
+    // Unix time the board took the sample, or opened the window, from its
+    // board clock, 0 when unknown
+    int64_t time_usec;
+    uint16_t timestamp;
+    uint8_t device;
+    uint8_t characteristic;
+    uint8_t count;
+    uint8_t statistic;
+    // Bit f set: field f is unchanged per its publish policy and left out
+    // of events
+    uint16_t omitted;
+    int32_t values[SAMPLE_MAX_FIELDS];
+} sample_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
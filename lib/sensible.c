@@ -0,0 +1,254 @@
+#include <string.h>
+#include <strings.h>
+#include "frame_batch.h"
+#include "monotonic.h"
+#include "sensible.h"
+
+int sensible_init(void){
+    if (decoder_init() != 0){
+        return -1;
+    }
+    frame_batch_init();
+    return 0;
+}
+
+void sensible_session_init(sensible_session_t* session, uint8_t device){
+    memset(session, 0, sizeof(*session));
+    session->device = device;
+}
+
+int sensible_session_subscribe(sensible_session_t* session, uint8_t characteristic, sensible_sample_cb_t callback,
+                               void* user_data, uint32_t window_msec){
+    sensible_channel_t* channel;
+
+    if (characteristic >= CHARACTERISTICS_COUNT || (window_msec > 0 && characteristics[characteristic].event == EVENT_ALWAYS)){
+        return -1;
+    }
+    channel = &session->channels[characteristic];
+    channel->callback = callback;
+    channel->user_data = user_data;
+    channel->window_msec = window_msec;
+    memset(&channel->aggregate, 0, sizeof(channel->aggregate));
+    channel->batch.count = 0;
+    return 0;
+}
+
+void sensible_session_on_short_frame(sensible_session_t* session, sensible_short_frame_cb_t callback,
+                                     void* user_data){
+    session->short_frame_callback = callback;
+    session->short_frame_user_data = user_data;
+}
+
+void sensible_session_on_decoded(sensible_session_t* session, sensible_decoded_cb_t callback, void* user_data){
+    session->decoded_callback = callback;
+    session->decoded_user_data = user_data;
+}
+
+uint32_t sensible_session_subscribed(const sensible_session_t* session){
+    uint32_t mask = 0;
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (session->channels[c].callback != NULL){
+            mask |= 1u << c;
+        }
+    }
+    return mask;
+}
+
+// Stamps samples with their Unix time and hands them to the callback
+static int deliver(const sensible_session_t* session, sensible_channel_t* channel, sample_t* samples, int count){
+    int i;
+
+    if (count == 0){
+        return 0;
+    }
+    for (i = 0; i < count; i++){
+        samples[i].time_usec = device_clock_time_usec(&session->clock, samples[i].timestamp);
+    }
+    channel->callback(samples, count, channel->user_data);
+    return count;
+}
+
+// Decodes the staged frames of a channel in one go and folds them into
+// its window
+static void fold_frames(sensible_session_t* session, sensible_channel_t* channel){
+    frame_batch_t* batch = &channel->batch;
+    sample_columns_t columns;
+    sample_t samples[FRAME_BATCH_MAX];
+    int64_t now;
+    uint32_t i;
+    uint8_t f;
+
+    if (batch->count == 0){
+        return;
+    }
+    frame_batch_decode(batch, &columns);
+    if (session->decoded_callback != NULL){
+        now = monotonic_usec();
+        for (i = 0; i < columns.count; i++){
+            sample_t* sample = &samples[i];
+
+            sample->device = session->device;
+            sample->characteristic = columns.characteristic;
+            sample->statistic = SAMPLE_RAW;
+            sample->omitted = 0;
+            sample->count = characteristics[columns.characteristic].field_count;
+            sample->timestamp = columns.timestamps[i];
+            sample->received_usec = batch->received_usec[i];
+            sample->decoded_usec = now;
+            sample->time_usec = device_clock_time_usec(&session->clock, sample->timestamp);
+            for (f = 0; f < sample->count; f++){
+                sample->values[f] = columns.columns[f][i];
+            }
+        }
+        session->decoded_callback(samples, (int)columns.count, session->decoded_user_data);
+    }
+    aggregate_fold_columns(&channel->aggregate, &columns, batch->received_usec[batch->count - 1]);
+    batch->count = 0;
+}
+
+// Aggregation of the layouts frame_batch_decode() vectorizes: frames are
+// staged raw and decoded when the batch fills or their window ends
+static int stage_frame(sensible_session_t* session, sensible_channel_t* channel, uint8_t characteristic,
+                       const uint8_t* data, size_t length, uint16_t timestamp, int64_t board_msec,
+                       int64_t received_usec){
+    frame_batch_t* batch = &channel->batch;
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    size_t copied = length < SENSIBLE_FRAME_MAX ? length : SENSIBLE_FRAME_MAX;
+    int count;
+
+    if (aggregate_crosses(&channel->aggregate, channel->window_msec, board_msec)){
+        fold_frames(session, channel);
+    }
+    count = deliver(session, channel, summary,
+                    aggregate_advance(&channel->aggregate, channel->window_msec, session->device, characteristic,
+                                      timestamp, board_msec, summary));
+    batch->characteristic = characteristic;
+    memcpy(batch->frames[batch->count], data, copied);
+    memset(batch->frames[batch->count] + copied, 0, SENSIBLE_FRAME_MAX - copied);
+    batch->received_usec[batch->count] = received_usec;
+    if (++batch->count == FRAME_BATCH_MAX){
+        fold_frames(session, channel);
+    }
+    return count;
+}
+
+// A step of the board clock, a board reset for instance, leaves the open
+// windows on the old board time: they are closed and start over
+static void restart_windows(sensible_session_t* session){
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        sensible_channel_t* channel = &session->channels[c];
+
+        if (channel->callback == NULL || channel->window_msec == 0){
+            continue;
+        }
+        fold_frames(session, channel);
+        deliver(session, channel, summary, aggregate_close(&channel->aggregate, summary));
+        memset(&channel->aggregate, 0, sizeof(channel->aggregate));
+    }
+}
+
+int sensible_session_notify(sensible_session_t* session, uint8_t characteristic, const uint8_t* data,
+                            size_t length, int64_t received_usec){
+    sensible_channel_t* channel;
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    sample_t sample;
+    uint16_t timestamp;
+    uint32_t steps = session->clock.steps;
+    int64_t board_msec;
+
+    if (characteristic >= CHARACTERISTICS_COUNT){
+        return 0;
+    }
+    channel = &session->channels[characteristic];
+    session->notifications++;
+    if (length < decoder_min_length(characteristic)){
+        session->short_frames++;
+        if (session->short_frame_callback != NULL){
+            session->short_frame_callback(characteristic, data, length, session->short_frame_user_data);
+        }
+        return -1;
+    }
+    // Every frame starts with the board timestamp
+    timestamp = (uint16_t)(data[0] | (data[1] << 8));
+    board_msec = device_clock_update(&session->clock, timestamp, received_usec);
+    if (session->clock.steps != steps){
+        restart_windows(session);
+    }
+    if (channel->callback == NULL){
+        return 0;
+    }
+    if (channel->window_msec > 0 && frame_batch_vectorized(characteristic)){
+        return stage_frame(session, channel, characteristic, data, length, timestamp, board_msec, received_usec);
+    }
+    decode_frame(characteristic, data, length, &sample);
+    sample.device = session->device;
+    sample.received_usec = received_usec;
+    sample.decoded_usec = monotonic_usec();
+    if (session->decoded_callback != NULL){
+        sample.time_usec = device_clock_time_usec(&session->clock, sample.timestamp);
+        session->decoded_callback(&sample, 1, session->decoded_user_data);
+    }
+    if (channel->window_msec == 0 || sample_is_event(&sample)){
+        return deliver(session, channel, &sample, 1);
+    }
+    return deliver(session, channel, summary,
+                   aggregate_add(&channel->aggregate, channel->window_msec, &sample, board_msec, summary));
+}
+
+void sensible_session_flush(sensible_session_t* session, int force){
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    int64_t now = monotonic_msec();
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        sensible_channel_t* channel = &session->channels[c];
+
+        if (channel->callback == NULL || channel->window_msec == 0){
+            continue;
+        }
+        if (force || aggregate_expired(&channel->aggregate, channel->window_msec, now)){
+            fold_frames(session, channel);
+            deliver(session, channel, summary, aggregate_expire(&channel->aggregate, channel->window_msec, summary));
+        }
+    }
+}
+
+void sensible_session_reset(sensible_session_t* session){
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        memset(&session->channels[c].aggregate, 0, sizeof(session->channels[c].aggregate));
+        session->channels[c].batch.count = 0;
+    }
+    device_clock_reset(&session->clock);
+}
+
+int sensible_characteristic_by_uuid(const char* uuid){
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (strcasecmp(characteristics[c].uuid, uuid) == 0){
+            return c;
+        }
+    }
+    return -1;
+}
+
+int sensible_field_index(uint8_t characteristic, const char* name){
+    uint8_t f;
+
+    if (characteristic >= CHARACTERISTICS_COUNT){
+        return -1;
+    }
+    for (f = 0; f < characteristics[characteristic].field_count; f++){
+        if (strcmp(characteristics[characteristic].fields[f].name, name) == 0){
+            return f;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,112 @@
+#ifndef SENSIBLE_H
+#define SENSIBLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "aggregate.h"
+#include "characteristics.h"
+#include "device_clock.h"
+#include "frame_batch.h"
+#include "sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called with the samples of a subscribed characteristic: a decoded
+// notification, or every statistic of a window summary at once. samples
+// are only valid during the call.
+typedef void (*sensible_sample_cb_t)(const sample_t* samples, int count, void* user_data);
+
+// Called with the notifications of the subscribed characteristics as
+// decoded, before a window takes them, to keep every sample for instance:
+// one at a time, or up to FRAME_BATCH_MAX of a characteristic at once for
+// the layouts decoded in batches
+typedef void (*sensible_decoded_cb_t)(const sample_t* samples, int count, void* user_data);
+
+// Called with a notification shorter than the frame layout of its
+// characteristic
+typedef void (*sensible_short_frame_cb_t)(uint8_t characteristic, const uint8_t* data, size_t length,
+                                          void* user_data);
+
+typedef struct {
+    sensible_sample_cb_t callback;
+    void* user_data;
+    // Aggregation window, 0 to deliver every notification
+    uint32_t window_msec;
+    aggregate_channel_t aggregate;
+    // Frames of a layout frame_batch_decode() vectorizes, waiting to be
+    // decoded into their window when it ends or the batch fills
+    frame_batch_t batch;
+} sensible_channel_t;
+
+// Decoding state of one board. Everything lives in the session, so
+// feeding it notifications never allocates: embed it or allocate it once
+// per board.
+typedef struct {
+    // Copied into the device field of every sample
+    uint8_t device;
+    sensible_channel_t channels[CHARACTERISTICS_COUNT];
+    // Board clock, fed by every notification, giving samples their time
+    device_clock_t clock;
+    sensible_short_frame_cb_t short_frame_callback;
+    void* short_frame_user_data;
+    sensible_decoded_cb_t decoded_callback;
+    void* decoded_user_data;
+    uint64_t notifications;
+    uint64_t short_frames;
+} sensible_session_t;
+
+// Compiles the frame layouts into the decoders, once per process before
+// any session is fed. Returns 0 on success, -1 when a layout is
+// inconsistent.
+int sensible_init(void);
+
+// A session with no characteristic subscribed
+void sensible_session_init(sensible_session_t* session, uint8_t device);
+
+// Delivers the samples of characteristic to callback, as summaries of
+// window_msec windows of the board clock unless window_msec is 0, which
+// are closed and start over when the board clock steps. Discrete
+// events are never aggregated: they are delivered as they come, and only
+// the other frames of a characteristic flagging its events are windowed.
+// Returns 0 on success, -1 for an unknown characteristic or a window on a
+// characteristic whose frames are all events.
+int sensible_session_subscribe(sensible_session_t* session, uint8_t characteristic, sensible_sample_cb_t callback,
+                               void* user_data, uint32_t window_msec);
+
+void sensible_session_on_short_frame(sensible_session_t* session, sensible_short_frame_cb_t callback,
+                                     void* user_data);
+
+void sensible_session_on_decoded(sensible_session_t* session, sensible_decoded_cb_t callback, void* user_data);
+
+// Bit c set for every subscribed characteristic c
+uint32_t sensible_session_subscribed(const sensible_session_t* session);
+
+// Decodes a notification of characteristic received at received_usec, a
+// CLOCK_MONOTONIC time, and calls its callback. Returns the number of
+// samples delivered, -1 for a short frame.
+int sensible_session_notify(sensible_session_t* session, uint8_t characteristic, const uint8_t* data,
+                            size_t length, int64_t received_usec);
+
+// Delivers the windows whose board went quiet, every open window when
+// force is set, e.g. before disconnecting. Call it regularly, e.g. every
+// window length, so a board that stops notifying still gets its summary.
+void sensible_session_flush(sensible_session_t* session, int force);
+
+// Forgets the open windows, the frames waiting in them and the board
+// clock, for a board that may have been reset. Flush first to keep them.
+void sensible_session_reset(sensible_session_t* session);
+
+// Characteristic of a UUID string, -1 when SensiBLE has none
+int sensible_characteristic_by_uuid(const char* uuid);
+
+// Index of a field in the samples of characteristic, -1 when it has none.
+// Resolve fields once, then read sample->values[index].
+int sensible_field_index(uint8_t characteristic, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
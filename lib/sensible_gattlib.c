@@ -0,0 +1,59 @@
+#include <string.h>
+#include "monotonic.h"
+#include "sensible_gattlib.h"
+
+// Parsed form of the characteristic UUIDs, filled once and used to route
+// notifications
+static uuid_t characteristic_uuids[CHARACTERISTICS_COUNT];
+
+int sensible_gattlib_init(void){
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        const char* uuid = characteristics[c].uuid;
+
+        if (gattlib_string_to_uuid(uuid, strlen(uuid) + 1, &characteristic_uuids[c]) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const uuid_t* sensible_gattlib_uuid(uint8_t characteristic){
+    return &characteristic_uuids[characteristic];
+}
+
+int sensible_gattlib_characteristic(const uuid_t* uuid){
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (gattlib_uuid_cmp(uuid, &characteristic_uuids[c]) == 0){
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Every characteristic is subscribed on the same connection, so route by
+// UUID
+static void session_dispatcher(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data){
+    int characteristic = sensible_gattlib_characteristic(uuid);
+
+    if (characteristic >= 0){
+        sensible_session_notify(user_data, (uint8_t)characteristic, data, data_length, monotonic_usec());
+    }
+}
+
+int sensible_session_attach(sensible_session_t* session, gatt_connection_t* connection){
+    uint32_t subscribed = sensible_session_subscribed(session);
+    int enabled = 0;
+    uint8_t c;
+
+    gattlib_register_notification(connection, session_dispatcher, session);
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if ((subscribed & (1u << c)) && gattlib_notification_start(connection, &characteristic_uuids[c]) == 0){
+            enabled++;
+        }
+    }
+    return enabled;
+}
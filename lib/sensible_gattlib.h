@@ -0,0 +1,31 @@
+#ifndef SENSIBLE_GATTLIB_H
+#define SENSIBLE_GATTLIB_H
+
+#include <stdint.h>
+#include "gattlib.h"
+#include "sensible.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Parses the characteristic UUIDs, once per process after sensible_init().
+// Returns 0 on success.
+int sensible_gattlib_init(void);
+
+// Parsed UUID of a characteristic
+const uuid_t* sensible_gattlib_uuid(uint8_t characteristic);
+
+// Characteristic of a notified UUID, -1 when SensiBLE has none
+int sensible_gattlib_characteristic(const uuid_t* uuid);
+
+// Feeds the notifications of connection to session and enables those of
+// the subscribed characteristics. The session must outlive the
+// connection. Returns the number of characteristics enabled.
+int sensible_session_attach(sensible_session_t* session, gatt_connection_t* connection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,77 @@
-gcc examples\ibm-watsons\humming-publish.c \
+# Set CFLAGS to tune the build, e.g. CFLAGS="-O2 -march=native" for AVX2
+# or CFLAGS="-O2 -mfpu=neon" for the NEON frame decoder on the HummingBoard
+CFLAGS=${CFLAGS:--O2}
+
+# libsensible.a: the SensiBLE protocol (characteristic UUIDs, frame layouts,
+# decoders, window aggregation, binary events) and its session API, for
+# the gateway, the tools and other programs. sensible_gattlib.o is only
+# linked by the programs using sensible_gattlib.h.
+mkdir -p build/lib
+for source in lib/characteristics.c lib/frame_batch.c lib/aggregate.c lib/payload.c lib/device_clock.c \
+lib/sensible.c lib/sensible_gattlib.c; do
+    gcc -c $source $CFLAGS -DHAVE_ZLIB -fPIC -Ilib -Igattlib/include -o build/lib/$(basename $source .c).o || exit 1
+done
+rm -f libsensible.a
+ar rcs libsensible.a build/lib/characteristics.o build/lib/frame_batch.o build/lib/aggregate.o \
+build/lib/payload.o build/lib/device_clock.o build/lib/sensible.o build/lib/sensible_gattlib.o
+
+# ./make.sh check: builds the unit tests of tests/ against libsensible.a and
+# runs them instead of building the programs. Exits with 1 when one fails.
+if [ "$1" = "check" ]; then
+    mkdir -p build/tests
+    failed=0
+    for test in frame_batch payload aggregate sensible device_clock sample_queue journal gatt_cache publish_filter mqtt_pipeline \
+sample_store sample_buffer sink worker; do
+        case $test in
+            frame_batch|payload|aggregate|sensible|device_clock) sources= ;;
+            worker) sources="examples/ibm-watsons/worker.c $(pkg-config --cflags --libs glib-2.0)" ;;
+            sink) sources="examples/ibm-watsons/sink.c examples/ibm-watsons/sample_buffer.c" ;;
+            sample_store) sources="examples/ibm-watsons/sample_store.c examples/ibm-watsons/sample_queue.c" ;;
+            mqtt_pipeline) sources="examples/ibm-watsons/mqtt_pipeline.c examples/ibm-watsons/metrics.c \
+examples/ibm-watsons/latency.c examples/ibm-watsons/link_state.c -Iiot-embeddedc/src -Iiot-embeddedc/lib \
+-Liot-embeddedc/build/lib -l:libmqttlib.a" ;;
+            *) sources=examples/ibm-watsons/$test.c ;;
+        esac
+        gcc tests/test_$test.c $sources $CFLAGS -DHAVE_ZLIB -Ilib -Iexamples/ibm-watsons -Itests \
+-L. -l:libsensible.a -lz -lm -lpthread -o build/tests/test_$test || exit 1
+        build/tests/test_$test || failed=1
+    done
+    exit $failed
+fi
+
+gcc examples/ibm-watsons/humming-publish.c examples/ibm-watsons/iot_message.c \
+examples/ibm-watsons/sample_queue.c examples/ibm-watsons/publisher.c \
+examples/ibm-watsons/journal.c examples/ibm-watsons/capture.c examples/ibm-watsons/latency.c \
+examples/ibm-watsons/metrics.c examples/ibm-watsons/gatt_cache.c \
+examples/ibm-watsons/link_state.c examples/ibm-watsons/logger.c \
+examples/ibm-watsons/publish_filter.c examples/ibm-watsons/mqtt_pipeline.c examples/ibm-watsons/sample_store.c \
+examples/ibm-watsons/sample_buffer.c examples/ibm-watsons/sink.c examples/ibm-watsons/local_sink.c \
+examples/ibm-watsons/worker.c \
+$CFLAGS -DHAVE_ZLIB -Ilib \
 $(pkg-config --cflags --libs glib-2.0) -Igattlib/include -Iiot-embeddedc/src -Iiot-embeddedc/lib \
--Lgattlib/build/dbus -l:libgattlib.so -Liot-embeddedc/build/src -l:libiotfdeviceclient.so \
+-L. -l:libsensible.a -Lgattlib/build/dbus -l:libgattlib.so -Liot-embeddedc/build/src -l:libiotfdeviceclient.so \
 -Liot-embeddedc/build/lib -l:libmbedtls.a -l:libmbedcrypto.a -l:libmbedx509.a -l:libmqttlib.a -l:libcJSON.a \
--lgcov -o humming-publish
+-lz -lm -lpthread -lgcov -o humming-publish
+
+gcc tools/sensible-decode.c $CFLAGS -Ilib -L. -l:libsensible.a -lz -o sensible-decode
+
+gcc tools/sensible-query.c examples/ibm-watsons/sample_store.c examples/ibm-watsons/sample_queue.c \
+$CFLAGS -Ilib -Iexamples/ibm-watsons -L. -l:libsensible.a -lpthread -o sensible-query
+
+gcc examples/ibm-watsons/humming-publish.c examples/ibm-watsons/iot_message.c \
+examples/ibm-watsons/sample_queue.c examples/ibm-watsons/publisher.c \
+examples/ibm-watsons/journal.c examples/ibm-watsons/capture.c examples/ibm-watsons/latency.c \
+examples/ibm-watsons/metrics.c examples/ibm-watsons/gatt_cache.c \
+examples/ibm-watsons/link_state.c examples/ibm-watsons/logger.c \
+examples/ibm-watsons/publish_filter.c examples/ibm-watsons/mqtt_pipeline.c examples/ibm-watsons/sample_store.c \
+examples/ibm-watsons/sample_buffer.c examples/ibm-watsons/sink.c examples/ibm-watsons/local_sink.c \
+examples/ibm-watsons/worker.c \
+sim/sim_gattlib.c sim/sim_iotf.c \
+$CFLAGS -DHAVE_ZLIB -DNO_NOTIFICATION_DEBUG -Ilib \
+$(pkg-config --cflags --libs glib-2.0) -Igattlib/include -Iiot-embeddedc/src -Iiot-embeddedc/lib \
+-Iexamples/ibm-watsons -L. -l:libsensible.a -Liot-embeddedc/build/lib -l:libmqttlib.a -lz -lm -lpthread \
+-o humming-publish-sim
+
+gcc tools/sensible-bench.c examples/ibm-watsons/iot_message.c examples/ibm-watsons/mqtt_pipeline.c \
+sim/sim_iotf.c $CFLAGS -DHAVE_ZLIB -Ilib -Iiot-embeddedc/src -Iiot-embeddedc/lib -Iexamples/ibm-watsons \
+-L. -l:libsensible.a -Liot-embeddedc/build/lib -l:libmqttlib.a -lz -lm -lpthread -o sensible-bench
@@ -1 +1 @@
-LD_LIBRARY_PATH=gattlib/build/dbus:iot-embeddedc/build/src ./humming-publish
+LD_LIBRARY_PATH=gattlib/build/dbus:iot-embeddedc/build/src ./humming-publish "$@"
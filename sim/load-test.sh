@@ -0,0 +1,24 @@
+# Streams simulated boards through humming-publish-sim, then prints the
+# notification, publish, drop and latency figures of the run.
+# Usage: sim/load-test.sh [DEVICES] [RATE_HZ] [SECONDS] [gateway options...]
+# With THREADS set, e.g. THREADS="0 1 2 4", the run is repeated with each
+# -t and only the throughput of each is printed, to see how the gateway
+# scales with the cores.
+DEVICES=${1:-50}
+RATE_HZ=${2:-10}
+DURATION=${3:-30}
+shift 3 2>/dev/null
+
+if [ -z "$THREADS" ]; then
+    SENSIBLE_SIM_DEVICES=$DEVICES SENSIBLE_SIM_RATE_HZ=$RATE_HZ \
+    timeout -s INT $DURATION ./humming-publish-sim -n SensiBLE-SIM- "$@"
+    exit
+fi
+
+for threads in $THREADS; do
+    printf -- "-t %s: " "$threads"
+    SENSIBLE_SIM_DEVICES=$DEVICES SENSIBLE_SIM_RATE_HZ=$RATE_HZ \
+    timeout -s INT $DURATION ./humming-publish-sim -n SensiBLE-SIM- -t "$threads" "$@" | \
+    grep -E "^Handled|dropped by its full inbox" | grep -vE " 0 dropped by its full inbox" | tr '\n' ' '
+    echo
+done
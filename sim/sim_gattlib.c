@@ -0,0 +1,535 @@
+// Stand-in for the gattlib BLE backend, linked instead of libgattlib to run
+// the gateway without hardware. Simulated SensiBLE boards notify every
+// subscribed characteristic at a fixed rate, or the notifications of a
+// capture recorded with -r are played back. Set through the environment:
+//   SENSIBLE_SIM_DEVICES  number of simulated boards (default 1)
+//   SENSIBLE_SIM_RATE_HZ  notifications per second and characteristic (default 10), above 1000
+//                         sent in bursts every millisecond like notifications sharing a
+//                         connection event
+//   SENSIBLE_SIM_REPLAY   capture file to play back instead
+//   SENSIBLE_SIM_SPEED    playback speed factor (default 1)
+//   SENSIBLE_SIM_CONNECT_MSEC    time a connection takes (default 0)
+//   SENSIBLE_SIM_DISCOVERY_MSEC  time the service discovery of a connection takes (default 0)
+//   SENSIBLE_SIM_LINK_LOSS       START:SECONDS, the first board goes out of range START
+//                                seconds after startup, for SECONDS
+//   SENSIBLE_SIM_DRIFT_PPM       how much faster the board clocks run than the host (default 0)
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "gattlib.h"
+#include "capture.h"
+#include "characteristics.h"
+#include "monotonic.h"
+
+#define SIM_MAX_DEVICES 256
+#define SIM_NAME_PREFIX "SensiBLE-SIM-"
+#define SIM_ADDRESS_SIZE 18
+
+// Simulated boards are 5E:00:00:00:HH:LL
+#define SIM_ADDRESS_FORMAT "5E:00:00:00:%02X:%02X"
+
+// Attributes of characteristic c: its declaration, value, user description
+// and client configuration descriptor, which thus is not next to the value
+#define SIM_DECLARATION_HANDLE(c) ((uint16_t)(0x10 + 4 * (c)))
+
+typedef struct {
+    char address[SIM_ADDRESS_SIZE];
+    gattlib_event_handler_t handler;
+    void* user_data;
+    gattlib_disconnection_handler_t on_disconnect;
+    void* on_disconnect_data;
+    uint32_t subscribed;
+    int discovered;
+    guint timer;
+    uint32_t seed;
+    int32_t walk[CHARACTERISTICS_COUNT][SAMPLE_MAX_FIELDS];
+} sim_connection_t;
+
+static pthread_once_t sim_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    uint32_t devices;
+    uint32_t rate_hz;
+    uint32_t connect_msec;
+    uint32_t discovery_msec;
+    double speed;
+    double drift_ppm;
+    uuid_t uuids[CHARACTERISTICS_COUNT];
+    uint8_t frame_length[CHARACTERISTICS_COUNT];
+    char addresses[SIM_MAX_DEVICES][SIM_ADDRESS_SIZE];
+    // The gateway connects from threads of its own while the main loop
+    // ticks: lock guards the connections, their handlers and
+    // subscriptions, and the replay timer
+    pthread_mutex_t lock;
+    sim_connection_t* connections[SIM_MAX_DEVICES];
+    capture_record_t* replay;
+    size_t replay_count;
+    size_t replay_next;
+    guint replay_timer;
+    int64_t replay_start_usec;
+    int64_t start_usec;
+    int64_t loss_start_usec;
+    int64_t loss_end_usec;
+    uint64_t emitted;
+} sim;
+
+static void sim_report(void){
+    double seconds = (monotonic_usec() - sim.start_usec) / 1e6;
+
+    printf("Simulated boards sent %llu notifications in %.1fs, %.0f per second\n",
+           (unsigned long long)sim.emitted, seconds, seconds > 0 ? sim.emitted / seconds : 0.0);
+}
+
+static uint32_t env_u32(const char* name, uint32_t fallback){
+    const char* value = getenv(name);
+    return value ? (uint32_t)strtoul(value, NULL, 10) : fallback;
+}
+
+static int sim_find_address(const char* address){
+    uint32_t i;
+
+    for (i = 0; i < sim.devices; i++){
+        if (strcasecmp(sim.addresses[i], address) == 0){
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void sim_load_replay(const char* path){
+    FILE* file = capture_open(path);
+    capture_record_t record;
+    size_t allocated = 0;
+
+    if (file == NULL){
+        fprintf(stderr, "SIM: cannot read the capture %s\n", path);
+        exit(1);
+    }
+    while (capture_read(file, &record) == 0){
+        if (sim.replay_count == allocated){
+            allocated = allocated ? allocated * 2 : 4096;
+            sim.replay = realloc(sim.replay, allocated * sizeof(capture_record_t));
+            if (sim.replay == NULL){
+                fprintf(stderr, "SIM: capture too large\n");
+                exit(1);
+            }
+        }
+        sim.replay[sim.replay_count++] = record;
+        if (sim_find_address(record.address) < 0 && sim.devices < SIM_MAX_DEVICES){
+            snprintf(sim.addresses[sim.devices++], SIM_ADDRESS_SIZE, "%s", record.address);
+        }
+    }
+    fclose(file);
+    printf("SIM: replaying %zu notifications of %u boards from %s\n", sim.replay_count, sim.devices, path);
+}
+
+// Run once through sim_init()
+static void sim_setup(void){
+    const char* replay = getenv("SENSIBLE_SIM_REPLAY");
+    const char* speed = getenv("SENSIBLE_SIM_SPEED");
+    const char* drift = getenv("SENSIBLE_SIM_DRIFT_PPM");
+    const char* loss = getenv("SENSIBLE_SIM_LINK_LOSS");
+    double loss_start = 0;
+    double loss_length = 0;
+    uint32_t i;
+    uint8_t c;
+    uint8_t f;
+
+    pthread_mutex_init(&sim.lock, NULL);
+    sim.start_usec = monotonic_usec();
+    sim.rate_hz = env_u32("SENSIBLE_SIM_RATE_HZ", 10);
+    sim.speed = speed ? atof(speed) : 1.0;
+    sim.drift_ppm = drift != NULL ? atof(drift) : 0.0;
+    sim.connect_msec = env_u32("SENSIBLE_SIM_CONNECT_MSEC", 0);
+    sim.discovery_msec = env_u32("SENSIBLE_SIM_DISCOVERY_MSEC", 0);
+    sim.loss_start_usec = INT64_MAX;
+    sim.loss_end_usec = INT64_MAX;
+    if (loss != NULL && sscanf(loss, "%lf:%lf", &loss_start, &loss_length) == 2){
+        sim.loss_start_usec = sim.start_usec + (int64_t)(loss_start * 1e6);
+        sim.loss_end_usec = sim.loss_start_usec + (int64_t)(loss_length * 1e6);
+    }
+    if (sim.rate_hz == 0){
+        sim.rate_hz = 1;
+    }
+    if (sim.speed <= 0){
+        sim.speed = 1.0;
+    }
+    decoder_init();
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        const characteristic_desc_t* desc = &characteristics[c];
+        gattlib_string_to_uuid(desc->uuid, strlen(desc->uuid) + 1, &sim.uuids[c]);
+        sim.frame_length[c] = SENSIBLE_TIMESTAMP_SIZE;
+        for (f = 0; f < desc->field_count; f++){
+            uint8_t end = desc->fields[f].offset + (desc->fields[f].type == FIELD_U8 ? 1 : 2);
+            if (end > sim.frame_length[c]){
+                sim.frame_length[c] = end;
+            }
+        }
+    }
+
+    if (replay != NULL){
+        sim_load_replay(replay);
+    }else{
+        sim.devices = env_u32("SENSIBLE_SIM_DEVICES", 1);
+        if (sim.devices > SIM_MAX_DEVICES){
+            sim.devices = SIM_MAX_DEVICES;
+        }
+        for (i = 0; i < sim.devices; i++){
+            snprintf(sim.addresses[i], SIM_ADDRESS_SIZE, SIM_ADDRESS_FORMAT, (i >> 8) & 0xFF, i & 0xFF);
+        }
+    }
+    atexit(sim_report);
+}
+
+// The gateway opens the adapter from its main thread but may connect
+// before, from several threads at once
+static void sim_init(void){
+    pthread_once(&sim_once, sim_setup);
+}
+
+static uint32_t sim_random(sim_connection_t* connection){
+    uint32_t x = connection->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    connection->seed = x;
+    return x;
+}
+
+// Builds a plausible frame: random walks for measurements, small values
+// for flags and states
+static uint8_t sim_synthesize(sim_connection_t* connection, uint8_t c, uint8_t* frame){
+    const characteristic_desc_t* desc = &characteristics[c];
+    uint16_t timestamp = (uint16_t)(int64_t)((double)monotonic_msec() * (1.0 + sim.drift_ppm / 1e6));
+    uint8_t f;
+
+    memset(frame, 0, SENSIBLE_FRAME_MAX);
+    frame[0] = (uint8_t)timestamp;
+    frame[1] = (uint8_t)(timestamp >> 8);
+    for (f = 0; f < desc->field_count; f++){
+        const field_desc_t* field = &desc->fields[f];
+        int32_t* walk = &connection->walk[c][f];
+        int32_t value;
+
+        if (field->presence != FIELD_ALWAYS){
+            continue;
+        }
+        *walk += (int32_t)(sim_random(connection) % 129) - 64;
+        if (field->type == FIELD_U8){
+            value = (sim_random(connection) % 16 == 0) ? (int32_t)(sim_random(connection) % 7) : 0;
+            frame[field->offset] = (uint8_t)value;
+        }else{
+            value = (field->type == FIELD_S16) ? (int16_t)*walk : (uint16_t)*walk;
+            frame[field->offset] = (uint8_t)value;
+            frame[field->offset + 1] = (uint8_t)(value >> 8);
+        }
+    }
+    return sim.frame_length[c];
+}
+
+// Called with sim.lock held
+static void sim_emit(sim_connection_t* connection, uint8_t c, const uint8_t* frame, size_t length){
+    if (connection->handler != NULL && (connection->subscribed & (1u << c))){
+        connection->handler(&sim.uuids[c], frame, length, connection->user_data);
+        sim.emitted++;
+    }
+}
+
+// The first board is out of range during SENSIBLE_SIM_LINK_LOSS
+static int sim_out_of_range(const char* address){
+    int64_t now = monotonic_usec();
+    return sim_find_address(address) == 0 && now >= sim.loss_start_usec && now < sim.loss_end_usec;
+}
+
+static gboolean sim_tick(gpointer user_data){
+    sim_connection_t* connection = user_data;
+    uint32_t burst = sim.rate_hz > 1000 ? sim.rate_hz / 1000 : 1;
+    uint8_t frame[SENSIBLE_FRAME_MAX];
+    uint32_t n;
+    uint8_t c;
+
+    // Held for the whole tick, so a connection is not freed under it
+    pthread_mutex_lock(&sim.lock);
+    if (sim_out_of_range(connection->address)){
+        connection->timer = 0;
+        if (connection->on_disconnect != NULL){
+            connection->on_disconnect(connection->on_disconnect_data);
+        }
+        pthread_mutex_unlock(&sim.lock);
+        return G_SOURCE_REMOVE;
+    }
+
+    for (n = 0; n < burst; n++){
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            if (connection->subscribed & (1u << c)){
+                sim_emit(connection, c, frame, sim_synthesize(connection, c, frame));
+            }
+        }
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return G_SOURCE_CONTINUE;
+}
+
+// Plays back every captured notification that is due, keeping the
+// recorded spacing scaled by SENSIBLE_SIM_SPEED
+static gboolean sim_replay_tick(gpointer user_data){
+    int64_t elapsed = (int64_t)((monotonic_usec() - sim.replay_start_usec) * sim.speed);
+    int64_t origin = sim.replay[0].host_usec;
+    gboolean more = G_SOURCE_CONTINUE;
+
+    pthread_mutex_lock(&sim.lock);
+    while (sim.replay_next < sim.replay_count && sim.replay[sim.replay_next].host_usec - origin <= elapsed){
+        const capture_record_t* record = &sim.replay[sim.replay_next++];
+        int device = sim_find_address(record->address);
+
+        if (device >= 0 && sim.connections[device] != NULL){
+            sim_emit(sim.connections[device], record->characteristic, record->data, record->length);
+        }
+    }
+    if (sim.replay_next == sim.replay_count){
+        printf("SIM: replay finished\n");
+        sim.replay_timer = 0;
+        more = G_SOURCE_REMOVE;
+    }
+    pthread_mutex_unlock(&sim.lock);
+    return more;
+}
+
+int gattlib_adapter_open(const char* adapter_name, void** adapter){
+    sim_init();
+    *adapter = &sim;
+    return 0;
+}
+
+int gattlib_adapter_scan_enable(void* adapter, gattlib_discovered_device_t discovered_device_cb, int timeout){
+    char name[32];
+    uint32_t i;
+
+    for (i = 0; i < sim.devices; i++){
+        snprintf(name, sizeof(name), SIM_NAME_PREFIX "%03u", i);
+        discovered_device_cb(sim.addresses[i], name);
+    }
+    return 0;
+}
+
+int gattlib_adapter_scan_disable(void* adapter){
+    return 0;
+}
+
+int gattlib_adapter_close(void* adapter){
+    return 0;
+}
+
+gatt_connection_t *gattlib_connect(const char *src, const char *dst, uint8_t dest_type,
+                                   gattlib_bt_sec_level_t sec_level, int psm, int mtu){
+    sim_connection_t* connection;
+    int device;
+
+    sim_init();
+    usleep(sim.connect_msec * 1000);
+    device = sim_find_address(dst);
+    if (device < 0 || sim_out_of_range(dst)){
+        return NULL;
+    }
+    connection = calloc(1, sizeof(*connection));
+    if (connection == NULL){
+        return NULL;
+    }
+    snprintf(connection->address, sizeof(connection->address), "%s", sim.addresses[device]);
+    connection->seed = 0x9E3779B9u ^ (uint32_t)(device + 1) * 2654435761u;
+    pthread_mutex_lock(&sim.lock);
+    if (sim.connections[device] != NULL){
+        pthread_mutex_unlock(&sim.lock);
+        free(connection);
+        return NULL;
+    }
+    sim.connections[device] = connection;
+
+    if (sim.replay != NULL){
+        if (sim.replay_timer == 0 && sim.replay_next == 0){
+            sim.replay_start_usec = monotonic_usec();
+            sim.replay_timer = g_timeout_add(1, sim_replay_tick, NULL);
+        }
+    }else{
+        connection->timer = g_timeout_add(sim.rate_hz >= 1000 ? 1 : 1000 / sim.rate_hz, sim_tick, connection);
+    }
+    pthread_mutex_unlock(&sim.lock);
+    // gatt_connection_t is never dereferenced by the gateway
+    return (gatt_connection_t*)connection;
+}
+
+int gattlib_disconnect(gatt_connection_t* gatt_connection){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+    int device = sim_find_address(connection->address);
+
+    pthread_mutex_lock(&sim.lock);
+    if (connection->timer != 0){
+        g_source_remove(connection->timer);
+    }
+    if (device >= 0){
+        sim.connections[device] = NULL;
+    }
+    pthread_mutex_unlock(&sim.lock);
+    free(connection);
+    return 0;
+}
+
+void gattlib_register_notification(gatt_connection_t* gatt_connection, gattlib_event_handler_t notification_handler,
+                                   void* user_data){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+
+    pthread_mutex_lock(&sim.lock);
+    connection->handler = notification_handler;
+    connection->user_data = user_data;
+    pthread_mutex_unlock(&sim.lock);
+}
+
+void gattlib_register_on_disconnect(gatt_connection_t* gatt_connection, gattlib_disconnection_handler_t handler,
+                                    void* user_data){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+
+    pthread_mutex_lock(&sim.lock);
+    connection->on_disconnect = handler;
+    connection->on_disconnect_data = user_data;
+    pthread_mutex_unlock(&sim.lock);
+}
+
+// The first lookup of a characteristic by UUID on a connection costs a
+// service discovery
+static void sim_discover(sim_connection_t* connection){
+    if (!connection->discovered){
+        usleep(sim.discovery_msec * 1000);
+        connection->discovered = 1;
+    }
+}
+
+static int sim_characteristic(const uuid_t* uuid){
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (gattlib_uuid_cmp(uuid, &sim.uuids[c]) == 0){
+            return c;
+        }
+    }
+    return -1;
+}
+
+int gattlib_notification_start(gatt_connection_t* gatt_connection, const uuid_t* uuid){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+    int c = sim_characteristic(uuid);
+
+    sim_discover(connection);
+    if (c < 0){
+        return -1;
+    }
+    pthread_mutex_lock(&sim.lock);
+    connection->subscribed |= 1u << c;
+    pthread_mutex_unlock(&sim.lock);
+    return 0;
+}
+
+int gattlib_notification_stop(gatt_connection_t* gatt_connection, const uuid_t* uuid){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+    int c = sim_characteristic(uuid);
+
+    if (c < 0){
+        return -1;
+    }
+    pthread_mutex_lock(&sim.lock);
+    connection->subscribed &= ~(1u << c);
+    pthread_mutex_unlock(&sim.lock);
+    return 0;
+}
+
+int gattlib_discover_char(gatt_connection_t* gatt_connection, gattlib_characteristic_t** characteristics_out,
+                          int* characteristic_count){
+    gattlib_characteristic_t* list = calloc(CHARACTERISTICS_COUNT, sizeof(*list));
+    uint8_t c;
+
+    if (list == NULL){
+        return -1;
+    }
+    sim_discover((sim_connection_t*)gatt_connection);
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        list[c].handle = SIM_DECLARATION_HANDLE(c);
+        list[c].value_handle = SIM_DECLARATION_HANDLE(c) + 1;
+        list[c].properties = 0x10;
+        list[c].uuid = sim.uuids[c];
+    }
+    *characteristics_out = list;
+    *characteristic_count = CHARACTERISTICS_COUNT;
+    return 0;
+}
+
+// Writing 0x0001 to the client configuration descriptor of a
+// characteristic subscribes it
+int gattlib_write_char_by_handle(gatt_connection_t* gatt_connection, uint16_t handle, const void* buffer,
+                                 size_t buffer_len){
+    sim_connection_t* connection = (sim_connection_t*)gatt_connection;
+    const uint8_t* value = buffer;
+    uint8_t c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (handle == SIM_DECLARATION_HANDLE(c) + 3){
+            if (buffer_len == 2 && value[0] == 0x01 && value[1] == 0x00){
+                connection->subscribed |= 1u << c;
+            }else{
+                connection->subscribed &= ~(1u << c);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int gattlib_string_to_uuid(const char *str, size_t size, uuid_t *uuid){
+    uint8_t* bytes = uuid->value.uuid128.data;
+    size_t n = 0;
+    size_t i;
+
+    memset(uuid, 0, sizeof(*uuid));
+    for (i = 0; i < size && str[i] != '\0' && n < 32; i++){
+        char ch = str[i];
+        uint8_t nibble;
+
+        if (ch == '-'){
+            continue;
+        }
+        if (ch >= '0' && ch <= '9'){
+            nibble = (uint8_t)(ch - '0');
+        }else if (ch >= 'a' && ch <= 'f'){
+            nibble = (uint8_t)(ch - 'a' + 10);
+        }else if (ch >= 'A' && ch <= 'F'){
+            nibble = (uint8_t)(ch - 'A' + 10);
+        }else{
+            return -1;
+        }
+        bytes[n / 2] = (uint8_t)((bytes[n / 2] << 4) | nibble);
+        n++;
+    }
+    if (n != 32){
+        return -1;
+    }
+    uuid->type = SDP_UUID128;
+    return 0;
+}
+
+int gattlib_uuid_to_string(const uuid_t *uuid, char *str, size_t size){
+    const uint8_t* b = uuid->value.uuid128.data;
+
+    snprintf(str, size, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+    return 0;
+}
+
+int gattlib_uuid_cmp(const uuid_t *uuid1, const uuid_t *uuid2){
+    if (uuid1->type != uuid2->type){
+        return 1;
+    }
+    return memcmp(uuid1->value.uuid128.data, uuid2->value.uuid128.data, sizeof(uuid1->value.uuid128.data)) != 0;
+}
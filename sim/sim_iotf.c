@@ -0,0 +1,346 @@
+// Stand-in for the IBM Watson IoT device client and its MQTT publish,
+// linked instead of libiotfdeviceclient. Events are counted, not sent.
+// QoS1 packets written to the connection are taken by a broker thread at
+// the other end of a socket pair, which answers PUBACKs a round trip later.
+// Set through the environment:
+//   SENSIBLE_SIM_PUBLISH_USEC  time one publish blocks for (default 0)
+//   SENSIBLE_SIM_RTT_USEC      round trip to the broker, delay of its PUBACKs
+//                              and PINGRESPs (default 0)
+//   SENSIBLE_SIM_OUTAGE        START:SECONDS, broker unreachable from START
+//                              seconds after connecting, for SECONDS
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "deviceclient.h"
+#include "monotonic.h"
+
+// Acknowledgements the broker thread holds back for the round trip
+#define SIM_ACK_QUEUE 4096
+
+// Largest packet the broker thread takes
+#define SIM_PACKET_SIZE 8192
+
+static struct {
+    int initialized;
+    int connected;
+    uint32_t publish_usec;
+    uint32_t rtt_usec;
+    int64_t outage_start_usec;
+    int64_t outage_end_usec;
+    int64_t start_usec;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t refused;
+    // Counters are shared by the publisher and broker threads
+    pthread_mutex_t lock;
+} broker = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// A PUBACK, or a PINGRESP when packet_id is 0, due at due_usec
+typedef struct {
+    int64_t due_usec;
+    uint16_t packet_id;
+} sim_ack_t;
+
+// Broker end of one connection
+typedef struct {
+    int socket;
+    sim_ack_t acks[SIM_ACK_QUEUE];
+    uint32_t head;
+    uint32_t tail;
+    uint8_t packet[SIM_PACKET_SIZE];
+} sim_session_t;
+
+static void broker_report(void){
+    double seconds;
+
+    pthread_mutex_lock(&broker.lock);
+    seconds = (monotonic_usec() - broker.start_usec) / 1e6;
+
+    printf("Simulated broker took %llu events, %llu bytes in %.1fs: %.0f events/s, %.1f kB/s, %llu refused\n",
+           (unsigned long long)broker.messages, (unsigned long long)broker.bytes, seconds,
+           seconds > 0 ? broker.messages / seconds : 0.0, seconds > 0 ? broker.bytes / seconds / 1000 : 0.0,
+           (unsigned long long)broker.refused);
+    pthread_mutex_unlock(&broker.lock);
+}
+
+static int broker_down(void){
+    int64_t now = monotonic_usec();
+    return now >= broker.outage_start_usec && now < broker.outage_end_usec;
+}
+
+static void broker_count(uint64_t* counter, size_t n){
+    pthread_mutex_lock(&broker.lock);
+    *counter += n;
+    pthread_mutex_unlock(&broker.lock);
+}
+
+static int broker_publish(size_t length){
+    if (!broker.connected || broker_down()){
+        broker.connected = 0;
+        broker_count(&broker.refused, 1);
+        return FAILURE;
+    }
+    if (broker.publish_usec > 0){
+        usleep(broker.publish_usec);
+    }
+    broker_count(&broker.messages, 1);
+    broker_count(&broker.bytes, length);
+    return SUCCESS;
+}
+
+// Reads exactly length bytes. Returns 0 on success, -1 once the client
+// end is closed.
+static int session_read(int socket, uint8_t* buffer, size_t length){
+    size_t done = 0;
+
+    while (done < length){
+        ssize_t rc = recv(socket, buffer + done, length - done, 0);
+        if (rc <= 0){
+            if (rc < 0 && errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)rc;
+    }
+    return 0;
+}
+
+// Takes one packet: a QoS1 PUBLISH is counted and acknowledged a round
+// trip later, a PINGREQ answered. Returns -1 once the connection is over.
+static int session_take(sim_session_t* session){
+    uint32_t remaining = 0;
+    uint32_t multiplier = 1;
+    uint8_t header;
+    uint8_t byte;
+    uint8_t type;
+
+    if (session_read(session->socket, &header, 1) != 0){
+        return -1;
+    }
+    do{
+        if (session_read(session->socket, &byte, 1) != 0){
+            return -1;
+        }
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+    }while (byte & 0x80);
+    if (remaining > SIM_PACKET_SIZE || session_read(session->socket, session->packet, remaining) != 0){
+        return -1;
+    }
+
+    type = header >> 4;
+    if (broker_down()){
+        // The broker is gone: nothing is answered and the client notices
+        // through its keepalive
+        broker_count(&broker.refused, type == PUBLISH);
+        return 0;
+    }
+    if (type == PUBLISH && remaining >= 2){
+        uint16_t topic_length = (uint16_t)(session->packet[0] << 8 | session->packet[1]);
+        uint32_t offset = 2u + topic_length;
+        uint16_t packet_id = 0;
+
+        if ((header >> 1 & 3) > 0 && offset + 2 <= remaining){
+            packet_id = (uint16_t)(session->packet[offset] << 8 | session->packet[offset + 1]);
+            offset += 2;
+        }
+        if (offset > remaining){
+            return -1;
+        }
+        broker_count(&broker.messages, 1);
+        broker_count(&broker.bytes, remaining - offset);
+        if (packet_id == 0){
+            return 0;
+        }
+        if (session->head - session->tail < SIM_ACK_QUEUE){
+            session->acks[session->head % SIM_ACK_QUEUE] =
+                (sim_ack_t){ monotonic_usec() + broker.rtt_usec, packet_id };
+            session->head++;
+        }
+        return 0;
+    }
+    if (type == PINGREQ && session->head - session->tail < SIM_ACK_QUEUE){
+        session->acks[session->head % SIM_ACK_QUEUE] = (sim_ack_t){ monotonic_usec() + broker.rtt_usec, 0 };
+        session->head++;
+    }
+    return 0;
+}
+
+// Sends the acknowledgements that are due
+static int session_answer(sim_session_t* session){
+    int64_t now = monotonic_usec();
+
+    while (session->tail != session->head && session->acks[session->tail % SIM_ACK_QUEUE].due_usec <= now){
+        const sim_ack_t* ack = &session->acks[session->tail % SIM_ACK_QUEUE];
+        uint8_t packet[4] = { PUBACK << 4, 2, (uint8_t)(ack->packet_id >> 8), (uint8_t)ack->packet_id };
+        size_t length = 4;
+
+        if (ack->packet_id == 0){
+            packet[0] = PINGRESP << 4;
+            packet[1] = 0;
+            length = 2;
+        }
+        if (send(session->socket, packet, length, MSG_NOSIGNAL) != (ssize_t)length){
+            return -1;
+        }
+        session->tail++;
+    }
+    return 0;
+}
+
+static void* session_run(void* arg){
+    sim_session_t* session = arg;
+
+    for (;;){
+        struct pollfd fd = { session->socket, POLLIN, 0 };
+        int timeout_msec = 100;
+
+        if (session->tail != session->head){
+            int64_t wait = session->acks[session->tail % SIM_ACK_QUEUE].due_usec - monotonic_usec();
+            timeout_msec = wait > 0 ? (int)((wait + 999) / 1000) : 0;
+        }
+        if (poll(&fd, 1, timeout_msec) > 0 && session_take(session) != 0){
+            break;
+        }
+        if (session_answer(session) != 0){
+            break;
+        }
+    }
+    close(session->socket);
+    free(session);
+    return NULL;
+}
+
+// Network of the client end, the iot-embeddedc signatures: they return
+// the bytes transferred, or -1 on error or timeout
+static int sim_mqttread(Network* network, unsigned char* buffer, int length, int timeout_ms){
+    int done = 0;
+
+    while (done < length){
+        struct pollfd fd = { network->my_socket, POLLIN, 0 };
+        ssize_t rc;
+
+        if (poll(&fd, 1, timeout_ms) <= 0){
+            break;
+        }
+        rc = recv(network->my_socket, buffer + done, (size_t)(length - done), 0);
+        if (rc <= 0){
+            return -1;
+        }
+        done += (int)rc;
+    }
+    return done > 0 ? done : -1;
+}
+
+static int sim_mqttwrite(Network* network, unsigned char* buffer, int length, int timeout_ms){
+    ssize_t rc = send(network->my_socket, buffer, (size_t)length, MSG_NOSIGNAL);
+    return rc < 0 ? -1 : (int)rc;
+}
+
+static void sim_disconnect(Network* network){
+    if (network->my_socket >= 0){
+        close(network->my_socket);
+        network->my_socket = -1;
+    }
+}
+
+// Opens the socket pair of a new connection and its broker thread
+static int session_open(iotfclient* client){
+    sim_session_t* session = calloc(1, sizeof(*session));
+    pthread_attr_t attr;
+    pthread_t thread;
+    int sockets[2];
+    int rc;
+
+    if (session == NULL || socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0){
+        free(session);
+        return FAILURE;
+    }
+    session->socket = sockets[1];
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, session_run, session);
+    pthread_attr_destroy(&attr);
+    if (rc != 0){
+        close(sockets[0]);
+        close(sockets[1]);
+        free(session);
+        return FAILURE;
+    }
+    client->n.my_socket = sockets[0];
+    client->n.mqttread = sim_mqttread;
+    client->n.mqttwrite = sim_mqttwrite;
+    client->n.disconnect = sim_disconnect;
+    client->c.ipstack = &client->n;
+    return SUCCESS;
+}
+
+int initialize(iotfclient *client, char *org, char *domain, char *type, char *id, char *authmethod,
+               char *authtoken, char *serverCertPath, int useCerts, char *rootCACertPath,
+               char *clientCertPath, char *clientKeyPath, int isGateway){
+    const char* publish_usec = getenv("SENSIBLE_SIM_PUBLISH_USEC");
+    const char* rtt_usec = getenv("SENSIBLE_SIM_RTT_USEC");
+    const char* outage = getenv("SENSIBLE_SIM_OUTAGE");
+
+    if (broker.initialized){
+        return SUCCESS;
+    }
+    broker.initialized = 1;
+    broker.start_usec = monotonic_usec();
+    broker.publish_usec = publish_usec ? (uint32_t)strtoul(publish_usec, NULL, 10) : 0;
+    broker.rtt_usec = rtt_usec ? (uint32_t)strtoul(rtt_usec, NULL, 10) : 0;
+    broker.outage_start_usec = INT64_MAX;
+    broker.outage_end_usec = INT64_MAX;
+    if (outage != NULL){
+        double start = 0;
+        double length = 0;
+        if (sscanf(outage, "%lf:%lf", &start, &length) == 2){
+            broker.outage_start_usec = broker.start_usec + (int64_t)(start * 1e6);
+            broker.outage_end_usec = broker.outage_start_usec + (int64_t)(length * 1e6);
+        }
+    }
+    atexit(broker_report);
+    return SUCCESS;
+}
+
+int connectiotf(iotfclient *client){
+    if (broker_down()){
+        return FAILURE;
+    }
+    if (broker.connected){
+        sim_disconnect(&client->n);
+    }
+    if (session_open(client) != SUCCESS){
+        return FAILURE;
+    }
+    broker.connected = 1;
+    return SUCCESS;
+}
+
+int isConnected(iotfclient *client){
+    return broker.connected && !broker_down();
+}
+
+int yield(iotfclient *client, int time_ms){
+    return SUCCESS;
+}
+
+int disconnect(iotfclient *client){
+    broker.connected = 0;
+    sim_disconnect(&client->n);
+    return SUCCESS;
+}
+
+int publishEvent(iotfclient *client, char *eventType, char *eventFormat, unsigned char* data, enum QoS qos){
+    return broker_publish(strlen((const char*)data));
+}
+
+int MQTTPublish(Client* c, const char* topicName, MQTTMessage* message){
+    return broker_publish(message->payloadlen);
+}
@@ -0,0 +1,27 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+// Assertions of the unit tests run by ./make.sh check. A failed CHECK is
+// reported and counted, the test goes on.
+#include <stdio.h>
+
+static int check_failures;
+
+#define CHECK(condition) do{ \
+    if (!(condition)){ \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        check_failures++; \
+    } \
+}while (0)
+
+// Prints the outcome of the test program name. Returns its exit status.
+static inline int check_done(const char* name){
+    if (check_failures > 0){
+        printf("FAIL %s: %d checks failed\n", name, check_failures);
+        return 1;
+    }
+    printf("PASS %s\n", name);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Windows on the board time: one summary per window, across rollovers and
+// silences longer than them, and after a window closed by host time
+#include <string.h>
+#include "aggregate.h"
+#include "check.h"
+
+// Acceleration, gyroscope and magnetometer: min/max/mean/RMS fields
+#define CHARACTERISTIC CHAR_ACC_GYRO_MAG
+#define WINDOW_MSEC 100
+
+// acc_steps of ACCEL_EV, present when the event flags are 0
+#define STEPS_FIELD 2
+
+// Sample at board time board_msec, its timestamp the low 16 bits
+static int add(aggregate_channel_t* channel, int64_t board_msec, int32_t value, sample_t* summary){
+    sample_t sample;
+    uint8_t f;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.characteristic = CHARACTERISTIC;
+    sample.count = characteristics[CHARACTERISTIC].field_count;
+    sample.timestamp = (uint16_t)board_msec;
+    for (f = 0; f < sample.count; f++){
+        sample.values[f] = value;
+    }
+    return aggregate_add(channel, WINDOW_MSEC, &sample, board_msec, summary);
+}
+
+static void test_windows(void){
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    aggregate_channel_t channel;
+
+    memset(&channel, 0, sizeof(channel));
+    CHECK(add(&channel, 65500, 1, summary) == 0);
+    CHECK(add(&channel, 65530, 3, summary) == 0);
+    // Past the rollover, 100 ms after the first sample
+    CHECK(add(&channel, 65600, 10, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].statistic == SAMPLE_MIN && summary[0].values[0] == 1);
+    CHECK(summary[1].statistic == SAMPLE_MAX && summary[1].values[0] == 3);
+    CHECK(summary[2].statistic == SAMPLE_MEAN && summary[2].values[0] == 2);
+    CHECK(summary[0].timestamp == 65500);
+    // Empty windows are skipped, the grid stays
+    CHECK(add(&channel, 65900, 20, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].timestamp == 64 && summary[0].values[0] == 10);
+    // An older sample does not move the windows
+    CHECK(add(&channel, 65850, 30, summary) == 0);
+    // A silence of a whole wrap, though the timestamp is 10 ms on
+    CHECK(add(&channel, 65910 + 65536, 40, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].timestamp == 364 && summary[1].values[0] == 30);
+    CHECK(aggregate_close(&channel, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].timestamp == 328 && summary[0].values[0] == 40);
+    CHECK(aggregate_close(&channel, summary) == 0);
+}
+
+// A late sample of a window closed by host time goes to the next window
+static void test_expire(void){
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    aggregate_channel_t channel;
+
+    memset(&channel, 0, sizeof(channel));
+    CHECK(add(&channel, 0, 1, summary) == 0);
+    CHECK(add(&channel, 50, 2, summary) == 0);
+    CHECK(aggregate_expire(&channel, WINDOW_MSEC, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].timestamp == 0 && summary[1].values[0] == 2);
+    // Nothing more to close, the next window stays where it is
+    CHECK(aggregate_expire(&channel, WINDOW_MSEC, summary) == 0);
+    CHECK(add(&channel, 70, 5, summary) == 0);
+    CHECK(add(&channel, 150, 7, summary) == 0);
+    CHECK(add(&channel, 200, 9, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].timestamp == 100);
+    CHECK(summary[0].values[0] == 5 && summary[1].values[0] == 7);
+}
+
+static int add_steps(aggregate_channel_t* channel, int64_t board_msec, int32_t steps, sample_t* summary){
+    sample_t sample;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.characteristic = CHAR_ACCEL_EV;
+    sample.count = characteristics[CHAR_ACCEL_EV].field_count;
+    sample.timestamp = (uint16_t)board_msec;
+    sample.values[STEPS_FIELD] = steps;
+    return aggregate_add(channel, WINDOW_MSEC, &sample, board_msec, summary);
+}
+
+// The step counter is summarized by the steps of each window, from the
+// last count of the window before, across the wrap of the counter
+static void test_step_delta(void){
+    sample_t summary[AGGREGATE_SUMMARY_SAMPLES];
+    aggregate_channel_t channel;
+
+    memset(&channel, 0, sizeof(channel));
+    CHECK(add_steps(&channel, 0, 100, summary) == 0);
+    CHECK(add_steps(&channel, 50, 103, summary) == 0);
+    CHECK(add_steps(&channel, 100, 110, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].values[STEPS_FIELD] == 3);
+    CHECK(add_steps(&channel, 150, 65530, summary) == 0);
+    CHECK(add_steps(&channel, 200, 4, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].values[STEPS_FIELD] == 65530 - 103);
+    CHECK(aggregate_close(&channel, summary) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(summary[0].values[STEPS_FIELD] == 10);
+    CHECK(summary[AGGREGATE_SUMMARY_SAMPLES - 1].values[STEPS_FIELD] == 10);
+}
+
+int main(void){
+    CHECK(decoder_init() == 0);
+    test_windows();
+    test_expire();
+    test_step_delta();
+    return check_done("aggregate");
+}
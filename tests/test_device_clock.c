@@ -0,0 +1,95 @@
+// Board clocks: 16-bit timestamps extended across rollovers and silences
+// longer than a wrap, the drift taken from the earliest arrivals, and a
+// reset board starting the model over
+#include <stdlib.h>
+#include "check.h"
+#include "device_clock.h"
+
+// Host time of the first frame, in CLOCK_MONOTONIC microseconds
+#define START_USEC 1000000000LL
+
+// Board of a crystal DRIFT_PPM fast, sampling every PERIOD_MSEC of host
+// time with notifications delayed 5 to 25 ms
+#define DRIFT_PPM 100
+#define PERIOD_MSEC 250
+
+// Board time of host time host_usec since the first frame
+static int64_t board_of(int64_t host_usec){
+    return host_usec * (1000000 + DRIFT_PPM) / 1000000000;
+}
+
+static int64_t feed(device_clock_t* clock, int64_t host_usec){
+    int64_t delay = rand() % 4 == 0 ? 5000 : 5000 + rand() % 20000;
+
+    return device_clock_update(clock, (uint16_t)(board_of(host_usec) + 7000), START_USEC + host_usec + delay);
+}
+
+// Every frame for ten minutes: the board time follows the board across
+// nine rollovers and the drift is found
+static void test_rollovers_and_drift(void){
+    device_clock_t clock;
+    int64_t host_usec;
+    int64_t board = 0;
+    int monotonic = 1;
+    int exact = 1;
+
+    device_clock_reset(&clock);
+    CHECK(device_clock_time_usec(&clock, 0) == 0);
+    for (host_usec = 0; host_usec <= 600000000LL; host_usec += PERIOD_MSEC * 1000){
+        int64_t next = feed(&clock, host_usec);
+
+        monotonic &= host_usec == 0 || next > board;
+        exact &= next == board_of(host_usec) - board_of(0);
+        board = next;
+    }
+    CHECK(monotonic && exact);
+    CHECK(clock.rollovers == (uint32_t)((board_of(600000000LL) + 7000) >> 16));
+    CHECK(clock.steps == 0 && clock.estimates > 0);
+    CHECK(clock.drift_ppm > DRIFT_PPM - 30 && clock.drift_ppm < DRIFT_PPM + 30);
+    // The model puts the last frame at its fastest arrival, 5 ms after it
+    // was sent, give or take a board tick
+    host_usec = device_clock_host_usec(&clock, board) - (START_USEC + 600000000LL);
+    CHECK(host_usec > 3000 && host_usec < 7000);
+    CHECK(device_clock_time_usec(&clock, clock.last_timestamp) ==
+          device_clock_host_usec(&clock, board) + clock.realtime_offset_usec);
+}
+
+// A silence of 100 s, more than a wrap, and a frame of a characteristic
+// slightly behind the latest one
+static void test_silence(void){
+    device_clock_t clock;
+
+    device_clock_reset(&clock);
+    CHECK(device_clock_update(&clock, 65000, START_USEC) == 0);
+    CHECK(device_clock_update(&clock, 1000, START_USEC + 1536000) == 1536);
+    CHECK(device_clock_update(&clock, (uint16_t)(1000 + 100000), START_USEC + 101536000) == 101536);
+    CHECK(clock.rollovers == 2);
+    CHECK(device_clock_update(&clock, (uint16_t)(1000 + 100000 - 20), START_USEC + 101537000) == 101516);
+    CHECK(clock.board_msec == 101536);
+    CHECK(device_clock_board_msec(&clock, (uint16_t)(1000 + 100000 - 100)) == 101436);
+}
+
+// A board reset mid-run: its timestamps start over far from the model
+static void test_step(void){
+    device_clock_t clock;
+    int64_t host_usec;
+
+    device_clock_reset(&clock);
+    for (host_usec = 0; host_usec < 30000000LL; host_usec += 100000){
+        device_clock_update(&clock, (uint16_t)(host_usec / 1000), START_USEC + host_usec);
+    }
+    CHECK(clock.steps == 0);
+    device_clock_update(&clock, 0, START_USEC + host_usec);
+    CHECK(clock.steps == 1 && clock.has_baseline == 0);
+    CHECK(device_clock_host_usec(&clock, clock.board_msec) == START_USEC + host_usec);
+    CHECK(device_clock_update(&clock, 100, START_USEC + host_usec + 100000) == clock.board_msec);
+    CHECK(clock.steps == 1);
+}
+
+int main(void){
+    srand(1);
+    test_rollovers_and_drift();
+    test_silence();
+    test_step();
+    return check_done("device_clock");
+}
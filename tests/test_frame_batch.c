@@ -0,0 +1,90 @@
+// Batched decoding into columns, with the instruction set libsensible.a was
+// built for, against decoding one frame at a time
+#include <stdlib.h>
+#include <string.h>
+#include "characteristics.h"
+#include "check.h"
+#include "frame_batch.h"
+
+// Rounds of random batches per batch size
+#define ROUNDS 200
+
+static void fill_batch(frame_batch_t* batch, uint8_t characteristic, uint32_t count){
+    uint32_t i;
+    uint8_t k;
+
+    batch->characteristic = characteristic;
+    batch->count = count;
+    for (i = 0; i < count; i++){
+        batch->received_usec[i] = i;
+        for (k = 0; k < SENSIBLE_FRAME_MAX; k++){
+            batch->frames[i][k] = (uint8_t)rand();
+        }
+        // Extremes of both signednesses
+        if (i % 5 == 1){
+            memset(batch->frames[i] + SENSIBLE_TIMESTAMP_SIZE, 0xFF, SENSIBLE_FRAME_MAX - SENSIBLE_TIMESTAMP_SIZE);
+        }else if (i % 5 == 3){
+            for (k = SENSIBLE_TIMESTAMP_SIZE; k + 1 < SENSIBLE_FRAME_MAX; k += 2){
+                batch->frames[i][k] = 0x00;
+                batch->frames[i][k + 1] = 0x80;
+            }
+        }
+    }
+}
+
+static int same_columns(const sample_columns_t* a, const sample_columns_t* b){
+    const characteristic_desc_t* desc = &characteristics[a->characteristic];
+    uint32_t i;
+    uint8_t f;
+
+    if (a->characteristic != b->characteristic || a->count != b->count){
+        return 0;
+    }
+    for (i = 0; i < a->count; i++){
+        if (a->timestamps[i] != b->timestamps[i]){
+            return 0;
+        }
+        for (f = 0; f < desc->field_count; f++){
+            if (a->columns[f][i] != b->columns[f][i]){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void test_matches_scalar(uint8_t characteristic){
+    frame_batch_t batch;
+    sample_columns_t vector;
+    sample_columns_t scalar;
+    uint32_t count;
+    int round;
+
+    for (count = 0; count <= FRAME_BATCH_MAX; count++){
+        for (round = 0; round < ROUNDS; round++){
+            fill_batch(&batch, characteristic, count);
+            frame_batch_decode(&batch, &vector);
+            frame_batch_decode_scalar(&batch, &scalar);
+            CHECK(same_columns(&vector, &scalar));
+        }
+    }
+}
+
+int main(void){
+    uint8_t vectorized = 0;
+    uint8_t c;
+
+    CHECK(decoder_init() == 0);
+    frame_batch_init();
+    srand(1);
+    printf("frame_batch: %s\n", frame_batch_isa());
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        if (frame_batch_vectorized(c)){
+            vectorized++;
+        }
+        test_matches_scalar(c);
+    }
+    // ACC_GYRO_MAG and ORIENT_ESTIM
+    CHECK(vectorized == 2);
+    return check_done("frame_batch");
+}
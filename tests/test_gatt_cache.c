@@ -0,0 +1,83 @@
+// The GATT handle cache file: what gatt_cache_save() writes is loaded back,
+// malformed lines and unknown characteristics are skipped
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "check.h"
+#include "gatt_cache.h"
+
+#define BOARD_A "02:80:E1:00:00:AA"
+#define BOARD_B "02:80:E1:00:00:BB"
+
+static char path[] = "/tmp/sensible-gatt-cache-XXXXXX";
+
+static void handles_of(uint16_t value_handles[CHARACTERISTICS_COUNT], uint16_t first){
+    int c;
+
+    for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+        value_handles[c] = c % 3 == 2 ? 0 : (uint16_t)(first + 3 * c);
+    }
+}
+
+static void test_round_trip(void){
+    uint16_t handles_a[CHARACTERISTICS_COUNT];
+    uint16_t handles_b[CHARACTERISTICS_COUNT];
+    const gatt_cache_entry_t* entry;
+    gatt_cache_t cache;
+
+    // A missing file is an empty cache
+    CHECK(gatt_cache_load(&cache, path) == 0);
+    CHECK(cache.count == 0 && gatt_cache_find(&cache, BOARD_A) == NULL);
+
+    handles_of(handles_a, 0x0c);
+    handles_of(handles_b, 0x100);
+    CHECK(gatt_cache_store(&cache, BOARD_A, handles_b) == 0);
+    CHECK(gatt_cache_store(&cache, BOARD_B, handles_b) == 0);
+    // Rediscovered, the entry is replaced
+    CHECK(gatt_cache_store(&cache, BOARD_A, handles_a) == 0);
+    CHECK(cache.count == 2);
+    CHECK(gatt_cache_save(&cache, path) == 0);
+    gatt_cache_destroy(&cache);
+
+    CHECK(gatt_cache_load(&cache, path) == 0);
+    CHECK(cache.count == 2);
+    entry = gatt_cache_find(&cache, "02:80:e1:00:00:aa");
+    CHECK(entry != NULL && memcmp(entry->value_handles, handles_a, sizeof(handles_a)) == 0);
+    entry = gatt_cache_find(&cache, BOARD_B);
+    CHECK(entry != NULL && memcmp(entry->value_handles, handles_b, sizeof(handles_b)) == 0);
+    gatt_cache_destroy(&cache);
+}
+
+// Written by hand or by another version
+static void test_foreign_lines(void){
+    const gatt_cache_entry_t* entry;
+    gatt_cache_t cache;
+    FILE* file = fopen(path, "w");
+
+    CHECK(file != NULL);
+    fprintf(file, "# comment\n\n%s %s=0x0012 ffffffff-0001-11e1-ac36-0002a5d5c51b=0x0020 garbage\n",
+            BOARD_A, ACC_GYRO_MAG);
+    fprintf(file, "%s %s=33\n", BOARD_B, "00000100-0001-11E1-AC36-0002A5D5C51B");
+    fclose(file);
+
+    CHECK(gatt_cache_load(&cache, path) == 0);
+    CHECK(cache.count == 2);
+    entry = gatt_cache_find(&cache, BOARD_A);
+    CHECK(entry != NULL && entry->value_handles[CHAR_ACC_GYRO_MAG] == 0x12);
+    CHECK(entry != NULL && entry->value_handles[CHAR_LIGHT_SENSOR] == 0);
+    entry = gatt_cache_find(&cache, BOARD_B);
+    CHECK(entry != NULL && entry->value_handles[CHAR_ORIENT_ESTIM] == 33);
+    gatt_cache_destroy(&cache);
+}
+
+int main(void){
+    int fd = mkstemp(path);
+
+    CHECK(fd >= 0);
+    close(fd);
+    unlink(path);
+    test_round_trip();
+    test_foreign_lines();
+    unlink(path);
+    return check_done("gatt_cache");
+}
@@ -0,0 +1,169 @@
+// The journal ring file: records survive a reopen, those written after the
+// last header update are recovered, torn ones are not
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "check.h"
+#include "journal.h"
+
+#define CAPACITY 16
+#define DEVICE_ID "02:80:E1:00:00:AA"
+
+static char path[] = "/tmp/sensible-journal-XXXXXX";
+
+static void append(journal_t* journal, uint32_t first, uint32_t count){
+    sample_t sample;
+    uint32_t i;
+
+    memset(&sample, 0, sizeof(sample));
+    for (i = first; i < first + count; i++){
+        sample.timestamp = (uint16_t)i;
+        sample.values[0] = (int32_t)i;
+        journal_append(journal, DEVICE_ID, &sample);
+    }
+}
+
+// Whether the pending records are the samples first to first + count - 1
+static int pending_are(journal_t* journal, uint32_t first, uint32_t count){
+    journal_record_t records[CAPACITY];
+    uint32_t peeked = journal_peek(journal, records, CAPACITY);
+    uint32_t i;
+
+    if (peeked != count || journal_pending(journal) != count){
+        return 0;
+    }
+    for (i = 0; i < count; i++){
+        if (records[i].sample.values[0] != (int32_t)(first + i) || strcmp(records[i].device_id, DEVICE_ID) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Rewinds the write sequence of the header in the file, as if the process
+// died after writing the records but before the header pointed past them
+static void rewind_header(uint64_t records){
+    int fd = open(path, O_RDWR);
+    uint64_t write_seq;
+
+    CHECK(pread(fd, &write_seq, sizeof(write_seq), offsetof(journal_header_t, write_seq)) == sizeof(write_seq));
+    write_seq -= records;
+    CHECK(pwrite(fd, &write_seq, sizeof(write_seq), offsetof(journal_header_t, write_seq)) == sizeof(write_seq));
+    close(fd);
+}
+
+// Flips a byte of the sample of record seq, as a torn write would leave it
+static void tear_record(uint64_t seq){
+    int fd = open(path, O_RDWR);
+    off_t offset = JOURNAL_HEADER_SIZE + (off_t)(seq % CAPACITY) * (off_t)sizeof(journal_record_t) +
+                   (off_t)offsetof(journal_record_t, sample);
+    uint8_t byte;
+
+    CHECK(pread(fd, &byte, 1, offset) == 1);
+    byte ^= 0xFF;
+    CHECK(pwrite(fd, &byte, 1, offset) == 1);
+    close(fd);
+}
+
+static void test_reopen(void){
+    journal_t journal;
+
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(journal_pending(&journal) == 0);
+    append(&journal, 0, 10);
+    journal_consume(&journal, 4);
+    journal_close(&journal);
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(pending_are(&journal, 4, 6));
+    journal_close(&journal);
+}
+
+static void test_full_ring(void){
+    journal_t journal;
+
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    journal_consume(&journal, CAPACITY);
+    append(&journal, 100, CAPACITY + 5);
+    CHECK(journal.overwritten == 5);
+    CHECK(pending_are(&journal, 105, CAPACITY));
+    journal_consume(&journal, CAPACITY);
+    journal_close(&journal);
+}
+
+static void test_recover(void){
+    journal_t journal;
+    uint64_t write_seq;
+
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    append(&journal, 200, 8);
+    write_seq = journal.header->write_seq;
+    journal_close(&journal);
+
+    // The three newest records are recovered
+    rewind_header(3);
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(pending_are(&journal, 200, 8));
+    journal_close(&journal);
+
+    // A torn record ends the recovery, the ones behind it are lost
+    rewind_header(3);
+    tear_record(write_seq - 2);
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(pending_are(&journal, 200, 6));
+    journal_close(&journal);
+}
+
+static void test_corrupt_pending(void){
+    journal_record_t records[CAPACITY];
+    journal_t journal;
+    uint64_t read_seq;
+
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    journal_consume(&journal, CAPACITY);
+    append(&journal, 300, 4);
+    read_seq = journal.header->read_seq;
+    journal_close(&journal);
+
+    // Dropped when nothing valid precedes it, else the peek stops there
+    tear_record(read_seq);
+    tear_record(read_seq + 2);
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(journal_peek(&journal, records, CAPACITY) == 1 && records[0].sample.values[0] == 301);
+    CHECK(journal.corrupt == 1);
+    journal_consume(&journal, 1);
+    CHECK(journal_peek(&journal, records, CAPACITY) == 1 && records[0].sample.values[0] == 303);
+    CHECK(journal.corrupt == 2);
+    journal_close(&journal);
+}
+
+// A file of another size is started afresh at the size asked for
+static void test_truncated_file(void){
+    journal_t journal;
+
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    append(&journal, 400, 5);
+    journal_close(&journal);
+    CHECK(truncate(path, JOURNAL_HEADER_SIZE + 3 * sizeof(journal_record_t)) == 0);
+    CHECK(journal_open(&journal, path, CAPACITY) == 0);
+    CHECK(journal_pending(&journal) == 0);
+    append(&journal, 500, 2);
+    CHECK(pending_are(&journal, 500, 2));
+    journal_close(&journal);
+}
+
+int main(void){
+    int fd = mkstemp(path);
+
+    CHECK(fd >= 0);
+    close(fd);
+    unlink(path);
+    test_reopen();
+    test_full_ring();
+    test_recover();
+    test_corrupt_pending();
+    test_truncated_file();
+    unlink(path);
+    return check_done("journal");
+}
@@ -0,0 +1,238 @@
+// The QoS1 pipeline against a broker played by the test at the other end
+// of a socket pair: PUBACKs free their slots in any order, a full window
+// waits for one, and what is left in flight after a reconnect goes out
+// again with the DUP flag, in the order it was first written, unlike a
+// publish whose write failed
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "check.h"
+#include "mqtt_pipeline.h"
+
+#define WINDOW 4
+#define TOPIC "iot-2/evt/status/fmt/sbin"
+
+// Fixed header flag of a PUBLISH written again
+#define DUP_FLAG 0x08
+
+typedef struct {
+    uint8_t header;
+    uint16_t packet_id;
+    // First byte of the payload, the number of the publish
+    uint8_t number;
+} packet_t;
+
+static int network_read(Network* network, unsigned char* buffer, int length, int timeout_ms){
+    int done = 0;
+
+    while (done < length){
+        struct pollfd ready = { network->my_socket, POLLIN, 0 };
+        ssize_t rc;
+
+        if (poll(&ready, 1, timeout_ms) <= 0){
+            break;
+        }
+        rc = recv(network->my_socket, buffer + done, (size_t)(length - done), 0);
+        if (rc <= 0){
+            return -1;
+        }
+        done += (int)rc;
+    }
+    return done > 0 ? done : -1;
+}
+
+static int network_write(Network* network, unsigned char* buffer, int length, int timeout_ms){
+    ssize_t rc = send(network->my_socket, buffer, (size_t)length, MSG_NOSIGNAL);
+    return rc < 0 ? -1 : (int)rc;
+}
+
+// Connects client to a new broker end, returned
+static int connect_client(iotfclient* client){
+    int sockets[2];
+
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    client->n.my_socket = sockets[0];
+    client->n.mqttread = network_read;
+    client->n.mqttwrite = network_write;
+    client->c.ipstack = &client->n;
+    return sockets[1];
+}
+
+static void read_exactly(int broker, uint8_t* buffer, size_t length){
+    size_t done = 0;
+
+    while (done < length){
+        ssize_t rc = recv(broker, buffer + done, length - done, 0);
+        if (rc <= 0 && errno != EINTR){
+            CHECK(rc > 0);
+            return;
+        }
+        done += rc > 0 ? (size_t)rc : 0;
+    }
+}
+
+// Takes the next packet the client wrote
+static packet_t take_packet(int broker){
+    uint8_t body[MQTT_PIPELINE_PACKET_SIZE];
+    uint32_t remaining = 0;
+    uint32_t multiplier = 1;
+    packet_t packet;
+    uint16_t topic_length;
+    uint8_t byte;
+
+    memset(&packet, 0, sizeof(packet));
+    read_exactly(broker, &packet.header, 1);
+    do{
+        read_exactly(broker, &byte, 1);
+        remaining += (byte & 0x7F) * multiplier;
+        multiplier *= 128;
+    }while (byte & 0x80);
+    CHECK(remaining <= sizeof(body));
+    read_exactly(broker, body, remaining);
+    if (packet.header >> 4 == PUBLISH){
+        topic_length = (uint16_t)(body[0] << 8 | body[1]);
+        packet.packet_id = (uint16_t)(body[2 + topic_length] << 8 | body[3 + topic_length]);
+        packet.number = body[4 + topic_length];
+    }
+    return packet;
+}
+
+static void send_puback(int broker, uint16_t packet_id){
+    uint8_t puback[4] = { PUBACK << 4, 2, (uint8_t)(packet_id >> 8), (uint8_t)packet_id };
+
+    CHECK(send(broker, puback, sizeof(puback), MSG_NOSIGNAL) == sizeof(puback));
+}
+
+static int publish(mqtt_pipeline_t* pipeline, uint8_t number){
+    return mqtt_pipeline_publish(pipeline, TOPIC, &number, 1);
+}
+
+// Whether nothing is waiting on the broker end
+static int nothing_written(int broker){
+    struct pollfd ready = { broker, POLLIN, 0 };
+    return poll(&ready, 1, 0) == 0;
+}
+
+static void test_acks(void){
+    mqtt_pipeline_t pipeline;
+    iotfclient client;
+    uint16_t packet_ids[WINDOW + 1];
+    packet_t packet;
+    int broker;
+    uint8_t i;
+
+    memset(&client, 0, sizeof(client));
+    broker = connect_client(&client);
+    CHECK(mqtt_pipeline_init(&pipeline, &client, WINDOW, NULL) == 0);
+    for (i = 0; i < WINDOW; i++){
+        CHECK(publish(&pipeline, i) == 0);
+        packet = take_packet(broker);
+        CHECK(packet.header >> 4 == PUBLISH && (packet.header >> 1 & 3) == QOS1 && !(packet.header & DUP_FLAG));
+        CHECK(packet.number == i);
+        packet_ids[i] = packet.packet_id;
+    }
+    CHECK(pipeline.count == WINDOW);
+    CHECK(mqtt_pipeline_poll(&pipeline, 0) == 0);
+
+    // Acknowledged out of order, a duplicate PUBACK is ignored
+    send_puback(broker, packet_ids[2]);
+    send_puback(broker, packet_ids[0]);
+    send_puback(broker, packet_ids[2]);
+    CHECK(mqtt_pipeline_poll(&pipeline, 1000) == 2);
+    CHECK(pipeline.count == WINDOW - 2 && pipeline.acked == 2);
+
+    // The window is full again: the next publish takes the PUBACK waiting
+    CHECK(publish(&pipeline, WINDOW) == 0);
+    CHECK(publish(&pipeline, WINDOW + 1) == 0);
+    CHECK(pipeline.count == WINDOW);
+    take_packet(broker);
+    take_packet(broker);
+    send_puback(broker, packet_ids[1]);
+    CHECK(publish(&pipeline, WINDOW + 2) == 0);
+    packet = take_packet(broker);
+    CHECK(packet.number == WINDOW + 2);
+    packet_ids[WINDOW] = packet.packet_id;
+    CHECK(pipeline.count == WINDOW && pipeline.acked == 3 && pipeline.sent == WINDOW + 3);
+
+    // PINGREQ answered
+    CHECK(mqtt_pipeline_keepalive(&pipeline) == 0);
+    packet = take_packet(broker);
+    CHECK(packet.header >> 4 == PINGREQ);
+    CHECK(pipeline.ping_usec != 0);
+    {
+        uint8_t pingresp[2] = { PINGRESP << 4, 0 };
+        CHECK(send(broker, pingresp, sizeof(pingresp), MSG_NOSIGNAL) == sizeof(pingresp));
+    }
+    CHECK(mqtt_pipeline_poll(&pipeline, 1000) == 0);
+    CHECK(pipeline.ping_usec == 0);
+
+    // Reconnected: publishes 3, 4, 5 and 6 are still in flight, their
+    // slots in another order than the one they were written in
+    close(broker);
+    close(client.n.my_socket);
+    broker = connect_client(&client);
+    CHECK(mqtt_pipeline_resend(&pipeline) == 0);
+    for (i = 3; i <= WINDOW + 2; i++){
+        packet = take_packet(broker);
+        CHECK(packet.header & DUP_FLAG);
+        CHECK(packet.number == i);
+    }
+    CHECK(nothing_written(broker));
+    CHECK(pipeline.retransmitted == WINDOW);
+    send_puback(broker, packet_ids[WINDOW]);
+    send_puback(broker, packet_ids[3]);
+    CHECK(mqtt_pipeline_drain(&pipeline, 100) == WINDOW - 2);
+    close(broker);
+    close(client.n.my_socket);
+    mqtt_pipeline_destroy(&pipeline);
+}
+
+// A publish whose write fails leaves the window, for the caller to journal,
+// while those written before stay in flight. A hung up broker is noticed
+// once the PUBACKs it sent before are taken.
+static void test_failures(void){
+    mqtt_pipeline_t pipeline;
+    iotfclient client;
+    packet_t packet;
+    uint64_t first;
+    int broker;
+
+    memset(&client, 0, sizeof(client));
+    broker = connect_client(&client);
+    CHECK(mqtt_pipeline_init(&pipeline, &client, WINDOW, NULL) == 0);
+    first = pipeline.sequence;
+    CHECK(publish(&pipeline, 1) == 0);
+    CHECK(publish(&pipeline, 2) == 0);
+    take_packet(broker);
+    packet = take_packet(broker);
+    send_puback(broker, packet.packet_id);
+    close(broker);
+    CHECK(mqtt_pipeline_poll(&pipeline, 1000) == -1);
+    CHECK(pipeline.acked == 1 && pipeline.count == 1);
+    CHECK(publish(&pipeline, 3) == -1);
+    CHECK(pipeline.count == 1 && pipeline.sent == 2);
+    CHECK(mqtt_pipeline_in_flight(&pipeline, first, first + 1));
+    CHECK(!mqtt_pipeline_in_flight(&pipeline, first + 1, pipeline.sequence));
+    close(client.n.my_socket);
+
+    // Only the publish written before goes out again
+    broker = connect_client(&client);
+    CHECK(mqtt_pipeline_resend(&pipeline) == 0);
+    packet = take_packet(broker);
+    CHECK((packet.header & DUP_FLAG) && packet.number == 1);
+    CHECK(nothing_written(broker));
+    send_puback(broker, packet.packet_id);
+    CHECK(mqtt_pipeline_poll(&pipeline, 1000) == 1);
+    CHECK(!mqtt_pipeline_in_flight(&pipeline, first, pipeline.sequence));
+    close(broker);
+    close(client.n.my_socket);
+    mqtt_pipeline_destroy(&pipeline);
+}
+
+int main(void){
+    test_acks();
+    test_failures();
+    return check_done("mqtt_pipeline");
+}
@@ -0,0 +1,193 @@
+// Packed binary events: what payload_encode() writes, payload_decode()
+// gives back, and malformed events are refused
+#include <stdlib.h>
+#include <string.h>
+#include "aggregate.h"
+#include "characteristics.h"
+#include "check.h"
+#include "payload.h"
+
+#define DEVICE_ID "02:80:E1:00:00:AA"
+
+typedef struct {
+    sample_t samples[PAYLOAD_MAX_SAMPLES];
+    uint32_t count;
+    char device_id[32];
+} decoded_t;
+
+static void collect(const char* device_id, const sample_t* sample, void* user_data){
+    decoded_t* decoded = user_data;
+
+    if (decoded->count < PAYLOAD_MAX_SAMPLES){
+        decoded->samples[decoded->count++] = *sample;
+    }
+    snprintf(decoded->device_id, sizeof(decoded->device_id), "%s", device_id);
+}
+
+static void fill_sample(sample_t* sample, uint8_t characteristic, uint8_t statistic, uint16_t timestamp,
+                        int64_t time_usec){
+    const characteristic_desc_t* desc = &characteristics[characteristic];
+    uint8_t f;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->characteristic = characteristic;
+    sample->statistic = statistic;
+    sample->count = desc->field_count;
+    sample->timestamp = timestamp;
+    sample->time_usec = time_usec;
+    for (f = 0; f < desc->field_count; f++){
+        uint16_t raw = (uint16_t)rand();
+        sample->values[f] = desc->fields[f].type == FIELD_S16 ? (int16_t)raw :
+                            desc->fields[f].type == FIELD_U8 ? (uint8_t)raw : raw;
+    }
+}
+
+// Whether the decoded samples are those encoded, in the order of their
+// characteristic and statistic groups
+static int same_samples(const sample_t* encoded, uint32_t count, const decoded_t* decoded){
+    uint32_t matched = 0;
+    uint32_t i;
+    uint32_t j;
+    uint8_t f;
+
+    if (decoded->count != count || strcmp(decoded->device_id, DEVICE_ID) != 0){
+        return 0;
+    }
+    for (j = 0; j < decoded->count; j++){
+        const sample_t* out = &decoded->samples[j];
+
+        for (i = 0; i < count; i++){
+            const sample_t* in = &encoded[i];
+
+            if (in->characteristic != out->characteristic || in->statistic != out->statistic ||
+                in->timestamp != out->timestamp || in->omitted != out->omitted || in->count != out->count ||
+                in->time_usec / 1000 != out->time_usec / 1000){
+                continue;
+            }
+            for (f = 0; f < in->count; f++){
+                int32_t expected = (in->omitted & (1u << f)) ? 0 : in->values[f];
+                if (out->values[f] != expected){
+                    break;
+                }
+            }
+            if (f == in->count){
+                matched++;
+                break;
+            }
+        }
+    }
+    return matched == count;
+}
+
+static void round_trip(const sample_t* samples, uint32_t count, int compress){
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    decoded_t decoded;
+    int length = payload_encode(DEVICE_ID, samples, count, compress, out, sizeof(out));
+
+    CHECK(length > PAYLOAD_HEADER_SIZE);
+    if (length <= PAYLOAD_HEADER_SIZE){
+        return;
+    }
+    CHECK(out[2] == PAYLOAD_VERSION);
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(payload_decode(out, (size_t)length, collect, &decoded) == (int)count);
+    CHECK(same_samples(samples, count, &decoded));
+}
+
+// Notifications of every characteristic, timestamps wrapping around
+static void test_round_trip(void){
+    sample_t samples[CHARACTERISTICS_COUNT * 3];
+    uint32_t count = 0;
+    uint8_t c;
+    int k;
+
+    for (k = 0; k < 3; k++){
+        for (c = 0; c < CHARACTERISTICS_COUNT; c++){
+            int64_t board_msec = 65500 + 20 * k;
+            fill_sample(&samples[count++], c, SAMPLE_RAW, (uint16_t)board_msec, 1760000000000000LL + board_msec * 1000);
+        }
+    }
+    round_trip(samples, count, 0);
+    round_trip(samples, count, 1);
+}
+
+// Window summaries, with and without a known time
+static void test_summaries(void){
+    sample_t samples[2 * AGGREGATE_SUMMARY_SAMPLES];
+    uint8_t s;
+
+    for (s = 0; s < AGGREGATE_SUMMARY_SAMPLES; s++){
+        fill_sample(&samples[s], CHAR_ACC_GYRO_MAG, SAMPLE_MIN + s, 1000, 1760000000000000LL);
+        fill_sample(&samples[AGGREGATE_SUMMARY_SAMPLES + s], CHAR_ACC_GYRO_MAG, SAMPLE_MIN + s, 2000, 1760000001000000LL);
+    }
+    round_trip(samples, 2 * AGGREGATE_SUMMARY_SAMPLES, 0);
+    for (s = 0; s < 2 * AGGREGATE_SUMMARY_SAMPLES; s++){
+        samples[s].time_usec = 0;
+    }
+    round_trip(samples, 2 * AGGREGATE_SUMMARY_SAMPLES, 1);
+}
+
+// Fields held back by a publish policy are left out and marked
+static void test_omitted(void){
+    uint16_t all_but_first = (uint16_t)((1u << characteristics[CHAR_ACC_GYRO_MAG].field_count) - 2);
+    sample_t samples[4];
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    int full;
+    int length;
+    int k;
+
+    for (k = 0; k < 4; k++){
+        fill_sample(&samples[k], CHAR_ACC_GYRO_MAG, SAMPLE_RAW, (uint16_t)(10 * k), 0);
+    }
+    full = payload_encode(DEVICE_ID, samples, 4, 0, out, sizeof(out));
+    samples[1].omitted = 0x06;
+    samples[2].omitted = all_but_first;
+    samples[3].omitted = 0x01;
+    round_trip(samples, 4, 0);
+    round_trip(samples, 4, 1);
+    length = payload_encode(DEVICE_ID, samples, 4, 0, out, sizeof(out));
+    // 11 values of 2 bytes left out, 5 bytes of masks added
+    CHECK(length == full - 22 + 5);
+}
+
+// Truncated, altered or foreign events are refused without reading past
+// their end
+static void test_malformed(void){
+    sample_t samples[8];
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    uint8_t copy[PAYLOAD_BUFFER_SIZE];
+    decoded_t decoded;
+    int length;
+    int k;
+
+    for (k = 0; k < 8; k++){
+        fill_sample(&samples[k], (uint8_t)(k % 2 ? CHAR_ACC_GYRO_MAG : CHAR_LIGHT_SENSOR), SAMPLE_RAW, (uint16_t)k, 1760000000000000LL);
+    }
+    samples[3].omitted = 0x05;
+    length = payload_encode(DEVICE_ID, samples, 8, 0, out, sizeof(out));
+    CHECK(length > 0);
+    for (k = 0; k < length; k++){
+        uint8_t* truncated = malloc((size_t)k + 1);
+        memcpy(truncated, out, (size_t)k);
+        decoded.count = 0;
+        CHECK(payload_decode(truncated, (size_t)k, collect, &decoded) == -1);
+        free(truncated);
+    }
+    memcpy(copy, out, (size_t)length);
+    copy[2] = PAYLOAD_VERSION + 1;
+    CHECK(payload_decode(copy, (size_t)length, collect, &decoded) == -1);
+    memcpy(copy, out, (size_t)length);
+    copy[0] = 'X';
+    CHECK(payload_decode(copy, (size_t)length, collect, &decoded) == -1);
+    CHECK(payload_encode(DEVICE_ID, samples, 8, 0, out, (size_t)length - 1) == -1);
+}
+
+int main(void){
+    CHECK(decoder_init() == 0);
+    srand(1);
+    test_round_trip();
+    test_summaries();
+    test_omitted();
+    test_malformed();
+    return check_done("payload");
+}
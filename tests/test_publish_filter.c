@@ -0,0 +1,111 @@
+// Publish policies: which fields publish_filter_apply() holds back, per
+// board and statistic, and the heartbeat that publishes them anyway
+#include <string.h>
+#include "check.h"
+#include "publish_filter.h"
+
+static sample_t sample_of(uint8_t device, uint8_t characteristic, uint8_t statistic, int32_t value){
+    sample_t sample;
+    uint8_t f;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.device = device;
+    sample.characteristic = characteristic;
+    sample.statistic = statistic;
+    sample.count = characteristics[characteristic].field_count;
+    for (f = 0; f < sample.count; f++){
+        sample.values[f] = value;
+    }
+    return sample;
+}
+
+// Whether the compass value of device is published at now_msec
+static bool compass_published(publish_filter_t* filter, uint8_t device, uint8_t statistic, int32_t value,
+                              int64_t now_msec){
+    sample_t sample = sample_of(device, CHAR_COMPAS, statistic, value);
+    bool published = publish_filter_apply(filter, &sample, now_msec);
+
+    CHECK(sample.omitted == (published ? 0 : 1));
+    return published;
+}
+
+static void test_parse(void){
+    publish_filter_t filter;
+
+    memset(&filter, 0, sizeof(filter));
+    CHECK(!publish_filter_active(&filter));
+    CHECK(publish_filter_parse(&filter, "light=rel:2.5/1000") == 0);
+    CHECK(filter.policies[CHAR_LIGHT_SENSOR][0].mode == FILTER_DEADBAND_REL);
+    CHECK(filter.policies[CHAR_LIGHT_SENSOR][0].threshold == 2.5);
+    CHECK(filter.policies[CHAR_LIGHT_SENSOR][0].heartbeat_msec == 1000);
+    CHECK(publish_filter_active(&filter));
+    CHECK(publish_filter_parse(&filter, "nothing=change") == -1);
+    CHECK(publish_filter_parse(&filter, "light=often") == -1);
+    CHECK(publish_filter_parse(&filter, "light=abs:-1") == -1);
+    CHECK(publish_filter_parse(&filter, "all=always") == 0);
+    CHECK(!publish_filter_active(&filter));
+}
+
+// The compass defaults to a deadband of a degree
+static void test_deadband(void){
+    publish_filter_t filter;
+
+    publish_filter_defaults(&filter);
+    CHECK(publish_filter_init(&filter, 2) == 0);
+    CHECK(compass_published(&filter, 0, SAMPLE_RAW, 1000, 1000));
+    CHECK(!compass_published(&filter, 0, SAMPLE_RAW, 1100, 2000));
+    CHECK(!compass_published(&filter, 0, SAMPLE_RAW, 900, 3000));
+    CHECK(compass_published(&filter, 0, SAMPLE_RAW, 1101, 4000));
+    // Other boards and statistics keep their own last value
+    CHECK(compass_published(&filter, 1, SAMPLE_RAW, 1101, 4000));
+    CHECK(compass_published(&filter, 0, SAMPLE_MIN, 1101, 4000));
+    // Held back until the heartbeat
+    CHECK(!compass_published(&filter, 0, SAMPLE_RAW, 1101, 4000 + PUBLISH_HEARTBEAT_MSEC - 1));
+    CHECK(compass_published(&filter, 0, SAMPLE_RAW, 1101, 4000 + PUBLISH_HEARTBEAT_MSEC));
+    publish_filter_destroy(&filter);
+}
+
+// Only the fields held back are marked, the others publish the sample
+static void test_fields(void){
+    publish_filter_t filter;
+    sample_t sample;
+
+    memset(&filter, 0, sizeof(filter));
+    CHECK(publish_filter_parse(&filter, "acc_x=change") == 0);
+    CHECK(publish_filter_parse(&filter, "acc_y=rel:10") == 0);
+    CHECK(publish_filter_init(&filter, 1) == 0);
+    sample = sample_of(0, CHAR_ACC_GYRO_MAG, SAMPLE_RAW, 100);
+    CHECK(publish_filter_apply(&filter, &sample, 10) && sample.omitted == 0);
+    sample = sample_of(0, CHAR_ACC_GYRO_MAG, SAMPLE_RAW, 100);
+    sample.values[1] = 110;
+    CHECK(publish_filter_apply(&filter, &sample, 20) && sample.omitted == 0x03);
+    sample.values[1] = 111;
+    CHECK(publish_filter_apply(&filter, &sample, 30) && sample.omitted == 0x01);
+    // Boards the filter was not sized for are published unfiltered
+    sample.device = 1;
+    CHECK(publish_filter_apply(&filter, &sample, 40) && sample.omitted == 0);
+    publish_filter_destroy(&filter);
+}
+
+// Fields absent from the frame are neither published nor held back
+static void test_absent_fields(void){
+    publish_filter_t filter;
+    sample_t sample;
+
+    memset(&filter, 0, sizeof(filter));
+    CHECK(publish_filter_parse(&filter, "all=change") == 0);
+    CHECK(publish_filter_init(&filter, 1) == 0);
+    sample = sample_of(0, CHAR_ACCEL_EV, SAMPLE_RAW, 0);
+    CHECK(publish_filter_apply(&filter, &sample, 10) && sample.omitted == 0);
+    CHECK(!publish_filter_apply(&filter, &sample, 20) && sample.omitted == 0x05);
+    publish_filter_destroy(&filter);
+}
+
+int main(void){
+    CHECK(decoder_init() == 0);
+    test_parse();
+    test_deadband();
+    test_fields();
+    test_absent_fields();
+    return check_done("publish_filter");
+}
@@ -0,0 +1,121 @@
+// The buffer ring between the decoding and output threads: every buffer
+// pushed comes out exactly once, to whichever consumer pops it, across the
+// wrap of its 32-bit indexes
+#include <pthread.h>
+#include <stdlib.h>
+#include "check.h"
+#include "sample_buffer.h"
+
+// Producers and consumers of the concurrent test, and buffers each
+// producer pushes
+#define RING_THREADS 4
+#define RING_CAPACITY 256
+#define RING_PUSHES 200000
+
+// Indexes start this close to the wrap of 32 bits
+#define NEAR_WRAP (UINT32_MAX - 3 * RING_CAPACITY + 1)
+
+// Moves the empty ring to index start, its slots on the matching lap
+static void ring_start_at(buffer_ring_t* ring, uint32_t start){
+    uint32_t i;
+
+    for (i = 0; i <= ring->mask; i++){
+        uint32_t position = start + i;
+        atomic_store(&ring->slots[position & ring->mask].sequence, position);
+    }
+    atomic_store(&ring->tail, start);
+    atomic_store(&ring->head, start);
+}
+
+static void test_ring_sequential(uint32_t start){
+    sample_buffer_t buffers[RING_CAPACITY + 1];
+    buffer_ring_t ring;
+    uint32_t lap;
+    uint32_t i;
+
+    CHECK(buffer_ring_init(&ring, RING_CAPACITY) == 0);
+    ring_start_at(&ring, start);
+    CHECK(buffer_ring_pop(&ring) == NULL);
+    for (lap = 0; lap < 4; lap++){
+        for (i = 0; i < RING_CAPACITY; i++){
+            CHECK(buffer_ring_push(&ring, &buffers[i]));
+        }
+        CHECK(!buffer_ring_push(&ring, &buffers[RING_CAPACITY]));
+        for (i = 0; i < RING_CAPACITY; i++){
+            CHECK(buffer_ring_pop(&ring) == &buffers[i]);
+        }
+        CHECK(buffer_ring_pop(&ring) == NULL);
+    }
+    buffer_ring_destroy(&ring);
+}
+
+typedef struct {
+    buffer_ring_t* ring;
+    sample_buffer_t* buffers;
+    _Atomic uint32_t* seen;
+    _Atomic uint32_t* consumed;
+} ring_test_t;
+
+static void* ring_producer(void* arg){
+    ring_test_t* test = arg;
+    uint32_t i;
+
+    for (i = 0; i < RING_PUSHES; i++){
+        while (!buffer_ring_push(test->ring, &test->buffers[i])){
+        }
+    }
+    return NULL;
+}
+
+static void* ring_consumer(void* arg){
+    ring_test_t* test = arg;
+
+    while (atomic_load(test->consumed) < RING_THREADS * RING_PUSHES){
+        sample_buffer_t* buffer = buffer_ring_pop(test->ring);
+
+        if (buffer != NULL){
+            atomic_fetch_add(&test->seen[buffer - test->buffers], 1);
+            atomic_fetch_add(test->consumed, 1);
+        }
+    }
+    return NULL;
+}
+
+// Every producer pushes each buffer once: each comes out RING_THREADS
+// times in all, whichever consumers take them
+static void test_ring_concurrent(void){
+    pthread_t threads[2 * RING_THREADS];
+    sample_buffer_t* buffers = calloc(RING_PUSHES, sizeof(sample_buffer_t));
+    _Atomic uint32_t* seen = calloc(RING_PUSHES, sizeof(*seen));
+    _Atomic uint32_t consumed = 0;
+    buffer_ring_t ring;
+    ring_test_t test = { &ring, buffers, seen, &consumed };
+    int exact = 1;
+    uint32_t i;
+
+    CHECK(buffers != NULL && seen != NULL);
+    CHECK(buffer_ring_init(&ring, RING_CAPACITY) == 0);
+    ring_start_at(&ring, NEAR_WRAP - RING_THREADS * RING_PUSHES / 2);
+    for (i = 0; i < RING_THREADS; i++){
+        pthread_create(&threads[i], NULL, ring_producer, &test);
+        pthread_create(&threads[RING_THREADS + i], NULL, ring_consumer, &test);
+    }
+    for (i = 0; i < 2 * RING_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+    for (i = 0; i < RING_PUSHES; i++){
+        exact &= atomic_load(&seen[i]) == RING_THREADS;
+    }
+    CHECK(exact);
+    CHECK(buffer_ring_pop(&ring) == NULL);
+    buffer_ring_destroy(&ring);
+    free(seen);
+    free(buffers);
+}
+
+int main(void){
+    test_ring_sequential(0);
+    test_ring_sequential(NEAR_WRAP);
+    test_ring_concurrent();
+    return check_done("sample_buffer");
+}
@@ -0,0 +1,123 @@
+// The sample queue between the BLE callbacks and the publisher: a full
+// queue drops its oldest samples or refuses new ones, across the wrap of
+// its 32-bit indexes
+#include <pthread.h>
+#include <string.h>
+#include "check.h"
+#include "sample_queue.h"
+
+#define QUEUE_CAPACITY 64
+
+// Samples pushed by the producer thread of the concurrent test
+#define STREAM_SAMPLES 2000000
+
+// Indexes start this close to the wrap of 32 bits
+#define NEAR_WRAP (UINT32_MAX - 3 * QUEUE_CAPACITY + 1)
+
+static sample_t numbered(uint32_t n){
+    sample_t sample;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.values[0] = (int32_t)n;
+    return sample;
+}
+
+// Moves the empty queue to index start
+static void queue_start_at(sample_queue_t* queue, uint32_t start){
+    atomic_store(&queue->head, start);
+    atomic_store(&queue->tail, start);
+}
+
+static void test_drop_oldest(uint32_t start){
+    sample_t out[QUEUE_CAPACITY];
+    sample_queue_t queue;
+    sample_t sample;
+    uint32_t popped;
+    uint32_t i;
+
+    CHECK(sample_queue_init(&queue, QUEUE_CAPACITY, QUEUE_DROP_OLDEST) == 0);
+    queue_start_at(&queue, start);
+    for (i = 0; i < QUEUE_CAPACITY + 10; i++){
+        sample = numbered(i);
+        CHECK(sample_queue_push(&queue, &sample) == 0);
+    }
+    CHECK(atomic_load(&queue.overruns) == 10);
+    popped = sample_queue_pop(&queue, out, QUEUE_CAPACITY);
+    CHECK(popped == QUEUE_CAPACITY);
+    for (i = 0; i < popped; i++){
+        CHECK(out[i].values[0] == (int32_t)(i + 10));
+    }
+    CHECK(sample_queue_pop(&queue, out, QUEUE_CAPACITY) == 0);
+    sample_queue_destroy(&queue);
+}
+
+static void test_backpressure(uint32_t start){
+    sample_t out[QUEUE_CAPACITY];
+    sample_queue_t queue;
+    sample_t sample;
+    uint32_t i;
+
+    CHECK(sample_queue_init(&queue, QUEUE_CAPACITY, QUEUE_BACKPRESSURE) == 0);
+    queue_start_at(&queue, start);
+    for (i = 0; i < QUEUE_CAPACITY; i++){
+        sample = numbered(i);
+        CHECK(sample_queue_push(&queue, &sample) == 0);
+    }
+    CHECK(sample_queue_push(&queue, &sample) == -1);
+    CHECK(atomic_load(&queue.overruns) == 1);
+    CHECK(sample_queue_pop(&queue, out, 1) == 1 && out[0].values[0] == 0);
+    sample = numbered(QUEUE_CAPACITY);
+    CHECK(sample_queue_push(&queue, &sample) == 0);
+    CHECK(sample_queue_pop(&queue, out, QUEUE_CAPACITY) == QUEUE_CAPACITY);
+    CHECK(out[0].values[0] == 1 && out[QUEUE_CAPACITY - 1].values[0] == QUEUE_CAPACITY);
+    sample_queue_destroy(&queue);
+}
+
+static void* stream_producer(void* arg){
+    sample_queue_t* queue = arg;
+    sample_t sample;
+    uint32_t i;
+
+    for (i = 1; i <= STREAM_SAMPLES; i++){
+        sample = numbered(i);
+        sample_queue_push(queue, &sample);
+    }
+    return NULL;
+}
+
+// The producer reclaims slots under the consumer: whatever the consumer
+// gets is in order, and with the overruns accounts for every sample
+static void test_concurrent_drop(void){
+    sample_t out[QUEUE_CAPACITY];
+    sample_queue_t queue;
+    pthread_t producer;
+    uint64_t received = 0;
+    int32_t last = 0;
+    int ordered = 1;
+
+    CHECK(sample_queue_init(&queue, QUEUE_CAPACITY, QUEUE_DROP_OLDEST) == 0);
+    queue_start_at(&queue, NEAR_WRAP - STREAM_SAMPLES / 2);
+    CHECK(pthread_create(&producer, NULL, stream_producer, &queue) == 0);
+    while (last != STREAM_SAMPLES){
+        uint32_t popped = sample_queue_pop(&queue, out, QUEUE_CAPACITY);
+        uint32_t i;
+
+        for (i = 0; i < popped; i++){
+            ordered &= out[i].values[0] > last;
+            last = out[i].values[0];
+        }
+        received += popped;
+    }
+    pthread_join(producer, NULL);
+    CHECK(ordered);
+    CHECK(received + atomic_load(&queue.overruns) == STREAM_SAMPLES);
+    sample_queue_destroy(&queue);
+}
+
+int main(void){
+    test_drop_oldest(0);
+    test_drop_oldest(NEAR_WRAP);
+    test_backpressure(NEAR_WRAP);
+    test_concurrent_drop();
+    return check_done("sample_queue");
+}
@@ -0,0 +1,171 @@
+// The columnar store: raw samples land in the blocks of their board and
+// characteristic with the ranges queries skip blocks by, segments are
+// numbered on across runs and the oldest deleted past the size of the store
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "check.h"
+#include "sample_store.h"
+
+#define BOARD_A "02:80:E1:00:00:AA"
+#define BOARD_B "02:80:E1:00:00:BB"
+
+// Motion samples of board A, enough to fill more than two blocks
+#define MOTION_SAMPLES 3000
+#define LIGHT_SAMPLES 10
+
+static const char* const device_ids[] = { BOARD_A, BOARD_B };
+
+static char dir[] = "/tmp/sensible-store-XXXXXX";
+
+static sample_t sample_of(uint8_t device, uint8_t characteristic, uint32_t i){
+    sample_t sample;
+    uint8_t f;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.device = device;
+    sample.characteristic = characteristic;
+    sample.count = characteristics[characteristic].field_count;
+    sample.timestamp = (uint16_t)(65000 + 10 * i);
+    sample.received_usec = 1000000 + 10000 * (int64_t)i;
+    for (f = 0; f < sample.count; f++){
+        sample.values[f] = (int32_t)(i * (f + 1)) - 1000;
+    }
+    return sample;
+}
+
+static void store_samples(void){
+    sample_store_t store;
+    sample_t sample;
+    uint32_t i;
+
+    // One producer per board, as with a worker thread per board
+    CHECK(sample_store_start(&store, dir, 1, device_ids, 2, 2) == 0);
+    for (i = 0; i < MOTION_SAMPLES; i++){
+        sample = sample_of(0, CHAR_ACC_GYRO_MAG, i);
+        sample_store_push(&store, 0, &sample);
+    }
+    for (i = 0; i < LIGHT_SAMPLES; i++){
+        sample = sample_of(1, CHAR_LIGHT_SENSOR, i);
+        sample_store_push(&store, 1, &sample);
+    }
+    // Summaries and unknown boards are not stored
+    sample.statistic = SAMPLE_MIN;
+    sample_store_push(&store, 1, &sample);
+    sample = sample_of(2, CHAR_LIGHT_SENSOR, 0);
+    sample_store_push(&store, 0, &sample);
+    sample_store_stop(&store);
+    CHECK(store.stored == MOTION_SAMPLES + LIGHT_SAMPLES);
+}
+
+// Whether the rows of block are the samples first to first + rows - 1
+static int block_holds(const store_block_header_t* block, uint32_t first){
+    uint32_t rows = atomic_load(&block->rows);
+    uint32_t i;
+    uint8_t f;
+
+    for (i = 0; i < rows; i++){
+        sample_t sample = sample_of(block->characteristic == CHAR_LIGHT_SENSOR, block->characteristic, first + i);
+
+        if (store_block_timestamps(block)[i] != sample.timestamp ||
+            store_block_times(block)[i] - store_block_times(block)[0] != 10000 * (int64_t)i){
+            return 0;
+        }
+        for (f = 0; f < block->field_count; f++){
+            if (store_block_column(block, f)[i] != sample.values[f]){
+                return 0;
+            }
+        }
+    }
+    for (f = 0; f < block->field_count; f++){
+        if (block->min[f] != sample_of(0, block->characteristic, first).values[f] ||
+            block->max[f] != sample_of(0, block->characteristic, first + rows - 1).values[f]){
+            return 0;
+        }
+    }
+    return block->max_usec - block->min_usec == 10000 * (int64_t)(rows - 1);
+}
+
+static void test_blocks(void){
+    char path[4096];
+    store_segment_t segment;
+    uint32_t motion_rows = 0;
+    uint32_t light_rows = 0;
+    uint64_t* sequences;
+    FILE* file;
+    uint32_t i;
+
+    store_samples();
+    CHECK(store_list_segments(dir, &sequences) == 1 && sequences[0] == 0);
+    free(sequences);
+    store_segment_path(path, sizeof(path), dir, 0);
+    CHECK(store_segment_map(&segment, path) == 0);
+    if (segment.map == NULL){
+        return;
+    }
+    CHECK(atomic_load(&segment.header->used) ==
+          (MOTION_SAMPLES + store_block_capacity(9) - 1) / store_block_capacity(9) + 1);
+    for (i = 0; i < atomic_load(&segment.header->used); i++){
+        const store_block_header_t* block = store_segment_block(&segment, i);
+
+        if (block->characteristic == CHAR_ACC_GYRO_MAG){
+            CHECK(strcmp(block->device_id, BOARD_A) == 0);
+            CHECK(block_holds(block, motion_rows));
+            motion_rows += atomic_load(&block->rows);
+        }else{
+            CHECK(block->characteristic == CHAR_LIGHT_SENSOR && strcmp(block->device_id, BOARD_B) == 0);
+            CHECK(block_holds(block, light_rows));
+            light_rows += atomic_load(&block->rows);
+        }
+    }
+    CHECK(motion_rows == MOTION_SAMPLES && light_rows == LIGHT_SAMPLES);
+    store_segment_unmap(&segment);
+
+    // A file without the magic is not a segment
+    snprintf(path, sizeof(path), "%s/other", dir);
+    file = fopen(path, "w");
+    CHECK(file != NULL && fclose(file) == 0);
+    CHECK(truncate(path, STORE_SEGMENT_SIZE) == 0);
+    CHECK(store_segment_map(&segment, path) == -1);
+    unlink(path);
+}
+
+// A run starts a segment after those of the previous ones, a store of the
+// least size keeps STORE_MIN_SEGMENTS
+static void test_segments(void){
+    sample_store_t store;
+    uint64_t* sequences;
+    int run;
+
+    for (run = 0; run < 2; run++){
+        CHECK(sample_store_start(&store, dir, 1, device_ids, 2, 1) == 0);
+        sample_store_stop(&store);
+    }
+    CHECK(store.deleted == 1);
+    CHECK(store_list_segments(dir, &sequences) == STORE_MIN_SEGMENTS);
+    CHECK(sequences[0] == 1 && sequences[1] == 2);
+    free(sequences);
+}
+
+static void remove_store(void){
+    char path[4096];
+    uint64_t* sequences;
+    int count = store_list_segments(dir, &sequences);
+    int i;
+
+    for (i = 0; i < count; i++){
+        store_segment_path(path, sizeof(path), dir, sequences[i]);
+        unlink(path);
+    }
+    free(sequences);
+    rmdir(dir);
+}
+
+int main(void){
+    CHECK(decoder_init() == 0);
+    CHECK(mkdtemp(dir) != NULL);
+    test_blocks();
+    test_segments();
+    remove_store();
+    return check_done("sample_store");
+}
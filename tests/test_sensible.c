@@ -0,0 +1,258 @@
+// The session API of libsensible: notifications of a board decoded and
+// delivered to the callback of their characteristic, raw or as window
+// summaries, every decoded sample handed over before windowing, short
+// frames reported
+#include <string.h>
+#include "check.h"
+#include "sensible.h"
+
+#define DEVICE 3
+#define WINDOW_MSEC 100
+
+// Motion frames of the batched test, more than a batch holds
+#define MOTION_FRAMES (2 * FRAME_BATCH_MAX + 3)
+
+typedef struct {
+    sample_t samples[MOTION_FRAMES];
+    int count;
+    // Callback calls, and the most samples one of them carried
+    int calls;
+    int most;
+} delivered_t;
+
+static int short_frames;
+
+static void collect(const sample_t* samples, int count, void* user_data){
+    delivered_t* delivered = user_data;
+    int i;
+
+    for (i = 0; i < count; i++){
+        if (delivered->count < MOTION_FRAMES){
+            delivered->samples[delivered->count] = samples[i];
+        }
+        delivered->count++;
+    }
+    delivered->calls++;
+    if (count > delivered->most){
+        delivered->most = count;
+    }
+}
+
+static void count_short_frame(uint8_t characteristic, const uint8_t* data, size_t length, void* user_data){
+    short_frames++;
+}
+
+// Frame of characteristic at timestamp with every field set to value.
+// Returns its length.
+static size_t frame_of(uint8_t* frame, uint8_t characteristic, uint16_t timestamp, uint16_t value){
+    const characteristic_desc_t* desc = &characteristics[characteristic];
+    size_t length = SENSIBLE_TIMESTAMP_SIZE;
+    uint8_t f;
+
+    memset(frame, 0, SENSIBLE_FRAME_MAX);
+    frame[0] = (uint8_t)timestamp;
+    frame[1] = (uint8_t)(timestamp >> 8);
+    for (f = 0; f < desc->field_count; f++){
+        const field_desc_t* field = &desc->fields[f];
+
+        frame[field->offset] = (uint8_t)value;
+        if (field->type != FIELD_U8){
+            frame[field->offset + 1] = (uint8_t)(value >> 8);
+        }
+        if ((size_t)field->offset + (field->type == FIELD_U8 ? 1 : 2) > length){
+            length = (size_t)field->offset + (field->type == FIELD_U8 ? 1 : 2);
+        }
+    }
+    return length;
+}
+
+// Notification received at host time received_msec
+static int notify_at(sensible_session_t* session, uint8_t characteristic, uint16_t timestamp, uint16_t value,
+                     int64_t received_msec){
+    uint8_t frame[SENSIBLE_FRAME_MAX];
+    size_t length = frame_of(frame, characteristic, timestamp, value);
+
+    return sensible_session_notify(session, characteristic, frame, length, 1000 * received_msec);
+}
+
+// Notification received when the board clock shows timestamp
+static int notify(sensible_session_t* session, uint8_t characteristic, uint16_t timestamp, uint16_t value){
+    return notify_at(session, characteristic, timestamp, value, timestamp);
+}
+
+static void test_raw(void){
+    sensible_session_t session;
+    delivered_t light;
+    uint8_t frame[SENSIBLE_FRAME_MAX];
+
+    memset(&light, 0, sizeof(light));
+    sensible_session_init(&session, DEVICE);
+    sensible_session_on_short_frame(&session, count_short_frame, NULL);
+    CHECK(sensible_session_subscribe(&session, CHAR_LIGHT_SENSOR, collect, &light, 0) == 0);
+    CHECK(sensible_session_subscribe(&session, CHARACTERISTICS_COUNT, collect, &light, 0) == -1);
+    CHECK(sensible_session_subscribed(&session) == 1u << CHAR_LIGHT_SENSOR);
+    // Discrete events are never aggregated
+    CHECK(sensible_session_subscribe(&session, CHAR_GESTURE_RECOGN, collect, &light, WINDOW_MSEC) == -1);
+    CHECK(sensible_session_subscribed(&session) == 1u << CHAR_LIGHT_SENSOR);
+
+    CHECK(notify(&session, CHAR_LIGHT_SENSOR, 1234, 567) == 1);
+    CHECK(light.count == 1);
+    CHECK(light.samples[0].device == DEVICE && light.samples[0].characteristic == CHAR_LIGHT_SENSOR);
+    CHECK(light.samples[0].statistic == SAMPLE_RAW && light.samples[0].timestamp == 1234);
+    CHECK(light.samples[0].count == 1 && light.samples[0].values[0] == 567);
+    CHECK(light.samples[0].received_usec == 1234000);
+
+    // Decoded but not subscribed
+    CHECK(notify(&session, CHAR_COMPAS, 1240, 9000) == 0);
+    // Too short for its layout
+    frame_of(frame, CHAR_LIGHT_SENSOR, 1250, 1);
+    CHECK(sensible_session_notify(&session, CHAR_LIGHT_SENSOR, frame, 3, 0) == -1);
+    CHECK(short_frames == 1 && session.short_frames == 1);
+    CHECK(session.notifications == 3 && light.count == 1);
+}
+
+static void test_windows(void){
+    sensible_session_t session;
+    delivered_t motion;
+
+    memset(&motion, 0, sizeof(motion));
+    sensible_session_init(&session, DEVICE);
+    CHECK(sensible_session_subscribe(&session, CHAR_ACC_GYRO_MAG, collect, &motion, WINDOW_MSEC) == 0);
+    CHECK(notify(&session, CHAR_ACC_GYRO_MAG, 65500, 10) == 0);
+    CHECK(notify(&session, CHAR_ACC_GYRO_MAG, 65530, 30) == 0);
+    // Past the rollover, in the next window
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 64, 50, 65600) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(motion.count == AGGREGATE_SUMMARY_SAMPLES && motion.calls == 1);
+    CHECK(motion.samples[0].statistic == SAMPLE_MIN && motion.samples[0].values[0] == 10);
+    CHECK(motion.samples[1].statistic == SAMPLE_MAX && motion.samples[1].values[8] == 30);
+    CHECK(motion.samples[0].device == DEVICE && motion.samples[0].timestamp == 65500);
+
+    // The open window is not due yet, unless forced
+    sensible_session_flush(&session, 0);
+    CHECK(motion.count == AGGREGATE_SUMMARY_SAMPLES);
+    sensible_session_flush(&session, 1);
+    CHECK(motion.count == 2 * AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(motion.samples[AGGREGATE_SUMMARY_SAMPLES].values[0] == 50);
+    sensible_session_flush(&session, 1);
+    CHECK(motion.count == 2 * AGGREGATE_SUMMARY_SAMPLES);
+
+    // A silence of a whole wrap is no step of 10 ms
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 164, 7, 65700) == 0);
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 174, 9, 65710 + 65536) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(motion.samples[2 * AGGREGATE_SUMMARY_SAMPLES].values[0] == 7);
+    CHECK(session.clock.rollovers == 2 && session.clock.steps == 0);
+    sensible_session_flush(&session, 1);
+    CHECK(motion.count == 4 * AGGREGATE_SUMMARY_SAMPLES);
+
+    // A step of the board clock closes the open window
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 224, 11, 65710 + 65536 + 50) == 0);
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 30000, 13, 65710 + 65536 + 60) == 0);
+    CHECK(session.clock.steps == 1 && motion.count == 5 * AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(motion.samples[4 * AGGREGATE_SUMMARY_SAMPLES].values[0] == 11);
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 30099, 15, 65710 + 65536 + 159) == 0);
+    CHECK(notify_at(&session, CHAR_ACC_GYRO_MAG, 30100, 17, 65710 + 65536 + 160) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(motion.samples[5 * AGGREGATE_SUMMARY_SAMPLES].values[0] == 13);
+    CHECK(motion.samples[5 * AGGREGATE_SUMMARY_SAMPLES + 1].values[0] == 15);
+
+    // A reset board starts a new grid
+    sensible_session_reset(&session);
+    CHECK(notify(&session, CHAR_ACC_GYRO_MAG, 5, 1) == 0);
+    CHECK(notify(&session, CHAR_ACC_GYRO_MAG, 104, 1) == 0);
+}
+
+// Motion frames are staged and decoded in batches when windowed, light
+// frames one at a time: both reach the decoded callback raw, each exactly
+// once, before their window summary
+static void test_decoded(void){
+    sensible_session_t session;
+    delivered_t decoded;
+    delivered_t summaries;
+    int ordered = 1;
+    int i;
+
+    memset(&decoded, 0, sizeof(decoded));
+    memset(&summaries, 0, sizeof(summaries));
+    sensible_session_init(&session, DEVICE);
+    sensible_session_on_decoded(&session, collect, &decoded);
+    CHECK(sensible_session_subscribe(&session, CHAR_ACC_GYRO_MAG, collect, &summaries, 1000) == 0);
+    for (i = 0; i < MOTION_FRAMES; i++){
+        CHECK(notify(&session, CHAR_ACC_GYRO_MAG, (uint16_t)(10 * i), (uint16_t)i) == 0);
+    }
+    // Full batches are decoded at once, the rest waits for the window
+    CHECK(decoded.count == 2 * FRAME_BATCH_MAX && decoded.most == FRAME_BATCH_MAX);
+    sensible_session_flush(&session, 1);
+    CHECK(decoded.count == MOTION_FRAMES && summaries.count == AGGREGATE_SUMMARY_SAMPLES);
+    for (i = 0; i < MOTION_FRAMES; i++){
+        const sample_t* sample = &decoded.samples[i];
+
+        ordered &= sample->statistic == SAMPLE_RAW && sample->device == DEVICE && sample->values[0] == i &&
+                   sample->values[8] == i && sample->timestamp == 10 * i && sample->received_usec == 10000 * i;
+    }
+    CHECK(ordered);
+    CHECK(summaries.samples[1].statistic == SAMPLE_MAX && summaries.samples[1].values[0] == MOTION_FRAMES - 1);
+
+    // Not vectorized: decoded as it arrives
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(sensible_session_subscribe(&session, CHAR_LIGHT_SENSOR, collect, &summaries, 1000) == 0);
+    CHECK(notify(&session, CHAR_LIGHT_SENSOR, 2000, 77) == 0);
+    CHECK(decoded.count == 1 && decoded.samples[0].values[0] == 77);
+    // A reset drops what the windows hold
+    CHECK(notify(&session, CHAR_ACC_GYRO_MAG, 2000, 1) == 0);
+    sensible_session_reset(&session);
+    sensible_session_flush(&session, 1);
+    CHECK(decoded.count == 1);
+}
+
+static int notify_accel_event(sensible_session_t* session, uint16_t timestamp, uint8_t flags, uint16_t steps){
+    uint8_t frame[5] = { (uint8_t)timestamp, (uint8_t)(timestamp >> 8), flags, (uint8_t)steps, (uint8_t)(steps >> 8) };
+
+    return sensible_session_notify(session, CHAR_ACCEL_EV, frame, sizeof(frame), 1000 * (int64_t)timestamp);
+}
+
+// Accelerometer event frames flagging an event are delivered at once, the
+// others carry the step counter, windowed
+static void test_events(void){
+    sensible_session_t session;
+    delivered_t events;
+    int steps = sensible_field_index(CHAR_ACCEL_EV, "acc_steps");
+
+    memset(&events, 0, sizeof(events));
+    sensible_session_init(&session, DEVICE);
+    CHECK(sensible_session_subscribe(&session, CHAR_ACCEL_EV, collect, &events, WINDOW_MSEC) == 0);
+    CHECK(notify_accel_event(&session, 1000, 0, 40) == 0);
+    CHECK(notify_accel_event(&session, 1020, 0x04, 0) == 1);
+    CHECK(events.count == 1 && sample_is_event(&events.samples[0]));
+    CHECK(events.samples[0].statistic == SAMPLE_RAW && events.samples[0].values[0] == 0x04);
+    CHECK(notify_accel_event(&session, 1050, 0, 45) == 0);
+    // The next window closes this one: 5 steps, no event among them
+    CHECK(notify_accel_event(&session, 1100, 0, 47) == AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(events.count == 1 + AGGREGATE_SUMMARY_SAMPLES);
+    CHECK(events.samples[1 + SAMPLE_MEAN - SAMPLE_MIN].statistic == SAMPLE_MEAN);
+    CHECK(events.samples[1 + SAMPLE_MEAN - SAMPLE_MIN].values[steps] == 5);
+    CHECK(!sample_is_event(&events.samples[1]));
+
+    // A raw step count is no event, a gesture always is
+    events.samples[0].values[0] = 0;
+    CHECK(!sample_is_event(&events.samples[0]));
+    events.samples[0].characteristic = CHAR_GESTURE_RECOGN;
+    CHECK(sample_is_event(&events.samples[0]));
+}
+
+static void test_lookups(void){
+    CHECK(sensible_characteristic_by_uuid(ACC_GYRO_MAG) == CHAR_ACC_GYRO_MAG);
+    CHECK(sensible_characteristic_by_uuid("00E00000-0001-11E1-AC36-0002A5D5C51B") == CHAR_ACC_GYRO_MAG);
+    CHECK(sensible_characteristic_by_uuid("00002a00-0000-1000-8000-00805f9b34fb") == -1);
+    CHECK(sensible_field_index(CHAR_ACC_GYRO_MAG, "gyro_y") == 4);
+    CHECK(sensible_field_index(CHAR_ACC_GYRO_MAG, "light") == -1);
+    CHECK(sensible_field_index(CHARACTERISTICS_COUNT, "light") == -1);
+}
+
+int main(void){
+    CHECK(sensible_init() == 0);
+    test_raw();
+    test_windows();
+    test_decoded();
+    test_events();
+    test_lookups();
+    return check_done("sensible");
+}
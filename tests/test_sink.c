@@ -0,0 +1,107 @@
+// Sinks fed by the hub: urgent buffers of discrete events are taken ahead
+// of telemetry, the overflow of the urgent ring waits in the queue, and a
+// full queue drops per its policy, for each sink on its own
+#include <string.h>
+#include "check.h"
+#include "sink.h"
+
+#define QUEUE_CAPACITY 4
+
+static void publish(sink_hub_t* hub, int32_t number, bool urgent){
+    sample_t sample;
+
+    memset(&sample, 0, sizeof(sample));
+    sample.count = 1;
+    sample.values[0] = number;
+    CHECK(sink_hub_publish(hub, &sample, 1, urgent) == 0);
+}
+
+// Takes every buffer of sink into numbers. Returns how many.
+static uint32_t take_all(sink_t* sink, int32_t* numbers, uint32_t max){
+    sample_buffer_t* batch[SINK_BATCH];
+    uint32_t total = 0;
+    uint32_t count;
+    uint32_t i;
+
+    while ((count = sink_pop(sink, batch, SINK_BATCH)) > 0){
+        for (i = 0; i < count; i++){
+            if (total < max){
+                numbers[total++] = batch[i]->samples[0].values[0];
+            }
+            sink_done(sink, batch[i]);
+        }
+    }
+    return total;
+}
+
+static void test_urgent_first(sink_hub_t* hub, sink_t* sink){
+    int32_t numbers[8];
+
+    publish(hub, 1, false);
+    publish(hub, 2, false);
+    publish(hub, 100, true);
+    publish(hub, 3, false);
+    publish(hub, 101, true);
+    CHECK(take_all(sink, numbers, 8) == 5);
+    CHECK(numbers[0] == 100 && numbers[1] == 101);
+    CHECK(numbers[2] == 1 && numbers[3] == 2 && numbers[4] == 3);
+}
+
+// Past SINK_URGENT_CAPACITY, urgent buffers queue behind telemetry
+static void test_urgent_overflow(sink_hub_t* hub, sink_t* sink){
+    int32_t numbers[SINK_URGENT_CAPACITY + 2];
+    int ordered = 1;
+    int32_t i;
+
+    publish(hub, 1, false);
+    for (i = 0; i <= SINK_URGENT_CAPACITY; i++){
+        publish(hub, 1000 + i, true);
+    }
+    CHECK(take_all(sink, numbers, SINK_URGENT_CAPACITY + 2) == SINK_URGENT_CAPACITY + 2);
+    for (i = 0; i < SINK_URGENT_CAPACITY; i++){
+        ordered &= numbers[i] == 1000 + i;
+    }
+    CHECK(ordered);
+    CHECK(numbers[SINK_URGENT_CAPACITY] == 1);
+    CHECK(numbers[SINK_URGENT_CAPACITY + 1] == 1000 + SINK_URGENT_CAPACITY);
+}
+
+// The sink dropping its oldest buffers keeps the newest, the other the
+// queued ones; an urgent buffer still gets through both
+static void test_full_queues(sink_hub_t* hub, sink_t* newest, sink_t* queued){
+    int32_t numbers[QUEUE_CAPACITY + 1];
+    int32_t i;
+
+    for (i = 1; i <= QUEUE_CAPACITY + 2; i++){
+        publish(hub, i, false);
+    }
+    publish(hub, 200, true);
+    CHECK(atomic_load(&newest->metrics->dropped) == 2 && atomic_load(&queued->metrics->dropped) == 2);
+    CHECK(take_all(newest, numbers, QUEUE_CAPACITY + 1) == QUEUE_CAPACITY + 1);
+    CHECK(numbers[0] == 200 && numbers[1] == 3 && numbers[QUEUE_CAPACITY] == QUEUE_CAPACITY + 2);
+    CHECK(take_all(queued, numbers, QUEUE_CAPACITY + 1) == QUEUE_CAPACITY + 1);
+    CHECK(numbers[0] == 200 && numbers[1] == 1 && numbers[QUEUE_CAPACITY] == QUEUE_CAPACITY);
+}
+
+int main(void){
+    sink_t newest;
+    sink_t queued;
+    sink_t* sinks[2] = { &newest, &queued };
+    sink_hub_t hub;
+    int32_t numbers[SINK_URGENT_CAPACITY + 2];
+
+    CHECK(sink_init(&newest, "newest", QUEUE_CAPACITY, QUEUE_DROP_OLDEST) == 0);
+    CHECK(sink_init(&queued, "queued", QUEUE_CAPACITY, QUEUE_BACKPRESSURE) == 0);
+    CHECK(sink_hub_init(&hub, sinks, 2) == 0);
+    test_urgent_first(&hub, &newest);
+    take_all(&queued, numbers, SINK_URGENT_CAPACITY + 2);
+    test_urgent_overflow(&hub, &newest);
+    take_all(&queued, numbers, SINK_URGENT_CAPACITY + 2);
+    test_full_queues(&hub, &newest, &queued);
+    // Every buffer went back to the pool
+    CHECK(atomic_load(&hub.pool.exhausted) == 0);
+    sink_destroy(&newest);
+    sink_destroy(&queued);
+    sink_hub_destroy(&hub);
+    return check_done("sink");
+}
@@ -0,0 +1,143 @@
+// The inbox of a worker: records of every producer come out in the order
+// each pushed them, a full inbox drops and counts, across the wrap of its
+// 32-bit indexes
+#include <pthread.h>
+#include <string.h>
+#include "check.h"
+#include "worker.h"
+
+#define PRODUCERS 4
+#define PRODUCER_PUSHES 500000
+
+// Indexes start this close to the wrap of 32 bits
+#define NEAR_WRAP (UINT32_MAX - 3 * WORKER_INBOX_CAPACITY + 1)
+
+// What the handler saw: the last number of every producer, records out of
+// order and lost records
+static uint32_t last_number[PRODUCERS];
+static uint64_t handled;
+static uint64_t out_of_order;
+static uint64_t lost;
+
+static void handle(worker_t* worker, const worker_record_t* record){
+    uint32_t number;
+
+    (void)worker;
+    handled++;
+    if (record->characteristic == WORKER_RECORD_LOST){
+        lost++;
+        return;
+    }
+    memcpy(&number, record->data, sizeof(number));
+    if (record->length != sizeof(number) || record->device >= PRODUCERS || number <= last_number[record->device]){
+        out_of_order++;
+        return;
+    }
+    last_number[record->device] = number;
+}
+
+static void reset_handler(void){
+    memset(last_number, 0, sizeof(last_number));
+    handled = 0;
+    out_of_order = 0;
+    lost = 0;
+}
+
+// Moves the empty inbox to index start, its slots on the matching lap
+static void inbox_start_at(worker_t* worker, uint32_t start){
+    uint32_t i;
+
+    for (i = 0; i <= worker->mask; i++){
+        uint32_t position = start + i;
+        atomic_store(&worker->slots[position & worker->mask].sequence, position);
+    }
+    atomic_store(&worker->tail, start);
+    worker->head = start;
+}
+
+static bool push_number(worker_t* worker, uint8_t device, uint32_t number){
+    return worker_push(worker, device, 9, (const uint8_t*)&number, sizeof(number), 0);
+}
+
+static void test_full_inbox(uint32_t start){
+    worker_t worker;
+    uint32_t number = 1;
+    uint32_t lap;
+    uint32_t i;
+
+    CHECK(worker_init(&worker, 0, handle) == 0);
+    inbox_start_at(&worker, start);
+    reset_handler();
+    for (lap = 0; lap < 4; lap++){
+        for (i = 0; i < WORKER_INBOX_CAPACITY; i++){
+            CHECK(push_number(&worker, 0, number++));
+        }
+        CHECK(!push_number(&worker, 0, number));
+        CHECK(worker_drain(&worker, WORKER_DISPATCH_MAX) == WORKER_DISPATCH_MAX);
+        CHECK(worker_drain(&worker, WORKER_INBOX_CAPACITY) == WORKER_INBOX_CAPACITY - WORKER_DISPATCH_MAX);
+        CHECK(worker_drain(&worker, WORKER_INBOX_CAPACITY) == 0);
+    }
+    CHECK(handled == 4 * WORKER_INBOX_CAPACITY && out_of_order == 0);
+    CHECK(last_number[0] == number - 1);
+    CHECK(atomic_load(&worker.counters.dropped) == 4);
+    CHECK(atomic_load(&worker.counters.handled) == 4 * WORKER_INBOX_CAPACITY);
+    worker_destroy(&worker);
+}
+
+typedef struct {
+    worker_t* worker;
+    uint8_t device;
+    uint64_t dropped;
+} producer_t;
+
+static void* produce(void* arg){
+    producer_t* producer = arg;
+    uint32_t number;
+
+    for (number = 1; number <= PRODUCER_PUSHES; number++){
+        if (!push_number(producer->worker, producer->device, number)){
+            producer->dropped++;
+        }
+    }
+    worker_push_lost(producer->worker, producer->device);
+    return NULL;
+}
+
+// The BLE callbacks of several boards push while the worker drains
+static void test_producers(void){
+    producer_t producers[PRODUCERS];
+    pthread_t threads[PRODUCERS];
+    worker_t worker;
+    uint64_t dropped = 0;
+    uint8_t p;
+
+    CHECK(worker_init(&worker, 0, handle) == 0);
+    inbox_start_at(&worker, NEAR_WRAP - PRODUCERS * PRODUCER_PUSHES / 2);
+    reset_handler();
+    for (p = 0; p < PRODUCERS; p++){
+        producers[p].worker = &worker;
+        producers[p].device = p;
+        producers[p].dropped = 0;
+        pthread_create(&threads[p], NULL, produce, &producers[p]);
+    }
+    // Every producer ends with a lost record, which is never dropped
+    while (lost < PRODUCERS){
+        worker_drain(&worker, WORKER_DISPATCH_MAX);
+    }
+    for (p = 0; p < PRODUCERS; p++){
+        pthread_join(threads[p], NULL);
+        dropped += producers[p].dropped;
+    }
+    CHECK(worker_drain(&worker, WORKER_INBOX_CAPACITY) == 0);
+    CHECK(out_of_order == 0);
+    CHECK(handled + dropped == PRODUCERS * (PRODUCER_PUSHES + 1));
+    CHECK(atomic_load(&worker.counters.dropped) == dropped);
+    worker_destroy(&worker);
+}
+
+int main(void){
+    test_full_inbox(0);
+    test_full_inbox(NEAR_WRAP);
+    test_producers();
+    return check_done("worker");
+}
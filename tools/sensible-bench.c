@@ -0,0 +1,271 @@
+// Microbenchmarks of the gateway hot paths on random frames: frame decoding
+// one notification at a time against batched decoding into columns, scalar
+// and vectorized, then notifications through a libsensible session, then
+// JSON against packed binary events, then QoS1
+// publishing across in-flight windows. Events go to the simulated broker
+// of sim/, so nothing leaves the machine; it acknowledges QoS1 publishes
+// SENSIBLE_SIM_RTT_USEC later, 1000 unless set.
+// Usage: sensible-bench [FRAMES]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "characteristics.h"
+#include "frame_batch.h"
+#include "iot_message.h"
+#include "monotonic.h"
+#include "payload.h"
+#include "sensible.h"
+
+// Frames decoded or samples serialized per measurement
+#define BENCH_FRAMES 1000000
+
+// Random frames cycled through by the benchmarks
+#define BENCH_POOL 4096
+
+// Events published per QoS1 measurement, and samples in each
+#define BENCH_QOS1_EVENTS 2000
+#define BENCH_QOS1_SAMPLES 16
+
+static uint8_t pool[BENCH_POOL][SENSIBLE_FRAME_MAX];
+
+// Keeps the compiler from dropping the decoded results
+static volatile int64_t sink;
+
+static void fill_pool(void){
+    uint32_t i;
+    uint8_t k;
+
+    srand(1);
+    for (i = 0; i < BENCH_POOL; i++){
+        for (k = 0; k < SENSIBLE_FRAME_MAX; k++){
+            pool[i][k] = (uint8_t)rand();
+        }
+    }
+}
+
+static double per_item_nsec(int64_t start_usec, uint64_t items){
+    return (monotonic_usec() - start_usec) * 1000.0 / items;
+}
+
+static double bench_decode_frame(uint8_t characteristic, uint64_t frames){
+    int64_t start = monotonic_usec();
+    sample_t sample;
+    uint64_t i;
+
+    for (i = 0; i < frames; i++){
+        decode_frame(characteristic, pool[i % BENCH_POOL], SENSIBLE_FRAME_MAX, &sample);
+        sink += sample.values[0];
+    }
+    return per_item_nsec(start, frames);
+}
+
+static double bench_decode_batch(uint8_t characteristic, uint32_t batch_size, int vectorized, uint64_t frames){
+    static frame_batch_t batch;
+    static sample_columns_t columns;
+    uint64_t decoded = 0;
+    int64_t start;
+    uint32_t i;
+
+    batch.characteristic = characteristic;
+    batch.count = batch_size;
+    start = monotonic_usec();
+    while (decoded < frames){
+        // Staging the frames is part of the batched path
+        for (i = 0; i < batch_size; i++){
+            memcpy(batch.frames[i], pool[(decoded + i) % BENCH_POOL], SENSIBLE_FRAME_MAX);
+        }
+        if (vectorized){
+            frame_batch_decode(&batch, &columns);
+        }else{
+            frame_batch_decode_scalar(&batch, &columns);
+        }
+        sink += columns.columns[0][0];
+        decoded += batch_size;
+    }
+    return per_item_nsec(start, decoded);
+}
+
+static void count_samples(const sample_t* samples, int count, void* user_data){
+    sink += samples[0].values[0] + count;
+}
+
+// Notifications fed to a session, their board timestamps 20 ms apart so
+// that windows close on time
+static double bench_session(uint8_t characteristic, uint32_t window_msec, uint64_t frames){
+    static sensible_session_t session;
+    uint8_t frame[SENSIBLE_FRAME_MAX];
+    int64_t start;
+    uint64_t i;
+
+    sensible_session_init(&session, 0);
+    sensible_session_subscribe(&session, characteristic, count_samples, NULL, window_msec);
+    start = monotonic_usec();
+    for (i = 0; i < frames; i++){
+        memcpy(frame, pool[i % BENCH_POOL], SENSIBLE_FRAME_MAX);
+        frame[0] = (uint8_t)(i * 20);
+        frame[1] = (uint8_t)(i * 20 >> 8);
+        sensible_session_notify(&session, characteristic, frame, SENSIBLE_FRAME_MAX, start);
+    }
+    return per_item_nsec(start, frames);
+}
+
+static void fill_samples(uint8_t characteristic, sample_t* samples, uint32_t count){
+    uint32_t i;
+
+    for (i = 0; i < count; i++){
+        decode_frame(characteristic, pool[i % BENCH_POOL], SENSIBLE_FRAME_MAX, &samples[i]);
+        // Board timestamps 20 ms apart, as a 50 Hz stream
+        samples[i].timestamp = (uint16_t)(i * 20);
+    }
+}
+
+static double bench_json(iotfclient* client, uint8_t characteristic, uint32_t batch_size, uint64_t samples,
+                         double* bytes){
+    const characteristic_desc_t* desc = &characteristics[characteristic];
+    static sample_t batch[PAYLOAD_MAX_SAMPLES];
+    iot_message_t message;
+    uint64_t done = 0;
+    uint64_t total_bytes = 0;
+    int64_t start;
+    uint32_t i;
+    uint8_t f;
+
+    fill_samples(characteristic, batch, batch_size);
+    iot_message_init(&message, client, NULL, "02:80:E1:00:00:AA");
+    start = monotonic_usec();
+    while (done < samples){
+        // A characteristic appears once per document, so one event per sample
+        for (i = 0; i < batch_size; i++){
+            for (f = 0; f < batch[i].count; f++){
+                iot_message_add(&message, desc->fields[f].name, batch[i].values[f]);
+            }
+            total_bytes += message.length + 2;
+            iot_message_publish(&message, "status");
+        }
+        done += batch_size;
+    }
+    *bytes = (double)total_bytes / done;
+    return per_item_nsec(start, done);
+}
+
+static double bench_binary(iotfclient* client, uint8_t characteristic, uint32_t batch_size, int compress,
+                           uint64_t samples, double* bytes){
+    static sample_t batch[PAYLOAD_MAX_SAMPLES];
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    uint64_t done = 0;
+    uint64_t total_bytes = 0;
+    int64_t start;
+    int length;
+
+    fill_samples(characteristic, batch, batch_size);
+    start = monotonic_usec();
+    while (done < samples){
+        length = payload_encode("02:80:E1:00:00:AA", batch, batch_size, compress, out, sizeof(out));
+        if (length < 0){
+            return -1;
+        }
+        iot_publish_raw(client, NULL, "status", PAYLOAD_BINARY_FORMAT, out, (size_t)length, QOS0);
+        total_bytes += (uint64_t)length;
+        done += batch_size;
+    }
+    *bytes = (double)total_bytes / done;
+    return per_item_nsec(start, done);
+}
+
+// Acknowledged binary events per second with up to window of them in flight
+static double bench_qos1(iotfclient* client, uint16_t window){
+    static sample_t batch[BENCH_QOS1_SAMPLES];
+    uint8_t out[PAYLOAD_BUFFER_SIZE];
+    mqtt_pipeline_t pipeline;
+    int64_t start;
+    uint32_t i;
+    int length;
+
+    fill_samples(CHAR_ACC_GYRO_MAG, batch, BENCH_QOS1_SAMPLES);
+    length = payload_encode("02:80:E1:00:00:AA", batch, BENCH_QOS1_SAMPLES, 0, out, sizeof(out));
+    if (length < 0 || mqtt_pipeline_init(&pipeline, client, window, NULL) != 0){
+        return -1;
+    }
+    start = monotonic_usec();
+    for (i = 0; i < BENCH_QOS1_EVENTS; i++){
+        if (iot_publish_raw(client, &pipeline, "status", PAYLOAD_BINARY_FORMAT, out, (size_t)length, QOS1) != 0){
+            break;
+        }
+    }
+    if (mqtt_pipeline_drain(&pipeline, MQTT_PIPELINE_ACK_TIMEOUT_MSEC) > 0){
+        i = 0;
+    }
+    mqtt_pipeline_destroy(&pipeline);
+    return i * 1e6 / (monotonic_usec() - start);
+}
+
+int main(int argc, char* argv[]){
+    static const uint8_t decoded[] = { CHAR_ACC_GYRO_MAG, CHAR_ORIENT_ESTIM };
+    static const uint32_t decode_sizes[] = { 1, 4, 8, 16 };
+    static const uint32_t serialize_sizes[] = { 1, 4, 16, 64 };
+    static const uint16_t windows[] = { 1, 4, 16, 64, 256 };
+    uint64_t frames = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_FRAMES;
+    iotfclient client;
+    size_t c;
+    size_t s;
+
+    if (sensible_init() != 0){
+        fprintf(stderr, "ERROR: Inconsistent characteristic frame layouts.\n");
+        return 1;
+    }
+    fill_pool();
+    setenv("SENSIBLE_SIM_RTT_USEC", "1000", 0);
+    initialize(&client, "quickstart", "internetofthings.ibmcloud.com", "bench", "bench", "token", "token",
+               NULL, 0, NULL, NULL, NULL, 0);
+    connectiotf(&client);
+
+    printf("Decoding, ns per frame, %s build\n", frame_batch_isa());
+    printf("%-14s %6s %12s %12s %12s\n", "layout", "batch", "per frame", "batch", "vectorized");
+    for (c = 0; c < sizeof(decoded); c++){
+        for (s = 0; s < sizeof(decode_sizes) / sizeof(decode_sizes[0]); s++){
+            printf("%-14s %6u %12.1f %12.1f %12.1f\n", characteristics[decoded[c]].fields[0].name, decode_sizes[s],
+                   bench_decode_frame(decoded[c], frames),
+                   bench_decode_batch(decoded[c], decode_sizes[s], 0, frames),
+                   bench_decode_batch(decoded[c], decode_sizes[s], 1, frames));
+        }
+    }
+
+    printf("\nSession notifications, ns per notification\n");
+    printf("%-14s %12s %12s\n", "layout", "raw", "1 s windows");
+    for (c = 0; c < sizeof(decoded); c++){
+        printf("%-14s %12.1f %12.1f\n", characteristics[decoded[c]].fields[0].name,
+               bench_session(decoded[c], 0, frames), bench_session(decoded[c], 1000, frames));
+    }
+
+    printf("\nSerializing ACC_GYRO_MAG samples, ns and bytes per sample\n");
+    printf("%6s %10s %8s %10s %8s", "batch", "json", "bytes", "binary", "bytes");
+#if defined(HAVE_ZLIB)
+    printf(" %10s %8s", "zlib", "bytes");
+#endif
+    printf("\n");
+    for (s = 0; s < sizeof(serialize_sizes) / sizeof(serialize_sizes[0]); s++){
+        uint32_t size = serialize_sizes[s];
+        double json_bytes;
+        double binary_bytes;
+        double json = bench_json(&client, CHAR_ACC_GYRO_MAG, size, frames / 4, &json_bytes);
+        double binary = bench_binary(&client, CHAR_ACC_GYRO_MAG, size, 0, frames / 4, &binary_bytes);
+
+        printf("%6u %10.1f %8.1f %10.1f %8.1f", size, json, json_bytes, binary, binary_bytes);
+#if defined(HAVE_ZLIB)
+        {
+            double zlib_bytes;
+            double zlib = bench_binary(&client, CHAR_ACC_GYRO_MAG, size, 1, frames / 4, &zlib_bytes);
+            printf(" %10.1f %8.1f", zlib, zlib_bytes);
+        }
+#endif
+        printf("\n");
+    }
+
+    printf("\nQoS1 binary events of %d samples acknowledged per second, %s us round trip\n",
+           BENCH_QOS1_SAMPLES, getenv("SENSIBLE_SIM_RTT_USEC"));
+    printf("%6s %10s\n", "window", "events/s");
+    for (s = 0; s < sizeof(windows) / sizeof(windows[0]); s++){
+        printf("%6u %10.0f\n", windows[s], bench_qos1(&client, windows[s]));
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Prints the samples of packed binary events (-f binary / binary-zlib) as
+// JSON lines, one file per event, stdin when no file is given
+#include <stdio.h>
+#include <stdlib.h>
+#include "characteristics.h"
+#include "payload.h"
+
+// Largest event accepted, a packed batch is far smaller
+#define DECODE_INPUT_MAX (64 * 1024)
+
+static void print_sample_json(const char* device_id, const sample_t* sample, void* user_data){
+    char line[SAMPLE_JSON_SIZE];
+
+    (void)user_data;
+    format_sample_json(device_id, sample, line, sizeof(line));
+    puts(line);
+}
+
+static int decode_file(FILE* file, const char* name){
+    static uint8_t data[DECODE_INPUT_MAX];
+    size_t length = fread(data, 1, sizeof(data), file);
+    int samples;
+
+    if (!feof(file)){
+        fprintf(stderr, "%s: event larger than %d bytes\n", name, DECODE_INPUT_MAX);
+        return -1;
+    }
+    samples = payload_decode(data, length, print_sample_json, NULL);
+    if (samples < 0){
+        fprintf(stderr, "%s: not a valid packed event\n", name);
+        return -1;
+    }
+    fprintf(stderr, "%s: %zu bytes, %d samples\n", name, length, samples);
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    int rc = 0;
+    int i;
+
+    if (decoder_init() != 0){
+        fprintf(stderr, "ERROR: Inconsistent characteristic frame layouts.\n");
+        return 1;
+    }
+    if (argc < 2){
+        return decode_file(stdin, "stdin") == 0 ? 0 : 1;
+    }
+    for (i = 1; i < argc; i++){
+        FILE* file = fopen(argv[i], "rb");
+        if (file == NULL){
+            perror(argv[i]);
+            rc = 1;
+            continue;
+        }
+        if (decode_file(file, argv[i]) != 0){
+            rc = 1;
+        }
+        fclose(file);
+    }
+    return rc;
+}
@@ -0,0 +1,369 @@
+// Scans the full-rate store of a gateway (-s STORE) for a time range, per
+// board and field, straight from the mapped segments. Blocks whose time
+// or value ranges cannot match are skipped from their index alone.
+// Usage: sensible-query [-d MAC] [-c FIELD] [-f FROM] [-t TO] [-w FIELD>VALUE] [-r] STORE
+//   -d MAC          only the board with this address
+//   -c FIELD        only the characteristic carrying FIELD
+//   -f FROM, -t TO  time range in Unix seconds, negative for seconds before now
+//   -w FIELD>VALUE  only rows whose FIELD is above VALUE, or below with <
+//   -r              print the matching rows as CSV instead of per field summaries
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "characteristics.h"
+#include "monotonic.h"
+#include "sample_store.h"
+
+#define QUERY_PATH_SIZE 4096
+
+// Summaries kept, one per board, characteristic and field
+#define QUERY_MAX_SUMMARIES 4096
+
+typedef struct {
+    char device_id[STORE_DEVICE_ID_SIZE];
+    uint8_t characteristic;
+    uint8_t field;
+    uint64_t rows;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+} summary_t;
+
+typedef struct {
+    const char* device_id;
+    int characteristic;
+    int64_t from_usec;
+    int64_t to_usec;
+    // Row predicate: field of characteristic above, or below, value
+    int where_characteristic;
+    uint8_t where_field;
+    bool where_above;
+    int32_t where_value;
+    bool rows;
+} query_t;
+
+static summary_t summaries[QUERY_MAX_SUMMARIES];
+static uint32_t summaries_count;
+
+static uint64_t blocks_total;
+static uint64_t blocks_skipped;
+static uint64_t bytes_scanned;
+
+static int64_t parse_time(const char* arg){
+    double seconds = strtod(arg, NULL);
+    return seconds < 0 ? realtime_usec() + (int64_t)(seconds * 1e6) : (int64_t)(seconds * 1e6);
+}
+
+static int field_index(uint8_t characteristic, const char* name){
+    uint8_t f;
+
+    for (f = 0; f < characteristics[characteristic].field_count; f++){
+        if (strcmp(characteristics[characteristic].fields[f].name, name) == 0){
+            return f;
+        }
+    }
+    return -1;
+}
+
+static int parse_where(query_t* query, const char* arg){
+    const char* op = strpbrk(arg, "<>");
+    char name[32];
+
+    if (op == NULL || (size_t)(op - arg) >= sizeof(name)){
+        return -1;
+    }
+    memcpy(name, arg, (size_t)(op - arg));
+    name[op - arg] = '\0';
+    query->where_characteristic = characteristic_by_field(name);
+    if (query->where_characteristic < 0){
+        return -1;
+    }
+    query->where_field = (uint8_t)field_index((uint8_t)query->where_characteristic, name);
+    query->where_above = *op == '>';
+    query->where_value = (int32_t)strtol(op + 1, NULL, 10);
+    return 0;
+}
+
+// Whether field f of row exists, per its presence condition
+static bool row_has_field(const store_block_header_t* block, uint8_t f, uint32_t row){
+    const field_desc_t* field = &characteristics[block->characteristic].fields[f];
+
+    switch (field->presence){
+    case FIELD_WHEN_ZERO:
+        return store_block_column(block, field->presence_field)[row] == 0;
+    case FIELD_WHEN_NONZERO:
+        return store_block_column(block, field->presence_field)[row] != 0;
+    default:
+        return true;
+    }
+}
+
+static summary_t* summary_of(const store_block_header_t* block, uint8_t f){
+    uint32_t i;
+
+    for (i = 0; i < summaries_count; i++){
+        if (summaries[i].characteristic == block->characteristic && summaries[i].field == f &&
+            strcmp(summaries[i].device_id, block->device_id) == 0){
+            return &summaries[i];
+        }
+    }
+    if (summaries_count == QUERY_MAX_SUMMARIES){
+        return NULL;
+    }
+    memcpy(summaries[i].device_id, block->device_id, STORE_DEVICE_ID_SIZE);
+    summaries[i].device_id[STORE_DEVICE_ID_SIZE - 1] = '\0';
+    summaries[i].characteristic = block->characteristic;
+    summaries[i].field = f;
+    summaries[i].min = INT32_MAX;
+    summaries[i].max = INT32_MIN;
+    summaries_count++;
+    return &summaries[i];
+}
+
+// First row at or after usec; the rows of a block are in board time
+// order, but for corrections of the clock model below a notification delay
+static uint32_t lower_bound(const int64_t* times, uint32_t rows, int64_t usec){
+    uint32_t low = 0;
+    uint32_t high = rows;
+
+    while (low < high){
+        uint32_t mid = low + (high - low) / 2;
+        if (times[mid] < usec){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Folds the contiguous rows [first, last) of a field column. Without
+// conditional fields the loop is branch free and vectorizes.
+static void summarize_range(const store_block_header_t* block, uint8_t f, uint32_t first, uint32_t last){
+    const int32_t* column = store_block_column(block, f);
+    summary_t* summary = summary_of(block, f);
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MIN;
+    int64_t sum = 0;
+    uint64_t rows = 0;
+    uint32_t i;
+
+    if (summary == NULL){
+        return;
+    }
+    if (characteristics[block->characteristic].fields[f].presence == FIELD_ALWAYS){
+        for (i = first; i < last; i++){
+            min = column[i] < min ? column[i] : min;
+            max = column[i] > max ? column[i] : max;
+            sum += column[i];
+        }
+        rows = last - first;
+    }else{
+        for (i = first; i < last; i++){
+            if (row_has_field(block, f, i)){
+                min = column[i] < min ? column[i] : min;
+                max = column[i] > max ? column[i] : max;
+                sum += column[i];
+                rows++;
+            }
+        }
+    }
+    summary->rows += rows;
+    summary->sum += sum;
+    summary->min = min < summary->min ? min : summary->min;
+    summary->max = max > summary->max ? max : summary->max;
+}
+
+static void print_row(const store_block_header_t* block, uint32_t row){
+    int64_t usec = store_block_times(block)[row];
+    uint8_t f;
+
+    printf("%lld.%06lld,%s,%s,%u", (long long)(usec / 1000000), (long long)(usec % 1000000), block->device_id,
+           characteristics[block->characteristic].title, store_block_timestamps(block)[row]);
+    for (f = 0; f < block->field_count; f++){
+        if (row_has_field(block, f, row)){
+            printf(",%s=%d", characteristics[block->characteristic].fields[f].name,
+                   store_block_column(block, f)[row]);
+        }
+    }
+    printf("\n");
+}
+
+// Whether the index of a block rules it out
+static bool block_skipped(const query_t* query, const store_block_header_t* block, uint32_t rows){
+    if (rows == 0 || block->characteristic >= CHARACTERISTICS_COUNT ||
+        block->max_usec < query->from_usec || block->min_usec >= query->to_usec){
+        return true;
+    }
+    if (query->characteristic >= 0 && block->characteristic != query->characteristic){
+        return true;
+    }
+    if (query->device_id != NULL && strncmp(block->device_id, query->device_id, STORE_DEVICE_ID_SIZE) != 0){
+        return true;
+    }
+    if (query->where_characteristic >= 0){
+        if (block->characteristic != query->where_characteristic){
+            return true;
+        }
+        return query->where_above ? block->max[query->where_field] <= query->where_value
+                                  : block->min[query->where_field] >= query->where_value;
+    }
+    return false;
+}
+
+static void scan_block(const query_t* query, const store_block_header_t* block){
+    uint32_t rows = atomic_load_explicit(&((store_block_header_t*)block)->rows, memory_order_acquire);
+    const int64_t* times = store_block_times(block);
+    uint32_t first;
+    uint32_t last;
+    uint32_t i;
+    uint8_t f;
+
+    blocks_total++;
+    if (block_skipped(query, block, rows)){
+        blocks_skipped++;
+        return;
+    }
+    first = block->min_usec >= query->from_usec ? 0 : lower_bound(times, rows, query->from_usec);
+    last = block->max_usec < query->to_usec ? rows : lower_bound(times, rows, query->to_usec);
+    bytes_scanned += (uint64_t)(last - first) * (sizeof(int64_t) + block->field_count * sizeof(int32_t));
+
+    if (query->where_characteristic < 0 && !query->rows){
+        for (f = 0; f < block->field_count; f++){
+            summarize_range(block, f, first, last);
+        }
+        return;
+    }
+    for (i = first; i < last; i++){
+        if (query->where_characteristic >= 0){
+            int32_t value = store_block_column(block, query->where_field)[i];
+            if (query->where_above ? value <= query->where_value : value >= query->where_value){
+                continue;
+            }
+        }
+        if (query->rows){
+            print_row(block, i);
+            continue;
+        }
+        for (f = 0; f < block->field_count; f++){
+            if (row_has_field(block, f, i)){
+                summarize_range(block, f, i, i + 1);
+            }
+        }
+    }
+}
+
+static int scan_store(const query_t* query, const char* dir){
+    char path[QUERY_PATH_SIZE];
+    uint64_t* sequences;
+    int count = store_list_segments(dir, &sequences);
+    int i;
+
+    if (count < 0){
+        perror(dir);
+        return -1;
+    }
+    for (i = 0; i < count; i++){
+        store_segment_t segment;
+        uint32_t used;
+        uint32_t b;
+
+        store_segment_path(path, sizeof(path), dir, sequences[i]);
+        // The gateway may have deleted it since the listing
+        if (store_segment_map(&segment, path) != 0){
+            continue;
+        }
+        used = atomic_load_explicit(&((store_segment_header_t*)segment.header)->used, memory_order_acquire);
+        for (b = 0; b < used && b < segment.header->blocks; b++){
+            scan_block(query, store_segment_block(&segment, b));
+        }
+        store_segment_unmap(&segment);
+    }
+    free(sequences);
+    return 0;
+}
+
+static void print_summaries(void){
+    uint32_t i;
+
+    printf("%-17s %-36s %-14s %10s %11s %11s %12s\n", "device", "characteristic", "field", "rows", "min", "max",
+           "mean");
+    for (i = 0; i < summaries_count; i++){
+        const summary_t* s = &summaries[i];
+        if (s->rows == 0){
+            continue;
+        }
+        printf("%-17s %-36s %-14s %10llu %11d %11d %12.2f\n", s->device_id, characteristics[s->characteristic].title,
+               characteristics[s->characteristic].fields[s->field].name, (unsigned long long)s->rows, s->min, s->max,
+               (double)s->sum / s->rows);
+    }
+}
+
+static void usage(const char* program){
+    fprintf(stderr, "Usage: %s [-d MAC] [-c FIELD] [-f FROM] [-t TO] [-w FIELD>VALUE] [-r] STORE\n", program);
+}
+
+int main(int argc, char* argv[]){
+    query_t query = { NULL, -1, INT64_MIN, INT64_MAX, -1, 0, false, 0, false };
+    int64_t start;
+    double seconds;
+    int opt;
+
+    if (decoder_init() != 0){
+        fprintf(stderr, "ERROR: Inconsistent characteristic frame layouts.\n");
+        return 1;
+    }
+    while ((opt = getopt(argc, argv, "d:c:f:t:w:rh")) != -1){
+        switch (opt){
+        case 'd':
+            query.device_id = optarg;
+            break;
+        case 'c':
+            query.characteristic = characteristic_by_field(optarg);
+            if (query.characteristic < 0){
+                fprintf(stderr, "Unknown field %s.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            query.from_usec = parse_time(optarg);
+            break;
+        case 't':
+            query.to_usec = parse_time(optarg);
+            break;
+        case 'w':
+            if (parse_where(&query, optarg) != 0){
+                fprintf(stderr, "Unknown field or condition in -w %s.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            query.rows = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1){
+        usage(argv[0]);
+        return 1;
+    }
+
+    start = monotonic_usec();
+    if (scan_store(&query, argv[optind]) != 0){
+        return 1;
+    }
+    seconds = (monotonic_usec() - start) / 1e6;
+    if (!query.rows){
+        print_summaries();
+    }
+    fprintf(stderr, "%llu of %llu blocks skipped by their index, %.1f MB scanned in %.3f s: %.2f GB/s\n",
+            (unsigned long long)blocks_skipped, (unsigned long long)blocks_total, bytes_scanned / 1e6, seconds,
+            seconds > 0 ? bytes_scanned / seconds / 1e9 : 0.0);
+    return 0;
+}